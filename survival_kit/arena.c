@@ -0,0 +1,452 @@
+
+#ifdef __DECC
+#pragma module skit_arena
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "survival_kit/arena.h"
+#include "survival_kit/memory.h"
+#include "survival_kit/assert.h"
+#include "survival_kit/math.h"
+#include "survival_kit/string.h"
+#include "survival_kit/feature_emulation.h"
+
+/* Each allocation is preceded by its size, so that realloc knows how much */
+/* to copy when it can't grow in place. */
+#define SKIT_ARENA_HEADER_SIZE (sizeof(size_t))
+
+#define SKIT_ARENA_ALIGN_UP(x) \
+	(((x) + (SKIT_ARENA_ALIGNMENT-1)) & ~((uintptr_t)(SKIT_ARENA_ALIGNMENT-1)))
+
+static uintptr_t skit_arena_chunk_base(skit_arena_chunk *chunk)
+{
+	return (uintptr_t)(chunk + 1);
+}
+
+static size_t skit_arena_block_size(void *ptr)
+{
+	return ((size_t*)ptr)[-1];
+}
+
+/* Returns true if 'ptr' points into one of the arena's chunks. */
+/* Anything else was allocated before the arena was entered. */
+static int skit_arena_owns(const skit_arena *arena, const void *ptr)
+{
+	skit_arena_chunk *chunk = arena->chunks;
+	while ( chunk != NULL )
+	{
+		uintptr_t base = skit_arena_chunk_base(chunk);
+		if ( base < (uintptr_t)ptr && (uintptr_t)ptr <= base + chunk->size )
+			return 1;
+		chunk = chunk->next;
+	}
+	return 0;
+}
+
+/* Returns true if 'ptr' was the last thing allocated from 'chunk'. */
+static int skit_arena_is_last_block(skit_arena_chunk *chunk, void *ptr)
+{
+	return chunk != NULL &&
+		(uintptr_t)ptr + skit_arena_block_size(ptr) == skit_arena_chunk_base(chunk) + chunk->used;
+}
+
+/* Returns NULL if 'size' bytes do not fit in 'chunk'. */
+static void *skit_arena_chunk_alloc(skit_arena_chunk *chunk, size_t size)
+{
+	uintptr_t base = skit_arena_chunk_base(chunk);
+	uintptr_t ptr = SKIT_ARENA_ALIGN_UP(base + chunk->used + SKIT_ARENA_HEADER_SIZE);
+	if ( ptr + size > base + chunk->size )
+		return NULL;
+
+	((size_t*)ptr)[-1] = size;
+	chunk->used = (ptr + size) - base;
+	return (void*)ptr;
+}
+
+static skit_arena_chunk *skit_arena_chunk_new(skit_arena *arena, size_t size)
+{
+	skit_arena_chunk *chunk = arena->backing->malloc_func(
+		arena->backing, sizeof(skit_arena_chunk) + size);
+	if ( chunk == NULL )
+		return NULL;
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void *skit_arena_alloc(skit_arena *arena, size_t size)
+{
+	sASSERT(arena != NULL);
+
+	void *result = NULL;
+	if ( arena->chunks != NULL )
+	{
+		result = skit_arena_chunk_alloc(arena->chunks, size);
+		if ( result != NULL )
+			return result;
+	}
+
+	size_t needed = size + SKIT_ARENA_HEADER_SIZE + SKIT_ARENA_ALIGNMENT;
+	if ( needed > arena->chunk_size && arena->chunks != NULL )
+	{
+		/* Oversized allocation: give it a chunk of its own and place that */
+		/* behind the current chunk so that the current chunk's free space */
+		/* can still be used by later (smaller) allocations. */
+		skit_arena_chunk *chunk = skit_arena_chunk_new(arena, needed);
+		if ( chunk == NULL )
+			return NULL;
+		chunk->next = arena->chunks->next;
+		arena->chunks->next = chunk;
+		return skit_arena_chunk_alloc(chunk, size);
+	}
+
+	skit_arena_chunk *chunk = skit_arena_chunk_new(arena, SKIT_MAX(needed, arena->chunk_size));
+	if ( chunk == NULL )
+		return NULL;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	return skit_arena_chunk_alloc(chunk, size);
+}
+
+static void *skit_arena_malloc_func(skit_allocator *self, size_t size)
+{
+	return skit_arena_alloc((skit_arena*)self, size);
+}
+
+static void *skit_arena_realloc_func(skit_allocator *self, void *ptr, size_t size)
+{
+	skit_arena *arena = (skit_arena*)self;
+	if ( ptr == NULL )
+		return skit_arena_alloc(arena, size);
+	if ( !skit_arena_owns(arena, ptr) )
+		return arena->backing->realloc_func(arena->backing, ptr, size);
+
+	size_t old_size = skit_arena_block_size(ptr);
+	skit_arena_chunk *chunk = arena->chunks;
+	if ( skit_arena_is_last_block(chunk, ptr) )
+	{
+		/* Grow or shrink in place. */
+		uintptr_t base = skit_arena_chunk_base(chunk);
+		if ( (uintptr_t)ptr + size <= base + chunk->size )
+		{
+			((size_t*)ptr)[-1] = size;
+			chunk->used = ((uintptr_t)ptr + size) - base;
+			return ptr;
+		}
+	}
+	else if ( size <= old_size )
+	{
+		((size_t*)ptr)[-1] = size;
+		return ptr;
+	}
+
+	void *result = skit_arena_alloc(arena, size);
+	if ( result == NULL )
+		return NULL;
+	memcpy(result, ptr, SKIT_MIN(old_size, size));
+	return result;
+}
+
+static skit_allocator *skit_arena_owner_func(skit_allocator *self, const void *ptr)
+{
+	skit_arena *arena = (skit_arena*)self;
+	if ( skit_arena_owns(arena, ptr) )
+		return self;
+	return arena->backing;
+}
+
+static void skit_arena_free_func(skit_allocator *self, void *ptr)
+{
+	skit_arena *arena = (skit_arena*)self;
+	if ( ptr == NULL )
+		return;
+	if ( !skit_arena_owns(arena, ptr) )
+	{
+		arena->backing->free_func(arena->backing, ptr);
+		return;
+	}
+
+	/* Only the most recent allocation can be given back. */
+	skit_arena_chunk *chunk = arena->chunks;
+	if ( skit_arena_is_last_block(chunk, ptr) )
+		chunk->used = ((uintptr_t)ptr - SKIT_ARENA_HEADER_SIZE) - skit_arena_chunk_base(chunk);
+}
+
+/* ------------------------------------------------------------------------- */
+
+void skit_arena_ctor(skit_arena *arena, size_t chunk_size)
+{
+	sASSERT(arena != NULL);
+	if ( chunk_size == 0 )
+		chunk_size = SKIT_ARENA_DEFAULT_CHUNK_SIZE;
+
+	arena->allocator.malloc_func  = &skit_arena_malloc_func;
+	arena->allocator.realloc_func = &skit_arena_realloc_func;
+	arena->allocator.free_func    = &skit_arena_free_func;
+	arena->allocator.context      = NULL;
+	arena->allocator.owner_func   = &skit_arena_owner_func;
+
+	arena->backing = skit_thread_allocator_get();
+	if ( arena->backing == NULL )
+		arena->backing = skit_process_allocator_get();
+
+	arena->prev_thread_allocator = NULL;
+	arena->chunks = NULL;
+	arena->chunk_size = chunk_size;
+	arena->entered = 0;
+}
+
+void skit_arena_dtor(skit_arena *arena)
+{
+	sASSERT(arena != NULL);
+	sASSERT_MSG(!arena->entered, "Attempt to destroy an arena that is still installed as the thread allocator.");
+
+	skit_arena_chunk *chunk = arena->chunks;
+	while ( chunk != NULL )
+	{
+		skit_arena_chunk *next = chunk->next;
+		arena->backing->free_func(arena->backing, chunk);
+		chunk = next;
+	}
+	arena->chunks = NULL;
+}
+
+skit_arena *skit_arena_new(size_t chunk_size)
+{
+	skit_arena *arena = skit_malloc(sizeof(skit_arena));
+	skit_arena_ctor(arena, chunk_size);
+	return arena;
+}
+
+skit_arena *skit_arena_free(skit_arena *arena)
+{
+	skit_arena_dtor(arena);
+	skit_free(arena);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void skit_arena_reset(skit_arena *arena)
+{
+	sASSERT(arena != NULL);
+
+	/* Keep one regular-sized chunk around for reuse. */
+	skit_arena_chunk *keep = NULL;
+	skit_arena_chunk *chunk = arena->chunks;
+	while ( chunk != NULL )
+	{
+		skit_arena_chunk *next = chunk->next;
+		if ( keep == NULL && chunk->size == arena->chunk_size )
+			keep = chunk;
+		else
+			arena->backing->free_func(arena->backing, chunk);
+		chunk = next;
+	}
+
+	if ( keep != NULL )
+	{
+		keep->next = NULL;
+		keep->used = 0;
+	}
+	arena->chunks = keep;
+}
+
+size_t skit_arena_bytes_used(const skit_arena *arena)
+{
+	size_t total = 0;
+	skit_arena_chunk *chunk = arena->chunks;
+	while ( chunk != NULL )
+	{
+		total += chunk->used;
+		chunk = chunk->next;
+	}
+	return total;
+}
+
+void skit_arena_enter(skit_arena *arena)
+{
+	sASSERT(arena != NULL);
+	sASSERT_MSG(!arena->entered, "Attempt to enter an arena that is already entered.");
+	arena->prev_thread_allocator = skit_thread_allocator_set(&arena->allocator);
+	arena->entered = 1;
+}
+
+void skit_arena_leave(skit_arena *arena)
+{
+	sASSERT(arena != NULL);
+	sASSERT_MSG(arena->entered, "Attempt to leave an arena that was not entered.");
+	skit_thread_allocator_set(arena->prev_thread_allocator);
+	arena->prev_thread_allocator = NULL;
+	arena->entered = 0;
+	skit_arena_reset(arena);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_arena_alloc_test()
+{
+	skit_arena arena;
+	skit_arena_ctor(&arena, 256);
+
+	char *a = skit_arena_alloc(&arena, 10);
+	char *b = skit_arena_alloc(&arena, 10);
+	sASSERT(a != NULL);
+	sASSERT(b != NULL);
+	sASSERT_EQ((uintptr_t)a % SKIT_ARENA_ALIGNMENT, 0);
+	sASSERT_EQ((uintptr_t)b % SKIT_ARENA_ALIGNMENT, 0);
+	sASSERT(b > a); /* Bump allocation. */
+	memset(a, 'a', 10);
+	memset(b, 'b', 10);
+
+	/* Oversized allocations get their own chunk and leave the current one alone. */
+	char *big = skit_arena_alloc(&arena, 1000);
+	memset(big, 'x', 1000);
+	char *c = skit_arena_alloc(&arena, 10);
+	sASSERT(c > b);
+	sASSERT(c - b < 256);
+
+	skit_arena_reset(&arena);
+	sASSERT_EQ(skit_arena_bytes_used(&arena), 0);
+	sASSERT(arena.chunks != NULL);
+	sASSERT(arena.chunks->next == NULL);
+
+	/* The kept chunk is reused. */
+	sASSERT(skit_arena_alloc(&arena, 10) == a);
+
+	skit_arena_dtor(&arena);
+	printf("  skit_arena_alloc_test passed.\n");
+}
+
+static void skit_arena_realloc_test()
+{
+	skit_arena *arena = skit_arena_new(256);
+	skit_allocator *allocator = &arena->allocator;
+
+	/* The most recent allocation grows in place. */
+	char *a = allocator->malloc_func(allocator, 8);
+	memcpy(a, "abcdefgh", 8);
+	sASSERT(allocator->realloc_func(allocator, a, 64) == a);
+
+	/* Older allocations are copied. */
+	char *b = allocator->malloc_func(allocator, 8);
+	char *a2 = allocator->realloc_func(allocator, a, 128);
+	sASSERT(a2 != a);
+	sASSERT(a2 > b);
+	sASSERT(memcmp(a2, "abcdefgh", 8) == 0);
+
+	/* Freeing the most recent allocation gives its space back. */
+	char *d = allocator->malloc_func(allocator, 8);
+	allocator->free_func(allocator, d);
+	sASSERT(allocator->malloc_func(allocator, 8) == d);
+
+	skit_arena_free(arena);
+	printf("  skit_arena_realloc_test passed.\n");
+}
+
+static void skit_arena_scope_body(skit_arena *arena, skit_allocator **seen)
+sSCOPE
+	SKIT_USE_FEATURE_EMULATION;
+	sSCOPE_ARENA(arena);
+
+	*seen = skit_thread_allocator_get();
+	skit_loaf loaf = skit_loaf_copy_cstr("Allocated from the arena.");
+	sASSERT_EQS(loaf.as_slice, sSLICE("Allocated from the arena."));
+	sASSERT_GT(skit_arena_bytes_used(arena), 0);
+sEND_SCOPE
+
+/* Grows a loaf that was allocated before the scope. */
+static void skit_arena_scope_grow(skit_arena *arena, skit_loaf *outer, const char *more)
+sSCOPE
+	SKIT_USE_FEATURE_EMULATION;
+	sSCOPE_ARENA(arena);
+
+	skit_loaf_append(outer, skit_slice_of_cstr(more));
+	skit_loaf scratch = skit_loaf_copy_cstr("################################");
+	sASSERT_EQS(scratch.as_slice, sSLICE("################################"));
+sEND_SCOPE
+
+static void skit_arena_scope_throw(skit_arena *arena)
+sSCOPE
+	SKIT_USE_FEATURE_EMULATION;
+	sSCOPE_ARENA(arena);
+
+	skit_malloc(100);
+	sTHROW(SKIT_EXCEPTION, "Testing sSCOPE_ARENA: this exception should be caught.");
+sEND_SCOPE
+
+static void skit_arena_scope_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	skit_arena *arena = skit_arena_new(0);
+	skit_allocator *seen = NULL;
+
+	sASSERT(skit_thread_allocator_get() == NULL);
+	skit_arena_scope_body(arena, &seen);
+	sASSERT(seen == &arena->allocator);
+	sASSERT(skit_thread_allocator_get() == NULL);
+	sASSERT_EQ(skit_arena_bytes_used(arena), 0);
+
+	/* Memory from before the scope is still handled by its own allocator, */
+	/*   including the first heap buffer of a loaf that was created before */
+	/*   the scope and first grows inside it. */
+	char long_text[301];
+	memset(long_text, 'o', 300);
+	long_text[300] = '\0';
+	skit_loaf outer = skit_loaf_copy_cstr("Allocated before the scope.");
+	skit_loaf expected = skit_loaf_copy_cstr("Allocated before the scope.");
+	skit_loaf_append(&expected, skit_slice_of_cstr(long_text));
+	skit_arena_scope_grow(arena, &outer, long_text);
+	sASSERT_EQ(skit_arena_bytes_used(arena), 0);
+	sASSERT_EQS(outer.as_slice, expected.as_slice);
+	skit_arena_scope_body(arena, &seen);
+	sASSERT_EQS(outer.as_slice, expected.as_slice);
+	skit_loaf_free(&outer);
+
+	/* A loaf that already has a heap buffer gets it grown by the backing */
+	/*   allocator too. */
+	outer = skit_loaf_copy_cstr("Allocated before the scope.");
+	skit_loaf_append(&outer, sSLICE(" Grown before the scope."));
+	skit_loaf_free(&expected);
+	expected = skit_loaf_copy_cstr("Allocated before the scope. Grown before the scope.");
+	skit_loaf_append(&expected, skit_slice_of_cstr(long_text));
+	skit_arena_scope_grow(arena, &outer, long_text);
+	sASSERT_EQ(skit_arena_bytes_used(arena), 0);
+	sASSERT_EQS(outer.as_slice, expected.as_slice);
+	skit_arena_scope_body(arena, &seen);
+	sASSERT_EQS(outer.as_slice, expected.as_slice);
+	skit_loaf_free(&outer);
+	skit_loaf_free(&expected);
+
+	/* The arena is released even when the scope exits by exception. */
+	int caught = 0;
+	sTRY
+		skit_arena_scope_throw(arena);
+	sCATCH(SKIT_EXCEPTION, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+	sASSERT(skit_thread_allocator_get() == NULL);
+	sASSERT_EQ(skit_arena_bytes_used(arena), 0);
+
+	skit_arena_free(arena);
+	printf("  skit_arena_scope_test passed.\n");
+}
+
+void skit_arena_unittest()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	printf("skit_arena_unittest()\n");
+	sTRACE(skit_arena_alloc_test());
+	sTRACE(skit_arena_realloc_test());
+	sTRACE(skit_arena_scope_test());
+	printf("  skit_arena_unittest passed!\n");
+	printf("\n");
+}
@@ -0,0 +1,128 @@
+
+#ifndef SKIT_ARENA_INCLUDED
+#define SKIT_ARENA_INCLUDED
+
+#include <stdlib.h>
+
+#include "survival_kit/memory.h"
+#include "survival_kit/feature_emulation.h"
+
+/**
+A region allocator that hands out memory from large chunks using a bump
+pointer and releases all of it at once.
+
+An arena is a skit_allocator, so it can be installed as the thread allocator
+with skit_arena_enter.  The intended use is with sSCOPE_ARENA, which makes
+every skit_malloc in the rest of an sSCOPE come from the arena and releases
+all of that memory when the scope exits (normally or by exception).
+
+skit_free on arena memory is a no-op, except that freeing the most recent
+allocation gives its space back.  skit_realloc grows the most recent
+allocation in place when there is room; otherwise it copies.
+
+Chunks are obtained from whichever allocator was current for the calling
+thread when the arena was constructed.
+*/
+typedef struct skit_arena_chunk skit_arena_chunk;
+struct skit_arena_chunk
+{
+	skit_arena_chunk *next;
+	size_t           size;
+	size_t           used;
+};
+
+typedef struct skit_arena skit_arena;
+struct skit_arena
+{
+	/* This must be the first member: the allocator callbacks cast their */
+	/* 'self' argument back into a skit_arena*. */
+	skit_allocator    allocator;
+
+	skit_allocator    *backing;
+	skit_allocator    *prev_thread_allocator;
+	skit_arena_chunk  *chunks;
+	size_t            chunk_size;
+	int               entered;
+};
+
+/// Default size of the chunks obtained from the backing allocator.
+#define SKIT_ARENA_DEFAULT_CHUNK_SIZE 16384
+
+/// Every pointer returned by an arena is aligned to this many bytes.
+#define SKIT_ARENA_ALIGNMENT 16
+
+/**
+Constructs/destroys an arena.
+'chunk_size' may be 0 to use SKIT_ARENA_DEFAULT_CHUNK_SIZE.
+Allocations larger than a chunk get a chunk of their own.
+The destructor frees all memory allocated from the arena.
+*/
+void skit_arena_ctor(skit_arena *arena, size_t chunk_size);
+void skit_arena_dtor(skit_arena *arena); /** ditto */
+
+/** Allocates and constructs/destructs and frees an arena. */
+skit_arena *skit_arena_new(size_t chunk_size);
+skit_arena *skit_arena_free(skit_arena *arena); /** ditto */
+
+/** Allocates 'size' bytes from the arena directly. */
+void *skit_arena_alloc(skit_arena *arena, size_t size);
+
+/**
+Releases everything allocated from the arena.
+One chunk is kept for reuse, so an arena that is reset after each request
+will normally stop calling the backing allocator after the first request.
+*/
+void skit_arena_reset(skit_arena *arena);
+
+/**
+Returns the number of bytes handed out by the arena since the last reset,
+including alignment padding and per-allocation bookkeeping.
+*/
+size_t skit_arena_bytes_used(const skit_arena *arena);
+
+/**
+Installs the arena as the calling thread's allocator, remembering the
+previous thread allocator.  skit_arena_leave restores the previous thread
+allocator and resets the arena.
+An arena may not be entered again before it is left.
+Prefer sSCOPE_ARENA over calling these directly.
+*/
+void skit_arena_enter(skit_arena *arena);
+void skit_arena_leave(skit_arena *arena); /** ditto */
+
+/**
+Makes the rest of the enclosing sSCOPE allocate from 'arena' and releases
+everything allocated from it when the scope exits.
+The arena itself is not freed; it can be reused for the next scope.
+'arena' is evaluated more than once.
+
+Memory allocated inside the scope must not be used after the scope exits.
+Anything that must outlive the scope should be copied out, or allocated
+before the sSCOPE_ARENA statement.  Memory allocated before the scope can
+still be reallocated or freed inside it; the arena passes those calls on to
+the allocator that was current when the arena was constructed.  Memory
+requested with skit_malloc_beside next to such memory comes from that
+allocator as well, which is how a loaf created before the scope can grow
+inside it and still be freed afterwards.
+
+Example:
+	static void handle_request(skit_arena *arena, skit_slice request)
+	sSCOPE
+		SKIT_USE_FEATURE_EMULATION;
+		sSCOPE_ARENA(arena);
+
+		// These come from the arena and are released together at sEND_SCOPE.
+		skit_loaf upper = skit_loaf_copy_cstr("...");
+		skit_text_stream *out = skit_text_stream_new();
+		...
+	sEND_SCOPE
+*/
+#define sSCOPE_ARENA(arena) \
+	do { \
+		skit_arena_enter((arena)); \
+		sSCOPE_EXIT(skit_arena_leave((arena))); \
+	} while(0)
+
+void skit_arena_unittest();
+
+#endif
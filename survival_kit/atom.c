@@ -0,0 +1,219 @@
+
+#ifdef __DECC
+#pragma module skit_atom
+#endif
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "survival_kit/assert.h"
+#include "survival_kit/memory.h"
+#include "survival_kit/string.h"
+#include "survival_kit/flags.h"
+#include "survival_kit/trie.h"
+#include "survival_kit/feature_emulation.h"
+#include "survival_kit/atom.h"
+
+/* ------------------------------------------------------------------------- */
+
+void skit_atom_table_ctor(skit_atom_table *table, skit_flags flags)
+{
+	sASSERT(table != NULL);
+	sENFORCE_MSG((flags & ~SKIT_FLAG_I) == 0, "skit_atom_table_ctor only accepts the 'i' flag.");
+
+	skit_trie_ctor(&table->trie);
+	table->names = NULL;
+	table->n_atoms = 0;
+	table->names_capacity = 0;
+	table->flags = flags;
+	pthread_rwlock_init(&table->lock, NULL);
+}
+
+void skit_atom_table_dtor(skit_atom_table *table)
+{
+	sASSERT(table != NULL);
+
+	int32_t i;
+	for ( i = 0; i < table->n_atoms; i++ )
+		skit_loaf_free(&table->names[i]);
+	skit_free(table->names);
+	table->names = NULL;
+	table->n_atoms = 0;
+	table->names_capacity = 0;
+
+	skit_trie_dtor(&table->trie);
+	pthread_rwlock_destroy(&table->lock);
+}
+
+skit_atom_table *skit_atom_table_new(skit_flags flags)
+{
+	skit_atom_table *result = skit_malloc(sizeof(skit_atom_table));
+	skit_atom_table_ctor(result, flags);
+	return result;
+}
+
+skit_atom_table *skit_atom_table_free(skit_atom_table *table)
+{
+	if ( table == NULL )
+		return NULL;
+	skit_atom_table_dtor(table);
+	skit_free(table);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* The caller must hold the lock (shared or exclusive). */
+static skit_atom skit_atom_find_locked(skit_atom_table *table, skit_slice name)
+{
+	void *value;
+	if ( !skit_trie_lookup(&table->trie, name, &value, table->flags) )
+		return SKIT_ATOM_NONE;
+	return (skit_atom)((size_t)value - 1);
+}
+
+skit_atom skit_atom_find(skit_atom_table *table, skit_slice name)
+{
+	sASSERT(table != NULL);
+	sASSERT(!skit_slice_is_null(name));
+
+	pthread_rwlock_rdlock(&table->lock);
+	skit_atom result = skit_atom_find_locked(table, name);
+	pthread_rwlock_unlock(&table->lock);
+	return result;
+}
+
+skit_atom skit_atom_intern(skit_atom_table *table, skit_slice name)
+{
+	sASSERT(table != NULL);
+	sASSERT(!skit_slice_is_null(name));
+
+	/* Most calls are for names that are already there: try that first, */
+	/*   without blocking other readers. */
+	skit_atom result = skit_atom_find(table, name);
+	if ( result != SKIT_ATOM_NONE )
+		return result;
+
+	pthread_rwlock_wrlock(&table->lock);
+
+	/* Another thread might have added it while we waited for the lock. */
+	result = skit_atom_find_locked(table, name);
+	if ( result != SKIT_ATOM_NONE )
+	{
+		pthread_rwlock_unlock(&table->lock);
+		return result;
+	}
+
+	if ( table->n_atoms == table->names_capacity )
+	{
+		int32_t new_capacity = table->names_capacity < 16 ? 16 : table->names_capacity * 2;
+		table->names = skit_realloc(table->names, new_capacity * sizeof(skit_loaf));
+		table->names_capacity = new_capacity;
+	}
+
+	result = table->n_atoms;
+	table->names[result] = skit_loaf_dup(name);
+	skit_trie_set(&table->trie, table->names[result].as_slice, (void*)((size_t)result + 1), SKIT_FLAG_C);
+	table->n_atoms++;
+
+	pthread_rwlock_unlock(&table->lock);
+	return result;
+}
+
+skit_slice skit_atom_name(skit_atom_table *table, skit_atom atom)
+{
+	sASSERT(table != NULL);
+
+	/* The names array can move when another thread interns a new name, */
+	/*   but the loaves in it never do. */
+	pthread_rwlock_rdlock(&table->lock);
+	sASSERT_MSGF(0 <= atom && atom < table->n_atoms, "Invalid atom %d given to skit_atom_name.", (int)atom);
+	skit_slice result = table->names[atom].as_slice;
+	pthread_rwlock_unlock(&table->lock);
+	return result;
+}
+
+size_t skit_atom_table_len(skit_atom_table *table)
+{
+	sASSERT(table != NULL);
+	pthread_rwlock_rdlock(&table->lock);
+	size_t result = table->n_atoms;
+	pthread_rwlock_unlock(&table->lock);
+	return result;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_atom_table_test()
+{
+	skit_atom_table *table = skit_atom_table_new(SKIT_FLAGS_NONE);
+	skit_atom foo = skit_atom_intern(table, sSLICE("foo"));
+	skit_atom bar = skit_atom_intern(table, sSLICE("bar"));
+	skit_atom fo  = skit_atom_intern(table, sSLICE("fo"));
+	skit_atom empty = skit_atom_intern(table, sSLICE(""));
+	sASSERT_EQ(foo, 0);
+	sASSERT_EQ(bar, 1);
+	sASSERT_EQ(fo, 2);
+	sASSERT_EQ(empty, 3);
+	sASSERT_EQ(skit_atom_table_len(table), 4);
+
+	/* Interning again gives the same atom, even from a different buffer. */
+	skit_loaf foo_copy = skit_loaf_copy_cstr("foo");
+	sASSERT_EQ(skit_atom_intern(table, foo_copy.as_slice), foo);
+	skit_loaf_free(&foo_copy);
+	sASSERT_EQ(skit_atom_intern(table, sSLICE("")), empty);
+	sASSERT_EQ(skit_atom_table_len(table), 4);
+
+	sASSERT_EQ(skit_atom_find(table, sSLICE("bar")), bar);
+	sASSERT_EQ(skit_atom_find(table, sSLICE("FOO")), SKIT_ATOM_NONE);
+	sASSERT_EQ(skit_atom_find(table, sSLICE("f")), SKIT_ATOM_NONE);
+	sASSERT_EQ(skit_atom_find(table, sSLICE("food")), SKIT_ATOM_NONE);
+
+	sASSERT_EQS(skit_atom_name(table, foo), sSLICE("foo"));
+	sASSERT_EQS(skit_atom_name(table, empty), sSLICE(""));
+
+	/* Names stay put as the table grows. */
+	skit_slice foo_name = skit_atom_name(table, foo);
+	int i;
+	char buf[32];
+	for ( i = 0; i < 1000; i++ )
+	{
+		snprintf(buf, sizeof(buf), "name%d", i);
+		sASSERT_EQ(skit_atom_intern(table, skit_slice_of_cstr(buf)), i + 4);
+	}
+	sASSERT(sSPTR(foo_name) == sSPTR(skit_atom_name(table, foo)));
+	sASSERT_EQS(skit_atom_name(table, 504), sSLICE("name500"));
+	sASSERT_EQ(skit_atom_find(table, sSLICE("name999")), 1003);
+
+	skit_atom_table_free(table);
+	printf("  skit_atom_table_test passed.\n");
+}
+
+static void skit_atom_table_icase_test()
+{
+	skit_atom_table *table = skit_atom_table_new(sFLAGS("i"));
+	skit_atom ct = skit_atom_intern(table, sSLICE("Content-Type"));
+	sASSERT_EQ(skit_atom_intern(table, sSLICE("content-type")), ct);
+	sASSERT_EQ(skit_atom_intern(table, sSLICE("CONTENT-TYPE")), ct);
+	sASSERT_EQ(skit_atom_find(table, sSLICE("cOnTeNt-TyPe")), ct);
+	sASSERT_EQS(skit_atom_name(table, ct), sSLICE("Content-Type"));
+
+	skit_atom cl = skit_atom_intern(table, sSLICE("content-length"));
+	sASSERT_NE(cl, ct);
+	sASSERT_EQ(skit_atom_find(table, sSLICE("Content-Length")), cl);
+	sASSERT_EQ(skit_atom_table_len(table), 2);
+
+	skit_atom_table_free(table);
+	printf("  skit_atom_table_icase_test passed.\n");
+}
+
+void skit_atom_unittest()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	printf("skit_atom_unittest()\n");
+	sTRACE(skit_atom_table_test());
+	sTRACE(skit_atom_table_icase_test());
+	printf("  skit_atom_unittest passed!\n");
+	printf("\n");
+}
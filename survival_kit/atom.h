@@ -0,0 +1,96 @@
+
+#ifndef SKIT_ATOM_INCLUDED
+#define SKIT_ATOM_INCLUDED
+
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "survival_kit/string.h"
+#include "survival_kit/flags.h"
+#include "survival_kit/trie.h"
+
+/**
+An atom is a small integer that stands for a string in an skit_atom_table.
+Two strings interned in the same table get the same atom if and only if they
+are equal (or equal ignoring ASCII case, for case-insensitive tables).  This
+turns string comparisons into integer comparisons, and atoms can be used
+directly as hash keys or array indices.
+
+Atoms are assigned in order starting from 0, so the atoms of a table with
+N entries are exactly 0 through N-1.
+*/
+typedef int32_t skit_atom;
+
+/** Returned by lookups that don't find the string. */
+#define SKIT_ATOM_NONE ((skit_atom)-1)
+
+/**
+Maps strings to atoms and back.
+
+Each interned string is copied into a loaf owned by the table, and that loaf
+is never resized or freed until the table is destroyed.  Slices returned by
+skit_atom_name therefore stay valid for the table's whole lifetime.
+
+For case-insensitive tables, the canonical name of an atom is the spelling
+that it was first interned with.
+
+Atom tables are thread-safe: any number of threads may intern and look up
+strings at the same time.  Lookups of strings that are already present only
+take a shared lock, so concurrent readers don't wait on each other.
+
+Example:
+	skit_atom_table *table = skit_atom_table_new(SKIT_FLAG_I);
+	skit_atom a = skit_atom_intern(table, sSLICE("Content-Type"));
+	skit_atom b = skit_atom_intern(table, sSLICE("content-type"));
+	sASSERT_EQ(a, b);
+	sASSERT_EQS(skit_atom_name(table, b), sSLICE("Content-Type"));
+	sASSERT_EQ(skit_atom_find(table, sSLICE("Accept")), SKIT_ATOM_NONE);
+	skit_atom_table_free(table);
+*/
+typedef struct skit_atom_table skit_atom_table;
+struct skit_atom_table
+{
+	skit_trie         trie;   /* Values are (atom+1), because the trie doesn't allow NULL values. */
+	skit_loaf         *names;
+	int32_t           n_atoms;
+	int32_t           names_capacity;
+	skit_flags        flags;
+	pthread_rwlock_t  lock;
+};
+
+/**
+Constructs/destroys an atom table.
+'flags' may be SKIT_FLAG_I (or sFLAGS("i")) to make the table
+case-insensitive, or SKIT_FLAGS_NONE.
+*/
+void skit_atom_table_ctor(skit_atom_table *table, skit_flags flags);
+void skit_atom_table_dtor(skit_atom_table *table); /** ditto */
+
+/** Allocates and constructs/destructs and frees an atom table. */
+skit_atom_table *skit_atom_table_new(skit_flags flags);
+skit_atom_table *skit_atom_table_free(skit_atom_table *table); /** ditto */
+
+/**
+Returns the atom for 'name', adding 'name' to the table if it isn't already
+there.
+*/
+skit_atom skit_atom_intern(skit_atom_table *table, skit_slice name);
+
+/**
+Returns the atom for 'name', or SKIT_ATOM_NONE if it has not been interned.
+This never modifies the table.
+*/
+skit_atom skit_atom_find(skit_atom_table *table, skit_slice name);
+
+/**
+Returns the canonical name of 'atom'.
+The returned slice is valid until the table is destroyed.
+*/
+skit_slice skit_atom_name(skit_atom_table *table, skit_atom atom);
+
+/** Returns the number of atoms in the table. */
+size_t skit_atom_table_len(skit_atom_table *table);
+
+void skit_atom_unittest();
+
+#endif
@@ -75,9 +75,9 @@ static const char **skit__exc_resize( const char **array_to_resize, ssize_t old_
 		return array_to_resize;
 
 	if ( array_to_resize == NULL )
-		array_to_resize = skit_malloc(sizeof(array_to_resize[0]));
+		array_to_resize = skit_process_malloc(sizeof(array_to_resize[0]));
 	else
-		array_to_resize = skit_realloc(
+		array_to_resize = skit_process_realloc(
 			array_to_resize, new_size * sizeof(array_to_resize[0]));
 
 	ssize_t i;
@@ -145,7 +145,7 @@ void skit_exception_dtor( skit_thread_context *skit_thread_ctx, skit_exception *
 {
 	if ( exc->error_text != NULL )
 	{
-		skit_free(exc->error_text);
+		skit_process_free(exc->error_text);
 		exc->error_text = NULL;
 	}
 	exc->error_len = 0;
@@ -158,8 +158,8 @@ void skit_exception_dtor( skit_thread_context *skit_thread_ctx, skit_exception *
 	{
 		skit_debug_stack *stack = exc->debug_info_stack;
 		while ( stack->length > 0 )
-			skit_free(skit_debug_stack_pop(stack));
-		skit_free(stack);
+			skit_process_free(skit_debug_stack_pop(stack));
+		skit_process_free(stack);
 	}
 	exc->debug_info_stack = NULL;
 }
@@ -212,7 +212,7 @@ static void skit_fill_exception(
 		/* This exists so that SKIT_NEW_EXCEPTION() can be called without having */
 		/*   a thread context available. */
 		const int error_buffer_size = 1024; /* We have to guess this size because we don't have a buffer from context to experiment on. */
-		char *error_text_buffer = skit_malloc(error_buffer_size);
+		char *error_text_buffer = skit_process_malloc(error_buffer_size);
 		int error_len = vsnprintf(
 			error_text_buffer,
 			error_buffer_size, fmtMsg, var_args);
@@ -226,10 +226,10 @@ static void skit_fill_exception(
 
 		exc->context = thrower_context;
 
-		exc->debug_info_stack = skit_malloc(sizeof(skit_debug_stack));
+		exc->debug_info_stack = skit_process_malloc(sizeof(skit_debug_stack));
 		skit_debug_stack_ctor(exc->debug_info_stack);
 		
-		skit_debug_stnode *fi = skit_malloc(sizeof(skit_debug_stnode));
+		skit_debug_stnode *fi = skit_process_malloc(sizeof(skit_debug_stnode));
 		skit_debug_info_store(&fi->val, line, file, func, " <- exception happened here.");
 		skit_debug_stack_push(exc->debug_info_stack, fi);
 		
@@ -237,7 +237,7 @@ static void skit_fill_exception(
 	}
 	else /* More desirable path that uses buffers in the thread context. */
 	{
-		skit_frame_info *fi = skit_debug_fstack_alloc(&skit_thread_ctx->debug_info_stack, &skit_malloc);
+		skit_frame_info *fi = skit_debug_fstack_alloc(&skit_thread_ctx->debug_info_stack, &skit_process_malloc);
 
 		int error_len = vsnprintf(
 			skit_thread_ctx->error_text_buffer,
@@ -255,7 +255,7 @@ static void skit_fill_exception(
 		cause the program to call skit_die, which would not allocate an
 		exception.  OTOH, if we want OOM to be catchable, then this should 
 		be considered or at least special-cased for OOM exceptions. */
-		exc->error_text = (char*)skit_malloc(error_len+1); /* +1 to make room for the \0 at the end. */
+		exc->error_text = (char*)skit_process_malloc(error_len+1); /* +1 to make room for the \0 at the end. */
 		strcpy(exc->error_text, skit_thread_ctx->error_text_buffer);
 		exc->error_len = error_len;
 
@@ -268,7 +268,11 @@ static void skit_fill_exception(
 		{
 			/* Slower version used when the caller needs to accumulate exceptions
 			that may have completely different debug stacks. */
+			/* The copy must come from the process allocator, because
+			skit_exception_dtor frees it with skit_process_free. */
+			skit_allocator *thread_allocator = skit_thread_allocator_set(NULL);
 			exc->debug_info_stack = skit_debug_stack_dup(&skit_thread_ctx->debug_info_stack.used);
+			skit_thread_allocator_set(thread_allocator);
 		}
 		else
 		{
@@ -296,7 +300,7 @@ void skit_throw_exception_no_ctx(
 	...)
 {
 	skit_thread_context *skit_thread_ctx = skit_thread_context_get();
-	skit_exception *exc = skit_exc_fstack_alloc(&skit_thread_ctx->exc_instance_stack, &skit_malloc);
+	skit_exception *exc = skit_exc_fstack_alloc(&skit_thread_ctx->exc_instance_stack, &skit_process_malloc);
 
 	/* Forward var args to the real exception throwing function. */
 	va_list vl;
@@ -321,7 +325,7 @@ void skit_throw_exception_no_ctx(
 
 void skit_push_exception_obj(skit_thread_context *skit_thread_ctx, skit_exception *exc)
 {
-	skit_exception *newb = skit_exc_fstack_alloc(&skit_thread_ctx->exc_instance_stack, &skit_malloc);
+	skit_exception *newb = skit_exc_fstack_alloc(&skit_thread_ctx->exc_instance_stack, &skit_process_malloc);
 	memcpy(newb, exc, sizeof(skit_exception));
 }
 
@@ -337,7 +341,7 @@ void skit_push_exception_va(
 	const char *fmtMsg,
 	va_list var_args)
 {
-	skit_exception *exc = skit_exc_fstack_alloc(&skit_thread_ctx->exc_instance_stack, &skit_malloc);
+	skit_exception *exc = skit_exc_fstack_alloc(&skit_thread_ctx->exc_instance_stack, &skit_process_malloc);
 
 	/* Forward the debug info to the exception filling function. */
 	skit_fill_exception(
@@ -392,7 +396,7 @@ skit_exception *skit_new_exception_va(
 	const char *fmtMsg,
 	va_list var_args)
 {
-	skit_exception *exc = skit_malloc(sizeof(skit_exception));
+	skit_exception *exc = skit_process_malloc(sizeof(skit_exception));
 
 	/* Forward the debug info to the exception filling function. */
 	skit_fill_exception(
@@ -15,7 +15,7 @@ void skit_features_init();
 		ctx = skit__create_thread_context(), \
 		\
 		skit_debug_info_store( \
-			skit_debug_fstack_alloc(&skit_thread_ctx->debug_info_stack, &skit_malloc), \
+			skit_debug_fstack_alloc(&skit_thread_ctx->debug_info_stack, &skit_process_malloc), \
 			__LINE__,__FILE__,__func__, " <- stack context established here."), \
 		\
 		/* This establishes the bottom of the stack for exception handling. */ \
@@ -23,7 +23,7 @@ void skit_features_init();
 		/*   enclosing this macro returns.  */ \
 		/* This means that skit__thread_context_dtor must be called before the */ \
 		/*   enclosing function returns. */ \
-		( setjmp( *skit_jmp_fstack_alloc(&ctx->exc_jmp_stack, &skit_malloc) ) != 0 ) ? \
+		( setjmp( *skit_jmp_fstack_alloc(&ctx->exc_jmp_stack, &skit_process_malloc) ) != 0 ) ? \
 		( \
 			/* Uncaught exception(s)!  We're going down! */ \
 			skit_print_uncaught_exceptions(ctx), \
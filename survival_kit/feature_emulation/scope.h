@@ -166,14 +166,14 @@ struct skit_scope_context
 			/* The existence of a scope guard will force sSCOPE/sEND_SCOPE to be used and thus */ \
 			/*   also force usage of sRETURN or sTHROW statements that will properly unwind */ \
 			/*   the scope_jmp_stack. */ \
-			skit__scope_ctx->scope_fn_exit = skit_jmp_fstack_alloc( &skit_thread_ctx->scope_jmp_stack, &skit_malloc ); \
+			skit__scope_ctx->scope_fn_exit = skit_jmp_fstack_alloc( &skit_thread_ctx->scope_jmp_stack, &skit_process_malloc ); \
 			skit__scope_ctx->scope_guards_used = 1; \
 			\
 			/* We set a  jump point to catch any exceptions that might be */ \
 			/* thrown from a function that wasn't called with the sTRACE macro. */ \
 			/* This is important because we'll need to ensure that the scope */ \
 			/*   guards get scanned during abnormal exit. */ \
-			int skit_jmp_code = setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack, &skit_malloc)); \
+			int skit_jmp_code = setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack, &skit_process_malloc)); \
 			if ( skit_jmp_code != 0 ) \
 			{ \
 				SKIT__SCAN_SCOPE_GUARDS(SKIT_SCOPE_FAILURE_EXIT); \
@@ -181,7 +181,7 @@ struct skit_scope_context
 				skit_propogate_exceptions(skit_thread_ctx, __LINE__, __FILE__, __func__); \
 			} \
 		} \
-		if ( setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->scope_jmp_stack, &skit_malloc)) != 0 ) \
+		if ( setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->scope_jmp_stack, &skit_process_malloc)) != 0 ) \
 		{ \
 			if ( (skit__scope_ctx->exit_status) & (macro_arg_exit_status) ) \
 			{ \
@@ -192,7 +192,7 @@ struct skit_scope_context
 				/* We set another jump point to catch any exceptions that might be \
 				thrown while in the scope guard.  This is important because exiting \
 				the scope guard with a thrown exception is forbidden. */ \
-				if ( setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack, &skit_malloc)) == 0 ) \
+				if ( setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack, &skit_process_malloc)) == 0 ) \
 				{
 
 #define sEND_SCOPE_GUARD \
@@ -144,9 +144,9 @@ static int skit_stack_to_str_each(void *context, const skit_debug_stnode *node)
 		fi->specifics);
 	
 #ifdef __VMS
-	free(device);
-	free(directory);
-	free(name);
+	skit_free(device);
+	skit_free(directory);
+	skit_free(name);
 #endif
 	
 	if ( nchars < 0 )
@@ -217,7 +217,7 @@ const char *skit_stack_trace_to_str_expr( uint32_t line, const char *file, const
 	if ( skit_thread_init_was_called() )
 	{
 		skit_thread_context *skit_thread_ctx = skit_thread_context_get();
-		skit_frame_info *fi = skit_debug_fstack_alloc(&skit_thread_ctx->debug_info_stack, &skit_malloc);
+		skit_frame_info *fi = skit_debug_fstack_alloc(&skit_thread_ctx->debug_info_stack, &skit_process_malloc);
 		skit_debug_info_store(fi, line, file, func, specifics);
 		result = skit_fstack_to_str_internal(
 			skit_thread_ctx, 
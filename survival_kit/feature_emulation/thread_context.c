@@ -88,11 +88,12 @@ void skit__thread_context_ctor( skit_thread_context *ctx )
 	
 	/* 16kB has GOT to be enough.  Riiight? */
 	ctx->error_text_buffer_size = 16384;
-	ctx->error_text_buffer = (char*)skit_malloc(ctx->error_text_buffer_size);
+	ctx->error_text_buffer = (char*)skit_process_malloc(ctx->error_text_buffer_size);
 	if ( ctx->error_text_buffer == NULL )
 		ctx->error_text_buffer_size = 0;
 
 	ctx->entry_check_count = 0;
+	ctx->allocator = NULL;
 }
 
 void skit__thread_context_dtor(skit_thread_context *ctx)
@@ -108,7 +109,7 @@ void skit__thread_context_dtor(skit_thread_context *ctx)
 
 skit_thread_context *skit__create_thread_context()
 {
-	skit_thread_context *ctx = skit_malloc(sizeof(skit_thread_context));
+	skit_thread_context *ctx = skit_process_malloc(sizeof(skit_thread_context));
 	skit__thread_context_ctor(ctx);
 	pthread_setspecific(skit_thread_context_key, (void*)ctx);
 	SKIT_CTX_BALANCE_TRACE("(((((((((((((((((((((((((((((((((((((( skit__create_thread_context\n");
@@ -120,6 +121,6 @@ skit_thread_context *skit__free_thread_context(skit_thread_context *ctx)
 	SKIT_CTX_BALANCE_TRACE(")))))))))))))))))))))))))))))))))))))) skit__free_thread_context\n");
 	pthread_setspecific(skit_thread_context_key, NULL);
 	skit__thread_context_dtor(ctx);
-	skit_free(ctx);
+	skit_process_free(ctx);
 	return NULL;
 }
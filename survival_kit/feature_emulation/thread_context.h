@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <unistd.h> /* ssize_t */
 
+#include "survival_kit/memory.h"
 #include "survival_kit/feature_emulation/exception.h"
 #include "survival_kit/feature_emulation/frame_info.h"
 #include "survival_kit/feature_emulation/setjmp/jmp_fstack.h"
@@ -51,6 +52,10 @@ struct skit_thread_context
 	establish a new frame in the debug stack.  
 	*/
 	ssize_t entry_check_count;
+	
+	/* The allocator installed by skit_thread_allocator_set, or NULL if this
+	thread uses the process allocator. */
+	skit_allocator *allocator;
 };
 
 /* Internal: used in macros to emulate language features. */
@@ -207,7 +207,7 @@ Example usage:
 	} while (0)
 
 #define SKIT_EXCEPTION_FREE(exc) \
-	(skit_exception_dtor(skit_thread_ctx, (exc)), skit_free((void*)(exc)))
+	(skit_exception_dtor(skit_thread_ctx, (exc)), skit_process_free((void*)(exc)))
 
 /* SKIT__PROPOGATE_THROWN_EXCEPTIONS is an implementation detail.
 // It does as the name suggests.  Do not call it from code that is not a part
@@ -33,11 +33,11 @@
 		/*   thus preventing pop calls that are supposed to match push calls. */ \
 		\
 		skit_debug_info_store( \
-			skit_debug_fstack_alloc(&skit_thread_ctx->debug_info_stack, &skit_malloc), \
+			skit_debug_fstack_alloc(&skit_thread_ctx->debug_info_stack, &skit_process_malloc), \
 			__LINE__,__FILE__,__func__, "code: " #original_code), \
 		\
 		SKIT_FEATURE_TRACE("Skit_jmp_stack_alloc\n"), \
-		(setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack, &skit_malloc)) == 0 ) ? \
+		(setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack, &skit_process_malloc)) == 0 ) ? \
 		( \
 			SKIT_FEATURE_TRACE("%s, %d.40: sTRACE.setjmp\n", __FILE__, __LINE__), \
 			SKIT_FEATURE_TRACE("sTRACE: exc_jmp_stack.size == %ld\n", skit_thread_ctx->exc_jmp_stack.used.length), \
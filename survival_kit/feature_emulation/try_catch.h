@@ -123,7 +123,7 @@ sTRY block.
 	SKIT_USE_FEATURES_IN_FUNC_BODY = 1; \
 	(void)SKIT_USE_FEATURES_IN_FUNC_BODY; \
 	SKIT_THREAD_CHECK_ENTRY(skit_thread_ctx); \
-	if ( setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->try_jmp_stack,&skit_malloc)) != SKIT__TRY_SAFE_EXIT ) { \
+	if ( setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->try_jmp_stack,&skit_process_malloc)) != SKIT__TRY_SAFE_EXIT ) { \
 		SKIT_COMPILE_TIME_CHECK(SKIT_NO_BUILTIN_RETURN_FROM_TRY_PTR,0); \
 		SKIT_COMPILE_TIME_CHECK(SKIT_NO_GOTO_FROM_TRY_PTR,0); \
 		SKIT_FEATURE_TRACE("%s, %d.129: sTRY.if\n", __FILE__, __LINE__); \
@@ -136,7 +136,7 @@ sTRY block.
 			/* NOTE: There is currently no logic that saves the value of skit__try_setjmp_code */ \
 			/*   when execution passes into the caller's part of the block. */ \
 			/*   As a consequence, do not use skit__try_setjmp_code outside of the sTRY macro. */ \
-			int skit__try_setjmp_code = setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack,&skit_malloc)); \
+			int skit__try_setjmp_code = setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack,&skit_process_malloc)); \
 			SKIT_FEATURE_TRACE("%s, %d.140: sTRY: switch( skit__try_setjmp_code )\n", __FILE__, __LINE__); \
 			switch( skit__try_setjmp_code ) \
 			{ \
@@ -219,7 +219,7 @@ sTRY block.
 					(void)(exc_name); \
 					skit__try_block_end_type = SKIT__TRY__END_OF_CATCH; \
 					SKIT_FEATURE_TRACE("exc_jmp_stack_alloc\n"); \
-					if ( setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack,&skit_malloc)) == 0 ) \
+					if ( setjmp(*skit_jmp_fstack_alloc(&skit_thread_ctx->exc_jmp_stack,&skit_process_malloc)) == 0 ) \
 					{ \
 						/* Prevent the caller from clobbering the try_block_end_type */ \
 						/* and skit__try_caught_exception variables when they do things */ \
@@ -0,0 +1,187 @@
+
+#ifdef __DECC
+#pragma module skit_hashmap_builtins
+#endif
+
+#define SKIT_T_HEADER "survival_kit/templates/hashmap.h"
+#include "survival_kit/hashmap_builtins.h"
+#undef SKIT_T_HEADER
+#undef SKIT_HASHMAP_BUILTINS_INCLUDED
+
+#define SKIT_T_HEADER "survival_kit/templates/hashmap.c"
+#include "survival_kit/hashmap_builtins.h"
+#undef SKIT_T_HEADER
+
+#include "survival_kit/assert.h"
+#include "survival_kit/feature_emulation.h"
+
+#include <stdio.h>
+
+#define SKIT_T_ELEM_TYPE int
+#define SKIT_T_NAME utest_int
+#include "survival_kit/templates/hashmap.h"
+#include "survival_kit/templates/hashmap.c"
+#undef SKIT_T_ELEM_TYPE
+#undef SKIT_T_NAME
+
+static void skit_hashmap_basic_test()
+{
+	skit_utest_int_hashmap map;
+	skit_utest_int_hashmap_ctor(&map, SKIT_FLAGS_NONE);
+	sASSERT_EQ(skit_utest_int_hashmap_len(&map), 0);
+	sASSERT(skit_utest_int_hashmap_get(&map, sSLICE("foo")) == NULL);
+	sASSERT_EQ(skit_utest_int_hashmap_remove(&map, sSLICE("foo"), NULL), 0);
+
+	sASSERT_EQ(skit_utest_int_hashmap_set(&map, sSLICE("foo"), 1), 1);
+	sASSERT_EQ(skit_utest_int_hashmap_set(&map, sSLICE("bar"), 2), 1);
+	sASSERT_EQ(skit_utest_int_hashmap_set(&map, sSLICE(""),    3), 1);
+	sASSERT_EQ(skit_utest_int_hashmap_len(&map), 3);
+	sASSERT_EQ(*skit_utest_int_hashmap_get(&map, sSLICE("foo")), 1);
+	sASSERT_EQ(*skit_utest_int_hashmap_get(&map, sSLICE("bar")), 2);
+	sASSERT_EQ(*skit_utest_int_hashmap_get(&map, sSLICE("")),    3);
+	sASSERT(skit_utest_int_hashmap_get(&map, sSLICE("FOO")) == NULL);
+	sASSERT(skit_utest_int_hashmap_get(&map, sSLICE("fo")) == NULL);
+
+	/* Keys are copied, so the caller's buffer can go away. */
+	skit_loaf key = skit_loaf_copy_cstr("baz");
+	sASSERT_EQ(skit_utest_int_hashmap_set(&map, key.as_slice, 4), 1);
+	skit_loaf_free(&key);
+	sASSERT_EQ(*skit_utest_int_hashmap_get(&map, sSLICE("baz")), 4);
+
+	/* Overwriting. */
+	sASSERT_EQ(skit_utest_int_hashmap_set(&map, sSLICE("foo"), 10), 0);
+	sASSERT_EQ(*skit_utest_int_hashmap_get(&map, sSLICE("foo")), 10);
+	sASSERT_EQ(skit_utest_int_hashmap_len(&map), 4);
+
+	/* Values can be modified in place. */
+	*skit_utest_int_hashmap_get(&map, sSLICE("bar")) += 5;
+	sASSERT_EQ(*skit_utest_int_hashmap_get(&map, sSLICE("bar")), 7);
+
+	int val = 0;
+	sASSERT_EQ(skit_utest_int_hashmap_remove(&map, sSLICE("foo"), &val), 1);
+	sASSERT_EQ(val, 10);
+	sASSERT(skit_utest_int_hashmap_get(&map, sSLICE("foo")) == NULL);
+	sASSERT_EQ(skit_utest_int_hashmap_remove(&map, sSLICE("foo"), &val), 0);
+	sASSERT_EQ(skit_utest_int_hashmap_len(&map), 3);
+
+	skit_utest_int_hashmap_clear(&map);
+	sASSERT_EQ(skit_utest_int_hashmap_len(&map), 0);
+	sASSERT(skit_utest_int_hashmap_get(&map, sSLICE("bar")) == NULL);
+	sASSERT_EQ(skit_utest_int_hashmap_set(&map, sSLICE("bar"), 8), 1);
+	sASSERT_EQ(*skit_utest_int_hashmap_get(&map, sSLICE("bar")), 8);
+
+	skit_utest_int_hashmap_dtor(&map);
+	printf("  skit_hashmap_basic_test passed.\n");
+}
+
+static void skit_hashmap_many_test()
+{
+	skit_utest_int_hashmap *map = skit_utest_int_hashmap_new(SKIT_FLAGS_NONE);
+	map->seed = 12345;
+	char buf[32];
+	int i;
+	const int n = 5000;
+
+	for ( i = 0; i < n; i++ )
+	{
+		snprintf(buf, sizeof(buf), "key%d", i);
+		sASSERT_EQ(skit_utest_int_hashmap_set(map, skit_slice_of_cstr(buf), i), 1);
+	}
+	sASSERT_EQ(skit_utest_int_hashmap_len(map), n);
+	sASSERT(map->capacity * 3 >= (size_t)n * 4);
+
+	/* Remove every third entry; the rest must still be found. */
+	for ( i = 0; i < n; i += 3 )
+	{
+		snprintf(buf, sizeof(buf), "key%d", i);
+		sASSERT_EQ(skit_utest_int_hashmap_remove(map, skit_slice_of_cstr(buf), NULL), 1);
+	}
+	for ( i = 0; i < n; i++ )
+	{
+		snprintf(buf, sizeof(buf), "key%d", i);
+		int *val = skit_utest_int_hashmap_get(map, skit_slice_of_cstr(buf));
+		if ( i % 3 == 0 )
+			sASSERT(val == NULL);
+		else
+			sASSERT_EQ(*val, i);
+	}
+
+	/* Iteration visits each remaining entry exactly once. */
+	size_t cursor = 0;
+	skit_slice key;
+	int *val;
+	long long sum = 0;
+	size_t count = 0;
+	while ( skit_utest_int_hashmap_next(map, &cursor, &key, &val) )
+	{
+		sASSERT_EQ(skit_slice_len(key), snprintf(buf, sizeof(buf), "key%d", *val));
+		sASSERT_EQS(key, skit_slice_of_cstr(buf));
+		sum += *val;
+		count++;
+	}
+	sASSERT_EQ(count, skit_utest_int_hashmap_len(map));
+	long long expected = 0;
+	for ( i = 0; i < n; i++ )
+		if ( i % 3 != 0 )
+			expected += i;
+	sASSERT_EQ(sum, expected);
+
+	skit_utest_int_hashmap_free(map);
+	printf("  skit_hashmap_many_test passed.\n");
+}
+
+static void skit_hashmap_icase_test()
+{
+	skit_utest_int_hashmap map;
+	skit_utest_int_hashmap_ctor(&map, sFLAGS("i"));
+	sASSERT_EQ(skit_utest_int_hashmap_set(&map, sSLICE("Content-Type"), 1), 1);
+	sASSERT_EQ(skit_utest_int_hashmap_set(&map, sSLICE("CONTENT-TYPE"), 2), 0);
+	sASSERT_EQ(*skit_utest_int_hashmap_get(&map, sSLICE("content-type")), 2);
+	sASSERT(skit_utest_int_hashmap_get(&map, sSLICE("content_type")) == NULL);
+
+	/* The first spelling is kept. */
+	size_t cursor = 0;
+	skit_slice key;
+	sASSERT(skit_utest_int_hashmap_next(&map, &cursor, &key, NULL));
+	sASSERT_EQS(key, sSLICE("Content-Type"));
+	sASSERT(!skit_utest_int_hashmap_next(&map, &cursor, &key, NULL));
+
+	sASSERT_EQ(skit_utest_int_hashmap_remove(&map, sSLICE("content-TYPE"), NULL), 1);
+	sASSERT_EQ(skit_utest_int_hashmap_len(&map), 0);
+	skit_utest_int_hashmap_dtor(&map);
+	printf("  skit_hashmap_icase_test passed.\n");
+}
+
+static void skit_hashmap_reserve_test()
+{
+	skit_vptr_hashmap map;
+	skit_vptr_hashmap_ctor(&map, SKIT_FLAGS_NONE);
+	skit_vptr_hashmap_reserve(&map, 100);
+	size_t capacity = map.capacity;
+	sASSERT(capacity * 3 >= 100 * 4);
+
+	char buf[32];
+	int i;
+	for ( i = 0; i < 100; i++ )
+	{
+		snprintf(buf, sizeof(buf), "%d", i);
+		skit_vptr_hashmap_set(&map, skit_slice_of_cstr(buf), &map);
+	}
+	sASSERT_EQ(map.capacity, capacity);
+	sASSERT(*skit_vptr_hashmap_get(&map, sSLICE("42")) == &map);
+
+	skit_vptr_hashmap_dtor(&map);
+	printf("  skit_hashmap_reserve_test passed.\n");
+}
+
+void skit_hashmap_unittest()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	printf("skit_hashmap_unittest()\n");
+	sTRACE(skit_hashmap_basic_test());
+	sTRACE(skit_hashmap_many_test());
+	sTRACE(skit_hashmap_icase_test());
+	sTRACE(skit_hashmap_reserve_test());
+	printf("  skit_hashmap_unittest passed!\n");
+	printf("\n");
+}
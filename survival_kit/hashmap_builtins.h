@@ -0,0 +1,57 @@
+
+#ifndef SKIT_HASHMAP_BUILTINS_INCLUDED
+#define SKIT_HASHMAP_BUILTINS_INCLUDED
+
+#include <inttypes.h>
+
+#include "survival_kit/string.h"
+#include "survival_kit/flags.h"
+#include "survival_kit/assert.h"
+#include "survival_kit/memory.h"
+#include "survival_kit/feature_emulation.h"
+
+/* SKIT_T_HEADER allows the template header file to be overridden. */
+/* It is used by the corresponding _builtins.c file to provide linkable */
+/*   implementations for all of these template instances. */
+/* It is not recommended that any calling code use SKIT_T_HEADER. */
+#ifndef SKIT_T_HEADER
+#	define SKIT_T_HEADER "survival_kit/templates/hashmap.h"
+#	define SKIT_CLEAN_HASHMAP_BUILTINS 1
+#endif
+
+/** Define skit_i64_hashmap */
+#define SKIT_T_ELEM_TYPE int64_t
+#define SKIT_T_NAME i64
+#include SKIT_T_HEADER
+#undef SKIT_T_ELEM_TYPE
+#undef SKIT_T_NAME
+
+/** Define skit_i32_hashmap */
+#define SKIT_T_ELEM_TYPE int32_t
+#define SKIT_T_NAME i32
+#include SKIT_T_HEADER
+#undef SKIT_T_ELEM_TYPE
+#undef SKIT_T_NAME
+
+/** Define skit_vptr_hashmap  (SKIT_T_ELEM_TYPE==void*) */
+#define SKIT_T_ELEM_TYPE void*
+#define SKIT_T_NAME vptr
+#include SKIT_T_HEADER
+#undef SKIT_T_ELEM_TYPE
+#undef SKIT_T_NAME
+
+/* Double guard this: the builtins .c file will #undef the normal include
+guards because it needs to expand this file twice: once for the definitions
+and again for the implementations. */
+#ifndef SKIT_HASHMAP_UNITTEST_INCLUDED
+#define SKIT_HASHMAP_UNITTEST_INCLUDED
+/** */
+void skit_hashmap_unittest();
+#endif
+
+#ifdef SKIT_CLEAN_HASHMAP_BUILTINS
+#	undef SKIT_T_HEADER
+#	undef SKIT_CLEAN_HASHMAP_BUILTINS
+#endif
+
+#endif
@@ -4,20 +4,696 @@
 #endif
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <inttypes.h>
 
 #include "survival_kit/memory.h"
+#include "survival_kit/misc.h" /* skit_die */
+#include "survival_kit/assert.h"
+#include "survival_kit/feature_emulation/thread_context.h"
+#include "survival_kit/streams/stream.h"
+#include "survival_kit/streams/text_stream.h"
 
-void *skit_malloc(size_t size)
+static void *skit_libc_malloc(skit_allocator *self, size_t size)
 {
 	return malloc(size);
 }
 
-void *skit_realloc(void *ptr, size_t size)
+static void *skit_libc_realloc(skit_allocator *self, void *ptr, size_t size)
 {
 	return realloc(ptr, size);
 }
 
+static void skit_libc_free(skit_allocator *self, void *ptr)
+{
+	free(ptr);
+}
+
+static skit_allocator skit__libc_allocator = {
+	&skit_libc_malloc,
+	&skit_libc_realloc,
+	&skit_libc_free,
+	NULL,
+	NULL
+};
+
+static skit_allocator *skit__process_allocator = &skit__libc_allocator;
+
+/* Counts how many times skit_thread_allocator_set has installed an allocator.
+This lets skit_malloc & friends skip the pthread_getspecific call entirely
+in processes that never use thread allocators.  It is never decremented,
+because another thread may still have its allocator installed. */
+static volatile int skit__thread_allocators_used = 0;
+
+/* ------------------------------------------------------------------------- */
+
+skit_allocator *skit_allocator_libc()
+{
+	return &skit__libc_allocator;
+}
+
+skit_allocator *skit_process_allocator_get()
+{
+	return skit__process_allocator;
+}
+
+skit_allocator *skit_process_allocator_set(skit_allocator *allocator)
+{
+	skit_allocator *prev = skit__process_allocator;
+	if ( allocator == NULL )
+		allocator = &skit__libc_allocator;
+	skit__process_allocator = allocator;
+	return prev;
+}
+
+skit_allocator *skit_thread_allocator_get()
+{
+	if ( !skit__thread_allocators_used )
+		return NULL;
+
+	skit_thread_context *ctx = skit_thread_context_get();
+	if ( ctx == NULL )
+		return NULL;
+
+	return ctx->allocator;
+}
+
+skit_allocator *skit_thread_allocator_set(skit_allocator *allocator)
+{
+	skit_thread_context *ctx = skit_thread_context_get();
+	if ( ctx == NULL )
+		skit_die("skit_thread_allocator_set: called from a thread with no thread context.");
+
+	skit_allocator *prev = ctx->allocator;
+	ctx->allocator = allocator;
+	if ( allocator != NULL )
+		skit__thread_allocators_used = 1;
+	return prev;
+}
+
+static skit_allocator *skit_allocator_current()
+{
+	skit_allocator *allocator = skit_thread_allocator_get();
+	if ( allocator != NULL )
+		return allocator;
+	return skit__process_allocator;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Statistics bookkeeping. */
+
+/* Placed in front of every allocation while statistics are enabled. */
+typedef struct skit_memory_header skit_memory_header;
+struct skit_memory_header
+{
+	size_t     size;
+	const char *tag;
+};
+
+static volatile int skit__memory_stats_on = 0;
+static volatile int skit__memory_used = 0;
+static pthread_key_t skit__memory_stats_key;
+static pthread_mutex_t skit__memory_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static skit_memory_stats *skit__memory_stats_list = NULL;
+
+static const char *skit__memory_untagged = "(untagged)";
+static const char *skit__memory_process_tag = "(process)";
+static const char *skit__memory_other_tag = "(other)";
+
+static int skit_memory_size_class(size_t size)
+{
+	int size_class = 0;
+	size_t limit = 16;
+	while ( size > limit && size_class < SKIT_MEMORY_N_SIZE_CLASSES-1 )
+	{
+		limit <<= 1;
+		size_class++;
+	}
+	return size_class;
+}
+
+static skit_memory_tag_stats *skit_memory_tag_lookup(skit_memory_stats *stats, const char *tag)
+{
+	int i;
+	if ( tag == NULL )
+		tag = skit__memory_untagged;
+
+	/* Pointer comparison catches almost everything. */
+	/* strcmp catches copies of the same __FILE__ string from different */
+	/* translation units (ex: template instantiations). */
+	for ( i = 0; i < stats->n_tags; i++ )
+		if ( stats->tags[i].tag == tag )
+			return &stats->tags[i];
+	for ( i = 0; i < stats->n_tags; i++ )
+		if ( strcmp(stats->tags[i].tag, tag) == 0 )
+			return &stats->tags[i];
+
+	/* The last slot is reserved for everything that doesn't fit. */
+	if ( stats->n_tags == SKIT_MEMORY_MAX_TAGS-1 )
+	{
+		stats->tags[stats->n_tags].tag = skit__memory_other_tag;
+		stats->n_tags++;
+	}
+	if ( stats->n_tags == SKIT_MEMORY_MAX_TAGS )
+		return &stats->tags[SKIT_MEMORY_MAX_TAGS-1];
+
+	skit_memory_tag_stats *result = &stats->tags[stats->n_tags++];
+	result->tag = tag;
+	result->live_bytes = 0;
+	result->peak_bytes = 0;
+	result->n_allocs = 0;
+	return result;
+}
+
+static void skit_memory_stats_adjust(skit_memory_stats *stats, const char *tag, ssize_t delta)
+{
+	skit_memory_tag_stats *tag_stats = skit_memory_tag_lookup(stats, tag);
+
+	stats->live_bytes += delta;
+	if ( stats->live_bytes > stats->peak_bytes )
+		stats->peak_bytes = stats->live_bytes;
+
+	tag_stats->live_bytes += delta;
+	if ( tag_stats->live_bytes > tag_stats->peak_bytes )
+		tag_stats->peak_bytes = tag_stats->live_bytes;
+}
+
+static void skit_memory_stats_on_alloc(skit_memory_stats *stats, size_t size, const char *tag)
+{
+	stats->n_allocs++;
+	stats->size_classes[skit_memory_size_class(size)]++;
+	skit_memory_tag_lookup(stats, tag)->n_allocs++;
+	skit_memory_stats_adjust(stats, tag, size);
+}
+
+static void skit_memory_stats_on_realloc(
+	skit_memory_stats *stats,
+	size_t old_size, const char *old_tag,
+	size_t new_size, const char *new_tag)
+{
+	stats->n_reallocs++;
+	stats->size_classes[skit_memory_size_class(new_size)]++;
+	skit_memory_stats_adjust(stats, old_tag, -(ssize_t)old_size);
+	skit_memory_stats_adjust(stats, new_tag, new_size);
+}
+
+static void skit_memory_stats_on_free(skit_memory_stats *stats, size_t size, const char *tag)
+{
+	stats->n_frees++;
+	skit_memory_stats_adjust(stats, tag, -(ssize_t)size);
+}
+
+static skit_memory_stats *skit_memory_thread_stats()
+{
+	skit_memory_stats *stats = pthread_getspecific(skit__memory_stats_key);
+	if ( stats != NULL )
+		return stats;
+
+	/* This uses calloc directly: going through skit_malloc would recurse. */
+	stats = calloc(1, sizeof(skit_memory_stats));
+	if ( stats == NULL )
+		skit_die("Out of memory while allocating memory statistics.");
+
+	pthread_mutex_lock(&skit__memory_stats_mutex);
+	stats->next = skit__memory_stats_list;
+	skit__memory_stats_list = stats;
+	pthread_mutex_unlock(&skit__memory_stats_mutex);
+
+	pthread_setspecific(skit__memory_stats_key, stats);
+	return stats;
+}
+
+static void *skit_memory_stats_malloc(skit_allocator *allocator, size_t size, const char *tag)
+{
+	skit_memory_header *header =
+		allocator->malloc_func(allocator, sizeof(skit_memory_header) + size);
+	if ( header == NULL )
+		return NULL;
+
+	header->size = size;
+	header->tag = tag;
+	skit_memory_stats_on_alloc(skit_memory_thread_stats(), size, tag);
+	return header + 1;
+}
+
+static void *skit_memory_stats_realloc(skit_allocator *allocator, void *ptr, size_t size, const char *tag)
+{
+	if ( ptr == NULL )
+		return skit_memory_stats_malloc(allocator, size, tag);
+
+	skit_memory_header *header = ((skit_memory_header*)ptr) - 1;
+	size_t old_size = header->size;
+	const char *old_tag = header->tag;
+
+	header = allocator->realloc_func(allocator, header, sizeof(skit_memory_header) + size);
+	if ( header == NULL )
+		return NULL;
+
+	header->size = size;
+	header->tag = tag;
+	skit_memory_stats_on_realloc(skit_memory_thread_stats(), old_size, old_tag, size, tag);
+	return header + 1;
+}
+
+static void skit_memory_stats_free(skit_allocator *allocator, void *ptr)
+{
+	if ( ptr == NULL )
+		return;
+
+	skit_memory_header *header = ((skit_memory_header*)ptr) - 1;
+	skit_memory_stats_on_free(skit_memory_thread_stats(), header->size, header->tag);
+	allocator->free_func(allocator, header);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void *skit_memory_malloc_with(skit_allocator *allocator, size_t size, const char *tag)
+{
+	if ( skit__memory_stats_on )
+		return skit_memory_stats_malloc(allocator, size, tag);
+
+	if ( !skit__memory_used )
+		skit__memory_used = 1;
+	return allocator->malloc_func(allocator, size);
+}
+
+static void *skit_memory_realloc_with(skit_allocator *allocator, void *ptr, size_t size, const char *tag)
+{
+	if ( skit__memory_stats_on )
+		return skit_memory_stats_realloc(allocator, ptr, size, tag);
+
+	if ( !skit__memory_used )
+		skit__memory_used = 1;
+	return allocator->realloc_func(allocator, ptr, size);
+}
+
+static void skit_memory_free_with(skit_allocator *allocator, void *mem)
+{
+	if ( skit__memory_stats_on )
+		skit_memory_stats_free(allocator, mem);
+	else
+		allocator->free_func(allocator, mem);
+}
+
+void *skit_malloc_at(size_t size, const char *tag)
+{
+	return skit_memory_malloc_with(skit_allocator_current(), size, tag);
+}
+
+void *skit_realloc_at(void *ptr, size_t size, const char *tag)
+{
+	return skit_memory_realloc_with(skit_allocator_current(), ptr, size, tag);
+}
+
+void *skit_malloc_beside_at(const void *neighbor, size_t size, const char *tag)
+{
+	skit_allocator *allocator = skit_allocator_current();
+	if ( neighbor != NULL && allocator->owner_func != NULL )
+		allocator = allocator->owner_func(allocator, neighbor);
+	return skit_memory_malloc_with(allocator, size, tag);
+}
+
+void *(skit_malloc)(size_t size)
+{
+	return skit_malloc_at(size, NULL);
+}
+
+void *(skit_realloc)(void *ptr, size_t size)
+{
+	return skit_realloc_at(ptr, size, NULL);
+}
+
 void skit_free(void *mem)
 {
-	free(mem);
-}
\ No newline at end of file
+	skit_memory_free_with(skit_allocator_current(), mem);
+}
+
+void *skit_process_malloc(size_t size)
+{
+	return skit_memory_malloc_with(skit__process_allocator, size, skit__memory_process_tag);
+}
+
+void *skit_process_realloc(void *ptr, size_t size)
+{
+	return skit_memory_realloc_with(skit__process_allocator, ptr, size, skit__memory_process_tag);
+}
+
+void skit_process_free(void *mem)
+{
+	skit_memory_free_with(skit__process_allocator, mem);
+}
+
+/* ------------------------------------------------------------------------- */
+
+void skit_memory_stats_enable()
+{
+	if ( skit__memory_stats_on )
+		return;
+	if ( skit__memory_used )
+		skit_die("skit_memory_stats_enable: called after memory was already allocated with skit_malloc.");
+
+	pthread_key_create(&skit__memory_stats_key, NULL);
+	skit__memory_stats_on = 1;
+}
+
+int skit_memory_stats_enabled()
+{
+	return skit__memory_stats_on;
+}
+
+const skit_memory_stats *skit_memory_stats_get()
+{
+	if ( !skit__memory_stats_on )
+		return NULL;
+	return skit_memory_thread_stats();
+}
+
+static void skit_memory_stats_dump_one(skit_stream *output, const skit_memory_stats *stats)
+{
+	int i;
+	skit_stream_appendf(output, "  live bytes: %lld, peak bytes: %lld\n",
+		(long long int)stats->live_bytes, (long long int)stats->peak_bytes);
+	skit_stream_appendf(output, "  allocs: %llu, reallocs: %llu, frees: %llu\n",
+		(unsigned long long)stats->n_allocs,
+		(unsigned long long)stats->n_reallocs,
+		(unsigned long long)stats->n_frees);
+
+	skit_stream_appendf(output, "  size classes:\n");
+	for ( i = 0; i < SKIT_MEMORY_N_SIZE_CLASSES; i++ )
+	{
+		if ( stats->size_classes[i] == 0 )
+			continue;
+		if ( i < SKIT_MEMORY_N_SIZE_CLASSES-1 )
+			skit_stream_appendf(output, "    <= %llu: %llu\n",
+				(unsigned long long)16 << i, (unsigned long long)stats->size_classes[i]);
+		else
+			skit_stream_appendf(output, "    >  %llu: %llu\n",
+				(unsigned long long)16 << (i-1), (unsigned long long)stats->size_classes[i]);
+	}
+
+	skit_stream_appendf(output, "  by tag:\n");
+	for ( i = 0; i < stats->n_tags; i++ )
+	{
+		const skit_memory_tag_stats *tag_stats = &stats->tags[i];
+		skit_stream_appendf(output, "    %s: live bytes: %lld, peak bytes: %lld, allocs: %llu\n",
+			tag_stats->tag,
+			(long long int)tag_stats->live_bytes,
+			(long long int)tag_stats->peak_bytes,
+			(unsigned long long)tag_stats->n_allocs);
+	}
+}
+
+void skit_memory_stats_dump(skit_stream *output)
+{
+	if ( !skit__memory_stats_on )
+	{
+		skit_stream_appendf(output, "Memory statistics are not enabled.\n");
+		return;
+	}
+
+	pthread_mutex_lock(&skit__memory_stats_mutex);
+	skit_memory_stats *stats = skit__memory_stats_list;
+	pthread_mutex_unlock(&skit__memory_stats_mutex);
+
+	skit_memory_stats total;
+	memset(&total, 0, sizeof(total));
+	int n_threads = 0;
+	for ( ; stats != NULL; stats = stats->next )
+	{
+		int i;
+		n_threads++;
+		skit_stream_appendf(output, "Memory statistics for thread #%d%s:\n", n_threads,
+			stats == pthread_getspecific(skit__memory_stats_key) ? " (current thread)" : "");
+		skit_memory_stats_dump_one(output, stats);
+
+		total.live_bytes += stats->live_bytes;
+		total.peak_bytes += stats->peak_bytes;
+		total.n_allocs   += stats->n_allocs;
+		total.n_reallocs += stats->n_reallocs;
+		total.n_frees    += stats->n_frees;
+		for ( i = 0; i < SKIT_MEMORY_N_SIZE_CLASSES; i++ )
+			total.size_classes[i] += stats->size_classes[i];
+		for ( i = 0; i < stats->n_tags; i++ )
+		{
+			skit_memory_tag_stats *tag_stats = skit_memory_tag_lookup(&total, stats->tags[i].tag);
+			tag_stats->live_bytes += stats->tags[i].live_bytes;
+			tag_stats->peak_bytes += stats->tags[i].peak_bytes;
+			tag_stats->n_allocs   += stats->tags[i].n_allocs;
+		}
+	}
+
+	skit_stream_appendf(output, "Memory statistics for all %d threads (peaks are summed):\n", n_threads);
+	skit_memory_stats_dump_one(output, &total);
+}
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct skit_counting_allocator skit_counting_allocator;
+struct skit_counting_allocator
+{
+	int n_mallocs;
+	int n_reallocs;
+	int n_frees;
+};
+
+static void *skit_counting_malloc(skit_allocator *self, size_t size)
+{
+	((skit_counting_allocator*)self->context)->n_mallocs++;
+	return malloc(size);
+}
+
+static void *skit_counting_realloc(skit_allocator *self, void *ptr, size_t size)
+{
+	((skit_counting_allocator*)self->context)->n_reallocs++;
+	return realloc(ptr, size);
+}
+
+static void skit_counting_free(skit_allocator *self, void *ptr)
+{
+	((skit_counting_allocator*)self->context)->n_frees++;
+	free(ptr);
+}
+
+static void skit_process_allocator_test()
+{
+	skit_counting_allocator counts = {0, 0, 0};
+	skit_allocator allocator = {
+		&skit_counting_malloc,
+		&skit_counting_realloc,
+		&skit_counting_free,
+		&counts };
+
+	sASSERT(skit_process_allocator_get() == skit_allocator_libc());
+	sASSERT(skit_process_allocator_set(&allocator) == skit_allocator_libc());
+	sASSERT(skit_process_allocator_get() == &allocator);
+
+	void *mem = skit_malloc(16);
+	mem = skit_realloc(mem, 32);
+	skit_free(mem);
+
+	sASSERT(skit_process_allocator_set(NULL) == &allocator);
+	sASSERT(skit_process_allocator_get() == skit_allocator_libc());
+
+	sASSERT_EQ(counts.n_mallocs, 1);
+	sASSERT_EQ(counts.n_reallocs, 1);
+	sASSERT_EQ(counts.n_frees, 1);
+
+	printf("  skit_process_allocator_test passed.\n");
+}
+
+static void skit_thread_allocator_test()
+{
+	skit_counting_allocator counts = {0, 0, 0};
+	skit_allocator allocator = {
+		&skit_counting_malloc,
+		&skit_counting_realloc,
+		&skit_counting_free,
+		&counts };
+
+	/* The unittests are run with a thread context already established. */
+	sASSERT(skit_thread_allocator_get() == NULL);
+	sASSERT(skit_thread_allocator_set(&allocator) == NULL);
+	sASSERT(skit_thread_allocator_get() == &allocator);
+
+	/* The process allocator is not consulted while the thread has its own. */
+	sASSERT(skit_process_allocator_get() == skit_allocator_libc());
+
+	void *mem = skit_malloc(16);
+	mem = skit_realloc(mem, 32);
+	skit_free(mem);
+
+	sASSERT(skit_thread_allocator_set(NULL) == &allocator);
+	sASSERT(skit_thread_allocator_get() == NULL);
+
+	mem = skit_malloc(16);
+	skit_free(mem);
+
+	sASSERT_EQ(counts.n_mallocs, 1);
+	sASSERT_EQ(counts.n_reallocs, 1);
+	sASSERT_EQ(counts.n_frees, 1);
+
+	printf("  skit_thread_allocator_test passed.\n");
+}
+
+static void skit_memory_stats_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+
+	/* The unittests don't run with statistics enabled (that would have to */
+	/* happen before skit_init), so exercise the bookkeeping directly. */
+	skit_memory_stats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	skit_memory_stats_on_alloc(&stats, 10, "trie.c");
+	skit_memory_stats_on_alloc(&stats, 100, "string.c");
+	skit_memory_stats_on_alloc(&stats, 1000000, "string.c");
+	sASSERT_EQ(stats.live_bytes, 1000110);
+	sASSERT_EQ(stats.peak_bytes, 1000110);
+	sASSERT_EQ(stats.n_allocs, 3);
+	sASSERT_EQ(stats.size_classes[0], 1);
+	sASSERT_EQ(stats.size_classes[3], 1);
+	sASSERT_EQ(stats.size_classes[SKIT_MEMORY_N_SIZE_CLASSES-1], 1);
+	sASSERT_EQ(stats.n_tags, 2);
+
+	skit_memory_stats_on_free(&stats, 1000000, "string.c");
+	skit_memory_stats_on_realloc(&stats, 10, "trie.c", 20, "trie.c");
+	sASSERT_EQ(stats.live_bytes, 120);
+	sASSERT_EQ(stats.peak_bytes, 1000110);
+	sASSERT_EQ(stats.n_frees, 1);
+	sASSERT_EQ(stats.n_reallocs, 1);
+
+	sASSERT_EQ(skit_memory_tag_lookup(&stats, "trie.c")->live_bytes, 20);
+	sASSERT_EQ(skit_memory_tag_lookup(&stats, "string.c")->live_bytes, 100);
+	sASSERT_EQ(skit_memory_tag_lookup(&stats, "string.c")->peak_bytes, 1000100);
+	sASSERT_EQ(skit_memory_tag_lookup(&stats, "string.c")->n_allocs, 2);
+
+	/* Tags beyond the table's capacity are lumped together. */
+	char tag_names[SKIT_MEMORY_MAX_TAGS+2][8];
+	int i;
+	for ( i = 0; i < SKIT_MEMORY_MAX_TAGS+2; i++ )
+	{
+		sprintf(tag_names[i], "tag%d", i);
+		skit_memory_stats_on_alloc(&stats, 1, tag_names[i]);
+	}
+	sASSERT_EQ(stats.n_tags, SKIT_MEMORY_MAX_TAGS);
+	sASSERT_EQ(skit_memory_tag_lookup(&stats, "tag99")->tag, skit__memory_other_tag);
+
+	skit_text_stream output;
+	skit_text_stream_ctor(&output);
+	skit_memory_stats_dump_one(&output.as_stream, &stats);
+	skit_text_stream_rewind(&output);
+	skit_slice text = skit_text_stream_slurp(&output, NULL);
+	sASSERT(skit_slice_find(text, sSLICE("live bytes: 154, peak bytes: 1000110"), NULL));
+	sASSERT(skit_slice_find(text, sSLICE("string.c: live bytes: 100, peak bytes: 1000100, allocs: 2"), NULL));
+	sASSERT(skit_slice_find(text, sSLICE("(other): live bytes: 5"), NULL));
+	skit_text_stream_dtor(&output);
+
+	printf("  skit_memory_stats_test passed.\n");
+}
+
+static size_t skit_memory_header_size(void *ptr)
+{
+	return (((skit_memory_header*)ptr) - 1)->size;
+}
+
+static const char *skit_memory_header_tag(void *ptr)
+{
+	return (((skit_memory_header*)ptr) - 1)->tag;
+}
+
+static void skit_memory_stats_header_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	const char *tag_a = "tag-a";
+	const char *tag_b = "tag-b";
+	int i;
+
+	/* Statistics aren't enabled in the unittests, so this thread's stats */
+	/* are kept under a key of the test's own, and thrown away after. */
+	int own_key = !skit__memory_stats_on;
+	if ( own_key )
+		pthread_key_create(&skit__memory_stats_key, NULL);
+	skit_memory_stats *stats = skit_memory_thread_stats();
+	ssize_t live_before = stats->live_bytes;
+	uint64_t frees_before = stats->n_frees;
+
+	/* glibc's malloc aligns to twice the size of a size_t, and the header */
+	/* must not take that away. */
+	char *mem = skit_memory_stats_malloc(skit__process_allocator, 24, tag_a);
+	sASSERT(mem != NULL);
+	sASSERT_EQ((uintptr_t)mem % (2*sizeof(size_t)), 0);
+	sASSERT_EQ(skit_memory_header_size(mem), 24);
+	sASSERT(skit_memory_header_tag(mem) == tag_a);
+	sASSERT_EQ(stats->live_bytes, live_before + 24);
+	sASSERT_EQ(skit_memory_tag_lookup(stats, tag_a)->live_bytes, 24);
+	for ( i = 0; i < 24; i++ )
+		mem[i] = (char)i;
+
+	/* Growing far enough to move the block, and moving it to another tag. */
+	mem = skit_memory_stats_realloc(skit__process_allocator, mem, 100000, tag_b);
+	sASSERT(mem != NULL);
+	sASSERT_EQ((uintptr_t)mem % (2*sizeof(size_t)), 0);
+	sASSERT_EQ(skit_memory_header_size(mem), 100000);
+	sASSERT(skit_memory_header_tag(mem) == tag_b);
+	for ( i = 0; i < 24; i++ )
+		sASSERT_EQ(mem[i], (char)i);
+	mem[99999] = 'z';
+	sASSERT_EQ(stats->live_bytes, live_before + 100000);
+	sASSERT_EQ(skit_memory_tag_lookup(stats, tag_a)->live_bytes, 0);
+	sASSERT_EQ(skit_memory_tag_lookup(stats, tag_b)->live_bytes, 100000);
+
+	/* Shrinking keeps the contents that still fit. */
+	mem = skit_memory_stats_realloc(skit__process_allocator, mem, 8, tag_b);
+	sASSERT_EQ(skit_memory_header_size(mem), 8);
+	for ( i = 0; i < 8; i++ )
+		sASSERT_EQ(mem[i], (char)i);
+	sASSERT_EQ(stats->live_bytes, live_before + 8);
+
+	/* realloc of NULL is a malloc. */
+	char *other = skit_memory_stats_realloc(skit__process_allocator, NULL, 40, tag_a);
+	sASSERT_EQ(skit_memory_header_size(other), 40);
+	sASSERT_EQ(stats->live_bytes, live_before + 48);
+
+	/* Freeing balances the books. */
+	skit_memory_stats_free(skit__process_allocator, mem);
+	skit_memory_stats_free(skit__process_allocator, other);
+	skit_memory_stats_free(skit__process_allocator, NULL);
+	sASSERT_EQ(stats->live_bytes, live_before);
+	sASSERT_EQ(stats->n_frees, frees_before + 2);
+	sASSERT_EQ(skit_memory_tag_lookup(stats, tag_a)->live_bytes, 0);
+	sASSERT_EQ(skit_memory_tag_lookup(stats, tag_b)->live_bytes, 0);
+
+	if ( own_key )
+	{
+		skit_memory_stats **link;
+		pthread_mutex_lock(&skit__memory_stats_mutex);
+		for ( link = &skit__memory_stats_list; *link != NULL; link = &(*link)->next )
+		{
+			if ( *link == stats )
+			{
+				*link = stats->next;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&skit__memory_stats_mutex);
+		pthread_setspecific(skit__memory_stats_key, NULL);
+		pthread_key_delete(skit__memory_stats_key);
+		free(stats);
+	}
+
+	printf("  skit_memory_stats_header_test passed.\n");
+}
+
+void skit_memory_unittest()
+{
+	printf("skit_memory_unittest()\n");
+	skit_process_allocator_test();
+	skit_thread_allocator_test();
+	skit_memory_stats_test();
+	skit_memory_stats_header_test();
+	printf("  skit_memory_unittest passed!\n");
+	printf("\n");
+}
@@ -3,31 +3,219 @@
 #define SKIT_MEMORY_INCLUDED
 
 #include <stdlib.h>
+#include <unistd.h> /* ssize_t */
 
-/** 
-Calls C's malloc function.
-In the future this will check for the existence of a custom allocator and use
-that instead, if it's present.
+/**
+An allocator backend that skit_malloc, skit_realloc, and skit_free will
+forward to.  This allows callers to plug in arenas, pools, or other
+allocation strategies without modifying the modules that allocate memory.
+
+The 'context' member is never touched by the memory module; it is for the
+allocator's own state, and is passed back to the allocator through the
+'self' argument of each callback.
+
+The malloc, realloc, and free callbacks must be non-NULL.  The realloc
+callback must behave like C's realloc: a NULL 'ptr' acts like malloc.  The
+free callback must accept NULL and ignore it.
+
+The owner callback is optional (it may be NULL).  Given memory that the
+caller wants to allocate more memory beside, it returns the allocator that
+the new memory should come from: 'self' if 'ptr' came from this allocator,
+or otherwise the allocator that memory from before this one was installed
+comes from.  See skit_malloc_beside.
+
+Memory must always be freed by the same allocator that allocated it.
+Because of this, an allocator should only be installed or uninstalled at
+points where no memory allocated through the previous allocator will later
+be handed to skit_realloc or skit_free.
+*/
+typedef struct skit_allocator skit_allocator;
+struct skit_allocator
+{
+	void *(*malloc_func)(skit_allocator *self, size_t size);
+	void *(*realloc_func)(skit_allocator *self, void *ptr, size_t size);
+	void  (*free_func)(skit_allocator *self, void *ptr);
+	void *context;
+	skit_allocator *(*owner_func)(skit_allocator *self, const void *ptr);
+};
+
+/**
+Returns the allocator that forwards to C's malloc, realloc, and free.
+This is the process allocator unless skit_process_allocator_set is called.
 */
-void *skit_malloc(size_t size);
+skit_allocator *skit_allocator_libc();
 
-/** 
-Calls C's realloc function.
-In the future this will check for the existence of a custom allocator and use
-that instead, if it's present.
+/**
+Returns the allocator used by threads that have not installed their own
+allocator with skit_thread_allocator_set.
+This is never NULL.
 */
-void *skit_realloc(void *ptr, size_t size);
+skit_allocator *skit_process_allocator_get();
 
-/** 
-Calls C's free function.
-In the future this will check for the existence of a custom allocator and use
-that instead, if it's present.
+/**
+Replaces the process-wide allocator and returns the previous one.
+Passing NULL restores the libc allocator.
+This is not synchronized with other threads: it should be called during
+program initialization, before other threads start allocating.
+*/
+skit_allocator *skit_process_allocator_set(skit_allocator *allocator);
+
+/**
+Returns the allocator installed for the calling thread, or NULL if the thread
+uses the process allocator.
+*/
+skit_allocator *skit_thread_allocator_get();
+
+/**
+Installs an allocator for the calling thread only and returns the previously
+installed thread allocator (or NULL if there was none).
+Passing NULL makes the thread go back to using the process allocator.
+
+The allocator is stored in the thread's skit_thread_context, so this must be
+called from a thread that has a context established (ex: from within a
+function that uses SKIT_USE_FEATURE_EMULATION and was called with sTRACE).
+
+Threads that never call this function do not pay for the thread-local
+lookup in skit_malloc/skit_realloc/skit_free until some thread in the process
+installs a thread allocator.
+*/
+skit_allocator *skit_thread_allocator_set(skit_allocator *allocator);
+
+/**
+Allocates 'size' bytes using the calling thread's allocator if it has one,
+or the process allocator otherwise.
+
+skit_malloc and skit_realloc are macros that pass the caller's __FILE__ to
+skit_malloc_at/skit_realloc_at, so that allocation statistics can be
+attributed to the module that made the allocation.  Taking the address of
+skit_malloc or skit_realloc (ex: &skit_malloc) still gives a function with
+the usual malloc/realloc signature; allocations made through such pointers
+are reported as untagged.
+*/
+void *(skit_malloc)(size_t size);
+void *skit_malloc_at(size_t size, const char *tag);
+#define skit_malloc(size) (skit_malloc_at((size), __FILE__))
+
+/**
+Resizes memory obtained from skit_malloc or skit_realloc using the calling
+thread's allocator if it has one, or the process allocator otherwise.
+*/
+void *(skit_realloc)(void *ptr, size_t size);
+void *skit_realloc_at(void *ptr, size_t size, const char *tag);
+#define skit_realloc(ptr, size) (skit_realloc_at((ptr), (size), __FILE__))
+
+/**
+Frees memory obtained from skit_malloc or skit_realloc using the calling
+thread's allocator if it has one, or the process allocator otherwise.
 */
 void skit_free(void *mem);
 
-/** 
-Prints a chunk of memory in both hexadecimal and text form. 
+/**
+Like skit_malloc, but allocates from the same allocator as 'neighbor', which
+is memory that the new memory will be owned by or freed along with.
+This matters for objects that were created before a scoped thread allocator
+(like skit_arena) was installed, and that allocate more memory while it is
+installed: that memory must outlive the scope just like the object does.
+The result can be resized and freed with skit_realloc and skit_free.
+*/
+void *skit_malloc_beside_at(const void *neighbor, size_t size, const char *tag);
+#define skit_malloc_beside(neighbor, size) (skit_malloc_beside_at((neighbor), (size), __FILE__))
+
+/**
+These are like skit_malloc, skit_realloc, and skit_free, except that they
+always use the process allocator and ignore any thread allocator.
+They are used for long-lived bookkeeping, such as the feature emulation
+stacks and exception messages.  That memory may outlive a scoped thread
+allocator like skit_arena, so it must not come from one.
+*/
+void *skit_process_malloc(size_t size);
+void *skit_process_realloc(void *ptr, size_t size); /** ditto */
+void skit_process_free(void *mem); /** ditto */
+
+/**
+Allocation statistics.
+
+When enabled, every allocation made through skit_malloc, skit_realloc,
+skit_free, and the skit_process_* functions is counted in a per-thread
+skit_memory_stats record: live bytes, peak live bytes, the number of calls,
+a histogram of allocation sizes, and the same live/peak/count figures broken
+down by tag.  The tag is the source file that called skit_malloc or
+skit_realloc (ex: "survival_kit/trie.c"), which is enough to tell which
+module is holding memory.
+
+Statistics are off by default, and cost one flag test per call while off.
+When on, each allocation carries a small hidden header that records its
+size and tag, so skit_memory_stats_enable must be called before anything
+is allocated through skit_malloc (ideally as the first statement in main,
+before skit_init).
+
+Memory freed by a different thread than the one that allocated it is
+subtracted from the freeing thread's counters.  As a result, an individual
+thread's live byte count can go negative, but the total across all threads
+is accurate.
+*/
+#define SKIT_MEMORY_N_SIZE_CLASSES 16  /** Size classes are powers of two from 16 bytes up. */
+#define SKIT_MEMORY_MAX_TAGS       32  /** Further tags are counted as "(other)". */
+
+typedef struct skit_memory_tag_stats skit_memory_tag_stats;
+struct skit_memory_tag_stats
+{
+	const char  *tag;
+	ssize_t     live_bytes;
+	ssize_t     peak_bytes;
+	size_t      n_allocs;
+};
+
+typedef struct skit_memory_stats skit_memory_stats;
+struct skit_memory_stats
+{
+	ssize_t     live_bytes;
+	ssize_t     peak_bytes;
+	size_t      n_allocs;
+	size_t      n_reallocs;
+	size_t      n_frees;
+
+	/** size_classes[i] counts allocations of at most (16 << i) bytes, */
+	/** except for the last class, which counts everything larger. */
+	size_t      size_classes[SKIT_MEMORY_N_SIZE_CLASSES];
+
+	skit_memory_tag_stats tags[SKIT_MEMORY_MAX_TAGS];
+	int         n_tags;
+
+	/* Internal: links every thread's record together for skit_memory_stats_dump. */
+	skit_memory_stats *next;
+};
+
+/**
+Turns on allocation statistics for the rest of the process's lifetime.
+This will call skit_die if anything has already been allocated with
+skit_malloc, because that memory would not have the statistics header.
+*/
+void skit_memory_stats_enable();
+
+/** Returns nonzero if skit_memory_stats_enable has been called. */
+int skit_memory_stats_enabled();
+
+/**
+Returns the calling thread's statistics, or NULL if statistics are not
+enabled.  The returned record is owned by the memory module.
+*/
+const skit_memory_stats *skit_memory_stats_get();
+
+/**
+Prints the statistics for every thread that has allocated memory since
+statistics were enabled, followed by the totals.
+Other threads' counters are read without synchronization, so their numbers
+may be slightly out of date if those threads are still allocating.
+*/
+union skit_stream;
+void skit_memory_stats_dump(union skit_stream *output);
+
+/**
+Prints a chunk of memory in both hexadecimal and text form.
 */
 void skit_print_mem(void *ptr, int size);
 
+void skit_memory_unittest();
+
 #endif
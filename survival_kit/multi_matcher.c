@@ -0,0 +1,588 @@
+
+#ifdef __DECC
+#pragma module skit_multi_matcher
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h> /* For ssize_t */
+
+#include "survival_kit/assert.h"
+#include "survival_kit/memory.h"
+#include "survival_kit/string.h"
+#include "survival_kit/streams/stream.h"
+#include "survival_kit/streams/text_stream.h"
+#include "survival_kit/feature_emulation.h"
+#include "survival_kit/multi_matcher.h"
+
+/* ------------------------------------------------------------------------- */
+
+/* Number of states that the goto function's tables have room for at first. */
+#define SKIT_MULTI_MATCHER_INITIAL_STATES 64
+
+/*
+Construction happens in three steps:
+(1) Assign byte classes.  Every byte that occurs in some needle gets its own
+    class; all other bytes share class 0.  The transition table only needs
+    one column per class.
+(2) Build the goto function: a trie of the needles where each state is a
+    prefix of some needle.  Missing edges are marked with -1.
+(3) Walk the trie breadth-first to compute each state's failure state (the
+    longest proper suffix of the state that is also a state) and replace every
+    missing edge with the edge of the failure state.  Because failure states
+    are always shallower, their rows are already complete when they are
+    needed.  The result is a DFA, so scanning never has to follow failure
+    links.
+*/
+void skit_multi_matcher_ctor(skit_multi_matcher *matcher, const skit_slice *patterns, size_t n_patterns)
+{
+	sASSERT(matcher != NULL);
+	sASSERT(patterns != NULL || n_patterns == 0);
+	sENFORCE_MSG(n_patterns < INT32_MAX, "Too many needles given to skit_multi_matcher_ctor.");
+
+	size_t i;
+	size_t max_states = 1;
+	for ( i = 0; i < n_patterns; i++ )
+	{
+		sENFORCE_MSG(!skit_slice_is_null(patterns[i]), "NULL needle given to skit_multi_matcher_ctor.");
+		sENFORCE_MSG(sSLENGTH(patterns[i]) > 0, "Empty needle given to skit_multi_matcher_ctor.");
+		max_states += sSLENGTH(patterns[i]);
+	}
+	sENFORCE_MSG(max_states < INT32_MAX, "Needles given to skit_multi_matcher_ctor are too long.");
+
+	/* (1) Byte classes. */
+	memset(matcher->byte_class, 0, sizeof(matcher->byte_class));
+	uint16_t n_classes = 1;
+	for ( i = 0; i < n_patterns; i++ )
+	{
+		const uint8_t *chars = sSPTR(patterns[i]);
+		ssize_t len = sSLENGTH(patterns[i]);
+		ssize_t j;
+		for ( j = 0; j < len; j++ )
+			if ( matcher->byte_class[chars[j]] == 0 )
+				matcher->byte_class[chars[j]] = n_classes++;
+	}
+	matcher->n_classes = n_classes;
+
+	/* (2) The goto function. */
+	/* max_states is only an upper bound: needles that share prefixes share */
+	/*   states.  So the tables start small and double as states are added. */
+	size_t capacity = max_states < SKIT_MULTI_MATCHER_INITIAL_STATES ? max_states : SKIT_MULTI_MATCHER_INITIAL_STATES;
+	int32_t *transitions = skit_malloc(capacity * n_classes * sizeof(int32_t));
+	int32_t *first_pattern = skit_malloc(capacity * sizeof(int32_t));
+	int32_t n_states = 1;
+	memset(transitions, 0xFF, n_classes * sizeof(int32_t));
+	first_pattern[0] = -1;
+
+	matcher->n_patterns = n_patterns;
+	matcher->next_pattern = skit_malloc((n_patterns + 1) * sizeof(int32_t));
+	matcher->pattern_lengths = skit_malloc((n_patterns + 1) * sizeof(size_t));
+
+	for ( i = 0; i < n_patterns; i++ )
+	{
+		const uint8_t *chars = sSPTR(patterns[i]);
+		ssize_t len = sSLENGTH(patterns[i]);
+		ssize_t j;
+		int32_t state = 0;
+		for ( j = 0; j < len; j++ )
+		{
+			size_t edge = (size_t)state * n_classes + matcher->byte_class[chars[j]];
+			if ( transitions[edge] < 0 )
+			{
+				if ( (size_t)n_states == capacity )
+				{
+					capacity *= 2;
+					if ( capacity > max_states )
+						capacity = max_states;
+					transitions = skit_realloc(transitions, capacity * n_classes * sizeof(int32_t));
+					first_pattern = skit_realloc(first_pattern, capacity * sizeof(int32_t));
+				}
+				transitions[edge] = n_states;
+				memset(&transitions[(size_t)n_states * n_classes], 0xFF, n_classes * sizeof(int32_t));
+				first_pattern[n_states] = -1;
+				n_states++;
+			}
+			state = transitions[edge];
+		}
+
+		/* Append, so that duplicate needles are reported in id order. */
+		matcher->pattern_lengths[i] = len;
+		matcher->next_pattern[i] = -1;
+		if ( first_pattern[state] < 0 )
+			first_pattern[state] = i;
+		else
+		{
+			int32_t last = first_pattern[state];
+			while ( matcher->next_pattern[last] >= 0 )
+				last = matcher->next_pattern[last];
+			matcher->next_pattern[last] = i;
+		}
+	}
+
+	/* Give back the space left over from the last doubling. */
+	transitions = skit_realloc(transitions, (size_t)n_states * n_classes * sizeof(int32_t));
+	first_pattern = skit_realloc(first_pattern, n_states * sizeof(int32_t));
+
+	/* (3) Failure states, in breadth-first order. */
+	int32_t *dict_link = skit_malloc(n_states * sizeof(int32_t));
+	int32_t *fail = skit_malloc(n_states * sizeof(int32_t));
+	int32_t *queue = skit_malloc(n_states * sizeof(int32_t));
+	int32_t head = 0;
+	int32_t tail = 0;
+	uint16_t c;
+
+	dict_link[0] = -1;
+	fail[0] = 0;
+	for ( c = 0; c < n_classes; c++ )
+	{
+		int32_t child = transitions[c];
+		if ( child < 0 )
+			transitions[c] = 0;
+		else
+		{
+			fail[child] = 0;
+			dict_link[child] = -1;
+			queue[tail++] = child;
+		}
+	}
+
+	while ( head < tail )
+	{
+		int32_t state = queue[head++];
+		int32_t *row = &transitions[(size_t)state * n_classes];
+		const int32_t *fail_row = &transitions[(size_t)fail[state] * n_classes];
+		for ( c = 0; c < n_classes; c++ )
+		{
+			int32_t child = row[c];
+			if ( child < 0 )
+				row[c] = fail_row[c];
+			else
+			{
+				int32_t f = fail_row[c];
+				fail[child] = f;
+				dict_link[child] = first_pattern[f] >= 0 ? f : dict_link[f];
+				queue[tail++] = child;
+			}
+		}
+	}
+
+	skit_free(queue);
+	skit_free(fail);
+
+	matcher->transitions = transitions;
+	matcher->first_pattern = first_pattern;
+	matcher->dict_link = dict_link;
+	matcher->n_states = n_states;
+}
+
+void skit_multi_matcher_dtor(skit_multi_matcher *matcher)
+{
+	sASSERT(matcher != NULL);
+	skit_free(matcher->transitions);
+	skit_free(matcher->first_pattern);
+	skit_free(matcher->dict_link);
+	skit_free(matcher->next_pattern);
+	skit_free(matcher->pattern_lengths);
+	matcher->transitions = NULL;
+	matcher->first_pattern = NULL;
+	matcher->dict_link = NULL;
+	matcher->next_pattern = NULL;
+	matcher->pattern_lengths = NULL;
+	matcher->n_states = 0;
+	matcher->n_patterns = 0;
+}
+
+skit_multi_matcher *skit_multi_matcher_new(const skit_slice *patterns, size_t n_patterns)
+{
+	skit_multi_matcher *result = skit_malloc(sizeof(skit_multi_matcher));
+	skit_multi_matcher_ctor(result, patterns, n_patterns);
+	return result;
+}
+
+skit_multi_matcher *skit_multi_matcher_free(skit_multi_matcher *matcher)
+{
+	if ( matcher == NULL )
+		return NULL;
+	skit_multi_matcher_dtor(matcher);
+	skit_free(matcher);
+	return NULL;
+}
+
+size_t skit_multi_matcher_pattern_length(const skit_multi_matcher *matcher, int32_t pattern_id)
+{
+	sASSERT(matcher != NULL);
+	sASSERT(0 <= pattern_id && pattern_id < matcher->n_patterns);
+	return matcher->pattern_lengths[pattern_id];
+}
+
+/* ------------------------------------------------------------------------- */
+
+void skit_multi_match_state_init(skit_multi_match_state *state)
+{
+	sASSERT(state != NULL);
+	state->state = 0;
+	state->offset = 0;
+}
+
+size_t skit_multi_matcher_feed(
+	const skit_multi_matcher *matcher,
+	skit_multi_match_state *mstate,
+	skit_slice text,
+	skit_multi_match_fn *callback,
+	void *context)
+{
+	sASSERT(matcher != NULL);
+	sASSERT(mstate != NULL);
+	sASSERT(callback != NULL);
+	sASSERT(!skit_slice_is_null(text));
+
+	const int32_t  *transitions = matcher->transitions;
+	const int32_t  *first_pattern = matcher->first_pattern;
+	const uint16_t *byte_class = matcher->byte_class;
+	uint16_t n_classes = matcher->n_classes;
+
+	const uint8_t *chars = sSPTR(text);
+	ssize_t len = sSLENGTH(text);
+	ssize_t base = mstate->offset;
+	int32_t state = mstate->state;
+	size_t n_matches = 0;
+	ssize_t i;
+
+	for ( i = 0; i < len; i++ )
+	{
+		state = transitions[(size_t)state * n_classes + byte_class[chars[i]]];
+
+		/* States with no needles and no dictionary links are the common case. */
+		int32_t out = first_pattern[state] >= 0 ? state : matcher->dict_link[state];
+		while ( out >= 0 )
+		{
+			int32_t id;
+			for ( id = first_pattern[out]; id >= 0; id = matcher->next_pattern[id] )
+			{
+				ssize_t end = base + i + 1;
+				n_matches++;
+				if ( !callback(context, id, end - matcher->pattern_lengths[id]) )
+				{
+					mstate->state = state;
+					mstate->offset = end;
+					return n_matches;
+				}
+			}
+			out = matcher->dict_link[out];
+		}
+	}
+
+	mstate->state = state;
+	mstate->offset = base + len;
+	return n_matches;
+}
+
+size_t skit_multi_matcher_scan(
+	const skit_multi_matcher *matcher,
+	skit_slice text,
+	skit_multi_match_fn *callback,
+	void *context)
+{
+	skit_multi_match_state state;
+	skit_multi_match_state_init(&state);
+	return skit_multi_matcher_feed(matcher, &state, text, callback, context);
+}
+
+/* Lets skit_multi_matcher_scan_stream notice when the caller's callback asks to stop. */
+typedef struct skit__multi_match_stop skit__multi_match_stop;
+struct skit__multi_match_stop
+{
+	skit_multi_match_fn *callback;
+	void *context;
+	int  stopped;
+};
+
+static int skit__multi_match_stop_fn(void *context, int32_t pattern_id, ssize_t pos)
+{
+	skit__multi_match_stop *stop = context;
+	if ( stop->callback(stop->context, pattern_id, pos) )
+		return 1;
+	stop->stopped = 1;
+	return 0;
+}
+
+size_t skit_multi_matcher_scan_stream(
+	const skit_multi_matcher *matcher,
+	skit_stream *stream,
+	skit_multi_match_fn *callback,
+	void *context)
+{
+	sASSERT(stream != NULL);
+	sASSERT(callback != NULL);
+
+	skit_multi_match_state state;
+	skit_multi_match_state_init(&state);
+
+	skit__multi_match_stop stop;
+	stop.callback = callback;
+	stop.context = context;
+	stop.stopped = 0;
+
+	size_t n_matches = 0;
+	skit_loaf buffer = skit_loaf_alloc(SKIT_MULTI_MATCHER_CHUNK_SIZE);
+	while ( !stop.stopped )
+	{
+		skit_slice chunk = skit_stream_read(stream, &buffer, SKIT_MULTI_MATCHER_CHUNK_SIZE);
+		if ( skit_slice_is_null(chunk) || sSLENGTH(chunk) == 0 )
+			break;
+		n_matches += skit_multi_matcher_feed(matcher, &state, chunk, &skit__multi_match_stop_fn, &stop);
+	}
+	skit_loaf_free(&buffer);
+
+	return n_matches;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Unittests */
+
+#define SKIT__MM_TEST_MAX_MATCHES 4096
+
+typedef struct skit__mm_test_matches skit__mm_test_matches;
+struct skit__mm_test_matches
+{
+	int32_t ids[SKIT__MM_TEST_MAX_MATCHES];
+	ssize_t positions[SKIT__MM_TEST_MAX_MATCHES];
+	size_t  count;
+	size_t  stop_after; /* 0 means never stop. */
+};
+
+static int skit__mm_test_collect(void *context, int32_t pattern_id, ssize_t pos)
+{
+	skit__mm_test_matches *m = context;
+	sASSERT(m->count < SKIT__MM_TEST_MAX_MATCHES);
+	m->ids[m->count] = pattern_id;
+	m->positions[m->count] = pos;
+	m->count++;
+	return m->stop_after == 0 || m->count < m->stop_after;
+}
+
+static void skit__mm_test_expect(const skit__mm_test_matches *m, size_t index, int32_t id, ssize_t pos)
+{
+	sASSERT_GT(m->count, index);
+	sASSERT_EQ(m->ids[index], id);
+	sASSERT_EQ(m->positions[index], pos);
+}
+
+static void skit_multi_matcher_basic_test()
+{
+	skit_slice keywords[] = { sSLICE("he"), sSLICE("she"), sSLICE("hers"), sSLICE("his") };
+	skit_multi_matcher *matcher = skit_multi_matcher_new(keywords, 4);
+	skit__mm_test_matches m;
+	m.count = 0;
+	m.stop_after = 0;
+
+	sASSERT_EQ(skit_multi_matcher_scan(matcher, sSLICE("ushers"), &skit__mm_test_collect, &m), 3);
+	sASSERT_EQ(m.count, 3);
+	skit__mm_test_expect(&m, 0, 1, 1);
+	skit__mm_test_expect(&m, 1, 0, 2);
+	skit__mm_test_expect(&m, 2, 2, 2);
+
+	m.count = 0;
+	sASSERT_EQ(skit_multi_matcher_scan(matcher, sSLICE("xyz"), &skit__mm_test_collect, &m), 0);
+	sASSERT_EQ(skit_multi_matcher_scan(matcher, sSLICE(""), &skit__mm_test_collect, &m), 0);
+	sASSERT_EQ(skit_multi_matcher_pattern_length(matcher, 2), 4);
+
+	/* Stopping early. */
+	m.count = 0;
+	m.stop_after = 2;
+	sASSERT_EQ(skit_multi_matcher_scan(matcher, sSLICE("his hers"), &skit__mm_test_collect, &m), 2);
+	skit__mm_test_expect(&m, 0, 3, 0);
+	skit__mm_test_expect(&m, 1, 0, 4);
+
+	matcher = skit_multi_matcher_free(matcher);
+	sASSERT(matcher == NULL);
+
+	/* Duplicate needles and needles that are suffixes of one another. */
+	skit_slice dups[] = { sSLICE("aa"), sSLICE("a"), sSLICE("aa") };
+	matcher = skit_multi_matcher_new(dups, 3);
+	m.count = 0;
+	m.stop_after = 0;
+	sASSERT_EQ(skit_multi_matcher_scan(matcher, sSLICE("aaa"), &skit__mm_test_collect, &m), 7);
+	skit__mm_test_expect(&m, 0, 1, 0);
+	skit__mm_test_expect(&m, 1, 0, 0);
+	skit__mm_test_expect(&m, 2, 2, 0);
+	skit__mm_test_expect(&m, 3, 1, 1);
+	skit__mm_test_expect(&m, 4, 0, 1);
+	skit__mm_test_expect(&m, 5, 2, 1);
+	skit__mm_test_expect(&m, 6, 1, 2);
+	skit_multi_matcher_free(matcher);
+
+	/* No needles at all. */
+	matcher = skit_multi_matcher_new(NULL, 0);
+	sASSERT_EQ(skit_multi_matcher_scan(matcher, sSLICE("abc"), &skit__mm_test_collect, &m), 0);
+	skit_multi_matcher_free(matcher);
+
+	printf("  skit_multi_matcher_basic_test passed.\n");
+}
+
+static void skit_multi_matcher_many_test()
+{
+	/* "0000;" through "0999;": far more states than the tables start with, */
+	/*   but far fewer than the needles' total length. */
+	char needle_bufs[1000][6];
+	skit_slice needles[1000];
+	char hay_buf[5000];
+	int32_t k;
+	for ( k = 0; k < 1000; k++ )
+	{
+		sprintf(needle_bufs[k], "%04d;", (int)k);
+		needles[k] = skit_slice_of_cstrn(needle_bufs[k], 5);
+		memcpy(hay_buf + k*5, needle_bufs[k], 5);
+	}
+
+	skit_multi_matcher *matcher = skit_multi_matcher_new(needles, 1000);
+	sASSERT_EQ(matcher->n_states, 1 + 1 + 10 + 100 + 1000 + 1000);
+
+	skit__mm_test_matches *m = skit_malloc(sizeof(skit__mm_test_matches));
+	m->count = 0;
+	m->stop_after = 0;
+	sASSERT_EQ(skit_multi_matcher_scan(matcher, skit_slice_of_cstrn(hay_buf, sizeof(hay_buf)), &skit__mm_test_collect, m), 1000);
+	for ( k = 0; k < 1000; k++ )
+		skit__mm_test_expect(m, k, k, k*5);
+
+	skit_free(m);
+	skit_multi_matcher_free(matcher);
+	printf("  skit_multi_matcher_many_test passed.\n");
+}
+
+static int skit__mm_test_compare(const void *a, const void *b)
+{
+	const int64_t *x = a;
+	const int64_t *y = b;
+	return (*x > *y) - (*x < *y);
+}
+
+/* Sorts matches by (position, id) so that they can be compared with the naive search. */
+static void skit__mm_test_sort(const skit__mm_test_matches *m, int64_t *keys)
+{
+	size_t i;
+	for ( i = 0; i < m->count; i++ )
+		keys[i] = (int64_t)m->positions[i] * 1024 + m->ids[i];
+	qsort(keys, m->count, sizeof(int64_t), &skit__mm_test_compare);
+}
+
+static void skit_multi_matcher_random_test()
+{
+	/* The alphabet is small so that overlapping and partial matches are common. */
+	char hay_buf[400];
+	char needle_bufs[20][8];
+	skit_slice needles[20];
+	skit__mm_test_matches *expected = skit_malloc(sizeof(skit__mm_test_matches));
+	skit__mm_test_matches *actual = skit_malloc(sizeof(skit__mm_test_matches));
+	int64_t *expected_keys = skit_malloc(SKIT__MM_TEST_MAX_MATCHES * sizeof(int64_t));
+	int64_t *actual_keys = skit_malloc(SKIT__MM_TEST_MAX_MATCHES * sizeof(int64_t));
+	unsigned int seed = 4321;
+	int trial;
+
+	for ( trial = 0; trial < 300; trial++ )
+	{
+		ssize_t i;
+		int n_needles = 1 + (seed = seed * 1103515245 + 12345) % 20;
+		ssize_t hay_len = (seed = seed * 1103515245 + 12345) % sizeof(hay_buf);
+		int alphabet = 2 + (trial % 4);
+		int k;
+
+		for ( i = 0; i < hay_len; i++ )
+			hay_buf[i] = 'a' + ((seed = seed * 1103515245 + 12345) >> 16) % alphabet;
+		for ( k = 0; k < n_needles; k++ )
+		{
+			ssize_t needle_len = 1 + ((seed = seed * 1103515245 + 12345) >> 16) % 7;
+			for ( i = 0; i < needle_len; i++ )
+				needle_bufs[k][i] = 'a' + ((seed = seed * 1103515245 + 12345) >> 16) % alphabet;
+			needles[k] = skit_slice_of_cstrn(needle_bufs[k], needle_len);
+		}
+		skit_slice haystack = skit_slice_of_cstrn(hay_buf, hay_len);
+
+		/* Naive search: one pass per needle. */
+		expected->count = 0;
+		expected->stop_after = 0;
+		for ( k = 0; k < n_needles; k++ )
+		{
+			ssize_t pos = -1;
+			while ( skit_slice_find_from(haystack, needles[k], pos + 1, &pos) )
+				skit__mm_test_collect(expected, k, pos);
+		}
+		skit__mm_test_sort(expected, expected_keys);
+
+		/* All at once. */
+		skit_multi_matcher *matcher = skit_multi_matcher_new(needles, n_needles);
+		actual->count = 0;
+		actual->stop_after = 0;
+		skit_multi_matcher_scan(matcher, haystack, &skit__mm_test_collect, actual);
+		sASSERT_EQ(actual->count, expected->count);
+		skit__mm_test_sort(actual, actual_keys);
+		sASSERT(memcmp(actual_keys, expected_keys, actual->count * sizeof(int64_t)) == 0);
+
+		/* Fed in randomly sized pieces. */
+		skit_multi_match_state state;
+		skit_multi_match_state_init(&state);
+		actual->count = 0;
+		i = 0;
+		while ( i < hay_len )
+		{
+			ssize_t piece = ((seed = seed * 1103515245 + 12345) >> 16) % 9;
+			if ( i + piece > hay_len )
+				piece = hay_len - i;
+			skit_multi_matcher_feed(matcher, &state, skit_slice_of(haystack, i, i + piece), &skit__mm_test_collect, actual);
+			i += piece;
+		}
+		sASSERT_EQ(state.offset, hay_len);
+		sASSERT_EQ(actual->count, expected->count);
+		skit__mm_test_sort(actual, actual_keys);
+		sASSERT(memcmp(actual_keys, expected_keys, actual->count * sizeof(int64_t)) == 0);
+
+		skit_multi_matcher_free(matcher);
+	}
+
+	skit_free(actual_keys);
+	skit_free(expected_keys);
+	skit_free(actual);
+	skit_free(expected);
+	printf("  skit_multi_matcher_random_test passed.\n");
+}
+
+static void skit_multi_matcher_stream_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	skit_slice keywords[] = { sSLICE("needle"), sSLICE("hay") };
+	skit_multi_matcher *matcher = skit_multi_matcher_new(keywords, 2);
+	skit__mm_test_matches *m = skit_malloc(sizeof(skit__mm_test_matches));
+	m->count = 0;
+	m->stop_after = 0;
+
+	/* Put a needle across the boundary between the first two chunks. */
+	skit_text_stream *tstream = skit_text_stream_new();
+	ssize_t i;
+	for ( i = 0; i < SKIT_MULTI_MATCHER_CHUNK_SIZE - 3; i++ )
+		skit_stream_appendf(&tstream->as_stream, ".");
+	skit_stream_appendf(&tstream->as_stream, "needle...hay");
+	skit_text_stream_rewind(tstream);
+
+	sASSERT_EQ(skit_multi_matcher_scan_stream(matcher, &tstream->as_stream, &skit__mm_test_collect, m), 2);
+	skit__mm_test_expect(m, 0, 0, SKIT_MULTI_MATCHER_CHUNK_SIZE - 3);
+	skit__mm_test_expect(m, 1, 1, SKIT_MULTI_MATCHER_CHUNK_SIZE + 6);
+
+	skit_stream_free(&tstream->as_stream);
+	skit_free(m);
+	skit_multi_matcher_free(matcher);
+	printf("  skit_multi_matcher_stream_test passed.\n");
+}
+
+void skit_multi_matcher_unittest()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	printf("skit_multi_matcher_unittest()\n");
+	sTRACE(skit_multi_matcher_basic_test());
+	sTRACE(skit_multi_matcher_random_test());
+	sTRACE(skit_multi_matcher_many_test());
+	sTRACE(skit_multi_matcher_stream_test());
+	printf("  skit_multi_matcher_unittest passed!\n");
+	printf("\n");
+}
@@ -0,0 +1,148 @@
+
+#ifndef SKIT_MULTI_MATCHER_INCLUDED
+#define SKIT_MULTI_MATCHER_INCLUDED
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h> /* For ssize_t */
+
+#include "survival_kit/string.h"
+#include "survival_kit/streams/stream.h"
+
+/**
+A compiled set of needles that can all be searched for in one pass over the
+text (the Aho-Corasick algorithm).
+
+Searching for N needles with skit_slice_find costs N passes over the text.
+A skit_multi_matcher reads each byte of the text once, no matter how many
+needles it was built from, and reports every occurrence of every needle,
+including overlapping ones.
+
+The matcher is compiled into a dense transition table, so each byte of text
+costs a single table lookup.  Bytes that do not appear in any needle share
+a single column of that table, which keeps the table small for typical
+keyword lists.
+
+A matcher is not modified by scanning, so the same matcher may be used by
+many threads at once as long as each has its own skit_multi_match_state.
+*/
+typedef struct skit_multi_matcher skit_multi_matcher;
+struct skit_multi_matcher
+{
+	int32_t   *transitions;     /* n_states * n_classes entries. */
+	int32_t   *first_pattern;   /* Per state: a needle ending here, or -1. */
+	int32_t   *dict_link;       /* Per state: nearest suffix state with needles, or -1. */
+	int32_t   *next_pattern;    /* Per needle: next needle ending in the same state, or -1. */
+	size_t    *pattern_lengths; /* Per needle. */
+	int32_t   n_states;
+	int32_t   n_patterns;
+	uint16_t  n_classes;
+	uint16_t  byte_class[256];
+};
+
+/**
+Position in a scan that is fed its text a piece at a time.
+Initialize with skit_multi_match_state_init before the first call to
+skit_multi_matcher_feed.
+*/
+typedef struct skit_multi_match_state skit_multi_match_state;
+struct skit_multi_match_state
+{
+	int32_t  state;
+	ssize_t  offset;  /** Number of bytes of text consumed so far. */
+};
+
+/**
+Called once for every match found.
+'pattern_id' is the index of the needle in the array that the matcher was
+built from, and 'pos' is the position of the first byte of the match in the
+text.  Positions are counted from the start of the whole text, even when the
+text is given in pieces.
+
+When several needles end at the same byte, the longest one is reported
+first.
+
+Return nonzero to continue scanning, or 0 to stop.
+*/
+typedef int skit_multi_match_fn(void *context, int32_t pattern_id, ssize_t pos);
+
+/**
+Compiles a matcher for the given needles.
+The needles are copied, so the 'patterns' array does not need to outlive
+the matcher.  Needles may contain any bytes, including NUL, and the same
+needle may be given more than once (each copy is reported with its own id).
+Empty needles are not allowed.
+*/
+void skit_multi_matcher_ctor(skit_multi_matcher *matcher, const skit_slice *patterns, size_t n_patterns);
+void skit_multi_matcher_dtor(skit_multi_matcher *matcher); /** ditto */
+
+/** Allocates and constructs/destructs and frees a matcher. */
+skit_multi_matcher *skit_multi_matcher_new(const skit_slice *patterns, size_t n_patterns);
+skit_multi_matcher *skit_multi_matcher_free(skit_multi_matcher *matcher); /** ditto */
+
+/** Returns the length of the needle with the given id. */
+size_t skit_multi_matcher_pattern_length(const skit_multi_matcher *matcher, int32_t pattern_id);
+
+/**
+Calls 'callback' for every occurrence of every needle in 'text'.
+Returns the number of matches reported (including the one that stopped the
+scan, if the callback returned 0).
+
+Example:
+	static int print_match(void *ctx, int32_t id, ssize_t pos)
+	{
+		printf("keyword %d at %d\n", (int)id, (int)pos);
+		return 1;
+	}
+	...
+	skit_slice keywords[] = { sSLICE("he"), sSLICE("she"), sSLICE("hers") };
+	skit_multi_matcher *m = skit_multi_matcher_new(keywords, 3);
+	skit_multi_matcher_scan(m, sSLICE("ushers"), &print_match, NULL);
+	// Prints:
+	// keyword 1 at 1
+	// keyword 0 at 2
+	// keyword 2 at 2
+	skit_multi_matcher_free(m);
+*/
+size_t skit_multi_matcher_scan(
+	const skit_multi_matcher *matcher,
+	skit_slice text,
+	skit_multi_match_fn *callback,
+	void *context);
+
+/**
+Incremental scanning.
+Each call to skit_multi_matcher_feed continues where the last one left off,
+so needles that straddle two pieces of text are still found.  The pieces do
+not need to be kept alive between calls.
+
+Returns the number of matches reported by this call.  If the callback
+returns 0, the rest of the piece is not scanned and state->offset is left
+just past the byte that completed the last reported match.
+*/
+void skit_multi_match_state_init(skit_multi_match_state *state);
+size_t skit_multi_matcher_feed(
+	const skit_multi_matcher *matcher,
+	skit_multi_match_state *state,
+	skit_slice text,
+	skit_multi_match_fn *callback,
+	void *context); /** ditto */
+
+/// Number of bytes read from the stream at a time by skit_multi_matcher_scan_stream.
+#define SKIT_MULTI_MATCHER_CHUNK_SIZE 4096
+
+/**
+Reads 'stream' until it is exhausted (or until 'callback' returns 0) and
+reports every match in it.  Positions are relative to where the stream was
+when this was called.
+Returns the number of matches reported.
+*/
+size_t skit_multi_matcher_scan_stream(
+	const skit_multi_matcher *matcher,
+	skit_stream *stream,
+	skit_multi_match_fn *callback,
+	void *context);
+
+void skit_multi_matcher_unittest();
+
+#endif
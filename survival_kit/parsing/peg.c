@@ -3,11 +3,28 @@
 #pragma module skit_parsing_peg
 #endif
 
+/*
+Whitespace and word characters are skipped 16 bytes at a time with SSE2.
+SSE2 is part of the x86-64 baseline, so no runtime CPU detection is needed;
+other targets look at one byte at a time.
+The intrinsics header must come before feature_emulation.h, whose macros
+would otherwise be expanded inside of it.
+*/
+#if defined(__SSE2__) && defined(__GNUC__)
+#  define SKIT_PEG_USE_SSE2 1
+#  include <emmintrin.h>
+#else
+#  define SKIT_PEG_USE_SSE2 0
+#endif
+
 #include "survival_kit/parsing/peg.h"
 #include "survival_kit/parsing/peg_macros.h"
 #include "survival_kit/parsing/peg_shorthand.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <stdarg.h>
 #include <inttypes.h>
 #include <pthread.h>
@@ -15,6 +32,7 @@
 #include "survival_kit/feature_emulation.h"
 #include "survival_kit/streams/stream.h"
 #include "survival_kit/streams/pfile_stream.h"
+#include "survival_kit/streams/text_stream.h"
 #include "survival_kit/string.h"
 #include "survival_kit/memory.h"
 #include "survival_kit/assert.h"
@@ -30,6 +48,28 @@ const static ssize_t skit_peg_default_word_char_tlen = 128;
 
 /* ------------------------------------------------------------------------- */
 
+static void skit_peg_memo_free_entries(skit_peg_memo *memo)
+{
+	size_t i;
+	if ( memo->entries == NULL )
+		return;
+	for ( i = 0; i < memo->capacity; i++ )
+		if ( !skit_loaf_is_null(memo->entries[i].error_msg_buf) )
+			skit_loaf_free(&memo->entries[i].error_msg_buf);
+	skit_free(memo->entries);
+	memo->entries = NULL;
+}
+
+static void skit_peg_stream_free_buffers(skit_peg_stream_input *in)
+{
+	if ( !skit_loaf_is_null(in->window) )
+		in->window = skit_loaf_free(&in->window);
+	if ( !skit_loaf_is_null(in->read_buf) )
+		in->read_buf = skit_loaf_free(&in->read_buf);
+}
+
+/* ------------------------------------------------------------------------- */
+
 void skit_peg_parser_ctor( skit_peg_parser *parser, skit_slice text_to_parse, skit_stream *debug_out )
 {
 	parser->input = text_to_parse;
@@ -43,6 +83,14 @@ void skit_peg_parser_ctor( skit_peg_parser *parser, skit_slice text_to_parse, sk
 	parser->is_word_char_method = &skit_peg_is_word_char_method;
 	parser->parse_whitespace = &skit_peg_parse_whitespace;
 	parser->branch_discard = NULL;
+
+	memset(&parser->memo, 0, sizeof(parser->memo));
+	parser->memo.capacity = SKIT_PEG_MEMO_DEFAULT_CAPACITY;
+	memset(&parser->profile, 0, sizeof(parser->profile));
+
+	memset(&parser->stream_input, 0, sizeof(parser->stream_input));
+	parser->stream_input.window = skit_loaf_null();
+	parser->stream_input.read_buf = skit_loaf_null();
 }
 
 skit_peg_parser *skit_peg_parser_new( skit_slice text_to_parse, skit_stream *debug_out )
@@ -62,6 +110,9 @@ void skit_peg_parser_dtor(skit_peg_parser *parser)
 	parser->input = skit_slice_null();
 	parser->last_error_msg_buf = skit_loaf_free(&parser->last_error_msg_buf);
 	parser->last_error_msg = skit_slice_null();
+	skit_peg_memo_free_entries(&parser->memo);
+	skit_peg_profile_reset(parser);
+	skit_peg_stream_free_buffers(&parser->stream_input);
 }
 
 skit_peg_parser *skit_peg_parser_free(skit_peg_parser *parser)
@@ -93,6 +144,7 @@ void skit_peg_lookup_index_ctor( skit_peg_lookup_index *index )
 	sCTRACE(pthread_mutex_init(&index->mutex, &index->mutex_attrs));
 
 	index->suffix_table = NULL;
+	index->ready = 0;
 	skit_trie_ctor(&index->trie);
 }
 
@@ -123,8 +175,321 @@ void skit_peg_parser_set_text(skit_peg_parser *parser, skit_slice text_to_parse)
 {
 	sASSERT(parser != NULL);
 	parser->input = text_to_parse;
+	skit_peg_parser_memo_clear(parser);
+}
+
+/* ------------------------------------------------------------------------- */
+
+void skit_peg_parser_set_memo_capacity(skit_peg_parser *parser, size_t n_entries)
+{
+	sASSERT(parser != NULL);
+	size_t capacity = 0;
+	if ( n_entries > 0 )
+	{
+		capacity = 2;
+		while ( capacity < n_entries )
+			capacity *= 2;
+	}
+
+	skit_peg_memo_free_entries(&parser->memo);
+	parser->memo.capacity = capacity;
+	skit_peg_parser_memo_clear(parser);
+}
+
+void skit_peg_parser_memo_clear(skit_peg_parser *parser)
+{
+	sASSERT(parser != NULL);
+	/* Entries are left in place (with their error message buffers) and */
+	/*   just marked as stale. */
+	parser->memo.valid_since = ++parser->memo.clock;
+	parser->memo.n_discards = 0;
+}
+
+/*
+Returns 1 if a successful result stored at 'stored_at' for a rule starting at
+'cursor' was part of a branch that was discarded since then.
+memo->discards is ordered by time and by position, so the first discard after
+the result was stored is also the one with the lowest position.
+*/
+static int skit_peg_memo_discarded(const skit_peg_memo *memo, uint64_t stored_at, ssize_t cursor)
+{
+	size_t i;
+	for ( i = 0; i < memo->n_discards; i++ )
+		if ( memo->discards[i].time > stored_at )
+			return memo->discards[i].cursor_reset_pos <= cursor;
+	return 0;
+}
+
+/*
+Records a branch discard for the memo table.
+A newer discard at a lower (or equal) position makes older ones redundant,
+so those are dropped.  If the list is still full, the two oldest discards
+are merged into one with the lower position and the later time.  This can
+only make results look discarded when they weren't, which costs a rerun of
+their rule, and never the other way around.
+*/
+static void skit_peg_memo_note_discard(skit_peg_memo *memo, ssize_t cursor_reset_pos)
+{
+	while ( memo->n_discards > 0 &&
+	        memo->discards[memo->n_discards-1].cursor_reset_pos >= cursor_reset_pos )
+		memo->n_discards--;
+
+	if ( memo->n_discards == SKIT__PEG_MEMO_MAX_DISCARDS )
+	{
+		memo->discards[0].time = memo->discards[1].time;
+		memmove(&memo->discards[1], &memo->discards[2],
+			(memo->n_discards - 2) * sizeof(skit_peg_memo_discard));
+		memo->n_discards--;
+	}
+
+	skit_peg_memo_discard *discard = &memo->discards[memo->n_discards++];
+	discard->time = ++memo->clock;
+	discard->cursor_reset_pos = cursor_reset_pos;
+}
+
+void skit__peg_branch_discard(skit_peg_parser *parser, ssize_t cursor_reset_pos)
+{
+	if ( parser->memo.entries != NULL )
+		skit_peg_memo_note_discard(&parser->memo, cursor_reset_pos);
+	parser->branch_discard(parser, cursor_reset_pos);
+}
+
+/* Returns the first of the two entries in the set that (rule, cursor) maps to. */
+static skit_peg_memo_entry *skit_peg_memo_set(const skit_peg_memo *memo, const void *rule, ssize_t cursor)
+{
+	uint64_t hash = (uint64_t)(uintptr_t)rule ^ ((uint64_t)cursor * UINT64_C(0x9E3779B97F4A7C15));
+	hash ^= hash >> 29;
+	hash *= UINT64_C(0xBF58476D1CE4E5B9);
+	hash ^= hash >> 32;
+	return &memo->entries[(hash & (memo->capacity / 2 - 1)) * 2];
+}
+
+static int skit_peg_memo_entry_valid(
+	const skit_peg_memo *memo, const skit_peg_memo_entry *entry,
+	const void *rule, ssize_t cursor, ssize_t ubound)
+{
+	if ( entry->rule != rule || entry->cursor != cursor || entry->ubound != ubound )
+		return 0;
+	if ( entry->stored_at <= memo->valid_since )
+		return 0;
+	if ( entry->successful && skit_peg_memo_discarded(memo, entry->stored_at, cursor) )
+		return 0;
+	return 1;
+}
+
+skit_peg_parse_match skit__peg_memo_call(
+	skit_peg_parser     *parser,
+	ssize_t             cursor,
+	ssize_t             ubound,
+	skit_peg_rule_func  rule)
+{
+	skit_peg_memo *memo = &parser->memo;
+	if ( memo->capacity == 0 )
+		return rule(parser, cursor, ubound);
+
+	if ( memo->entries == NULL )
+	{
+		memo->entries = skit_malloc(memo->capacity * sizeof(skit_peg_memo_entry));
+		memset(memo->entries, 0, memo->capacity * sizeof(skit_peg_memo_entry));
+		size_t i;
+		for ( i = 0; i < memo->capacity; i++ )
+			memo->entries[i].error_msg_buf = skit_loaf_null();
+	}
+
+	skit_peg_memo_entry *set = skit_peg_memo_set(memo, (const void*)rule, cursor);
+	int i;
+	for ( i = 0; i < 2; i++ )
+	{
+		skit_peg_memo_entry *entry = &set[i];
+		if ( !skit_peg_memo_entry_valid(memo, entry, (const void*)rule, cursor, ubound) )
+			continue;
+
+		memo->hits++;
+		skit_peg_parse_match match;
+		match.successful = entry->successful;
+		match.input = parser->input;
+		match.begin = entry->begin;
+		match.end = entry->end;
+		if ( !match.successful && !skit_slice_is_null(entry->error_msg) )
+			parser->last_error_msg = skit_loaf_store_slice(&parser->last_error_msg_buf, entry->error_msg);
+		return match;
+	}
+
+	memo->misses++;
+	skit_peg_parse_match match = rule(parser, cursor, ubound);
+
+	/* The rule may have stored results in the same set while it ran, so the */
+	/*   victim is picked afterwards: a stale entry if there is one, or */
+	/*   else the older of the two. */
+	skit_peg_memo_entry *entry = &set[0];
+	if ( skit_peg_memo_entry_valid(memo, &set[0], set[0].rule, set[0].cursor, set[0].ubound) )
+	{
+		if ( !skit_peg_memo_entry_valid(memo, &set[1], set[1].rule, set[1].cursor, set[1].ubound)
+		||   set[1].stored_at < set[0].stored_at )
+			entry = &set[1];
+	}
+
+	entry->rule = (const void*)rule;
+	entry->cursor = cursor;
+	entry->ubound = ubound;
+	entry->successful = match.successful;
+	entry->begin = match.begin;
+	entry->end = match.end;
+	entry->stored_at = ++memo->clock;
+	entry->error_msg = skit_slice_null();
+	if ( !match.successful )
+		entry->error_msg = skit_loaf_store_slice(&entry->error_msg_buf, parser->last_error_msg);
+
+	return match;
+}
+
+void skit_peg_parser_set_stream(
+	skit_peg_parser  *parser,
+	skit_stream      *stream,
+	size_t           window_size,
+	size_t           lookahead)
+{
+	sASSERT(parser != NULL);
+	sASSERT(stream != NULL);
+	sASSERT_MSG(window_size > lookahead, "The streaming window must be larger than the lookahead.");
+
+	skit_peg_stream_input *in = &parser->stream_input;
+	skit_peg_stream_free_buffers(in);
+	in->stream = stream;
+	in->window = skit_loaf_alloc(window_size);
+	in->len = 0;
+	in->window_size = window_size;
+	in->lookahead = lookahead;
+	in->offset = 0;
+	in->pending_cut = 0;
+	in->at_eof = 0;
+	skit_peg_parser_set_text(parser, skit_slice_of(in->window.as_slice, 0, 0));
+}
+
+uint64_t skit_peg_stream_offset(const skit_peg_parser *parser)
+{
+	sASSERT(parser != NULL);
+	return parser->stream_input.offset;
+}
+
+/* Reads from the stream until the window is full or the stream ends. */
+static void skit_peg_stream_fill(skit_peg_stream_input *in)
+{
+	while ( !in->at_eof && in->len < (size_t)sLLENGTH(in->window) )
+	{
+		skit_slice chunk = skit_stream_read(in->stream, &in->read_buf, sLLENGTH(in->window) - in->len);
+		if ( skit_slice_is_null(chunk) || sSLENGTH(chunk) == 0 )
+		{
+			in->at_eof = 1;
+			break;
+		}
+		memcpy((char*)sLPTR(in->window) + in->len, sSPTR(chunk), sSLENGTH(chunk));
+		in->len += sSLENGTH(chunk);
+	}
+}
+
+/* Releases the first 'n_bytes' of the window.  This is a cut point: */
+/*   nothing before it will ever be parsed again. */
+static void skit_peg_stream_cut(skit_peg_stream_input *in, size_t n_bytes)
+{
+	char *window = (char*)sLPTR(in->window);
+	memmove(window, window + n_bytes, in->len - n_bytes);
+	in->len -= n_bytes;
+	in->offset += n_bytes;
+
+	/* A window that grew to fit a long item shrinks back to its usual size */
+	/*   as the bytes read into it are consumed, instead of being refilled. */
+	if ( (size_t)sLLENGTH(in->window) > in->window_size )
+		skit_loaf_resize(&in->window, in->len > in->window_size ? in->len : in->window_size);
 }
 
+/* Points parser->input at the window's contents.  This also forgets any */
+/*   memoized results, because cursors now refer to different bytes. */
+static void skit_peg_stream_expose(skit_peg_parser *parser)
+{
+	skit_peg_stream_input *in = &parser->stream_input;
+	skit_peg_parser_set_text(parser, skit_slice_of(in->window.as_slice, 0, in->len));
+}
+
+/* Whether something found at 'pos' in the window could change if more of */
+/*   the input was read. */
+static int skit_peg_stream_near_end(const skit_peg_stream_input *in, ssize_t pos)
+{
+	return !in->at_eof && (size_t)pos + in->lookahead > in->len;
+}
+
+/* Applies the cut from the last item, refills the window, and skips */
+/*   whitespace until the window starts with something else (or is empty */
+/*   at the end of the input). */
+static void skit_peg_stream_advance(skit_peg_parser *parser)
+{
+	skit_peg_stream_input *in = &parser->stream_input;
+	sASSERT_MSG(in->stream != NULL, "This parser isn't streaming.  Call skit_peg_parser_set_stream first.");
+
+	skit_peg_stream_cut(in, in->pending_cut);
+	in->pending_cut = 0;
+	while ( 1 )
+	{
+		skit_peg_stream_fill(in);
+		skit_peg_stream_expose(parser);
+
+		ssize_t skipped = 0;
+		if ( parser->parse_whitespace != NULL )
+			skipped = parser->parse_whitespace(parser, 0, in->len);
+		skit_peg_stream_cut(in, skipped);
+
+		/* Cutting makes room in the window, so this always makes progress. */
+		if ( !skit_peg_stream_near_end(in, 0) || in->at_eof )
+			break;
+		if ( skipped == 0 && in->len == (size_t)sLLENGTH(in->window) )
+			break;
+	}
+	skit_peg_stream_expose(parser);
+}
+
+int skit_peg_stream_at_end(skit_peg_parser *parser)
+{
+	sASSERT(parser != NULL);
+	skit_peg_stream_advance(parser);
+	return parser->stream_input.len == 0;
+}
+
+skit_peg_parse_match skit_peg_stream_next(skit_peg_parser *parser, skit_peg_rule_func rule)
+{
+	sASSERT(parser != NULL);
+	sASSERT(rule != NULL);
+	skit_peg_stream_input *in = &parser->stream_input;
+	skit_peg_parse_match match;
+
+	skit_peg_stream_advance(parser);
+	while ( 1 )
+	{
+		/* Any part of the grammar may have reached the end of the window, */
+		/*   even when the item as a whole stops well short of it. */
+		in->reach = 0;
+		match = rule(parser, 0, in->len);
+		if ( !skit_peg_stream_near_end(in, in->reach) )
+			break;
+
+		/* The item may have seen the end of the window as the end of the */
+		/*   input.  Undo it and try again with more input. */
+		if ( parser->branch_discard != NULL )
+			skit__peg_branch_discard(parser, 0);
+		if ( in->len == (size_t)sLLENGTH(in->window) )
+			skit_loaf_resize(&in->window, in->len * 2);
+		skit_peg_stream_fill(in);
+		skit_peg_stream_expose(parser);
+	}
+
+	/* The cut waits for the next call, so that slices of this match stay */
+	/*   valid until then. */
+	if ( match.successful )
+		in->pending_cut = match.end;
+	return match;
+}
+
+/* ------------------------------------------------------------------------- */
+
 skit_peg_parse_match skit_peg_match_success(skit_peg_parser *parser, size_t begin, size_t end)
 {
 	skit_peg_parse_match m;
@@ -132,6 +497,8 @@ skit_peg_parse_match skit_peg_match_success(skit_peg_parser *parser, size_t begi
 	m.input = parser->input;
 	m.begin = begin;
 	m.end = end;
+	if ( (ssize_t)end > parser->stream_input.reach )
+		parser->stream_input.reach = end;
 	return m;
 }
 
@@ -142,6 +509,8 @@ skit_peg_parse_match skit_peg_match_failure(skit_peg_parser *parser, ssize_t pos
 	m.input = parser->input;
 	m.begin = position;
 	m.end = -1;
+	if ( position > parser->stream_input.reach )
+		parser->stream_input.reach = position;
 	
 	va_list vl;
 	va_start(vl, fail_msg);
@@ -205,20 +574,195 @@ int skit_parsing_is_whitespace( skit_utf8c c )
 		return 0;
 }
 
-ssize_t skit_peg_parse_whitespace(skit_peg_parser *parser, ssize_t cursor, ssize_t ubound)
+/*
+A set of bytes, given as a few inclusive ranges.  The ranges are what the
+SSE2 code tests; 'members' is filled in from them by skit_peg_module_init
+for testing one byte at a time.
+*/
+#define SKIT_PEG_BYTE_CLASS_MAX_RANGES 4
+typedef struct skit_peg_byte_class skit_peg_byte_class;
+struct skit_peg_byte_class
 {
-	skit_utf8c *ptr = sSPTR(parser->input);
-	ssize_t new_cursor = cursor;
-	
-	while ( new_cursor < ubound )
+	int      n_ranges;
+	uint8_t  lo[SKIT_PEG_BYTE_CLASS_MAX_RANGES];
+	uint8_t  hi[SKIT_PEG_BYTE_CLASS_MAX_RANGES];
+	uint8_t  members[256];
+};
+
+/* The same bytes as skit_parsing_is_whitespace. */
+static skit_peg_byte_class skit_peg_whitespace_class =
+	{ 3, {'\t', '\r', ' '}, {'\n', '\r', ' '}, {0} };
+
+/* The same bytes as skit_peg_default_word_char_tbl. */
+static skit_peg_byte_class skit_peg_default_word_class =
+	{ 4, {'0', 'A', '_', 'a'}, {'9', 'Z', '_', 'z'}, {0} };
+
+static void skit_peg_byte_class_init(skit_peg_byte_class *cls)
+{
+	int c, i;
+	for ( c = 0; c < 256; c++ )
+	{
+		cls->members[c] = 0;
+		for ( i = 0; i < cls->n_ranges; i++ )
+			if ( cls->lo[i] <= c && c <= cls->hi[i] )
+				cls->members[c] = 1;
+	}
+}
+
+/*
+Scans the bytes in [cursor,end) one at a time, for skit_peg_scan_class.
+Returns the index of the first one that isn't in 'cls', or 'end'.
+*/
+static ssize_t skit_peg_scan_class_bytes(
+	const skit_utf8c *txt, ssize_t cursor, ssize_t end, ssize_t ubound,
+	const skit_peg_byte_class *cls,
+	ssize_t *newlines, ssize_t *last_start)
+{
+	ssize_t i;
+	for ( i = cursor; i < end; i++ )
 	{
-		if ( !skit_parsing_is_whitespace(ptr[new_cursor]) )
+		skit_utf8c c = txt[i];
+		if ( !cls->members[c] )
 			break;
-		
-		new_cursor++;
+		if ( c == '\n' || (c == '\r' && !(i + 1 < ubound && txt[i + 1] == '\n')) )
+		{
+			(*newlines)++;
+			*last_start = i + 1;
+		}
 	}
-	
-	return new_cursor;
+	return i;
+}
+
+/* Runs shorter than this are scanned without setting up any SSE2 registers. */
+#define SKIT_PEG_SCAN_SHORT_RUN 8
+
+/*
+Returns the index of the first byte at or after 'cursor' that isn't in
+'cls', or 'ubound' if there is none.
+If 'n_newlines' isn't NULL, it is set to the number of newlines skipped,
+counted the same way as skit_peg_parse_one_newline counts them, and
+'line_start' is set to the index just after the last of them (or -1).
+*/
+static ssize_t skit_peg_scan_class(
+	const skit_utf8c *txt, ssize_t cursor, ssize_t ubound,
+	const skit_peg_byte_class *cls,
+	ssize_t *n_newlines, ssize_t *line_start)
+{
+	ssize_t i = cursor;
+	ssize_t newlines = 0;
+	ssize_t last_start = -1;
+
+	/* Most runs are short, and are done before a block could be loaded. */
+	ssize_t short_end = ubound - cursor > SKIT_PEG_SCAN_SHORT_RUN ? cursor + SKIT_PEG_SCAN_SHORT_RUN : ubound;
+	i = skit_peg_scan_class_bytes(txt, i, short_end, ubound, cls, &newlines, &last_start);
+
+#if SKIT_PEG_USE_SSE2
+	if ( i == short_end && i + 16 <= ubound )
+	{
+		__m128i lo[SKIT_PEG_BYTE_CLASS_MAX_RANGES];
+		__m128i span[SKIT_PEG_BYTE_CLASS_MAX_RANGES];
+		const __m128i lf = _mm_set1_epi8('\n');
+		const __m128i cr = _mm_set1_epi8('\r');
+		int r;
+		for ( r = 0; r < cls->n_ranges; r++ )
+		{
+			lo[r]   = _mm_set1_epi8((char)cls->lo[r]);
+			span[r] = _mm_set1_epi8((char)(cls->hi[r] - cls->lo[r]));
+		}
+
+		for ( ; i + 16 <= ubound; i += 16 )
+		{
+			__m128i block = _mm_loadu_si128((const __m128i*)(txt + i));
+
+			/* A byte is in [lo,hi] when (byte - lo) doesn't exceed (hi - lo), unsigned. */
+			__m128i in_class = _mm_setzero_si128();
+			for ( r = 0; r < cls->n_ranges; r++ )
+			{
+				__m128i offset = _mm_sub_epi8(block, lo[r]);
+				in_class = _mm_or_si128(in_class,
+					_mm_cmpeq_epi8(_mm_min_epu8(offset, span[r]), offset));
+			}
+			unsigned outside = ~(unsigned)_mm_movemask_epi8(in_class) & 0xFFFF;
+			unsigned run = outside != 0 ? (unsigned)__builtin_ctz(outside) : 16;
+
+			if ( n_newlines != NULL )
+			{
+				/* A '\r' only ends a line by itself when no '\n' follows it. */
+				unsigned lf_mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf));
+				unsigned cr_mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, cr));
+				unsigned lf_next = lf_mask >> 1;
+				if ( i + 16 < ubound && txt[i + 16] == '\n' )
+					lf_next |= 0x8000;
+
+				unsigned ends = (lf_mask | (cr_mask & ~lf_next)) & ((1u << run) - 1);
+				if ( ends != 0 )
+				{
+					newlines  += __builtin_popcount(ends);
+					last_start = i + 32 - __builtin_clz(ends);
+				}
+			}
+
+			if ( run < 16 )
+			{
+				i += run;
+				break;
+			}
+		}
+	}
+#endif
+
+	/* The bytes after the last full block, or all of them without SSE2. */
+	if ( i >= short_end )
+		i = skit_peg_scan_class_bytes(txt, i, ubound, ubound, cls, &newlines, &last_start);
+
+	if ( n_newlines != NULL )
+	{
+		*n_newlines = newlines;
+		*line_start = last_start;
+	}
+	return i;
+}
+
+ssize_t skit_peg_skip_whitespace(skit_utf8c *txt, ssize_t cursor, ssize_t ubound, ssize_t *n_newlines, ssize_t *line_start)
+{
+	ssize_t unused_count, unused_start;
+	if ( n_newlines != NULL || line_start != NULL )
+	{
+		if ( n_newlines == NULL )
+			n_newlines = &unused_count;
+		if ( line_start == NULL )
+			line_start = &unused_start;
+	}
+
+	/* Most whitespace between tokens is a single space, or nothing at all. */
+	if ( cursor >= ubound || !skit_parsing_is_whitespace(txt[cursor]) )
+	{
+		if ( n_newlines != NULL )
+		{
+			*n_newlines = 0;
+			*line_start = -1;
+		}
+		return cursor;
+	}
+
+	/* Without newlines to count, short runs are finished right here. */
+	if ( n_newlines == NULL )
+	{
+		ssize_t short_end = ubound - cursor > SKIT_PEG_SCAN_SHORT_RUN ? cursor + SKIT_PEG_SCAN_SHORT_RUN : ubound;
+		ssize_t i = cursor + 1;
+		while ( i < short_end && skit_peg_whitespace_class.members[txt[i]] )
+			i++;
+		if ( i < short_end || i == ubound )
+			return i;
+		cursor = i;
+	}
+
+	return skit_peg_scan_class(txt, cursor, ubound, &skit_peg_whitespace_class, n_newlines, line_start);
+}
+
+ssize_t skit_peg_parse_whitespace(skit_peg_parser *parser, ssize_t cursor, ssize_t ubound)
+{
+	return skit_peg_skip_whitespace(sSPTR(parser->input), cursor, ubound, NULL, NULL);
 }
 
 static void skit_peg_whitespace_test()
@@ -245,6 +789,79 @@ static void skit_peg_whitespace_test()
 	printf("  skit_peg_whitespace_test passed.\n");
 }
 
+/* The obvious way to do what skit_peg_skip_whitespace does. */
+static ssize_t skit_peg_skip_whitespace_slowly(skit_utf8c *txt, ssize_t cursor, ssize_t ubound, ssize_t *n_newlines, ssize_t *line_start)
+{
+	*n_newlines = 0;
+	*line_start = -1;
+	while ( cursor < ubound && skit_parsing_is_whitespace(txt[cursor]) )
+	{
+		ssize_t after_newline = skit_peg_parse_one_newline(txt, cursor, ubound);
+		if ( after_newline > cursor )
+		{
+			(*n_newlines)++;
+			*line_start = after_newline;
+			cursor = after_newline;
+		}
+		else
+			cursor++;
+	}
+	return cursor;
+}
+
+static void skit_peg_skip_whitespace_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	skit_utf8c txt[100];
+	ssize_t n_newlines, line_start;
+	ssize_t expected_newlines, expected_start;
+	ssize_t len, i;
+	int trial;
+
+	/* A "\r\n" that straddles two 16-byte blocks is still one newline. */
+	memset(txt, ' ', 40);
+	txt[15] = '\r';
+	txt[16] = '\n';
+	txt[31] = '\r';
+	txt[32] = 'x';
+	sASSERT_EQ(skit_peg_skip_whitespace(txt, 0, 40, &n_newlines, &line_start), 32);
+	sASSERT_EQ(n_newlines, 2);
+	sASSERT_EQ(line_start, 32);
+	sASSERT_EQ(skit_peg_skip_whitespace(txt, 17, 40, &n_newlines, &line_start), 32);
+	sASSERT_EQ(n_newlines, 1);
+	sASSERT_EQ(skit_peg_skip_whitespace(txt, 33, 40, &n_newlines, &line_start), 40);
+	sASSERT_EQ(n_newlines, 0);
+	sASSERT_EQ(line_start, -1);
+	sASSERT_EQ(skit_peg_skip_whitespace(txt, 32, 40, NULL, NULL), 32);
+
+	/* Runs of every length, ending at every position within a block. */
+	srand(4321);
+	for ( trial = 0; trial < 2000; trial++ )
+	{
+		static const char alphabet[] = " \t\r\n x";
+		len = rand() % sizeof(txt);
+		for ( i = 0; i < len; i++ )
+		{
+			/* Mostly whitespace, so that the runs are long. */
+			int which = rand() % (sizeof(alphabet) - 1 + (trial % 4 == 0 ? 16 : 0));
+			txt[i] = which < (int)sizeof(alphabet) - 1 ? alphabet[which] : 'y';
+			if ( trial % 2 == 1 && txt[i] == 'x' && rand() % 8 != 0 )
+				txt[i] = ' ';
+		}
+
+		for ( i = 0; i <= len; i++ )
+		{
+			ssize_t expected = skit_peg_skip_whitespace_slowly(txt, i, len, &expected_newlines, &expected_start);
+			sASSERT_EQ(skit_peg_skip_whitespace(txt, i, len, &n_newlines, &line_start), expected);
+			sASSERT_EQ(n_newlines, expected_newlines);
+			sASSERT_EQ(line_start, expected_start);
+			sASSERT_EQ(skit_peg_skip_whitespace(txt, i, len, NULL, NULL), expected);
+		}
+	}
+
+	printf("  skit_peg_skip_whitespace_test passed.\n");
+}
+
 /* ------------------------------------------------------------------------- */
 
 skit_peg_parse_match SKIT_PEG_success( skit_peg_parser *parser, ssize_t cursor, ssize_t ubound )
@@ -429,6 +1046,9 @@ skit_peg_parse_match skit__peg_parse_token(skit_peg_parser *parser, ssize_t curs
 	ssize_t token_length = sSLENGTH(token);
 	if ( (ubound - cursor) < token_length )
 	{
+		/* The token might have fit in more input than this. */
+		if ( ubound > parser->stream_input.reach )
+			parser->stream_input.reach = ubound;
 		next_chars = skit_slice_of(parser->input, cursor, ubound);
 		return skit_peg_match_failure(parser, cursor, "Expected token %.*s, instead got '%.*s'",
 			sSLENGTH(token),      sSPTR(token), 
@@ -503,6 +1123,13 @@ skit_peg_parse_match SKIT_PEG_any_word(skit_peg_parser *parser, ssize_t cursor,
 	// Now we iterate over the word.
 	new_cursor++;
 
+	// Words made of the default table's characters are skipped in blocks.
+	// Any other table could be changed by the caller, so it is only ever
+	// consulted a byte at a time.
+	if ( parser->is_word_char_table == skit_peg_default_word_char_tbl &&
+	     parser->is_word_char_table_len == skit_peg_default_word_char_tlen )
+		new_cursor = skit_peg_scan_class(text, new_cursor, ubound, &skit_peg_default_word_class, NULL, NULL);
+
 	while ( new_cursor < ubound && skit_peg_is_word_char(parser, text[new_cursor]) )
 		new_cursor++;
 	
@@ -584,6 +1211,20 @@ static void skit_peg_any_word_test()
 	parser->input = sSLICE("x");
 	any_word_test( 0, "x", 1);
 	
+	/* Words longer than a few blocks. */
+	parser->input = sSLICE("a_long_identifier_with_Digits_0123456789_in_it-and_more");
+	ubound = sSLENGTH(parser->input);
+	any_word_test( 0, "a_long_identifier_with_Digits_0123456789_in_it", 1);
+	any_word_test(47, "and_more", 1);
+	
+	/* A table of the caller's own is used instead. */
+	uint8_t dashed_table[128];
+	memcpy(dashed_table, skit_peg_default_word_char_tbl, sizeof(dashed_table));
+	dashed_table['-'] = 1;
+	parser->is_word_char_table = dashed_table;
+	any_word_test( 0, "a_long_identifier_with_Digits_0123456789_in_it-and_more", 1);
+	parser->is_word_char_table = skit_peg_default_word_char_tbl;
+	
 	skit_peg_parser_mock_free(parser);
 	
 	printf("  skit_peg_any_word_test passed.\n");
@@ -676,6 +1317,52 @@ static void skit_peg_lookup_test()
 
 /* ------------------------------------------------------------------------- */
 
+#define SKIT_PEG_LOOKUP_UTEST_THREADS 4
+#define SKIT_PEG_LOOKUP_UTEST_PARSES  500
+
+/* Half of the threads use the caller's index, and half use the lookup's */
+/*   process-global one.  Either way, they all race to populate it first. */
+static void *skit_peg_lookup_utest_thread(void *arg)
+{
+	SKIT_USE_FEATURE_EMULATION;
+	skit_peg_lookup_index *index = arg;
+	skit_peg_parser *parser = skit_peg_parser_mock_new(skit_slice_null());
+	int i;
+	int result;
+	for ( i = 0; i < SKIT_PEG_LOOKUP_UTEST_PARSES; i++ )
+	{
+		result = 0;
+		sASSERT_PARSE_PASS(parser, "foobar", lookup_test, index, &result);
+		sASSERT_EQ(result, 2);
+		result = 0;
+		sASSERT_PARSE_PASS(parser, "x", lookup_test, index, &result);
+		sASSERT_EQ(result, 1);
+		sASSERT_PARSE_FAIL(parser, "fo", lookup_test, index, &result);
+	}
+	skit_peg_parser_mock_free(parser);
+	return NULL;
+}
+
+static void skit_peg_lookup_threads_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	pthread_t threads[SKIT_PEG_LOOKUP_UTEST_THREADS];
+	skit_peg_lookup_index *index = sETRACE(skit_peg_lookup_index_new());
+	int i;
+
+	for ( i = 0; i < SKIT_PEG_LOOKUP_UTEST_THREADS; i++ )
+		sASSERT_EQ(pthread_create(&threads[i], NULL, &skit_peg_lookup_utest_thread, i % 2 ? index : NULL), 0);
+	for ( i = 0; i < SKIT_PEG_LOOKUP_UTEST_THREADS; i++ )
+		pthread_join(threads[i], NULL);
+
+	sASSERT(index->ready);
+	sTRACE(skit_peg_lookup_index_free(index));
+
+	printf("  skit_peg_lookup_threads_test passed.\n");
+}
+
+/* ------------------------------------------------------------------------- */
+
 static void skit_peg_bd_test_callback( skit_peg_parser *parser, ssize_t cursor_reset_pos )
 {
 	int *which_discard = (int*)parser->caller_context;
@@ -764,6 +1451,132 @@ static void skit_peg_branch_discard_test()
 
 /* ------------------------------------------------------------------------- */
 
+static size_t skit_peg_memo_test_term_runs = 0;
+
+/* Every alternative of memo_expr starts with memo_term, so without */
+/*   memoization, each level of parentheses triples the work. */
+static skit_peg_parse_match SKIT_PEG_memo_term( skit_peg_parser *parser, ssize_t cursor, ssize_t ubound );
+
+DEFINE_MEMO_RULE(memo_expr)
+	auto_consume_whitespace = 0;
+	CHOOSE(
+		SEQ(RULE(memo_term), RULE(token, "+"), RULE(memo_expr)),
+		SEQ(RULE(memo_term), RULE(token, "-"), RULE(memo_expr)),
+		RULE(memo_term)
+	);
+END_RULE
+
+DEFINE_MEMO_RULE(memo_term)
+	skit_peg_memo_test_term_runs++;
+	auto_consume_whitespace = 0;
+	CHOOSE(
+		SEQ(RULE(token, "("), RULE(memo_expr), RULE(token, ")")),
+		RULE(token, "x")
+	);
+END_RULE
+
+/* memo_item's action pushes its position onto the events stack, and the */
+/*   branch_discard callback pops everything at or after the reset position. */
+typedef struct skit_peg_memo_test_events skit_peg_memo_test_events;
+struct skit_peg_memo_test_events
+{
+	ssize_t  positions[16];
+	size_t   len;
+};
+
+static void skit_peg_memo_test_discard( skit_peg_parser *parser, ssize_t cursor_reset_pos )
+{
+	skit_peg_memo_test_events *events = parser->caller_context;
+	while ( events->len > 0 && events->positions[events->len-1] >= cursor_reset_pos )
+		events->len--;
+}
+
+DEFINE_MEMO_RULE(memo_item)
+	skit_peg_memo_test_events *events = parser->caller_context;
+	auto_consume_whitespace = 0;
+	SEQ(
+		RULE(token, "a"),
+		ACTION( events->positions[events->len++] = cursor; )
+	);
+END_RULE
+
+DEFINE_RULE(memo_items)
+	auto_consume_whitespace = 0;
+	CHOOSE(
+		SEQ(RULE(memo_item), RULE(token, "x")),
+		SEQ(RULE(memo_item), RULE(token, "y"))
+	);
+END_RULE
+
+static void skit_peg_memo_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	skit_peg_parser *parser = skit_peg_parser_mock_new(skit_slice_null());
+	const char *nested = "((((((((x+x))))))))";
+	const ssize_t depth = 8;
+
+	/* Without memoization. */
+	skit_peg_parser_set_memo_capacity(parser, 0);
+	skit_peg_memo_test_term_runs = 0;
+	sASSERT_PARSE_PASS(parser, nested, memo_expr);
+	size_t plain_runs = skit_peg_memo_test_term_runs;
+	sASSERT_EQ(parser->memo.hits + parser->memo.misses, 0);
+	sASSERT_PARSE_FAIL(parser, "((((x+x)))", memo_expr);
+	skit_loaf plain_error = skit_loaf_dup(parser->last_error_msg);
+
+	/* With it, memo_term runs once per position it's tried at: each of the */
+	/*   parentheses, and the two x's. */
+	skit_peg_parser_set_memo_capacity(parser, SKIT_PEG_MEMO_DEFAULT_CAPACITY);
+	skit_peg_memo_test_term_runs = 0;
+	sASSERT_PARSE_PASS(parser, nested, memo_expr);
+	sASSERT_EQ(skit_peg_memo_test_term_runs, depth + 2);
+	sASSERT_GT(plain_runs, 100 * skit_peg_memo_test_term_runs);
+	sASSERT_GT(parser->memo.hits, 0);
+
+	/* Remembered failures bring back their error messages. */
+	sASSERT_PARSE_FAIL(parser, "((((x+x)))", memo_expr);
+	sASSERT_EQS(parser->last_error_msg, plain_error.as_slice);
+	skit_loaf_free(&plain_error);
+
+	/* A tiny table evicts a lot, but still parses correctly. */
+	skit_peg_parser_set_memo_capacity(parser, 2);
+	sASSERT_EQ(parser->memo.capacity, 2);
+	sASSERT_PARSE_PASS(parser, nested, memo_expr);
+	sASSERT_PARSE_FAIL(parser, "((x)", memo_expr);
+
+	/* Without a branch_discard callback, memo_item's success is reused */
+	/*   by the second alternative, and its action runs only once. */
+	skit_peg_memo_test_events events;
+	events.len = 0;
+	parser->caller_context = &events;
+	skit_peg_parser_set_memo_capacity(parser, 64);
+	size_t hits = parser->memo.hits;
+	sASSERT_PARSE_PASS(parser, "ay", memo_items);
+	sASSERT_EQ(events.len, 1);
+	sASSERT_EQ(parser->memo.hits, hits + 1);
+
+	/* With one, the first alternative's discard undoes memo_item's action, */
+	/*   so memo_item has to run again for the second alternative. */
+	events.len = 0;
+	parser->branch_discard = &skit_peg_memo_test_discard;
+	sASSERT_PARSE_PASS(parser, "ay", memo_items);
+	sASSERT_EQ(events.len, 1);
+	sASSERT_EQ(events.positions[0], 0);
+	sASSERT_EQ(parser->memo.hits, hits + 1);
+
+	/* Failures are still reused. */
+	events.len = 0;
+	sASSERT_PARSE_FAIL(parser, "b", memo_items);
+	sASSERT_EQ(events.len, 0);
+	sASSERT_EQ(parser->memo.hits, hits + 2);
+
+	sTRACE(skit_peg_parser_mock_free(parser));
+
+	printf("  skit_peg_memo_test passed.\n");
+}
+
+/* ------------------------------------------------------------------------- */
+
 static int skit_peg_module_initialized = 0;
 pthread_mutex_t      skit_peg__lookup_mutex;
 pthread_mutexattr_t  skit_peg__lookup_mutex_attrs;
@@ -1191,6 +2004,437 @@ void skit__peg_on_exit(
 
 /* ------------------------------------------------------------------------- */
 
+static uint64_t skit_peg_profile_ticks()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static size_t skit_peg_profile_hash(const char *func_name, size_t mask)
+{
+	uint64_t hash = (uint64_t)(uintptr_t)func_name * UINT64_C(0x9E3779B97F4A7C15);
+	return (size_t)(hash >> 32) & mask;
+}
+
+static void skit_peg_profile_grow_index(skit_peg_profile *profile)
+{
+	size_t i;
+	size_t capacity = profile->index_capacity == 0 ? 64 : profile->index_capacity * 2;
+	skit_free(profile->index);
+	profile->index = skit_malloc(capacity * sizeof(size_t));
+	memset(profile->index, 0, capacity * sizeof(size_t));
+	profile->index_capacity = capacity;
+
+	for ( i = 0; i < profile->len; i++ )
+	{
+		size_t slot = skit_peg_profile_hash(profile->rules[i].rule_name, capacity - 1);
+		while ( profile->index[slot] != 0 )
+			slot = (slot + 1) & (capacity - 1);
+		profile->index[slot] = i + 1;
+	}
+}
+
+/*
+Returns 1 + the index of the counters for the rule whose function is named
+'func_name', adding them if this is the rule's first call.
+Rules are told apart by the address of their __func__ string, so this never
+compares any text.
+*/
+static size_t skit_peg_profile_find(skit_peg_profile *profile, const char *func_name)
+{
+	if ( (profile->len + 1) * 2 > profile->index_capacity )
+		skit_peg_profile_grow_index(profile);
+
+	size_t mask = profile->index_capacity - 1;
+	size_t slot = skit_peg_profile_hash(func_name, mask);
+	while ( profile->index[slot] != 0 )
+	{
+		if ( profile->rules[profile->index[slot] - 1].rule_name == func_name )
+			return profile->index[slot];
+		slot = (slot + 1) & mask;
+	}
+
+	if ( profile->len == profile->capacity )
+	{
+		profile->capacity = profile->capacity == 0 ? 16 : profile->capacity * 2;
+		profile->rules = skit_realloc(profile->rules, profile->capacity * sizeof(skit_peg_rule_profile));
+	}
+
+	skit_peg_rule_profile *rule = &profile->rules[profile->len];
+	memset(rule, 0, sizeof(skit_peg_rule_profile));
+	rule->rule_name = func_name;
+	profile->index[slot] = ++profile->len;
+	return profile->len;
+}
+
+void skit__peg_profile_enter(
+	skit_peg_parser          *parser,
+	skit__peg_profile_frame  *frame,
+	const char               *func_name)
+{
+	skit_peg_profile *profile = &parser->profile;
+	frame->rule = skit_peg_profile_find(profile, func_name);
+	frame->outer_active = profile->active;
+	frame->outer_child_ticks = profile->child_ticks;
+	profile->active = frame->rule;
+	profile->child_ticks = 0;
+	profile->rules[frame->rule - 1].invocations++;
+	profile->rules[frame->rule - 1].running++;
+	frame->start = skit_peg_profile_ticks();
+}
+
+void skit__peg_profile_exit(
+	skit_peg_parser          *parser,
+	skit__peg_profile_frame  *frame,
+	skit_peg_parse_match     match)
+{
+	uint64_t elapsed = skit_peg_profile_ticks() - frame->start;
+	skit_peg_profile *profile = &parser->profile;
+	skit_peg_rule_profile *rule = &profile->rules[frame->rule - 1];
+
+	if ( match.successful )
+	{
+		rule->successes++;
+		rule->bytes_consumed += match.end - match.begin;
+	}
+	else
+		rule->failures++;
+
+	/* Recursive calls would count the same time more than once, so only */
+	/*   the outermost call of a rule adds to its total. */
+	if ( --rule->running == 0 )
+		rule->ticks += elapsed;
+	rule->self_ticks += elapsed - profile->child_ticks;
+
+	profile->active = frame->outer_active;
+	profile->child_ticks = frame->outer_child_ticks + elapsed;
+}
+
+void skit__peg_profile_backtrack(skit_peg_parser *parser)
+{
+	if ( parser->profile.active != 0 )
+		parser->profile.rules[parser->profile.active - 1].backtracks++;
+}
+
+const skit_peg_rule_profile *skit_peg_profile_get(const skit_peg_parser *parser, const char *rule_name)
+{
+	size_t i;
+	sASSERT(parser != NULL);
+	for ( i = 0; i < parser->profile.len; i++ )
+	{
+		const skit_peg_rule_profile *rule = &parser->profile.rules[i];
+		if ( strcmp(skit__peg_rule_name(rule->rule_name), rule_name) == 0 )
+			return rule;
+	}
+	return NULL;
+}
+
+void skit_peg_profile_reset(skit_peg_parser *parser)
+{
+	sASSERT(parser != NULL);
+	skit_peg_profile *profile = &parser->profile;
+	if ( profile->rules != NULL )
+		skit_free(profile->rules);
+	if ( profile->index != NULL )
+		skit_free(profile->index);
+	memset(profile, 0, sizeof(skit_peg_profile));
+}
+
+static int skit_peg_profile_cmp_self_ticks(const void *a, const void *b)
+{
+	const skit_peg_rule_profile *rule_a = *(const skit_peg_rule_profile* const*)a;
+	const skit_peg_rule_profile *rule_b = *(const skit_peg_rule_profile* const*)b;
+	if ( rule_a->self_ticks != rule_b->self_ticks )
+		return rule_a->self_ticks < rule_b->self_ticks ? 1 : -1;
+	return strcmp(rule_a->rule_name, rule_b->rule_name);
+}
+
+void skit_peg_profile_dump(skit_peg_parser *parser, skit_stream *output)
+{
+	size_t i;
+	sASSERT(parser != NULL);
+	sASSERT(output != NULL);
+	skit_peg_profile *profile = &parser->profile;
+
+	if ( profile->len == 0 )
+	{
+		skit_stream_appendf(output, "No PEG rules were profiled.  (Were they compiled with SKIT_PROFILE_PEG_PARSING set to 1?)\n");
+		return;
+	}
+
+	const skit_peg_rule_profile **sorted = skit_malloc(profile->len * sizeof(skit_peg_rule_profile*));
+	for ( i = 0; i < profile->len; i++ )
+		sorted[i] = &profile->rules[i];
+	qsort(sorted, profile->len, sizeof(skit_peg_rule_profile*), &skit_peg_profile_cmp_self_ticks);
+
+	skit_stream_appendf(output, "%-24s %10s %10s %10s %12s %10s %14s %14s\n",
+		"rule", "calls", "matched", "failed", "bytes", "backtracks", "ticks", "self ticks");
+	for ( i = 0; i < profile->len; i++ )
+	{
+		const skit_peg_rule_profile *rule = sorted[i];
+		skit_stream_appendf(output, "%-24s %10llu %10llu %10llu %12llu %10llu %14llu %14llu\n",
+			skit__peg_rule_name(rule->rule_name),
+			(unsigned long long)rule->invocations,
+			(unsigned long long)rule->successes,
+			(unsigned long long)rule->failures,
+			(unsigned long long)rule->bytes_consumed,
+			(unsigned long long)rule->backtracks,
+			(unsigned long long)rule->ticks,
+			(unsigned long long)rule->self_ticks);
+	}
+
+	skit_free(sorted);
+}
+
+#define SKIT_PEG_STREAM_UTEST_RECORDS 2000
+#define SKIT_PEG_STREAM_UTEST_LONG     777
+
+typedef struct skit_peg_stream_utest skit_peg_stream_utest;
+struct skit_peg_stream_utest
+{
+	size_t     n_records;
+	size_t     n_mismatches;
+	skit_loaf  expected;
+};
+
+/* Record i is named "rec<i>", except for one that's too long for the window. */
+static skit_slice skit_peg_stream_utest_name(skit_peg_stream_utest *utest, size_t i)
+{
+	char buf[32];
+	if ( i == SKIT_PEG_STREAM_UTEST_LONG )
+	{
+		skit_loaf_resize(&utest->expected, 300);
+		memset((char*)sLPTR(utest->expected), 'L', 300);
+		return utest->expected.as_slice;
+	}
+	snprintf(buf, sizeof(buf), "rec%u", (unsigned)i);
+	return skit_loaf_store_slice(&utest->expected, skit_slice_of_cstr(buf));
+}
+
+DEFINE_RULE(stream_record)
+	skit_peg_stream_utest *utest = parser->caller_context;
+	skit_slice name;
+	char *name_buf;
+	SEQ(
+		RULE(any_word, "record name", &name, &name_buf),
+		RULE(token, ";"),
+		ACTION(
+			if ( skit_slice_ascii_cmp(name, skit_peg_stream_utest_name(utest, utest->n_records)) != 0 )
+				utest->n_mismatches++;
+		)
+	);
+END_RULE
+
+/* The argument list is optional, so a failure inside of it is backtracked */
+/*   out of, and the item as a whole still succeeds. */
+DEFINE_RULE(stream_call)
+	skit_slice name, arg;
+	char *name_buf, *arg_buf;
+	SEQ(
+		RULE(any_word, "name", &name, &name_buf),
+		OPTIONAL(
+			RULE(token, "("),
+			RULE(any_word, "argument", &arg, &arg_buf),
+			RULE(token, ")")
+		)
+	);
+END_RULE
+
+static void skit_peg_stream_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	skit_peg_stream_utest utest;
+	skit_peg_parser *parser = skit_peg_parser_mock_new(skit_slice_null());
+	skit_text_stream text;
+	skit_peg_parse_match match;
+	size_t i;
+
+	utest.n_records = 0;
+	utest.n_mismatches = 0;
+	utest.expected = skit_loaf_alloc(16);
+	parser->caller_context = &utest;
+
+	skit_text_stream_ctor(&text);
+	for ( i = 0; i < SKIT_PEG_STREAM_UTEST_RECORDS; i++ )
+	{
+		skit_slice name = skit_peg_stream_utest_name(&utest, i);
+		skit_text_stream_appendf(&text, "%.*s ;\n", (int)sSLENGTH(name), sSPTR(name));
+	}
+	skit_text_stream_rewind(&text);
+
+	skit_peg_parser_set_stream(parser, &text.as_stream, 64, 8);
+	size_t max_window = 0;
+	uint64_t offset = 0;
+	while ( !skit_peg_stream_at_end(parser) )
+	{
+		sASSERT_GE(skit_peg_stream_offset(parser), offset);
+		offset = skit_peg_stream_offset(parser);
+
+		/* The window shrinks back within a few records of the long one. */
+		if ( utest.n_records == SKIT_PEG_STREAM_UTEST_LONG + 64 )
+			sASSERT_EQ(sLLENGTH(parser->stream_input.window), 64);
+
+		match = skit_peg_stream_next(parser, &SKIT_PEG_stream_record);
+		sASSERT_MSGF(match.successful, "Record %d didn't parse: %.*s", (int)utest.n_records,
+			sSLENGTH(parser->last_error_msg), sSPTR(parser->last_error_msg));
+		utest.n_records++;
+
+		if ( max_window < (size_t)sLLENGTH(parser->stream_input.window) )
+			max_window = sLLENGTH(parser->stream_input.window);
+	}
+	sASSERT_EQ(utest.n_records, SKIT_PEG_STREAM_UTEST_RECORDS);
+	sASSERT_EQ(utest.n_mismatches, 0);
+	sASSERT_GE(max_window, 300);
+	sASSERT_LE(max_window, 1024);
+	sASSERT(skit_peg_stream_at_end(parser));
+	skit_text_stream_dtor(&text);
+
+	/* An argument that runs past the end of the window is found in full, */
+	/*   even though only the OPTIONAL inside the item saw the window end. */
+	skit_loaf expected_call = skit_loaf_alloc(16);
+	char arg_text[85];
+	memset(arg_text, 'a', 84);
+	arg_text[84] = '\0';
+	skit_text_stream_ctor(&text);
+	for ( i = 0; i < 20; i++ )
+		skit_text_stream_appendf(&text, "f%u(%s%u)\n", (unsigned)i, arg_text, (unsigned)i);
+	skit_text_stream_rewind(&text);
+	skit_peg_parser_set_stream(parser, &text.as_stream, 64, 1);
+	for ( i = 0; i < 20; i++ )
+	{
+		char buf[128];
+		snprintf(buf, sizeof(buf), "f%u(%s%u)", (unsigned)i, arg_text, (unsigned)i);
+		skit_loaf_store_cstr(&expected_call, buf);
+		match = skit_peg_stream_next(parser, &SKIT_PEG_stream_call);
+		sASSERT(match.successful);
+		sASSERT_EQS(skit_slice_of(parser->input, match.begin, match.end), expected_call.as_slice);
+	}
+	sASSERT(skit_peg_stream_at_end(parser));
+	skit_text_stream_dtor(&text);
+	skit_loaf_free(&expected_call);
+
+	/* A syntax error consumes nothing, and leaves the stream where it was. */
+	skit_text_stream_init_str(&text, sSLICE("rec0; rec1 rec2;"));
+	utest.n_records = 0;
+	skit_peg_parser_set_stream(parser, &text.as_stream, 64, 8);
+	sASSERT(skit_peg_stream_next(parser, &SKIT_PEG_stream_record).successful);
+	utest.n_records++;
+	sASSERT(!skit_peg_stream_next(parser, &SKIT_PEG_stream_record).successful);
+	sASSERT_EQ(skit_peg_stream_offset(parser), 6);
+	sASSERT(!skit_peg_stream_at_end(parser));
+	skit_text_stream_dtor(&text);
+
+	skit_loaf_free(&utest.expected);
+	sTRACE(skit_peg_parser_mock_free(parser));
+
+	printf("  skit_peg_stream_test passed.\n");
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* The rules below are compiled with profiling on, whatever the default is. */
+#undef SKIT_PROFILE_PEG_PARSING
+#define SKIT_PROFILE_PEG_PARSING 1
+
+DEFINE_RULE(profile_item)
+	auto_consume_whitespace = 0;
+	CHOOSE(
+		RULE(token, "ab"),
+		RULE(token, "a")
+	);
+END_RULE
+
+DEFINE_RULE(profile_list)
+	auto_consume_whitespace = 0;
+	SEQ(
+		RULE(profile_item),
+		ZERO_OR_MORE(RULE(token, ","), RULE(profile_item))
+	);
+END_RULE
+
+DEFINE_RULE(profile_nest)
+	auto_consume_whitespace = 0;
+	CHOOSE(
+		SEQ(RULE(token, "("), RULE(profile_nest), RULE(token, ")")),
+		RULE(token, "x")
+	);
+END_RULE
+
+#undef SKIT_PROFILE_PEG_PARSING
+#define SKIT_PROFILE_PEG_PARSING 0
+
+static void skit_peg_profile_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	skit_peg_parser *parser = skit_peg_parser_mock_new(skit_slice_null());
+	const skit_peg_rule_profile *list;
+	const skit_peg_rule_profile *item;
+	const skit_peg_rule_profile *nest;
+
+	sASSERT(skit_peg_profile_get(parser, "profile_list") == NULL);
+
+	/* Rules without profiling compiled in don't show up. */
+	sASSERT_PARSE_PASS(parser, "x", memo_term);
+	sASSERT_EQ(parser->profile.len, 0);
+
+	sASSERT_PARSE_PASS(parser, "a,ab,a", profile_list);
+	list = skit_peg_profile_get(parser, "profile_list");
+	item = skit_peg_profile_get(parser, "profile_item");
+	sASSERT(list != NULL && item != NULL);
+	sASSERT_EQ(list->invocations, 1);
+	sASSERT_EQ(list->successes, 1);
+	sASSERT_EQ(list->bytes_consumed, 6);
+	sASSERT_EQ(list->backtracks, 1); /* The end of the ZERO_OR_MORE. */
+	sASSERT_EQ(item->invocations, 3);
+	sASSERT_EQ(item->successes, 3);
+	sASSERT_EQ(item->failures, 0);
+	sASSERT_EQ(item->bytes_consumed, 4);
+	sASSERT_EQ(item->backtracks, 2);   /* "ab" didn't match "a" twice. */
+	sASSERT_GE(list->ticks, item->ticks);
+	sASSERT_GE(list->ticks, list->self_ticks);
+	sASSERT_EQ(parser->profile.active, 0);
+
+	sASSERT_PARSE_FAIL(parser, "b", profile_list);
+	sASSERT_EQ(list->invocations, 2);
+	sASSERT_EQ(list->failures, 1);
+	sASSERT_EQ(item->failures, 1);
+	sASSERT_EQ(item->backtracks, 3);
+
+	/* Recursion. */
+	sASSERT_PARSE_PASS(parser, "((x))", profile_nest);
+	nest = skit_peg_profile_get(parser, "profile_nest");
+	sASSERT_EQ(nest->invocations, 3);
+	sASSERT_EQ(nest->successes, 3);
+	sASSERT_EQ(nest->bytes_consumed, 5 + 3 + 1);
+	sASSERT_EQ(nest->running, 0);
+	sASSERT_GE(nest->ticks, nest->self_ticks);
+
+	skit_text_stream output;
+	skit_text_stream_ctor(&output);
+	skit_peg_profile_dump(parser, &output.as_stream);
+	skit_text_stream_rewind(&output);
+	skit_slice text = skit_text_stream_slurp(&output, NULL);
+	sASSERT(skit_slice_find(text, sSLICE("backtracks"), NULL));
+	sASSERT(skit_slice_find(text, sSLICE("profile_list "), NULL));
+	sASSERT(skit_slice_find(text, sSLICE("profile_item "), NULL));
+	sASSERT(skit_slice_find(text, sSLICE("profile_nest "), NULL));
+	skit_text_stream_dtor(&output);
+
+	skit_peg_profile_reset(parser);
+	sASSERT(skit_peg_profile_get(parser, "profile_list") == NULL);
+
+	sTRACE(skit_peg_parser_mock_free(parser));
+
+	printf("  skit_peg_profile_test passed.\n");
+}
+
+/* ------------------------------------------------------------------------- */
+
 void skit_peg_module_init()
 {
 	SKIT_USE_FEATURE_EMULATION;
@@ -1203,6 +2447,9 @@ void skit_peg_module_init()
 	for ( i = 0; i < skit_peg_default_word_char_tlen; i++ )
 		skit_peg_default_word_char_tbl[i] = skit_peg_is_word_char_method(NULL, i);
 	
+	skit_peg_byte_class_init(&skit_peg_whitespace_class);
+	skit_peg_byte_class_init(&skit_peg_default_word_class);
+	
 	sCTRACE(pthread_mutexattr_init(&skit_peg__lookup_mutex_attrs));
 	sCTRACE(pthread_mutexattr_settype(&skit_peg__lookup_mutex_attrs, PTHREAD_MUTEX_ERRORCHECK));
 	sCTRACE(pthread_mutex_init(&skit_peg__lookup_mutex, &skit_peg__lookup_mutex_attrs));
@@ -1219,12 +2466,17 @@ void skit_peg_unittests()
 	sTRACE(skit_peg_macros_test());
 	sTRACE(skit_peg_parse_one_newline_test());
 	sTRACE(skit_peg_whitespace_test());
+	sTRACE(skit_peg_skip_whitespace_test());
 	sTRACE(skit_peg_word_boundary_test());
 	sTRACE(skit_peg_end_of_text_test());
 	// TODO: token, keyword tests.
 	sTRACE(skit_peg_any_word_test());
 	sTRACE(skit_peg_lookup_test());
+	sTRACE(skit_peg_lookup_threads_test());
 	sTRACE(skit_peg_branch_discard_test());
+	sTRACE(skit_peg_memo_test());
+	sTRACE(skit_peg_profile_test());
+	sTRACE(skit_peg_stream_test());
 	sTRACE(skit_peg_line_bounds_test());
 	printf("  skit_peg_parser_unittests all passed!\n");
 	printf("\n");
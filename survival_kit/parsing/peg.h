@@ -6,8 +6,125 @@
 #include "survival_kit/string.h"
 #include "survival_kit/trie.h"
 
+#include <inttypes.h>
 #include <pthread.h>
 
+/// Number of results that a parser's memo table remembers unless
+/// skit_peg_parser_set_memo_capacity says otherwise.
+#define SKIT_PEG_MEMO_DEFAULT_CAPACITY 4096
+
+/// Internal use only: how many branch discards the memo table tracks
+/// separately before it starts merging the oldest ones.
+#define SKIT__PEG_MEMO_MAX_DISCARDS 64
+
+/// Internal use only: one remembered result of a memoized rule.
+typedef struct skit_peg_memo_entry skit_peg_memo_entry;
+struct skit_peg_memo_entry
+{
+	const void  *rule;       /* NULL if the entry is empty. */
+	ssize_t     cursor;
+	ssize_t     ubound;
+	int         successful;
+	ssize_t     begin, end;
+	uint64_t    stored_at;   /* The memo's clock when this was stored. */
+	skit_loaf   error_msg_buf;
+	skit_slice  error_msg;   /* The parser's last_error_msg after a failure. */
+};
+
+/// Internal use only: a call to the parser's branch_discard callback.
+typedef struct skit_peg_memo_discard skit_peg_memo_discard;
+struct skit_peg_memo_discard
+{
+	uint64_t    time;
+	ssize_t     cursor_reset_pos;
+};
+
+/// The packrat memo table used by rules defined with
+/// SKIT_PEG_DEFINE_MEMO_RULE.  Every parser has one, but it isn't
+/// allocated until a memoized rule runs.
+/// It is a 2-way set-associative cache keyed by (rule, cursor): memory use
+/// is fixed by its capacity no matter how large the input is, and when a
+/// set is full the older of its two results is evicted.
+typedef struct skit_peg_memo skit_peg_memo;
+struct skit_peg_memo
+{
+	skit_peg_memo_entry    *entries;
+	size_t                 capacity;    /* 0, or a power of 2 that is at least 2. */
+	uint64_t               clock;
+	uint64_t               valid_since; /* Entries stored at or before this are stale. */
+
+	/* Discards with increasing positions; see skit__peg_branch_discard. */
+	skit_peg_memo_discard  discards[SKIT__PEG_MEMO_MAX_DISCARDS];
+	size_t                 n_discards;
+
+	/// Number of memoized rule calls answered from the table, and number
+	/// that had to run the rule.  These are never reset by the parser.
+	size_t                 hits;
+	size_t                 misses;
+};
+
+/// Counters kept for one rule by the profiling mode.
+/// See SKIT_PROFILE_PEG_PARSING in "survival_kit/parsing/peg_macros.h".
+/// Ticks are CPU cycles (from rdtsc) on x86 with GCC, and nanoseconds
+/// elsewhere.
+typedef struct skit_peg_rule_profile skit_peg_rule_profile;
+struct skit_peg_rule_profile
+{
+	const char  *rule_name;
+	uint64_t    invocations;
+	uint64_t    successes;
+	uint64_t    failures;
+	uint64_t    bytes_consumed; /* Total length of the rule's successful matches. */
+	uint64_t    backtracks;     /* Branches rewound by elements in the rule's own body. */
+	uint64_t    ticks;          /* Time spent in the rule, including the rules it called. */
+	uint64_t    self_ticks;     /* Time spent in the rule, excluding the rules it called. */
+	size_t      running;        /* Internal: calls of the rule that haven't returned yet. */
+};
+
+/// Internal use only: the profiling state of a parser.
+typedef struct skit_peg_profile skit_peg_profile;
+struct skit_peg_profile
+{
+	skit_peg_rule_profile  *rules;      /* In the order they were first called. */
+	size_t                 len;
+	size_t                 capacity;
+
+	/* Open addressing table from a rule's __func__ pointer to 1 + its */
+	/*   index in 'rules', or 0 for an empty slot. */
+	size_t                 *index;
+	size_t                 index_capacity;
+
+	size_t                 active;      /* 1 + the index of the innermost running rule, or 0. */
+	uint64_t               child_ticks; /* Ticks spent in rules called by the active rule. */
+};
+
+/// Internal use only: what a running rule needs to remember for profiling.
+typedef struct skit__peg_profile_frame skit__peg_profile_frame;
+struct skit__peg_profile_frame
+{
+	size_t     rule;
+	size_t     outer_active;
+	uint64_t   outer_child_ticks;
+	uint64_t   start;
+};
+
+/// Internal use only: the sliding window that a streaming parser reads its
+/// input through.  See skit_peg_parser_set_stream.
+typedef struct skit_peg_stream_input skit_peg_stream_input;
+struct skit_peg_stream_input
+{
+	skit_stream  *stream;     /* NULL unless the parser is streaming. */
+	skit_loaf    window;      /* Holds 'len' bytes of input, starting at 'offset'. */
+	size_t       len;
+	size_t       window_size;
+	size_t       lookahead;
+	uint64_t     offset;
+	size_t       pending_cut; /* Where the last item ended. */
+	ssize_t      reach;       /* The furthest cursor that any match, failed or not, has reached. */
+	int          at_eof;
+	skit_loaf    read_buf;
+};
+
 typedef struct skit_peg_parser skit_peg_parser;
 struct skit_peg_parser
 {
@@ -69,6 +186,16 @@ struct skit_peg_parser
 	void (*branch_discard)(
 		skit_peg_parser *parser,
 		ssize_t cursor_reset_pos );
+
+	/// Results remembered by memoized rules.  See SKIT_PEG_DEFINE_MEMO_RULE.
+	skit_peg_memo       memo;
+
+	/// Per-rule counters, kept when rules are compiled with
+	/// SKIT_PROFILE_PEG_PARSING set to 1.  See skit_peg_profile_dump.
+	skit_peg_profile    profile;
+
+	/// Where input comes from in streaming mode.  See skit_peg_parser_set_stream.
+	skit_peg_stream_input  stream_input;
 };
 
 typedef struct skit_peg_parse_match skit_peg_parse_match;
@@ -79,6 +206,10 @@ struct skit_peg_parse_match
 	ssize_t      begin, end;
 };
 
+/// The signature shared by all rules that take no extra arguments.
+typedef skit_peg_parse_match (*skit_peg_rule_func)(
+	skit_peg_parser *parser, ssize_t cursor, ssize_t ubound );
+
 typedef struct skit_peg_lookup_index skit_peg_lookup_index;
 struct skit_peg_lookup_index
 {
@@ -86,8 +217,24 @@ struct skit_peg_lookup_index
 	pthread_mutexattr_t     mutex_attrs;
 	int                     *suffix_table;
 	skit_trie               trie;
+
+	/* Set (with release semantics) once suffix_table and trie are populated. */
+	/* After that, the index is only ever read, and lookups don't lock it. */
+	int                     ready;
 };
 
+/// Internal use only: atomic loads and stores used by peg_lookup.h so that
+/// entering a lookup whose index is already populated doesn't take any
+/// locks.  Without GCC-style atomics, the acquire-load always reports
+/// "not ready yet" and every entry checks again under the mutex instead.
+#if defined(__GNUC__)
+#  define SKIT__PEG_LOAD_ACQUIRE(ptr)        __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#  define SKIT__PEG_STORE_RELEASE(ptr, val)  __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#else
+#  define SKIT__PEG_LOAD_ACQUIRE(ptr)        (0)
+#  define SKIT__PEG_STORE_RELEASE(ptr, val)  (*(ptr) = (val))
+#endif
+
 void skit_peg_parser_ctor( skit_peg_parser *parser, skit_slice text_to_parse, skit_stream *debug_out );
 void skit_peg_parser_dtor( skit_peg_parser *parser );
 
@@ -109,6 +256,92 @@ void skit_peg_lookup_index_dtor( skit_peg_lookup_index *index );
 /// This should never be called during parsing; call it BEFORE parsing.
 void skit_peg_parser_set_text(skit_peg_parser *parser, skit_slice text_to_parse);
 
+/// Makes the parser read its input from 'stream' a piece at a time, instead
+/// of needing all of it in one slice.  The input is then parsed as a
+/// sequence of items with skit_peg_stream_next, and only a window of it is
+/// kept in memory: each item's end is a cut point, and the bytes before it
+/// are released as soon as the item has been parsed.
+///
+/// 'window_size' is how many bytes of input are normally buffered.  An
+/// item that doesn't fit (with its lookahead) makes the window grow to fit
+/// it, and the window shrinks back to 'window_size' after that item.
+/// Memory use is therefore proportional to the window, or to the longest
+/// item, and not to the size of the input.
+///
+/// 'lookahead' is the most bytes that the grammar looks at past the furthest
+/// point any of its matches reach (ex: 1 for a word boundary).  While an
+/// item is parsed, the parser keeps track of the furthest cursor reached by
+/// any match, including failed ones inside of OPTIONAL, CHOOSE, and
+/// ZERO_OR_MORE that were backtracked out of.  If that is closer than
+/// 'lookahead' to the end of the window, and the end of the input hasn't
+/// been read yet, the item is parsed again with more input in the window.
+/// Before doing so, parser->branch_discard (if set) is called with a
+/// cursor_reset_pos of 0, so that the effects of the abandoned attempt can
+/// be undone.
+/// Rules of the caller's own that look at the input directly should return
+/// their results through skit_peg_match_success and skit_peg_match_failure,
+/// and fail at (or succeed up to) the furthest byte they looked at, so that
+/// this can see them.
+///
+/// The stream is not owned by the parser.
+void skit_peg_parser_set_stream(
+	skit_peg_parser  *parser,
+	skit_stream      *stream,
+	size_t           window_size,
+	size_t           lookahead);
+
+/// Skips whitespace (using parser->parse_whitespace) in a streaming parser's
+/// input, and returns 1 if nothing else is left, or 0 otherwise.
+int skit_peg_stream_at_end(skit_peg_parser *parser);
+
+/// Parses the next item of a streaming parser's input with 'rule', after
+/// skipping any whitespace.  The rule is called with a cursor of 0:
+/// while it runs, parser->input holds the window, starting at the item.
+/// skit_peg_stream_offset tells where that is in the stream.
+///
+/// If the match is successful, the input is cut after it, and the next call
+/// will continue from there.  Slices of parser->input, including the
+/// match's, are only valid until the next call.
+/// If the match fails, nothing is consumed.
+skit_peg_parse_match skit_peg_stream_next(skit_peg_parser *parser, skit_peg_rule_func rule);
+
+/// Returns the position in the stream of the first byte of parser->input.
+uint64_t skit_peg_stream_offset(const skit_peg_parser *parser);
+
+/// Sets how many results the parser's memo table can hold, and forgets any
+/// results it already holds.  The capacity is rounded up to a power of 2.
+/// A capacity of 0 turns memoization off: rules defined with
+/// SKIT_PEG_DEFINE_MEMO_RULE then run every time, like any other rule.
+/// Each entry takes about a hundred bytes, plus a copy of the error message
+/// for rules that failed.
+/// This should never be called during parsing.
+void skit_peg_parser_set_memo_capacity(skit_peg_parser *parser, size_t n_entries);
+
+/// Forgets every result in the parser's memo table.
+/// skit_peg_parser_set_text does this automatically.  Call it after
+/// changing anything else that affects how memoized rules parse, like
+/// parser->case_sensitive or parser->parse_whitespace.
+void skit_peg_parser_memo_clear(skit_peg_parser *parser);
+
+/// Prints the counters collected by profiling (see SKIT_PROFILE_PEG_PARSING)
+/// as a table with one line per rule, sorted by self ticks, busiest first.
+/// Rules that take a lot of self time, backtrack often, or are called
+/// many times for the bytes they consume are the ones worth reordering or
+/// defining with SKIT_PEG_DEFINE_MEMO_RULE.
+/// Memoized rules are listed as "<rule>_memoized", and only count the calls
+/// that missed the memo table (see parser->memo.hits).
+void skit_peg_profile_dump(skit_peg_parser *parser, skit_stream *output);
+
+/// Returns the profiling counters for the rule named 'rule_name' (without
+/// the SKIT_PEG_ prefix), or NULL if it hasn't been called since the last
+/// skit_peg_profile_reset.  The pointer is invalidated when a rule that
+/// hasn't been called before is called.
+const skit_peg_rule_profile *skit_peg_profile_get(const skit_peg_parser *parser, const char *rule_name);
+
+/// Clears all profiling counters.
+/// This should never be called during parsing.
+void skit_peg_profile_reset(skit_peg_parser *parser);
+
 skit_peg_parse_match skit_peg_match_success(skit_peg_parser *parser, size_t begin, size_t end);
 skit_peg_parse_match skit_peg_match_failure(skit_peg_parser *parser, ssize_t position, const char *fail_msg, ...);
 
@@ -142,6 +375,18 @@ ssize_t skit_peg_parse_one_newline(skit_utf8c *txt, ssize_t cursor, ssize_t ubou
 
 int skit_parsing_is_whitespace( skit_utf8c c );
 
+/// Returns the index of the first non-whitespace character at or after
+/// 'cursor' in the given text, or 'ubound' if there is none.
+/// Whitespace is anything that skit_parsing_is_whitespace accepts.
+/// If 'n_newlines' is not NULL, it is set to the number of newlines that were
+/// skipped, with "\r\n" counting as one newline like it does for
+/// skit_peg_parse_one_newline.  If 'line_start' is not NULL, it is set to the
+/// index just past the last of those newlines, or -1 if there were none.
+/// This lets whitespace parsers that keep track of line numbers skip long
+/// runs of whitespace without looking at every character themselves.
+/// Like skit_peg_parse_one_newline, this is not callable as a SKIT_PEG_RULE.
+ssize_t skit_peg_skip_whitespace(skit_utf8c *txt, ssize_t cursor, ssize_t ubound, ssize_t *n_newlines, ssize_t *line_start);
+
 /// Returns the index (byte-wise) of the  character the parser would have to
 /// position to in order to skip any whitespace at the current cursor position.
 /// If there is no whitespace to skip, this will return the current cursor
@@ -221,6 +466,29 @@ void skit__peg_on_entry(
 	ssize_t ubound,
 	const char *func_name);
 
+/// Internal use only
+skit_peg_parse_match skit__peg_memo_call(
+	skit_peg_parser     *parser,
+	ssize_t             cursor,
+	ssize_t             ubound,
+	skit_peg_rule_func  rule);
+
+/// Internal use only
+void skit__peg_branch_discard(skit_peg_parser *parser, ssize_t cursor_reset_pos);
+
+/// Internal use only
+void skit__peg_profile_enter(
+	skit_peg_parser          *parser,
+	skit__peg_profile_frame  *frame,
+	const char               *func_name);
+
+void skit__peg_profile_exit(
+	skit_peg_parser          *parser,
+	skit__peg_profile_frame  *frame,
+	skit_peg_parse_match     match);
+
+void skit__peg_profile_backtrack(skit_peg_parser *parser);
+
 void skit__peg_on_exit(
 	skit_peg_parser      *parser,
 	skit_peg_parse_match match,
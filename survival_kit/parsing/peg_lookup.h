@@ -14,6 +14,8 @@ such an object and pass it into the lookup.  The index will be populated on
 the first entry into the peg_lookup.h inclusion.  The inclusion macro uses
 a pthread mutex to ensure that any attempts to access a lookup index in the
 process of being populated will block until the population is complete.
+Once an index is populated, entering the lookup takes no locks at all, so
+many parser threads can share one index without contending for it.
 
 If INDEX is passed a NULL argument or never specified, then the lookup
 inclusion will initialize it's own (static / process-global) instance that
@@ -126,47 +128,61 @@ do {
 
 	// Fill in a static/process-global index if the caller doesn't want to
 	// control this aspect of the lookup.
+	// The pointer is published with a release-store after the index is
+	// constructed, so once it is set, an acquire-load is all it takes to
+	// use it.  The mutex only matters on the first entries, when more than
+	// one thread might try to create it.
 	static skit_peg_lookup_index *skit_peg__global_index = NULL;
 	
 	if ( skit__peg_lookup_index == NULL )
 	{
-		sCTRACE(pthread_mutex_lock(&skit_peg__lookup_mutex));
+		skit__peg_lookup_index = SKIT__PEG_LOAD_ACQUIRE(&skit_peg__global_index);
+		if ( skit__peg_lookup_index == NULL )
+		{
+			sCTRACE(pthread_mutex_lock(&skit_peg__lookup_mutex));
 
-		if ( skit_peg__global_index == NULL )
-			skit_peg__global_index = skit_peg_lookup_index_new();
-		
-		skit__peg_lookup_index = skit_peg__global_index;
-		
-		sCTRACE(pthread_mutex_unlock(&skit_peg__lookup_mutex));
+			if ( skit_peg__global_index == NULL )
+				SKIT__PEG_STORE_RELEASE(&skit_peg__global_index, skit_peg_lookup_index_new());
+			
+			skit__peg_lookup_index = skit_peg__global_index;
+			
+			sCTRACE(pthread_mutex_unlock(&skit_peg__lookup_mutex));
+		}
 	}
 	
-	// Note: Avoid the perils of Double-Checked Locking.
-	// Also, uncontested locks should be very fast to obtain.
-	// (TODO: This should be true for modern OSes, but are they still fast to obtain on VMS?)
-	
-	sCTRACE(pthread_mutex_lock(&skit__peg_lookup_index->mutex));
-
-	// Lazily initialize the index used to choose potential strings.	
-	// if ( !initialized )
-	if ( skit__peg_lookup_index->suffix_table == NULL )
+	// Lazily populate the index used to choose potential strings.
+	// This is double-checked locking done with atomics: 'ready' is
+	// release-stored only after the trie and suffix table are complete, so
+	// a thread whose acquire-load sees it set also sees everything they
+	// hold, and never needs the mutex.  Populated indices are only read
+	// from then on, so any number of threads can use them at once.
+	if ( !SKIT__PEG_LOAD_ACQUIRE(&skit__peg_lookup_index->ready) )
 	{
-		// Note: The ->trie member should already be constructed.
-		//       See skit_peg_lookup_index_ctor(index) to see where that occurs.
-		skit__peg_lookup_index->suffix_table = skit_malloc(sizeof(int)*(skit__peg_lookup__kw_count));
-		int skit__peg_lookup_current_suffix = skit__peg_lookup_default_suffix;
+		sCTRACE(pthread_mutex_lock(&skit__peg_lookup_index->mutex));
 
-		#define SKIT_X_INDEX(ptr_expr) (void)0;
-		#define SKIT_X_CHOICE(keyword, rule) \
-			skit_trie_set( &skit__peg_lookup_index->trie, sSLICE(#keyword), (void*)(skit_x__ ## keyword), SKIT_FLAG_C ); \
-			skit__peg_lookup_index->suffix_table[skit_x__ ## keyword] = skit__peg_lookup_current_suffix;
-		#define SKIT_X_SUFFIX(name, rule) \
-			skit__peg_lookup_current_suffix = skit_sx__ ## name;
-		SKIT_PEG_LOOKUP_CHOICE(SKIT_X_INDEX, SKIT_X_CHOICE, SKIT_X_SUFFIX)
-		#undef SKIT_X_INDEX
-		#undef SKIT_X_CHOICE
-		#undef SKIT_X_SUFFIX
+		if ( !skit__peg_lookup_index->ready )
+		{
+			// Note: The ->trie member should already be constructed.
+			//       See skit_peg_lookup_index_ctor(index) to see where that occurs.
+			skit__peg_lookup_index->suffix_table = skit_malloc(sizeof(int)*(skit__peg_lookup__kw_count));
+			int skit__peg_lookup_current_suffix = skit__peg_lookup_default_suffix;
+
+			#define SKIT_X_INDEX(ptr_expr) (void)0;
+			#define SKIT_X_CHOICE(keyword, rule) \
+				skit_trie_set( &skit__peg_lookup_index->trie, sSLICE(#keyword), (void*)(intptr_t)(skit_x__ ## keyword), SKIT_FLAG_C ); \
+				skit__peg_lookup_index->suffix_table[skit_x__ ## keyword] = skit__peg_lookup_current_suffix;
+			#define SKIT_X_SUFFIX(name, rule) \
+				skit__peg_lookup_current_suffix = skit_sx__ ## name;
+			SKIT_PEG_LOOKUP_CHOICE(SKIT_X_INDEX, SKIT_X_CHOICE, SKIT_X_SUFFIX)
+			#undef SKIT_X_INDEX
+			#undef SKIT_X_CHOICE
+			#undef SKIT_X_SUFFIX
+
+			SKIT__PEG_STORE_RELEASE(&skit__peg_lookup_index->ready, 1);
+		}
+
+		sCTRACE(pthread_mutex_unlock(&skit__peg_lookup_index->mutex));
 	}
-	sCTRACE(pthread_mutex_unlock(&skit__peg_lookup_index->mutex));
 
 	// Grab a keyword.  (This is essentially what a tokenizer would do, if we had one.)
 	char *word_buf;
@@ -182,11 +198,11 @@ do {
 	// Verify that the identifier/keyword parsed is one of
 	//   the keywords that we can accept.
 	// Additionally, find out WHICH key word it is.
-	int skit__peg_lookup_which_keyword = -1;
-	skit_slice skit__peg_lookup_result = 
-		skit_trie_get(&skit__peg_lookup_index->trie, word, (void**)&skit__peg_lookup_which_keyword,
-			parser->case_sensitive ? SKIT_FLAGS_NONE : SKIT_FLAG_I);
-	if ( skit_slice_is_null(skit__peg_lookup_result) )
+	// (skit_trie_lookup doesn't write to the trie, so this is safe to do
+	//  from many threads at once.)
+	void *skit__peg_lookup_value = NULL;
+	if ( !skit_trie_lookup(&skit__peg_lookup_index->trie, word, &skit__peg_lookup_value,
+			parser->case_sensitive ? SKIT_FLAGS_NONE : SKIT_FLAG_I) )
 	{
 		skit_slice next_chars =
 			skit_peg_next_chars_in_parse(parser,new_cursor,NUM_NEXT_CHARS);
@@ -195,6 +211,8 @@ do {
 		break;
 	}
 	
+	int skit__peg_lookup_which_keyword = (int)(intptr_t)skit__peg_lookup_value;
+	
 	// Parse the SUFFIX associated with the keyword.
 	int skit__peg_lookup_which_suffix = 
 		skit__peg_lookup_index->suffix_table[skit__peg_lookup_which_keyword];
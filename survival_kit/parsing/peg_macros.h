@@ -25,6 +25,18 @@
 #  define SKIT__PEG_PRINT_EXIT()  ((void)0)
 #endif
 
+// Default parser profiling status.
+// Rules compiled while this is 1 record per-rule counters and timings in
+// parser->profile (see skit_peg_profile_dump).  This costs a couple of
+// function calls per rule invocation, which is far less than the debug
+// traces from SKIT_DEBUG_PEG_PARSING.
+// It is checked where the rule macros are expanded, so it can be turned on
+// for the rules of a single grammar file by defining it before the
+// DEFINE_RULEs (after any #undef).
+#ifndef SKIT_PROFILE_PEG_PARSING
+#define SKIT_PROFILE_PEG_PARSING 0
+#endif
+
 #define SKIT_PEG_PARSING_INITIAL_VARS(parser) \
 		int auto_consume_whitespace = 1; \
 		ssize_t cursor = 0; \
@@ -52,6 +64,51 @@
 #define SKIT_PEG_DEFINE_RULE(...) \
 	SKIT_MACRO_DISPATCHER2(SKIT_PEG_DEFINE_RULE, __VA_ARGS__)(__VA_ARGS__)
 
+/// Defines a rule like SKIT_PEG_DEFINE_RULE does, but one whose results are
+/// remembered in the parser's memo table (packrat parsing).  When a CHOOSE,
+/// OPTIONAL, ZERO_OR_MORE, or similar element backtracks and tries the rule
+/// again at the same cursor, the remembered match (or failure, along with its
+/// error message) is returned without running the rule again.  Grammars
+/// whose alternatives share long prefixes can take exponential time without
+/// this, and take linear time with it.
+///
+/// Memoized rules can't take extra arguments: the table is keyed only by
+/// the rule and the cursor position, and a rule's arguments are how it
+/// passes results back to its caller.
+///
+/// ACTIONs in a memoized rule do not run again when its result is reused.
+/// If the parser has a branch_discard callback, it is assumed to undo the
+/// effects of everything parsed at or after the position it is given, so
+/// successful results stored at or after that position are forgotten and
+/// their rules run again (and redo their effects) the next time they are
+/// needed.  Failures are always remembered.  Grammars whose actions have no
+/// effects that need undoing get the most out of memoization by leaving
+/// branch_discard NULL.
+///
+/// Example:
+///   DEFINE_MEMO_RULE(expr)
+///       CHOOSE(
+///           SEQ(RULE(term), RULE(token,"+"), RULE(expr)),
+///           SEQ(RULE(term), RULE(token,"-"), RULE(expr)),
+///           RULE(term)
+///       );
+///   END_RULE
+#define SKIT_PEG_DEFINE_MEMO_RULE(rule_name) \
+	static skit_peg_parse_match SKIT_PEG_ ## rule_name ## _memoized ( \
+		skit_peg_parser *parser, ssize_t cursor, ssize_t ubound ); \
+	\
+	static skit_peg_parse_match SKIT_PEG_ ## rule_name ( \
+		skit_peg_parser *parser, ssize_t cursor, ssize_t ubound ) \
+	{ \
+		return skit__peg_memo_call(parser, cursor, ubound, \
+			&SKIT_PEG_ ## rule_name ## _memoized); \
+	} \
+	\
+	static skit_peg_parse_match SKIT_PEG_ ## rule_name ## _memoized ( \
+		skit_peg_parser *parser, ssize_t cursor, ssize_t ubound ) \
+	{ \
+		SKIT_PEG_RULE_HEADER
+
 #define SKIT_PEG_RULE_HEADER \
 		int auto_consume_whitespace = 1; \
 		ssize_t new_cursor = cursor; \
@@ -59,17 +116,24 @@
 		(void)new_cursor; \
 		(void)match; \
 		(void)auto_consume_whitespace; \
+		skit__peg_profile_frame skit__peg_profile; \
+		if ( SKIT_PROFILE_PEG_PARSING ) \
+			skit__peg_profile_enter(parser, &skit__peg_profile, __func__); \
 		SKIT__PEG_PRINT_ENTRY();
 
 #define SKIT_PEG_END_RULE \
 		SKIT__PEG_PRINT_EXIT(); \
+		if ( SKIT_PROFILE_PEG_PARSING ) \
+			skit__peg_profile_exit(parser, &skit__peg_profile, match); \
 		return match; \
 	}
 
 #define SKIT_PEG__BRANCH_DISCARD(cursor_reset_pos) \
 	do { \
+		if ( SKIT_PROFILE_PEG_PARSING ) \
+			skit__peg_profile_backtrack(parser); \
 		if ( parser->branch_discard != NULL ) \
-			parser->branch_discard(parser, cursor_reset_pos); \
+			skit__peg_branch_discard(parser, cursor_reset_pos); \
 	} while(0)
 
 #define SKIT_PEG_SEQ1(a) \
@@ -4,6 +4,7 @@
 #include "survival_kit/parsing/peg_macros.h"
 
 #define DEFINE_RULE(...)   SKIT_PEG_DEFINE_RULE(__VA_ARGS__)
+#define DEFINE_MEMO_RULE(rule_name) SKIT_PEG_DEFINE_MEMO_RULE(rule_name)
 #define END_RULE           SKIT_PEG_END_RULE
 
 #define SEQ(...)           SKIT_PEG_SEQ(__VA_ARGS__)
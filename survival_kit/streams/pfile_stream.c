@@ -391,8 +391,9 @@ skit_slice skit_pfile_stream_read_fn(skit_pfile_stream *stream, skit_loaf *buffe
 		nbytes++;
 		if ( length < nbytes )
 		{
-			/* Slow, but w/e. */
-			skit_loaf_resize(read_buf, nbytes+64);
+			/* skit_loaf_resize grows the capacity geometrically, so */
+			/*   this only reallocates once in a while. */
+			skit_loaf_resize(read_buf, nbytes);
 			length = sLLENGTH(*read_buf);
 			buf_ptr = sLPTR(*read_buf);
 		}
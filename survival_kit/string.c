@@ -8,10 +8,12 @@
 #include <inttypes.h>
 #include <unistd.h> /* For ssize_t */
 #include <stddef.h> /* For ptrdiff_t */
+#include <pthread.h>
 
 #include "survival_kit/string.h"
 #include "survival_kit/assert.h"
 #include "survival_kit/memory.h"
+#include "survival_kit/math.h"
 
 #define SKIT_DO_STRING_DEBUG 0
 #if SKIT_DO_STRING_DEBUG != 0
@@ -23,7 +25,7 @@
 /* 
 -----------===== .meta layout =====-----------
 The hi 8 bits of the 'meta' member is layed out like so:
-  1 0 1 A A S S S
+  1 0 1 A A W S S
 
 The highest 3 bits are always 1 0 1.  This causes the meta member to
   always be /very/ negative, and at the same time not entirely made of set
@@ -38,12 +40,14 @@ The A bits (standing for 'allocation type' here) specify how the string
   0 - The string is either a loaf or a slice of a loaf.
   1 - The string data is in a user-provided location, probably the stack.
   2 - The string is a slice of a C style string.
+  3 - The string is a loaf (or a slice of one) whose original block is a
+      recycled small block.  See "Small loaves" below.
   Strings that are a slice of a C-style string will have a chars_handle
   pointer that points directly to string data.
   Strings that are a loaf or a slice of a loaf will have a chars_handle
   that points to a pointer that points to the string data.  This is the
   case for both 0 and 1.  The specifics of this arrangement are described
-  in the ".chars_handle layout" section.
+  in the ".chars_handle layout" section.  This is also true for 3.
   The 1 value is used to determine if skit_free is called or not on the
   string data when skit_loaf_free is called.  It is otherwise equivalent
   to the 0 case.
@@ -52,25 +56,40 @@ The A bits (standing for 'allocation type' here) specify how the string
   satiate growth: that will always be dynamically allocated with skit_malloc.
   See also the skit_string_alloc_type definitions.
 
-The three S bits are the stride of the array.  Currently, this field has the
+The W bit selects how the rest of the 'meta' member is used:
+  0 - The compact layout.  The low 56 bits are the length of the string and
+      its offset (if it's a slice).  These are accessed internally with the
+      META_LENGTH_XXX and META_OFFSET_XXX defines.  They are 28 bits each.
+  1 - The wide layout.  The low 56 bits are the length of the string, and
+      the offset is always 0.  This is accessed internally with the
+      META_WIDE_XXX defines.
+  A loaf will always have an offset of 0, so a loaf switches to the wide
+  layout as soon as its length no longer fits in 28 bits.
+  A slice whose offset or length does not fit in 28 bits, and whose offset
+  is not 0, can't be represented by either layout while still going through
+  the loaf's handle.  Such slices point directly at the string data instead,
+  exactly like a slice of a C string (see case 3 in ".chars_handle layout").
+  The skit_slice_len and skit_slice_ptr functions should always be used to
+  access these fields, so that the layout is handled correctly.
+
+The two S bits are the stride of the array.  Currently, this field has the
   following possible values with the following meanings:
   1 - A utf8 encoded string.
   2 - A utf16 encoded string.
-  4 - A utf32 encoded string.
+  3 - A utf32 encoded string.
   This is accessed internally with the META_STRIDE_XXX defines.
   (currently populated, but not used)
-
-The rest of the bytes in the 'meta' member are the length of the string and its
-  offset (if it's a slice).  These are accessed internally with the 
-  META_LENGTH_XXX and META_OFFSET_XXX defines.  They are 28 bits each: a split
-  between the remaining bits in the meta member.  A loaf will always have an
-  offset of 0.  This does mean that strings can't be longer than ~268MB.
   
 -----------===== .chars_handle layout =====-----------
 The .chars_handle can have one of 3 meanings:
 
 (1) It is a pointer to a pointer to the string data.  The second pointer is
 called a "handle" and is allocated by loaves on an as-needed basis.
+The memory the handle points into is laid out like so:
+  [size_t capacity][capacity bytes of string data][nul byte]
+The handle points at the string data, not at the capacity.  Resizes that fit
+within the capacity do not reallocate, and resizes that don't fit grow the
+capacity geometrically so that repeated appends are amortized O(1).
 
 (2) It is a pointer to a null pointer, with the string data following the
 null pointer/handle contiguously in memory.  
@@ -106,7 +125,7 @@ very temporary manner.
  */
 
 #define META_STRIDE_SHIFT (sizeof(skit_string_meta)*8 - 8)
-#define META_STRIDE_MASK  (0x0700000000000000ULL)
+#define META_STRIDE_MASK  (0x0300000000000000ULL)
 
 #define META_CHECK_SHIFT  (sizeof(skit_string_meta)*8 - 3)
 #define META_CHECK_MASK   (0xE000000000000000ULL)
@@ -121,11 +140,15 @@ very temporary manner.
 #define META_OFFSET_MASK  (0x00FFFFFFF0000000ULL)
 #define META_OFFSET_SHIFT (28)
 
+#define META_WIDE_MASK        (0x0400000000000000ULL)
+#define META_WIDE_LENGTH_MASK (0x00FFFFFFFFFFFFFFULL)
+
 enum skit_string_alloc_type
 {
 	skit_string_alloc_type_malloc = 0,  /* skit_malloc, to be exact. */
 	skit_string_alloc_type_user   = 1,  /* Probably stack memory.  Don't free. */
 	skit_string_alloc_type_cstr   = 2,  /* Handle doesn't exist.  Don't resize or free. */
+	skit_string_alloc_type_small  = 3,  /* Give back to the small block cache. */
 };
 typedef enum skit_string_alloc_type skit_string_alloc_type;
 
@@ -141,25 +164,47 @@ typedef enum skit_string_alloc_type skit_string_alloc_type;
 #define skit_string_init_meta() \
 	(META_CHECK_VAL | (1ULL << META_STRIDE_SHIFT))
 
+static size_t skit_slice_get_offset(skit_slice slice)
+{
+	if ( slice.meta & META_WIDE_MASK )
+		return 0;
+	return (slice.meta & META_OFFSET_MASK) >> META_OFFSET_SHIFT;
+}
+
 static void skit_slice_set_length(skit_slice *slice, uint64_t len)
 {
-	slice->meta = 
-		(slice->meta & ~META_LENGTH_MASK) | 
-		((len << META_LENGTH_SHIFT) & META_LENGTH_MASK);
+	if ( slice->meta & META_WIDE_MASK )
+	{
+		sASSERT_MSG(len <= META_WIDE_LENGTH_MASK, "String length is too large.");
+		slice->meta = (slice->meta & ~META_WIDE_LENGTH_MASK) | len;
+	}
+	else if ( len <= (META_LENGTH_MASK >> META_LENGTH_SHIFT) )
+	{
+		slice->meta = 
+			(slice->meta & ~META_LENGTH_MASK) | 
+			((len << META_LENGTH_SHIFT) & META_LENGTH_MASK);
+	}
+	else
+	{
+		/* Only strings without an offset can switch to the wide layout. */
+		/* skit_slice_of handles the other case. */
+		sASSERT(skit_slice_get_offset(*slice) == 0);
+		sASSERT_MSG(len <= META_WIDE_LENGTH_MASK, "String length is too large.");
+		slice->meta = (slice->meta & ~META_WIDE_LENGTH_MASK) | META_WIDE_MASK | len;
+	}
 }
 
 static void skit_slice_set_offset(skit_slice *slice, uint64_t offset)
 {
+	sASSERT(!(slice->meta & META_WIDE_MASK) || offset == 0);
+	sASSERT(offset <= (META_OFFSET_MASK >> META_OFFSET_SHIFT));
+	if ( slice->meta & META_WIDE_MASK )
+		return;
 	slice->meta = 
 		(slice->meta & ~META_OFFSET_MASK) | 
 		((offset << META_OFFSET_SHIFT) & META_OFFSET_MASK);
 }
 
-static size_t skit_slice_get_offset(skit_slice slice)
-{
-	return (slice.meta & META_OFFSET_MASK) >> META_OFFSET_SHIFT;
-}
-
 /* ------------------------------------------------------------------------- */
 
 /* 
@@ -231,9 +276,105 @@ skit_loaf skit_loaf_copy_cstr(const char *cstr)
 
 /* ------------------------------------------------------------------------- */
 
+/*
+Small loaves.
+
+Most loaves are short (keys, tokens, names), and each one used to cost a
+call into the allocator on creation and again when freed.  Loaves whose
+block (handle, characters, and nul byte) fits in SKIT_LOAF_SMALL_BLOCK_SIZE
+bytes instead use fixed-size blocks that are recycled through a per-thread
+free list.  Any thread may free a small loaf: the block just joins the
+freeing thread's list.  Each list holds at most SKIT_LOAF_SMALL_CACHE_MAX
+blocks; beyond that, blocks go back to the process allocator.
+
+Because every small block has the same size, a small loaf can grow in place
+up to SKIT_LOAF_SMALL_MAX_LENGTH characters before it needs a handle.
+
+The blocks come from the process allocator, so they are not used while a
+thread allocator (ex: an skit_arena) is installed; skit_malloc is used then,
+as before.
+
+Note that the loaf itself can't hold the characters: loaves and slices are
+passed by value, and sLPTR/sSPTR return pointers that must outlive the copy
+they were called on.
+*/
+#define SKIT_LOAF_SMALL_BLOCK_SIZE 32
+#define SKIT_LOAF_SMALL_MAX_LENGTH (SKIT_LOAF_SMALL_BLOCK_SIZE - SKIT_LOAF_EMPLACEMENT_OVERHEAD)
+#define SKIT_LOAF_SMALL_CACHE_MAX  256
+
+typedef struct skit_loaf_small_cache skit_loaf_small_cache;
+struct skit_loaf_small_cache
+{
+	void  *free_list; /* Each free block starts with a pointer to the next one. */
+	int   length;
+};
+
+static pthread_key_t  skit__loaf_small_key;
+static pthread_once_t skit__loaf_small_once = PTHREAD_ONCE_INIT;
+
+static void skit_loaf_small_cache_dtor(void *context)
+{
+	skit_loaf_small_cache *cache = context;
+	while ( cache->free_list != NULL )
+	{
+		void *block = cache->free_list;
+		cache->free_list = *(void**)block;
+		skit_process_free(block);
+	}
+	skit_process_free(cache);
+}
+
+static void skit_loaf_small_key_init()
+{
+	pthread_key_create(&skit__loaf_small_key, &skit_loaf_small_cache_dtor);
+}
+
+static skit_loaf_small_cache *skit_loaf_small_cache_get()
+{
+	pthread_once(&skit__loaf_small_once, &skit_loaf_small_key_init);
+	skit_loaf_small_cache *cache = pthread_getspecific(skit__loaf_small_key);
+	if ( cache == NULL )
+	{
+		cache = skit_process_malloc(sizeof(skit_loaf_small_cache));
+		cache->free_list = NULL;
+		cache->length = 0;
+		pthread_setspecific(skit__loaf_small_key, cache);
+	}
+	return cache;
+}
+
+static void *skit_loaf_small_alloc()
+{
+	skit_loaf_small_cache *cache = skit_loaf_small_cache_get();
+	void *block = cache->free_list;
+	if ( block == NULL )
+		return skit_process_malloc(SKIT_LOAF_SMALL_BLOCK_SIZE);
+	cache->free_list = *(void**)block;
+	cache->length--;
+	return block;
+}
+
+static void skit_loaf_small_free(void *block)
+{
+	skit_loaf_small_cache *cache = skit_loaf_small_cache_get();
+	if ( cache->length >= SKIT_LOAF_SMALL_CACHE_MAX )
+	{
+		skit_process_free(block);
+		return;
+	}
+	*(void**)block = cache->free_list;
+	cache->free_list = block;
+	cache->length++;
+}
+
 skit_loaf skit_loaf_alloc(size_t length)
 {
 	size_t mem_size = SKIT_LOAF_EMPLACEMENT_OVERHEAD + length;
+	if ( mem_size <= SKIT_LOAF_SMALL_BLOCK_SIZE && skit_thread_allocator_get() == NULL )
+	{
+		void *mem = skit_loaf_small_alloc();
+		return skit_loaf_emplace_internal(mem, mem_size, skit_string_alloc_type_small);
+	}
 	void *mem = skit_malloc(mem_size);
 	return skit_loaf_emplace_internal(mem, mem_size, skit_string_alloc_type_malloc);
 }
@@ -245,6 +386,40 @@ skit_loaf skit_loaf_emplace( void *mem, size_t mem_size )
 	return skit_loaf_emplace_internal(mem, mem_size, skit_string_alloc_type_user);
 }
 
+static void skit_loaf_small_test()
+{
+	/* Short loaves grow in place until they outgrow their block. */
+	skit_loaf loaf = skit_loaf_copy_cstr("foo");
+	skit_utf8c *ptr = sLPTR(loaf);
+	sASSERT_EQ(skit_loaf_capacity(loaf), SKIT_LOAF_SMALL_MAX_LENGTH);
+	skit_loaf_append(&loaf, sSLICE("bar"));
+	sASSERT(ptr == sLPTR(loaf));
+	sASSERT_EQ_CSTR("foobar", skit_loaf_as_cstr(loaf));
+	skit_slice slice = skit_slice_of(loaf.as_slice, 3, 6);
+	while ( sLLENGTH(loaf) < SKIT_LOAF_SMALL_MAX_LENGTH + 10 )
+		skit_loaf_append(&loaf, sSLICE("!"));
+	sASSERT(ptr != sLPTR(loaf));
+	sASSERT_EQS(slice, sSLICE("bar"));
+	sASSERT_EQ(sLPTR(loaf)[sLLENGTH(loaf)], '\0');
+	skit_loaf_free(&loaf);
+
+	/* Freed blocks are reused. */
+	loaf = skit_loaf_copy_cstr("baz");
+	ptr = sLPTR(loaf);
+	skit_loaf_free(&loaf);
+	loaf = skit_loaf_alloc(SKIT_LOAF_SMALL_MAX_LENGTH);
+	sASSERT(ptr == sLPTR(loaf));
+	sASSERT_EQ(sLPTR(loaf)[SKIT_LOAF_SMALL_MAX_LENGTH], '\0');
+	skit_loaf_free(&loaf);
+
+	/* Longer loaves are allocated as before. */
+	loaf = skit_loaf_alloc(SKIT_LOAF_SMALL_MAX_LENGTH + 1);
+	sASSERT_EQ(skit_loaf_capacity(loaf), SKIT_LOAF_SMALL_MAX_LENGTH + 1);
+	skit_loaf_free(&loaf);
+
+	printf("  skit_loaf_small_test passed.\n");
+}
+
 static void skit_loaf_emplace_test()
 {
 	char mem[128];
@@ -271,6 +446,8 @@ static void skit_loaf_on_stack_test()
 
 ssize_t skit_slice_len(skit_slice slice)
 {
+	if ( slice.meta & META_WIDE_MASK )
+		return slice.meta & META_WIDE_LENGTH_MASK;
 	return (slice.meta & META_LENGTH_MASK) >> META_LENGTH_SHIFT;
 }
 
@@ -385,7 +562,7 @@ static void skit_slice_check_init_test()
 
 /* ------------------------------------------------------------------------- */
 
-skit_slice skit_slice_of_cstrn(const char *cstr, int length )
+skit_slice skit_slice_of_cstrn(const char *cstr, ssize_t length )
 {
 	skit_slice result = skit_slice_null();
 	result.chars_handle = (skit_utf8c*)cstr;
@@ -445,21 +622,68 @@ static void skit_slice_sSLICE_test()
 
 /* ------------------------------------------------------------------------- */
 
+/* Memory pointed to by a handle starts with its capacity.  See ".chars_handle layout". */
+static size_t skit_loaf_heap_capacity(skit_utf8c *handle)
+{
+	return ((size_t*)handle)[-1];
+}
+
+static skit_utf8c *skit_loaf_heap_realloc(skit_utf8c *handle, size_t capacity)
+{
+	size_t *mem = (handle == NULL ? NULL : ((size_t*)handle) - 1);
+	mem = (size_t*)skit_realloc(mem, sizeof(size_t) + capacity + 1);
+	mem[0] = capacity;
+	return (skit_utf8c*)(mem + 1);
+}
+
+/* The first heap buffer of a loaf comes from the allocator that owns the */
+/*   loaf's handle block, so that a loaf made before an sSCOPE_ARENA can */
+/*   still grow inside it and be freed after it. */
+static skit_utf8c *skit_loaf_heap_alloc_beside(skit_utf8c *chars_handle, size_t capacity)
+{
+	size_t *mem = (size_t*)skit_malloc_beside(chars_handle, sizeof(size_t) + capacity + 1);
+	mem[0] = capacity;
+	return (skit_utf8c*)(mem + 1);
+}
+
+static void skit_loaf_heap_free(skit_utf8c *handle)
+{
+	skit_free(((size_t*)handle) - 1);
+}
+
+/* Grow by 1.5x, or to 'length' if that isn't enough. */
+static size_t skit_loaf_grow_capacity(size_t capacity, size_t length)
+{
+	size_t new_capacity = capacity + capacity/2;
+	if ( new_capacity < 16 )
+		new_capacity = 16;
+	if ( new_capacity < length )
+		new_capacity = length;
+	return new_capacity;
+}
+
 skit_loaf *skit_loaf_resize(skit_loaf *loaf, size_t length)
 {
 	skit_utf8c *loaf_chars = sLPTR(*loaf);
 	sASSERT(loaf != NULL);
 	sASSERT(loaf_chars != NULL);
 	sASSERT_MSG(skit_loaf_check_init(*loaf), "'loaf' was not initialized.");
-	
+
 	skit_utf8c **handle_ptr = (skit_utf8c**)loaf->chars_handle;
 	if ( *handle_ptr == NULL )
 	{
 		size_t old_length = sLLENGTH(*loaf);
-		if ( old_length < length )
+		if ( old_length < length &&
+			SKIT_STRING_GET_ALLOC_TYPE(loaf->as_slice.meta) == skit_string_alloc_type_small &&
+			length <= SKIT_LOAF_SMALL_MAX_LENGTH )
+		{
+			/* grow operation, within a small block: no allocation required */
+			loaf->chars_handle[sizeof(skit_utf8c*)+length] = '\0';
+		}
+		else if ( old_length < length )
 		{
 			/* grow operation */
-			*handle_ptr = (skit_utf8c*)skit_malloc(length+1);
+			*handle_ptr = skit_loaf_heap_alloc_beside(loaf->chars_handle, skit_loaf_grow_capacity(old_length, length));
 			memcpy(*handle_ptr, loaf->chars_handle + sizeof(skit_utf8c*), old_length);
 			(*handle_ptr)[old_length] = '\0';
 			(*handle_ptr)[length] = '\0';
@@ -483,14 +707,114 @@ skit_loaf *skit_loaf_resize(skit_loaf *loaf, size_t length)
 	}
 	else
 	{
-		*handle_ptr = (skit_utf8c*)skit_realloc(*handle_ptr, length+1);
+		/* Shrinking keeps the capacity, so that the loaf can be reused */
+		/*   as a buffer without going back to the allocator. */
+		size_t capacity = skit_loaf_heap_capacity(*handle_ptr);
+		if ( capacity < length )
+			*handle_ptr = skit_loaf_heap_realloc(*handle_ptr, skit_loaf_grow_capacity(capacity, length));
 		(*handle_ptr)[length] = '\0';
 	}
 	skit_slice_set_length(&loaf->as_slice, length);
-	
+
 	return loaf;
 }
 
+/* ------------------------------------------------------------------------- */
+
+skit_loaf *skit_loaf_reserve(skit_loaf *loaf, size_t capacity)
+{
+	sASSERT(loaf != NULL);
+	sASSERT(sLPTR(*loaf) != NULL);
+	sASSERT_MSG(skit_loaf_check_init(*loaf), "'loaf' was not initialized.");
+
+	if ( capacity <= skit_loaf_capacity(*loaf) )
+		return loaf;
+
+	skit_utf8c **handle_ptr = (skit_utf8c**)loaf->chars_handle;
+	if ( *handle_ptr == NULL )
+	{
+		size_t length = sLLENGTH(*loaf);
+		*handle_ptr = skit_loaf_heap_alloc_beside(loaf->chars_handle, capacity);
+		memcpy(*handle_ptr, loaf->chars_handle + sizeof(skit_utf8c*), length);
+		(*handle_ptr)[length] = '\0';
+	}
+	else
+		*handle_ptr = skit_loaf_heap_realloc(*handle_ptr, capacity);
+
+	return loaf;
+}
+
+size_t skit_loaf_capacity(skit_loaf loaf)
+{
+	sASSERT(loaf.chars_handle != NULL);
+	skit_utf8c *handle = *((skit_utf8c**)loaf.chars_handle);
+	if ( handle != NULL )
+		return skit_loaf_heap_capacity(handle);
+	else if ( SKIT_STRING_GET_ALLOC_TYPE(loaf.as_slice.meta) == skit_string_alloc_type_small )
+		return SKIT_LOAF_SMALL_MAX_LENGTH;
+	else
+		return sLLENGTH(loaf);
+}
+
+static void skit_loaf_reserve_test()
+{
+	/* Short loaves start out with a small block's worth of capacity. */
+	skit_loaf loaf = skit_loaf_copy_cstr("Hello");
+	sASSERT_EQ(skit_loaf_capacity(loaf), SKIT_LOAF_SMALL_MAX_LENGTH);
+
+	skit_loaf_reserve(&loaf, 3);
+	sASSERT_EQ(skit_loaf_capacity(loaf), SKIT_LOAF_SMALL_MAX_LENGTH);
+	skit_loaf_reserve(&loaf, 100);
+	sASSERT_EQ(skit_loaf_capacity(loaf), 100);
+	sASSERT_EQ(sLLENGTH(loaf), 5);
+	sASSERT_EQ_CSTR("Hello", skit_loaf_as_cstr(loaf));
+
+	/* Anything up to the reserved capacity does not move the data. */
+	skit_utf8c *ptr = sLPTR(loaf);
+	while ( sLLENGTH(loaf) < 100 )
+		skit_loaf_append(&loaf, sSLICE("!"));
+	sASSERT(ptr == sLPTR(loaf));
+	sASSERT_EQ(skit_loaf_capacity(loaf), 100);
+
+	/* Shrinking keeps the capacity. */
+	skit_loaf_resize(&loaf, 5);
+	sASSERT_EQ_CSTR("Hello", skit_loaf_as_cstr(loaf));
+	sASSERT_EQ(skit_loaf_capacity(loaf), 100);
+	skit_loaf_reserve(&loaf, 200);
+	sASSERT_EQ_CSTR("Hello", skit_loaf_as_cstr(loaf));
+	skit_loaf_free(&loaf);
+
+	/* Same thing, with memory the loaf doesn't own. */
+	SKIT_LOAF_ON_STACK(stack_loaf, 8);
+	skit_loaf_store_cstr(&stack_loaf, "foo");
+	skit_loaf_reserve(&stack_loaf, 64);
+	sASSERT_EQ(skit_loaf_capacity(stack_loaf), 64);
+	sASSERT_EQ_CSTR("foo", skit_loaf_as_cstr(stack_loaf));
+	skit_loaf_free(&stack_loaf);
+
+	/* Appending one byte at a time should only reallocate a logarithmic */
+	/*   number of times. */
+	int n_moves = 0;
+	size_t i;
+	loaf = skit_loaf_new();
+	size_t capacity = skit_loaf_capacity(loaf);
+	for ( i = 0; i < 100000; i++ )
+	{
+		skit_loaf_append(&loaf, sSLICE("x"));
+		if ( skit_loaf_capacity(loaf) != capacity )
+		{
+			n_moves++;
+			capacity = skit_loaf_capacity(loaf);
+		}
+	}
+	sASSERT_EQ(sLLENGTH(loaf), 100000);
+	sASSERT_LT(n_moves, 40);
+	sASSERT_EQ(sLPTR(loaf)[100000], '\0');
+	skit_loaf_free(&loaf);
+
+	printf("  skit_loaf_reserve_test passed.\n");
+}
+
 static void skit_loaf_resize_test()
 {
 	skit_loaf loaf = skit_loaf_copy_cstr("Hello world!");
@@ -611,9 +935,15 @@ skit_slice *skit_slice_buffered_resize(
 		/* Resize to (new_buffer_length * 1.5) */
 		new_buffer_length = (new_buffer_length * 3) / 2;
 		skit_loaf_resize( buffer, new_buffer_length );
+		
+		/* Terminate the new slice, as promised in the documentation. */
+		sLPTR(*buffer)[new_rbound - buffer_chars] = '\0';
 	}
 	
-	skit_slice_set_length(buf_slice, new_buf_slice_length);
+	/* Re-slice instead of just setting the length: large slices point */
+	/*   directly at the buffer's data, which may have just moved. */
+	ssize_t slice_start = buf_slice_chars - buffer_chars;
+	*buf_slice = skit_slice_of(buffer->as_slice, slice_start, slice_start + new_buf_slice_length);
 	
 	return buf_slice;
 }
@@ -1003,11 +1333,26 @@ skit_slice skit_slice_of(skit_slice slice, ssize_t index1, ssize_t index2)
 	sASSERT((index2-index1) >= 0);
 	
 	/* Do the slicing. */
-	result.chars_handle = slice.chars_handle;
-	skit_slice_set_length(&result, index2-index1);
-	skit_slice_set_offset(&result, index1 + old_offset);
-	if ( SKIT_SLICE_IS_CSTR(slice) )
+	size_t new_offset = index1 + old_offset;
+	size_t new_length = index2 - index1;
+	if ( new_offset == 0 ||
+		(new_offset <= (META_OFFSET_MASK >> META_OFFSET_SHIFT) &&
+		 new_length <= (META_LENGTH_MASK >> META_LENGTH_SHIFT)) )
+	{
+		result.chars_handle = slice.chars_handle;
+		skit_slice_set_length(&result, new_length);
+		skit_slice_set_offset(&result, new_offset);
+		if ( SKIT_SLICE_IS_CSTR(slice) )
+			SKIT_STRING_SET_ALLOC_TYPE(result.meta, skit_string_alloc_type_cstr);
+	}
+	else
+	{
+		/* Too large for the compact layout: point at the characters directly. */
+		/* See ".meta layout" for details. */
+		result.chars_handle = sSPTR(slice) + index1;
 		SKIT_STRING_SET_ALLOC_TYPE(result.meta, skit_string_alloc_type_cstr);
+		skit_slice_set_length(&result, new_length);
+	}
 	
 	DEBUG(printf("skit_slice_of.result = {ptr=%p,offset=%ld,len=%ld}\n",
 		sSPTR(result), skit_slice_get_offset(slice), sSLENGTH(result)));
@@ -1027,6 +1372,41 @@ static void skit_slice_of_subtest(skit_slice slice0)
 	sASSERT_EQS(slice4, sSLICE("a"));
 }
 
+static void skit_slice_of_large_test()
+{
+	/* Only a few bytes of this are ever touched, so most of it never needs */
+	/*   to be backed by physical memory. */
+	size_t big = (1ULL << 28) + 64;
+	skit_loaf loaf = skit_loaf_alloc(big);
+	sASSERT_EQ(sLLENGTH(loaf), big);
+	skit_utf8c *ptr = sLPTR(loaf);
+	memcpy(ptr, "begin", 5);
+	memcpy(ptr + big - 3, "end", 3);
+	sASSERT_EQ(ptr[big], '\0');
+
+	/* No offset: still goes through the loaf's handle. */
+	skit_slice head = skit_slice_of(loaf.as_slice, 0, big - 32);
+	sASSERT_EQ(sSLENGTH(head), big - 32);
+	sASSERT(sSPTR(head) == ptr);
+
+	/* Large offsets and lengths. */
+	skit_slice tail = skit_slice_of(loaf.as_slice, big - 3, SKIT_EOT);
+	sASSERT_EQS(tail, sSLICE("end"));
+	skit_slice mid = skit_slice_of(loaf.as_slice, 2, SKIT_EOT);
+	sASSERT_EQ(sSLENGTH(mid), big - 2);
+	sASSERT(sSPTR(mid) == ptr + 2);
+	sASSERT_EQS(skit_slice_of(mid, -3, SKIT_EOT), sSLICE("end"));
+	skit_slice end = skit_slice_of(loaf.as_slice, -3, SKIT_EOT);
+	sASSERT_EQS(end, sSLICE("end"));
+
+	/* Small slices of large strings stay small. */
+	sASSERT_EQS(skit_slice_of(head, 0, 5), sSLICE("begin"));
+	sASSERT_EQS(skit_slice_of(mid, 0, 3), sSLICE("gin"));
+
+	skit_loaf_free(&loaf);
+	printf("  skit_slice_of_large_test passed.\n");
+}
+
 static void skit_slice_of_test()
 {
 	printf("  skit_slice_of_subtest: slice of a loaf.\n");
@@ -1068,23 +1448,19 @@ skit_loaf skit_loaf_free(skit_loaf *loaf)
 	skit_string_alloc_type alloc_type = SKIT_STRING_GET_ALLOC_TYPE(loaf->as_slice.meta);
 	
 	skit_utf8c **handle_ptr = (skit_utf8c**)loaf->chars_handle;
-	if ( *handle_ptr == NULL )
-	{
-		/* Shallow string storage configuration.  Only 1 free needed. */
-		if ( alloc_type == skit_string_alloc_type_malloc )
-			skit_free(loaf->chars_handle);
-	}
-	else
+	if ( *handle_ptr != NULL )
 	{
 		/* Deeper storage configuration with an extra layer of indirection. */
-		skit_free(*handle_ptr);
-		
-		/* The original block might not come from malloc, so we have to check
-		  its allocation type and make sure. */
-		if ( alloc_type == skit_string_alloc_type_malloc )
-			skit_free(loaf->chars_handle);
+		skit_loaf_heap_free(*handle_ptr);
 	}
 	
+	/* The original block might not come from malloc, so we have to check
+	  its allocation type and make sure. */
+	if ( alloc_type == skit_string_alloc_type_malloc )
+		skit_free(loaf->chars_handle);
+	else if ( alloc_type == skit_string_alloc_type_small )
+		skit_loaf_small_free(loaf->chars_handle);
+	
 	*loaf = skit_loaf_null();
 	return *loaf;
 }
@@ -1505,6 +1881,198 @@ static void skit_slice_ascii_cmp_test()
 
 /* ------------------------------------------------------------------------- */
 
+/*
+The hash is in the style of wyhash: the input is consumed 16 bytes at a time
+(48 when it is long enough to keep three lanes busy), and each block is mixed
+into the state with a 64x64->128 bit multiply whose halves are folded
+together.  Inputs of 16 bytes or less never loop.
+
+The case-insensitive variant lowercases each word as it is loaded, so it
+costs only a few extra bitwise operations per 8 bytes.
+*/
+
+static const uint64_t skit_hash_secret[4] = {
+	0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+	0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL };
+
+static void skit_hash_mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)(*a) * (*b);
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*a = lo;
+	*b = hi;
+#endif
+}
+
+static uint64_t skit_hash_mix(uint64_t a, uint64_t b)
+{
+	skit_hash_mum(&a, &b);
+	return a ^ b;
+}
+
+/* Lowercases every ASCII letter in a word without branching. */
+/* Bytes >= 0x80 are left alone, just like skit_char_ascii_to_lower does. */
+static uint64_t skit_hash_fold64(uint64_t w)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	uint64_t low7 = w & (0x7f * ones);
+	uint64_t ge_a = low7 + ((0x80 - 'A') * ones);
+	uint64_t gt_z = low7 + ((0x80 - 'Z' - 1) * ones);
+	uint64_t is_upper = (ge_a ^ gt_z) & ~w & (0x80 * ones);
+	return w | (is_upper >> 2);
+}
+
+static uint64_t skit_hash_r8(const uint8_t *p, int icase)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return icase ? skit_hash_fold64(v) : v;
+}
+
+static uint64_t skit_hash_r4(const uint8_t *p, int icase)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return icase ? (uint32_t)skit_hash_fold64(v) : v;
+}
+
+static uint64_t skit_hash_r1(const uint8_t *p, int icase)
+{
+	return icase ? skit_char_ascii_to_lower(*p) : *p;
+}
+
+static uint64_t skit_slice_hash_impl(const uint8_t *p, size_t len, uint64_t seed, int icase)
+{
+	const uint64_t *s = skit_hash_secret;
+	uint64_t a, b;
+
+	seed ^= skit_hash_mix(seed ^ s[0], s[1]);
+	if ( len <= 16 )
+	{
+		if ( len >= 4 )
+		{
+			size_t shift = (len >> 3) << 2;
+			a = (skit_hash_r4(p, icase) << 32) | skit_hash_r4(p + shift, icase);
+			b = (skit_hash_r4(p + len - 4, icase) << 32) | skit_hash_r4(p + len - 4 - shift, icase);
+		}
+		else if ( len > 0 )
+		{
+			a = (skit_hash_r1(p, icase) << 16) | (skit_hash_r1(p + (len >> 1), icase) << 8) | skit_hash_r1(p + len - 1, icase);
+			b = 0;
+		}
+		else
+			a = b = 0;
+	}
+	else
+	{
+		size_t i = len;
+		if ( i > 48 )
+		{
+			uint64_t see1 = seed, see2 = seed;
+			do
+			{
+				seed = skit_hash_mix(skit_hash_r8(p,      icase) ^ s[1], skit_hash_r8(p + 8,  icase) ^ seed);
+				see1 = skit_hash_mix(skit_hash_r8(p + 16, icase) ^ s[2], skit_hash_r8(p + 24, icase) ^ see1);
+				see2 = skit_hash_mix(skit_hash_r8(p + 32, icase) ^ s[3], skit_hash_r8(p + 40, icase) ^ see2);
+				p += 48;
+				i -= 48;
+			} while ( i > 48 );
+			seed ^= see1 ^ see2;
+		}
+		while ( i > 16 )
+		{
+			seed = skit_hash_mix(skit_hash_r8(p, icase) ^ s[1], skit_hash_r8(p + 8, icase) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = skit_hash_r8(p + i - 16, icase);
+		b = skit_hash_r8(p + i - 8, icase);
+	}
+
+	a ^= s[1];
+	b ^= seed;
+	skit_hash_mum(&a, &b);
+	return skit_hash_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+uint64_t skit_slice_hash_seeded(const skit_slice slice, uint64_t seed)
+{
+	return skit_slice_hash_impl(sSPTR(slice), sSLENGTH(slice), seed, 0);
+}
+
+uint64_t skit_slice_ihash_seeded(const skit_slice slice, uint64_t seed)
+{
+	return skit_slice_hash_impl(sSPTR(slice), sSLENGTH(slice), seed, 1);
+}
+
+uint64_t skit_slice_chash_seeded(const skit_slice slice, uint64_t seed, int case_sensitive)
+{
+	return skit_slice_hash_impl(sSPTR(slice), sSLENGTH(slice), seed, !case_sensitive);
+}
+
+uint64_t skit_slice_hash(const skit_slice slice)  { return skit_slice_hash_seeded(slice, 0); }
+uint64_t skit_slice_ihash(const skit_slice slice) { return skit_slice_ihash_seeded(slice, 0); }
+
+static void skit_slice_hash_test()
+{
+	char buf[128];
+	char upper[128];
+	int i;
+	for ( i = 0; i < (int)sizeof(buf); i++ )
+	{
+		buf[i] = 'a' + (i % 26);
+		upper[i] = 'A' + (i % 26);
+	}
+
+	/* Every length takes a slightly different path through the hash. */
+	ssize_t len;
+	for ( len = 0; len <= (ssize_t)sizeof(buf); len++ )
+	{
+		skit_slice lo = skit_slice_of_cstrn(buf, len);
+		skit_slice hi = skit_slice_of_cstrn(upper, len);
+
+		/* Deterministic, and independent of where the bytes live. */
+		skit_loaf copy = skit_loaf_dup(lo);
+		sASSERT_EQ(skit_slice_hash(lo), skit_slice_hash(copy.as_slice));
+		skit_loaf_free(&copy);
+
+		sASSERT_EQ(skit_slice_ihash(lo), skit_slice_ihash(hi));
+		sASSERT_EQ(skit_slice_ihash(lo), skit_slice_hash(lo));
+		sASSERT_EQ(skit_slice_chash_seeded(hi, 7, 0), skit_slice_hash_seeded(lo, 7));
+		sASSERT_EQ(skit_slice_chash_seeded(hi, 7, 1), skit_slice_hash_seeded(hi, 7));
+		if ( len > 0 )
+		{
+			sASSERT_NE(skit_slice_hash(lo), skit_slice_hash(hi));
+			sASSERT_NE(skit_slice_hash(lo), skit_slice_hash(skit_slice_of_cstrn(buf, len-1)));
+			sASSERT_NE(skit_slice_hash_seeded(lo, 1), skit_slice_hash_seeded(lo, 2));
+		}
+	}
+
+	/* Only letters are folded. */
+	sASSERT_NE(skit_slice_ihash(sSLICE("@[`{")), skit_slice_ihash(sSLICE("`{@[")));
+	sASSERT_NE(skit_slice_ihash(sSLICE("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@")),
+	           skit_slice_ihash(sSLICE("````````````````````````````````")));
+	sASSERT_EQ(skit_slice_ihash(sSLICE("Content-Length: \xC3\x89")),
+	           skit_slice_ihash(sSLICE("content-LENGTH: \xC3\x89")));
+
+	/* Null slices hash like empty ones. */
+	sASSERT_EQ(skit_slice_hash(skit_slice_null()), skit_slice_hash(sSLICE("")));
+
+	printf("  skit_slice_hash_test passed.\n");
+}
+
+/* ------------------------------------------------------------------------- */
+
 /* --- Case-sensitive --- */
 int skit_slice_ges(const skit_slice str1, const skit_slice str2) { return ( skit_slice_ascii_cmp(str1,str2) >= 0 ); }
 int skit_slice_gts(const skit_slice str1, const skit_slice str2) { return ( skit_slice_ascii_cmp(str1,str2) >  0 ); }
@@ -1859,27 +2427,281 @@ static void skit_slice_match_test_nl()
 
 /* ------------------------------------------------------------------------- */
 
-int skit_slice_find(
+/*
+Substring search.
+
+Short needles are located by scanning for positions where both the first and
+the last byte of the needle occur, and only then comparing the bytes in
+between.  With SSE2 this tests 16 positions at a time.  SSE2 is part of the
+x86-64 baseline, so no runtime CPU detection is needed; other targets use
+memchr (which libc implementations vectorize) for the first-byte scan.
+
+Long needles use the Two-Way algorithm (Crochemore & Perrin, 1991), which is
+linear in the length of the haystack no matter what the input looks like and
+needs only constant extra space.
+*/
+#if defined(__SSE2__) && defined(__GNUC__)
+#  define SKIT_SLICE_FIND_USE_SSE2 1
+#  include <emmintrin.h>
+#else
+#  define SKIT_SLICE_FIND_USE_SSE2 0
+#endif
+
+/* Needles at least this long are searched for with Two-Way. */
+#define SKIT_SLICE_FIND_TWO_WAY_THRESHOLD 32
+
+/* Returns the index of the first match at or after 0, or -1. */
+static ssize_t skit_find_first_last(
+	const skit_utf8c *hay, size_t hay_len,
+	const skit_utf8c *needle, size_t needle_len)
+{
+	skit_utf8c first = needle[0];
+	skit_utf8c last  = needle[needle_len-1];
+	size_t i = 0;
+
+	if ( needle_len > hay_len )
+		return -1;
+
+#if SKIT_SLICE_FIND_USE_SSE2
+	const __m128i first_v = _mm_set1_epi8((char)first);
+	const __m128i last_v  = _mm_set1_epi8((char)last);
+	for ( ; i + needle_len - 1 + 16 <= hay_len; i += 16 )
+	{
+		__m128i block_first = _mm_loadu_si128((const __m128i*)(hay + i));
+		__m128i block_last  = _mm_loadu_si128((const __m128i*)(hay + i + needle_len - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(first_v, block_first),
+			_mm_cmpeq_epi8(last_v,  block_last)));
+
+		while ( mask != 0 )
+		{
+			size_t candidate = i + __builtin_ctz(mask);
+			if ( needle_len <= 2 || memcmp(hay + candidate + 1, needle + 1, needle_len - 2) == 0 )
+				return candidate;
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	while ( i + needle_len <= hay_len )
+	{
+		const skit_utf8c *found = memchr(hay + i, first, (hay_len - needle_len + 1) - i);
+		if ( found == NULL )
+			return -1;
+
+		i = found - hay;
+		if ( hay[i + needle_len - 1] == last
+		&&   (needle_len <= 2 || memcmp(hay + i + 1, needle + 1, needle_len - 2) == 0) )
+			return i;
+		i++;
+	}
+
+	return -1;
+}
+
+/* Computes the critical factorization of 'needle' for the Two-Way algorithm. */
+/* Returns the index of the critical position and stores the period of the */
+/* right half in *period. */
+static size_t skit_two_way_critical_factorization(
+	const skit_utf8c *needle, size_t needle_len, size_t *period)
+{
+	size_t max_suffix, max_suffix_rev;
+	size_t j, k, p;
+	skit_utf8c a, b;
+
+	/* Maximal suffix for the '<' ordering. */
+	/* max_suffix starts at SIZE_MAX ("-1") so that max_suffix + k wraps to k - 1. */
+	max_suffix = SIZE_MAX;
+	j = 0;
+	k = p = 1;
+	while ( j + k < needle_len )
+	{
+		a = needle[j + k];
+		b = needle[max_suffix + k];
+		if ( a < b )
+		{
+			j += k;
+			k = 1;
+			p = j - max_suffix;
+		}
+		else if ( a == b )
+		{
+			if ( k != p )
+				k++;
+			else
+			{
+				j += p;
+				k = 1;
+			}
+		}
+		else
+		{
+			max_suffix = j++;
+			k = p = 1;
+		}
+	}
+	*period = p;
+
+	/* Maximal suffix for the '>' ordering. */
+	max_suffix_rev = SIZE_MAX;
+	j = 0;
+	k = p = 1;
+	while ( j + k < needle_len )
+	{
+		a = needle[j + k];
+		b = needle[max_suffix_rev + k];
+		if ( b < a )
+		{
+			j += k;
+			k = 1;
+			p = j - max_suffix_rev;
+		}
+		else if ( a == b )
+		{
+			if ( k != p )
+				k++;
+			else
+			{
+				j += p;
+				k = 1;
+			}
+		}
+		else
+		{
+			max_suffix_rev = j++;
+			k = p = 1;
+		}
+	}
+
+	/* Choose the longer suffix.  The +1 avoids comparisons against SIZE_MAX. */
+	if ( max_suffix_rev + 1 < max_suffix + 1 )
+		return max_suffix + 1;
+	*period = p;
+	return max_suffix_rev + 1;
+}
+
+/* Returns the index of the first match, or -1. */
+static ssize_t skit_find_two_way(
+	const skit_utf8c *hay, size_t hay_len,
+	const skit_utf8c *needle, size_t needle_len)
+{
+	size_t i, j, period, suffix;
+
+	if ( needle_len > hay_len )
+		return -1;
+
+	suffix = skit_two_way_critical_factorization(needle, needle_len, &period);
+
+	if ( memcmp(needle, needle + period, suffix) == 0 )
+	{
+		/* The needle is periodic: remember how much of the left half is */
+		/* already known to match after each shift by 'period'. */
+		size_t memory = 0;
+		j = 0;
+		while ( j <= hay_len - needle_len )
+		{
+			i = SKIT_MAX(suffix, memory);
+			while ( i < needle_len && needle[i] == hay[i + j] )
+				i++;
+
+			if ( needle_len <= i )
+			{
+				i = suffix - 1;
+				while ( memory < i + 1 && needle[i] == hay[i + j] )
+					i--;
+				if ( i + 1 < memory + 1 )
+					return j;
+
+				j += period;
+				memory = needle_len - period;
+			}
+			else
+			{
+				j += i - suffix + 1;
+				memory = 0;
+			}
+		}
+	}
+	else
+	{
+		/* The two halves of the needle are distinct: a mismatch in the */
+		/* left half allows a shift of at least max(suffix, len-suffix)+1. */
+		period = SKIT_MAX(suffix, needle_len - suffix) + 1;
+		j = 0;
+		while ( j <= hay_len - needle_len )
+		{
+			i = suffix;
+			while ( i < needle_len && needle[i] == hay[i + j] )
+				i++;
+
+			if ( needle_len <= i )
+			{
+				i = suffix - 1;
+				while ( i != SIZE_MAX && needle[i] == hay[i + j] )
+					i--;
+				if ( i == SIZE_MAX )
+					return j;
+				j += period;
+			}
+			else
+				j += i - suffix + 1;
+		}
+	}
+
+	return -1;
+}
+
+int skit_slice_find_from(
 	const skit_slice haystack,
 	const skit_slice needle,
+	ssize_t from,
 	ssize_t *output_pos)
 {
-	ssize_t pos;
-	ssize_t len = sSLENGTH(haystack);
+	ssize_t pos = -1;
+	ssize_t haystack_length = sSLENGTH(haystack);
+	ssize_t needle_length = sSLENGTH(needle);
+	skit_utf8c *haystack_chars = sSPTR(haystack);
+	skit_utf8c *needle_chars = sSPTR(needle);
+	sASSERT(haystack_chars != NULL);
+	sASSERT(needle_chars != NULL);
+	sASSERT_GE(from, 0);
+
 	if ( output_pos == NULL )
 		output_pos = &pos;
 
-	for ( pos = 0; pos < len; pos++ )
+	if ( from >= haystack_length )
+		pos = -1;
+	else if ( needle_length == 0 )
+		pos = from;
+	else
 	{
-		if ( skit_slice_match(haystack,needle,pos) )
+		const skit_utf8c *hay = haystack_chars + from;
+		size_t hay_len = haystack_length - from;
+
+		if ( needle_length == 1 )
 		{
-			*output_pos = pos;
-			return 1;
+			const skit_utf8c *found = memchr(hay, needle_chars[0], hay_len);
+			pos = (found == NULL ? -1 : found - hay);
 		}
+		else if ( needle_length < SKIT_SLICE_FIND_TWO_WAY_THRESHOLD )
+			pos = skit_find_first_last(hay, hay_len, needle_chars, needle_length);
+		else
+			pos = skit_find_two_way(hay, hay_len, needle_chars, needle_length);
+
+		if ( pos >= 0 )
+			pos += from;
 	}
 
-	*output_pos = -1;
-	return 0;
+	*output_pos = pos;
+	return pos >= 0;
+}
+
+int skit_slice_find(
+	const skit_slice haystack,
+	const skit_slice needle,
+	ssize_t *output_pos)
+{
+	return skit_slice_find_from(haystack, needle, 0, output_pos);
 }
 
 static void skit_slice_find_test()
@@ -1897,6 +2719,62 @@ static void skit_slice_find_test()
 	printf("  skit_slice_find_test passed.\n");
 }
 
+/* Straightforward search used to check the fast paths. */
+static ssize_t skit_slice_find_naive(skit_slice haystack, skit_slice needle, ssize_t from)
+{
+	ssize_t pos;
+	for ( pos = from; pos < sSLENGTH(haystack); pos++ )
+		if ( skit_slice_match(haystack, needle, pos) )
+			return pos;
+	return -1;
+}
+
+static void skit_slice_find_from_test()
+{
+	ssize_t pos = 0;
+	skit_slice text = sSLICE("foo bar foo bar foo");
+	sASSERT(skit_slice_find_from(text, sSLICE("foo"), 0, &pos));
+	sASSERT_EQ(pos, 0);
+	sASSERT(skit_slice_find_from(text, sSLICE("foo"), 1, &pos));
+	sASSERT_EQ(pos, 8);
+	sASSERT(skit_slice_find_from(text, sSLICE("foo"), 9, &pos));
+	sASSERT_EQ(pos, 16);
+	sASSERT(!skit_slice_find_from(text, sSLICE("foo"), 17, &pos));
+	sASSERT_EQ(pos, -1);
+	sASSERT(!skit_slice_find_from(text, sSLICE("foo"), 100, &pos));
+	sASSERT_EQ(pos, -1);
+
+	/* Compare every code path against the naive search. */
+	/* The alphabet is small so that partial matches are common. */
+	char hay_buf[300];
+	char needle_buf[80];
+	unsigned int seed = 12345;
+	int trial;
+	for ( trial = 0; trial < 2000; trial++ )
+	{
+		ssize_t i;
+		ssize_t hay_len = (seed = seed * 1103515245 + 12345) % sizeof(hay_buf);
+		ssize_t needle_len = 1 + (seed = seed * 1103515245 + 12345) % (sizeof(needle_buf)-1);
+		int alphabet = 2 + (trial % 3);
+		for ( i = 0; i < hay_len; i++ )
+			hay_buf[i] = 'a' + ((seed = seed * 1103515245 + 12345) >> 16) % alphabet;
+		for ( i = 0; i < needle_len; i++ )
+			needle_buf[i] = 'a' + ((seed = seed * 1103515245 + 12345) >> 16) % alphabet;
+
+		/* Make sure there is often something to find. */
+		if ( trial % 2 == 0 && needle_len <= hay_len )
+			memcpy(needle_buf, hay_buf + (hay_len - needle_len) / 2, needle_len);
+
+		skit_slice haystack = skit_slice_of_cstrn(hay_buf, hay_len);
+		skit_slice needle = skit_slice_of_cstrn(needle_buf, needle_len);
+		ssize_t from = hay_len == 0 ? 0 : (seed >> 16) % (hay_len/4 + 1);
+		skit_slice_find_from(haystack, needle, from, &pos);
+		sASSERT_EQ(pos, skit_slice_find_naive(haystack, needle, from));
+	}
+
+	printf("  skit_slice_find_from_test passed.\n");
+}
+
 /* ------------------------------------------------------------------------- */
 
 int skit_slice_partition(
@@ -2137,6 +3015,7 @@ static void skit_slice_escapify_test()
 void skit_string_unittest()
 {
 	printf("skit_slice_unittest()\n");
+	skit_loaf_small_test();
 	skit_loaf_emplace_test();
 	skit_loaf_on_stack_test();
 	skit_slice_len_test();
@@ -2148,6 +3027,7 @@ void skit_string_unittest()
 	skit_slice_sSLICE_test();
 	skit_loaf_resize_test();
 	skit_loaf_append_test();
+	skit_loaf_reserve_test();
 	skit_slice_concat_test();
 	skit_slice_buffered_resize_test();
 	skit_slice_buffered_append_test();
@@ -2157,6 +3037,7 @@ void skit_string_unittest()
 	skit_loaf_store_slice_test();
 	skit_loaf_assign_slice_test();
 	skit_slice_of_test();
+	skit_slice_of_large_test();
 	skit_loaf_free_test();
 	skit_slice_get_printf_formatter_test();
 	skit_is_alpha_test();
@@ -2168,6 +3049,7 @@ void skit_string_unittest()
 	skit_slice_to_upper_test();
 	skit_slice_common_prefix_test();
 	skit_slice_ascii_cmp_test();
+	skit_slice_hash_test();
 	skit_slice_comparison_ops_test();
 	skit_slice_trimx_test();
 	skit_slice_trim_test();
@@ -2175,6 +3057,7 @@ void skit_string_unittest()
 	skit_slice_match_test();
 	skit_slice_match_test_nl();
 	skit_slice_find_test();
+	skit_slice_find_from_test();
 	skit_slice_partition_test();
 	skit_slice_take_head_test();
 	skit_slice_escapify_test();
@@ -3,12 +3,16 @@
 
 #include <inttypes.h> /* uint8_t, uint16_t, uint32_t */
 #include <unistd.h> /* For ssize_t */
-#include <limits.h> /* For INT_MAX */
+#include <limits.h> /* For SSIZE_MAX and INT_MAX */
 
 #include "survival_kit/math.h"
 
 /* Used in skit_slice_of.  See skit_slice_of for usage. */
+#if defined(SSIZE_MAX)
+#define SKIT_EOT SSIZE_MAX
+#else
 #define SKIT_EOT INT_MAX
+#endif
 
 /* ----------------------------- string types ------------------------------ */
 
@@ -72,8 +76,14 @@ Other notes:
     type.  Either pass it as a pointer or pass it's '.as_slice' value.  Passing
     a skit_loaf as a pointer is a way of communicating to the called function
     that ownership of the loaf is being (temporarily) transferred.
-- Both loaves and slices have a max length limit of about 286MB worth of
-    characters (2^28 bytes).  
+- Loaves and slices may be as long as 2^56 bytes.  Strings with lengths and
+    offsets below 2^28 (256MB) use a compact representation.  Beyond that,
+    a slice that starts at a nonzero offset of a loaf points directly at the
+    loaf's characters instead of going through the loaf's handle, so it
+    will not follow the loaf's data if the loaf is later resized.  Such
+    large slices must be taken again after resizing the loaf.  Slices of
+    loaves that are not resized (ex: a slurped file being parsed) are
+    unaffected.
 */
 
 /**
@@ -301,7 +311,7 @@ Example:
 	sASSERT_EQ(skit_slice_len(slice), 3);
 	sASSERT_EQ_CSTR((char*)sSPTR(slice), "foo");
 */
-skit_slice skit_slice_of_cstrn(const char *cstr, int length );
+skit_slice skit_slice_of_cstrn(const char *cstr, ssize_t length );
 
 /**
 Creates a slice of the given nul-terminated C string.
@@ -347,7 +357,10 @@ Example:
 
 /**
 Resizes the given 'loaf' to the given 'length'.
-This will call skit_realloc to adjust the underlying memory size.
+If the loaf's capacity (see skit_loaf_capacity) is not large enough, this
+will call skit_realloc to grow the underlying memory by at least half again
+its previous capacity, so that a loop of small appends is amortized O(1) per
+byte.  Shrinking never releases memory; the capacity is kept for later growth.
 'loaf' will be altered in-place, and the result will also be returned.
 When growing text, any nul-terminating character immediately following the text
 will remain in place, and a nul-terminating character will also be placed at
@@ -371,9 +384,33 @@ Example:
 skit_loaf *skit_loaf_resize(skit_loaf *loaf, size_t length);
 
 
+/**
+Ensures that 'loaf' can grow to at least 'capacity' bytes without another
+allocation.  This does not change the loaf's length or contents.
+Callers that know how large a loaf will become can reserve that much up
+front, so that the following appends or resizes never reallocate.
+Unlike skit_loaf_resize, this allocates exactly what is asked for.
+'loaf' will be altered in-place, and the result will also be returned.
+
+Example:
+	skit_loaf loaf = skit_loaf_copy_cstr("Hello");
+	skit_loaf_reserve(&loaf, 100);
+	sASSERT_EQ(sLLENGTH(loaf), 5);
+	sASSERT_GE(skit_loaf_capacity(loaf), 100);
+	skit_loaf_free(&loaf);
+*/
+skit_loaf *skit_loaf_reserve(skit_loaf *loaf, size_t capacity);
+
+/**
+Returns the length that 'loaf' can be resized to without allocating memory.
+This is never less than the loaf's length.
+*/
+size_t skit_loaf_capacity(skit_loaf loaf);
+
 /**
 Appends 'str2' onto the end of 'loaf1'.
-The additional memory needed is created using realloc. 
+The additional memory needed is created with skit_loaf_resize, so appending
+many small pieces to the same loaf does not reallocate on every call.
 Example:
 	skit_loaf loaf = skit_loaf_copy_cstr("Hello");
 	skit_loaf_append(&loaf, sSLICE(" world!"));
@@ -1147,6 +1184,33 @@ int skit_slice_ascii_cmp(const skit_slice str1, const skit_slice str2);
 int skit_slice_ascii_icmp(const skit_slice str1, const skit_slice str2);
 int skit_slice_ascii_ccmp(const skit_slice str1, const skit_slice str2, int case_sensitive);
 
+/**
+Fast, non-cryptographic hashes of a slice's contents.
+
+These are suitable for hash tables and for quickly rejecting unequal
+strings, but not for anything that has to resist a deliberate attacker.
+Use a per-table random 'seed' when the keys come from untrusted input.
+
+The 'ihash' variants are case-insensitive in the same way that
+skit_slice_ascii_icmp is: any two slices that compare equal with
+skit_slice_ascii_icmp have the same ihash.  The 'chash' variant chooses
+between the two at runtime.
+
+Hash values may differ between platforms and between versions of this
+library, so they should not be written to files or sent over the network.
+
+Example:
+	sASSERT_EQ(skit_slice_hash(sSLICE("foo")), skit_slice_hash(sSLICE("foo")));
+	sASSERT_NE(skit_slice_hash(sSLICE("foo")), skit_slice_hash(sSLICE("FOO")));
+	sASSERT_EQ(skit_slice_ihash(sSLICE("foo")), skit_slice_ihash(sSLICE("FOO")));
+	sASSERT_NE(skit_slice_hash_seeded(sSLICE("foo"), 1), skit_slice_hash_seeded(sSLICE("foo"), 2));
+*/
+uint64_t skit_slice_hash(const skit_slice slice);
+uint64_t skit_slice_ihash(const skit_slice slice);
+uint64_t skit_slice_hash_seeded(const skit_slice slice, uint64_t seed);
+uint64_t skit_slice_ihash_seeded(const skit_slice slice, uint64_t seed);
+uint64_t skit_slice_chash_seeded(const skit_slice slice, uint64_t seed, int case_sensitive);
+
 /**
 Convenient string comparison functions.
 
@@ -1341,6 +1405,35 @@ int skit_slice_find(
 	const skit_slice needle,
 	ssize_t *output_pos);
 
+/// Like skit_slice_find, but the search begins at index 'from' in 'haystack'.
+/// The position stored in 'output_pos' is relative to the start of 'haystack',
+/// so repeated searches can feed the previous result (plus one) back in
+/// without re-slicing.
+/// If 'from' is at or past the end of 'haystack', nothing is found.
+///
+/// Preconditions:
+/// 'haystack' must be non-null.
+/// 'needle' must be non-null.
+/// 'from' must be non-negative.
+///
+/// Returns 1 if it was found, or 0 if it was not.
+/// Example:
+///   ssize_t pos = 0;
+///   skit_slice text = sSLICE("foo bar foo bar foo");
+///   sASSERT(skit_slice_find_from(text, sSLICE("foo"), 0, &pos));
+///   sASSERT_EQ(pos, 0);
+///   sASSERT(skit_slice_find_from(text, sSLICE("foo"), 1, &pos));
+///   sASSERT_EQ(pos, 8);
+///   sASSERT(skit_slice_find_from(text, sSLICE("foo"), 9, &pos));
+///   sASSERT_EQ(pos, 16);
+///   sASSERT(!skit_slice_find_from(text, sSLICE("foo"), 17, &pos));
+///   sASSERT_EQ(pos, -1);
+int skit_slice_find_from(
+	const skit_slice haystack,
+	const skit_slice needle,
+	ssize_t from,
+	ssize_t *output_pos);
+
 /// Finds the first occurrence of 'delimiter' in 'text' and splits it into
 /// left (head) and right (tail) slices.
 ///
@@ -0,0 +1,256 @@
+/** See survival_kit/templates/hashmap.h for documentation. */
+
+#ifndef SKIT_T_NAMESPACE
+#define SKIT_T_NAMESPACE skit
+#define SKIT_T_NAMESPACE_IS_DEFAULT 1
+#endif
+
+#include "survival_kit/misc.h"
+#include "survival_kit/assert.h"
+#include "survival_kit/memory.h"
+#include "survival_kit/string.h"
+#include "survival_kit/flags.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef SKIT_HASHMAP_COMMON_DEFINED
+#define SKIT_HASHMAP_COMMON_DEFINED
+/* Smallest number of slots allocated once the map has any entries. */
+#define SKIT_HASHMAP_MIN_CAPACITY 8
+
+/* The map grows when it would become more than 3/4 full. */
+#define SKIT_HASHMAP_FULL(length, capacity) ((length) * 4 > (capacity) * 3)
+#endif
+
+static uint64_t SKIT_T(hashmap_hash)(const SKIT_T(hashmap) *map, skit_slice key)
+{
+	uint64_t hash = skit_slice_chash_seeded(key, map->seed, !(map->flags & SKIT_FLAG_I));
+	return hash != 0 ? hash : 1; /* 0 is reserved for empty slots. */
+}
+
+static int SKIT_T(hashmap_key_eq)(
+	const SKIT_T(hashmap) *map,
+	const SKIT_T(hmslot)  *slot,
+	uint64_t              hash,
+	skit_slice            key)
+{
+	if ( slot->hash != hash || sLLENGTH(slot->key) != sSLENGTH(key) )
+		return 0;
+	if ( map->flags & SKIT_FLAG_I )
+		return skit_slice_ascii_icmp(slot->key.as_slice, key) == 0;
+	return memcmp(sLPTR(slot->key), sSPTR(key), sSLENGTH(key)) == 0;
+}
+
+/* Returns the slot holding 'key', or the empty slot where it would go. */
+static SKIT_T(hmslot) *SKIT_T(hashmap_probe)(
+	const SKIT_T(hashmap) *map,
+	uint64_t              hash,
+	skit_slice            key)
+{
+	size_t mask = map->capacity - 1;
+	size_t i = hash & mask;
+	while ( 1 )
+	{
+		SKIT_T(hmslot) *slot = &map->slots[i];
+		if ( slot->hash == 0 || SKIT_T(hashmap_key_eq)(map, slot, hash, key) )
+			return slot;
+		i = (i + 1) & mask;
+	}
+}
+
+static void SKIT_T(hashmap_rehash)(SKIT_T(hashmap) *map, size_t new_capacity)
+{
+	SKIT_T(hmslot) *old_slots = map->slots;
+	size_t old_capacity = map->capacity;
+
+	map->slots = skit_malloc(new_capacity * sizeof(SKIT_T(hmslot)));
+	memset(map->slots, 0, new_capacity * sizeof(SKIT_T(hmslot)));
+	map->capacity = new_capacity;
+
+	/* The stored hashes are reused: no key is hashed or compared again. */
+	size_t mask = new_capacity - 1;
+	size_t i;
+	for ( i = 0; i < old_capacity; i++ )
+	{
+		if ( old_slots[i].hash == 0 )
+			continue;
+		size_t j = old_slots[i].hash & mask;
+		while ( map->slots[j].hash != 0 )
+			j = (j + 1) & mask;
+		map->slots[j] = old_slots[i];
+	}
+
+	skit_free(old_slots);
+}
+
+void SKIT_T(hashmap_ctor)(SKIT_T(hashmap) *map, skit_flags flags)
+{
+	sASSERT(map != NULL);
+	sASSERT_MSG((flags & ~SKIT_FLAG_I) == 0, "hashmap_ctor only accepts the 'i' flag.");
+	map->slots = NULL;
+	map->capacity = 0;
+	map->length = 0;
+	map->flags = flags;
+	map->seed = 0;
+}
+
+void SKIT_T(hashmap_dtor)(SKIT_T(hashmap) *map)
+{
+	sASSERT(map != NULL);
+	SKIT_T(hashmap_clear)(map);
+	skit_free(map->slots);
+	map->slots = NULL;
+	map->capacity = 0;
+}
+
+SKIT_T(hashmap) *SKIT_T(hashmap_new)(skit_flags flags)
+{
+	SKIT_T(hashmap) *result = skit_malloc(sizeof(SKIT_T(hashmap)));
+	SKIT_T(hashmap_ctor)(result, flags);
+	return result;
+}
+
+SKIT_T(hashmap) *SKIT_T(hashmap_free)(SKIT_T(hashmap) *map)
+{
+	if ( map == NULL )
+		return NULL;
+	SKIT_T(hashmap_dtor)(map);
+	skit_free(map);
+	return NULL;
+}
+
+size_t SKIT_T(hashmap_len)(const SKIT_T(hashmap) *map)
+{
+	sASSERT(map != NULL);
+	return map->length;
+}
+
+void SKIT_T(hashmap_reserve)(SKIT_T(hashmap) *map, size_t n_entries)
+{
+	sASSERT(map != NULL);
+	size_t new_capacity = map->capacity != 0 ? map->capacity : SKIT_HASHMAP_MIN_CAPACITY;
+	while ( SKIT_HASHMAP_FULL(n_entries, new_capacity) )
+		new_capacity *= 2;
+	if ( new_capacity != map->capacity )
+		SKIT_T(hashmap_rehash)(map, new_capacity);
+}
+
+SKIT_T_ELEM_TYPE *SKIT_T(hashmap_get)(const SKIT_T(hashmap) *map, skit_slice key)
+{
+	sASSERT(map != NULL);
+	if ( map->length == 0 )
+		return NULL;
+
+	SKIT_T(hmslot) *slot = SKIT_T(hashmap_probe)(map, SKIT_T(hashmap_hash)(map, key), key);
+	if ( slot->hash == 0 )
+		return NULL;
+	return &slot->val;
+}
+
+int SKIT_T(hashmap_set)(SKIT_T(hashmap) *map, skit_slice key, SKIT_T_ELEM_TYPE val)
+{
+	sASSERT(map != NULL);
+	sASSERT(!skit_slice_is_null(key));
+
+	if ( SKIT_HASHMAP_FULL(map->length + 1, map->capacity) )
+		SKIT_T(hashmap_reserve)(map, map->length + 1);
+
+	uint64_t hash = SKIT_T(hashmap_hash)(map, key);
+	SKIT_T(hmslot) *slot = SKIT_T(hashmap_probe)(map, hash, key);
+	if ( slot->hash != 0 )
+	{
+		slot->val = val;
+		return 0;
+	}
+
+	slot->hash = hash;
+	slot->key = skit_loaf_dup(key);
+	slot->val = val;
+	map->length++;
+	return 1;
+}
+
+int SKIT_T(hashmap_remove)(SKIT_T(hashmap) *map, skit_slice key, SKIT_T_ELEM_TYPE *val)
+{
+	sASSERT(map != NULL);
+	if ( map->length == 0 )
+		return 0;
+
+	SKIT_T(hmslot) *slot = SKIT_T(hashmap_probe)(map, SKIT_T(hashmap_hash)(map, key), key);
+	if ( slot->hash == 0 )
+		return 0;
+
+	if ( val != NULL )
+		*val = slot->val;
+	skit_loaf_free(&slot->key);
+	map->length--;
+
+	/* Shift later members of the probe sequence back into the hole, so that */
+	/*   lookups never need to step over deleted slots. */
+	size_t mask = map->capacity - 1;
+	size_t hole = slot - map->slots;
+	size_t i = hole;
+	while ( 1 )
+	{
+		i = (i + 1) & mask;
+		if ( map->slots[i].hash == 0 )
+			break;
+
+		/* An entry can only move back if the hole is between its home */
+		/*   slot and where it is now. */
+		size_t home = map->slots[i].hash & mask;
+		if ( ((i - home) & mask) >= ((i - hole) & mask) )
+		{
+			map->slots[hole] = map->slots[i];
+			hole = i;
+		}
+	}
+	map->slots[hole].hash = 0;
+	return 1;
+}
+
+void SKIT_T(hashmap_clear)(SKIT_T(hashmap) *map)
+{
+	sASSERT(map != NULL);
+	size_t i;
+	for ( i = 0; i < map->capacity; i++ )
+	{
+		if ( map->slots[i].hash == 0 )
+			continue;
+		skit_loaf_free(&map->slots[i].key);
+		map->slots[i].hash = 0;
+	}
+	map->length = 0;
+}
+
+int SKIT_T(hashmap_next)(
+	const SKIT_T(hashmap) *map,
+	size_t                *cursor,
+	skit_slice            *key,
+	SKIT_T_ELEM_TYPE      **val)
+{
+	sASSERT(map != NULL);
+	sASSERT(cursor != NULL);
+
+	size_t i;
+	for ( i = *cursor; i < map->capacity; i++ )
+	{
+		SKIT_T(hmslot) *slot = &map->slots[i];
+		if ( slot->hash == 0 )
+			continue;
+		if ( key != NULL )
+			*key = slot->key.as_slice;
+		if ( val != NULL )
+			*val = &slot->val;
+		*cursor = i + 1;
+		return 1;
+	}
+	*cursor = map->capacity;
+	return 0;
+}
+
+#ifdef SKIT_T_NAMESPACE_IS_DEFAULT
+#undef SKIT_T_NAMESPACE
+#undef SKIT_T_NAMESPACE_IS_DEFAULT
+#endif
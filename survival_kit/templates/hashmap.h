@@ -0,0 +1,180 @@
+/**
+Template hashmap: defines a hash table type that maps string keys to values
+of type SKIT_T_ELEM_TYPE.
+
+This is the tool to reach for when keys are only ever looked up exactly.
+skit_trie can also enumerate keys by prefix and keeps them sorted, but each
+lookup walks one node per key character.  A hashmap lookup hashes the key
+once (see skit_slice_hash in "survival_kit/string.h") and then usually
+touches a single slot.
+
+The table uses open addressing with linear probing.  All entries live in
+one flat array of slots, and each slot holds the key's full hash, the key,
+and the value.  Probing therefore walks contiguous memory, and the stored
+hashes let most non-matching slots be skipped without looking at their keys.
+Removal shifts later entries back into the hole, so there are no tombstones
+and lookups don't slow down after many removals.
+
+Keys are copied into the map when they are first inserted, so the caller's
+slices don't need to outlive the map.  Values are copied by assignment.
+
+It is the caller's responsibility to undefine template parameters after
+#include'ing this file.  "survival_kit/string.h" should be #include'd
+before the template parameters are defined.
+
+See "survival_kit/hashmap_builtins.h" for hashmap instantiations of common C
+  builtin types, as well as unit tests.
+
+Parameters:
+
+SKIT_T_ELEM_TYPE (required) -
+	The type of the values in the map, ex: int, void*.
+
+SKIT_T_NAMESPACE (optional) -
+	The namespace that the instanced hashmap will live in.
+
+	With a SKIT_T_NAMESPACE of foobar, the resulting type will be
+	foobar_abc_hashmap.
+
+	This, along with SKIT_T_NAME, can be about 9 characters long in total.
+	Any longer and the symbol names generated by the template could be too
+	long for the OpenVMS linker to handle.
+
+	By default, this is defined like so:
+	#define SKIT_T_NAMESPACE skit
+
+SKIT_T_NAME (required) -
+	A unique name that is included in all type/function expansions created by
+	this template.  It works like so:
+
+	EXAMPLE:
+	#define SKIT_T_ELEM_TYPE int
+	#define SKIT_T_NAME int
+	#include "survival_kit/templates/hashmap.h"
+	#undef SKIT_T_ELEM_TYPE
+	#undef SKIT_T_NAME
+
+	skit_int_hashmap map;                          // The type 'skit_int_hashmap' is defined.
+	skit_int_hashmap_ctor(&map, SKIT_FLAGS_NONE);  // The function 'skit_int_hashmap_ctor' is defined.
+	skit_int_hashmap_set(&map, sSLICE("answer"), 42);
+	sASSERT_EQ(*skit_int_hashmap_get(&map, sSLICE("answer")), 42);
+	sASSERT(skit_int_hashmap_get(&map, sSLICE("question")) == NULL);
+	skit_int_hashmap_dtor(&map);
+*/
+
+
+#ifndef SKIT_T_NAMESPACE
+#define SKIT_T_NAMESPACE skit
+#define SKIT_T_NAMESPACE_IS_DEFAULT 1
+#endif
+
+#include "survival_kit/templates/skit_t.h"
+
+#ifndef SKIT_T_ELEM_TYPE
+#error "SKIT_T_ELEM_TYPE is needed but was not defined."
+#endif
+
+#include <inttypes.h>
+#include <unistd.h> /* for ssize_t */
+
+#include "survival_kit/string.h"
+#include "survival_kit/flags.h"
+
+typedef struct SKIT_T(hmslot) SKIT_T(hmslot);
+struct SKIT_T(hmslot)
+{
+	uint64_t          hash;  /* 0 marks an empty slot. */
+	skit_loaf         key;
+	SKIT_T_ELEM_TYPE  val;
+};
+
+typedef struct SKIT_T(hashmap) SKIT_T(hashmap);
+struct SKIT_T(hashmap)
+{
+	SKIT_T(hmslot)  *slots;
+	size_t          capacity;  /* Always 0 or a power of 2. */
+	size_t          length;
+	skit_flags      flags;
+
+	/**
+	Seed given to the key hash function.  This defaults to 0.
+	Maps holding keys from untrusted input should set this to a random
+	value right after construction, before any keys are inserted, so that
+	an attacker can't choose keys that all land in the same slot.
+	*/
+	uint64_t        seed;
+};
+
+/**
+Constructs/destroys a hashmap.
+'flags' may be SKIT_FLAG_I (or sFLAGS("i")) to make key matching
+case-insensitive, or SKIT_FLAGS_NONE.
+In a case-insensitive map, a key keeps the spelling it was first
+inserted with.
+Destroying the map frees its keys, but does not do anything with its values.
+*/
+void SKIT_T(hashmap_ctor)(SKIT_T(hashmap) *map, skit_flags flags);
+void SKIT_T(hashmap_dtor)(SKIT_T(hashmap) *map); /** ditto */
+
+/** Allocates and constructs/destructs and frees a hashmap. */
+SKIT_T(hashmap) *SKIT_T(hashmap_new)(skit_flags flags);
+SKIT_T(hashmap) *SKIT_T(hashmap_free)(SKIT_T(hashmap) *map); /** ditto */
+
+/** Returns the number of entries in the map. */
+size_t SKIT_T(hashmap_len)(const SKIT_T(hashmap) *map);
+
+/**
+Makes room for at least 'n_entries' entries in total, so that the map won't
+need to grow while they are being inserted.
+*/
+void SKIT_T(hashmap_reserve)(SKIT_T(hashmap) *map, size_t n_entries);
+
+/**
+Returns a pointer to the value stored under 'key', or NULL if there is no
+such entry.
+The pointer is invalidated by the next call that adds or removes entries.
+*/
+SKIT_T_ELEM_TYPE *SKIT_T(hashmap_get)(const SKIT_T(hashmap) *map, skit_slice key);
+
+/**
+Stores 'val' under 'key', replacing any value that was already there.
+Returns 1 if a new entry was created, or 0 if an existing one was
+overwritten.
+*/
+int SKIT_T(hashmap_set)(SKIT_T(hashmap) *map, skit_slice key, SKIT_T_ELEM_TYPE val);
+
+/**
+Removes the entry for 'key'.
+If 'val' is not NULL, the removed value is copied into it.
+Returns 1 if an entry was removed, or 0 if there was none.
+*/
+int SKIT_T(hashmap_remove)(SKIT_T(hashmap) *map, skit_slice key, SKIT_T_ELEM_TYPE *val);
+
+/** Removes all entries, but keeps the map's memory for reuse. */
+void SKIT_T(hashmap_clear)(SKIT_T(hashmap) *map);
+
+/**
+Iterates over every entry in the map, in no particular order.
+'cursor' must be set to 0 before the first call.  Each call that returns 1
+fills in 'key' and 'val' (either may be NULL) and advances the cursor.
+Returns 0 when there are no more entries.
+The map must not be modified during iteration, except through the 'val'
+pointers it hands out.
+
+Example:
+	size_t cursor = 0;
+	skit_slice key;
+	int *val;
+	while ( skit_int_hashmap_next(&map, &cursor, &key, &val) )
+		printf("%.*s = %d\n", (int)sSLENGTH(key), sSPTR(key), *val);
+*/
+int SKIT_T(hashmap_next)(
+	const SKIT_T(hashmap) *map,
+	size_t                *cursor,
+	skit_slice            *key,
+	SKIT_T_ELEM_TYPE      **val);
+
+#ifdef SKIT_T_NAMESPACE_IS_DEFAULT
+#undef SKIT_T_NAMESPACE
+#undef SKIT_T_NAMESPACE_IS_DEFAULT
+#endif
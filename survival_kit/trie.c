@@ -6,6 +6,26 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <unistd.h> /* For ssize_t */
+#include <stddef.h> /* For offsetof */
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+Multi-nodes and node16s find their children by comparing the key byte
+against every entry in a short array of characters.  With SSE2, all of them
+are compared at once.  SSE2 is part of the x86-64 baseline, so no runtime CPU
+detection is needed; other targets compare one byte at a time.
+The intrinsics header must come before feature_emulation.h, whose macros
+would otherwise be expanded inside of it.
+*/
+#if defined(__SSE2__) && defined(__GNUC__)
+#  define SKIT_TRIE_USE_SSE2 1
+#  include <emmintrin.h>
+#else
+#  define SKIT_TRIE_USE_SSE2 0
+#endif
 
 #include "survival_kit/feature_emulation.h"
 #include "survival_kit/string.h"
@@ -14,8 +34,10 @@
 #include "survival_kit/memory.h"
 #include "survival_kit/trie.h"
 #include "survival_kit/math.h"
+#include "survival_kit/misc.h"
 
 #include "survival_kit/streams/pfile_stream.h"
+#include "survival_kit/streams/text_stream.h"
 
 #define SKIT_DO_FIND_DEBUG 0
 #if SKIT_DO_FIND_DEBUG != 0
@@ -52,6 +74,7 @@ skit_err_code SKIT_TRIE_KEY_ALREADY_EXISTS;
 skit_err_code SKIT_TRIE_KEY_NOT_FOUND;
 skit_err_code SKIT_TRIE_BAD_FLAGS;
 skit_err_code SKIT_TRIE_WRITE_IN_ITERATION;
+skit_err_code SKIT_TRIE_BAD_IMAGE;
 
 void skit_trie_module_init()
 {
@@ -61,6 +84,7 @@ void skit_trie_module_init()
 	SKIT_REGISTER_EXCEPTION(SKIT_TRIE_KEY_NOT_FOUND,      SKIT_TRIE_EXCEPTION, "Wrote a value to a non-existant key. 'c' (create) not passed in flags.");
 	SKIT_REGISTER_EXCEPTION(SKIT_TRIE_BAD_FLAGS,          SKIT_TRIE_EXCEPTION, "The flags parameter contained invalid characters or an invalid combination.");
 	SKIT_REGISTER_EXCEPTION(SKIT_TRIE_WRITE_IN_ITERATION, SKIT_TRIE_EXCEPTION, "Attempt to do set or remove on a skit_trie with an iterator open.");
+	SKIT_REGISTER_EXCEPTION(SKIT_TRIE_BAD_IMAGE,          SKIT_TRIE_EXCEPTION, "The bytes given as a trie image were not written by skit_trie_save, or have been damaged.");
 }
 
 /* ------------------------------------------------------------------------- */
@@ -167,14 +191,20 @@ static skit_trie_coords skit_trie_continue_lookup(skit_trie_node *node, uint32_t
 
 /* ------------------------------------------------------------------------- */
 
+/*
+A key can also run out partway through a linear node's characters.  The
+node's value then belongs to a shorter key, so that is a prefix match.
+*/
 static int skit_exact_match( skit_trie_coords coords, size_t key_len )
 {
-	return ( coords.pos == key_len && coords.node != NULL && coords.node->have_value );
+	return ( coords.pos == key_len && coords.node != NULL &&
+		coords.n_chars_into_node == 0 && coords.node->have_value );
 }
 
 static int skit_prefix_match( skit_trie_coords coords, size_t key_len )
 {
-	return ( coords.lookup_stopped && key_len == coords.pos && !coords.node->have_value );
+	return ( coords.lookup_stopped && key_len == coords.pos &&
+		(coords.n_chars_into_node > 0 || !coords.node->have_value) );
 }
 
 static int skit_no_match( skit_trie_coords coords, size_t key_len )
@@ -184,9 +214,13 @@ static int skit_no_match( skit_trie_coords coords, size_t key_len )
 
 /* ------------------------------------------------------------------------- */
 
+/* 'trie' may be NULL for lookups that must not write to the trie. */
 static void skit_trie_accumulate_key(skit_trie *trie, size_t pos, const uint8_t *key_frag, size_t frag_len)
 {
 	/* printf("skit_trie_accumulate_key(trie, %d, \"%.*s\")\n", pos, (int)frag_len, key_frag); */
+	if ( trie == NULL )
+		return;
+
 	uint8_t *key_return_buf = sLPTR(trie->key_return_buf);
 	
 	/* printf("  -> '%.*s' ~ '%.*s'\n", pos, key_return_buf, (int)frag_len, key_frag); */
@@ -198,6 +232,185 @@ static void skit_trie_accumulate_key(skit_trie *trie, size_t pos, const uint8_t
 
 /* ------------------------------------------------------------------------- */
 
+/*
+Returns the contiguous block of children used by every node shape except
+tables, or NULL for table nodes.  The block holds nodes_len nodes.
+*/
+static skit_trie_node *skit_trie_node_children(const skit_trie_node *node)
+{
+	if ( node->nodes_len <= SKIT__TRIE_NODE_PREALLOC )
+		return node->nodes.array;
+	else if ( node->nodes_len <= SKIT__TRIE_NODE16_MAX )
+		return node->nodes.n16->children;
+	else if ( node->nodes_len <= SKIT__TRIE_NODE48_MAX )
+		return node->nodes.n48->children;
+	else
+		return NULL;
+}
+
+#if SKIT_TRIE_USE_SSE2
+/* Compares 16 bytes at 'window' against c1 and c2, giving one bit per byte. */
+static unsigned skit_trie_match16(const uint8_t *window, uint8_t c1, uint8_t c2)
+{
+	__m128i block = _mm_loadu_si128((const __m128i*)window);
+	__m128i eq = _mm_or_si128(
+		_mm_cmpeq_epi8(block, _mm_set1_epi8((char)c1)),
+		_mm_cmpeq_epi8(block, _mm_set1_epi8((char)c2)));
+	return _mm_movemask_epi8(eq);
+}
+
+/* The 16 byte window that ends at the end of a node's chars must stay inside the node. */
+typedef char skit_trie_chars_window_check[
+	(offsetof(skit_trie_node, chars) + SKIT__TRIE_NODE_PREALLOC >= 16) ? 1 : -1];
+#endif
+
+/*
+Returns a mask with bit i set when the i'th character of a multi-node or
+node16 is either c1 or c2.  Pass the same character twice to look for just
+that one.
+*/
+static unsigned skit_trie_node_match_chars(const skit_trie_node *node, uint8_t c1, uint8_t c2)
+{
+	size_t nodes_len = node->nodes_len;
+	sASSERT_LE(nodes_len, SKIT__TRIE_NODE16_MAX);
+
+#if SKIT_TRIE_USE_SSE2
+	unsigned mask;
+	if ( nodes_len <= SKIT__TRIE_NODE_PREALLOC )
+	{
+		/* 'chars' is shorter than 16 bytes, so load the window that ends */
+		/*   where it ends, and shift off the bytes that come before it. */
+		const uint8_t *window = node->chars + SKIT__TRIE_NODE_PREALLOC - 16;
+		mask = skit_trie_match16(window, c1, c2) >> (16 - SKIT__TRIE_NODE_PREALLOC);
+	}
+	else
+		mask = skit_trie_match16(node->nodes.n16->keys, c1, c2);
+
+	return mask & ((1u << nodes_len) - 1);
+#else
+	size_t i;
+	unsigned mask = 0;
+	const uint8_t *chars;
+	if ( nodes_len <= SKIT__TRIE_NODE_PREALLOC )
+		chars = node->chars;
+	else
+		chars = node->nodes.n16->keys;
+
+	for ( i = 0; i < nodes_len; i++ )
+		if ( chars[i] == c1 || chars[i] == c2 )
+			mask |= 1u << i;
+	return mask;
+#endif
+}
+
+/* Returns the index of the lowest set bit in a nonzero mask. */
+static size_t skit_trie_lowest_bit(unsigned mask)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(mask);
+#else
+	size_t i = 0;
+	while ( !(mask & 1) )
+	{
+		mask >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+/*
+Returns the child that character 'c' leads to, or NULL if there is none.
+This works for every node shape except linear nodes with more than one
+character in them.
+*/
+static skit_trie_node *skit_trie_node_find_child(const skit_trie_node *node, uint8_t c)
+{
+	size_t nodes_len = node->nodes_len;
+
+	if ( nodes_len <= SKIT__TRIE_NODE16_MAX )
+	{
+		unsigned mask = skit_trie_node_match_chars(node, c, c);
+		if ( mask == 0 )
+			return NULL;
+		return &skit_trie_node_children(node)[skit_trie_lowest_bit(mask)];
+	}
+	else if ( nodes_len <= SKIT__TRIE_NODE48_MAX )
+	{
+		const skit_trie_node48 *n48 = node->nodes.n48;
+		uint8_t index = n48->index[c];
+		if ( index == 0 )
+			return NULL;
+		return (skit_trie_node*)&n48->children[index-1];
+	}
+	else
+		return node->nodes.table[c];
+}
+
+/*
+Returns the child with the lowest character that is at least 'c', and
+stores that character in *found_c.  Returns NULL if there is no such child.
+Like skit_trie_node_find_child, this does not work for linear nodes with
+more than one character in them.
+*/
+static skit_trie_node *skit_trie_node_child_from(const skit_trie_node *node, uint16_t c, uint8_t *found_c)
+{
+	size_t i;
+	size_t nodes_len = node->nodes_len;
+	const uint8_t *keys = NULL;
+	skit_trie_node *children = NULL;
+
+	if ( nodes_len <= SKIT__TRIE_NODE_PREALLOC )
+	{
+		keys = node->chars;
+		children = node->nodes.array;
+	}
+	else if ( nodes_len <= SKIT__TRIE_NODE16_MAX )
+	{
+		keys = node->nodes.n16->keys;
+		children = node->nodes.n16->children;
+	}
+	else if ( nodes_len <= SKIT__TRIE_NODE48_MAX )
+	{
+		const skit_trie_node48 *n48 = node->nodes.n48;
+		for ( i = c; i < 256; i++ )
+		{
+			if ( n48->index[i] != 0 )
+			{
+				*found_c = i;
+				return (skit_trie_node*)&n48->children[n48->index[i] - 1];
+			}
+		}
+		return NULL;
+	}
+	else
+	{
+		for ( i = c; i < 256; i++ )
+		{
+			if ( node->nodes.table[i] != NULL )
+			{
+				*found_c = i;
+				return node->nodes.table[i];
+			}
+		}
+		return NULL;
+	}
+
+	/* Unsorted key arrays: find the smallest key that isn't below 'c'. */
+	ssize_t best = -1;
+	for ( i = 0; i < nodes_len; i++ )
+		if ( keys[i] >= c && (best < 0 || keys[i] < keys[best]) )
+			best = i;
+
+	if ( best < 0 )
+		return NULL;
+
+	*found_c = keys[best];
+	return &children[best];
+}
+
+/* ------------------------------------------------------------------------- */
+
 static skit_trie_coords skit_trie_next_node(
 	skit_trie *trie,
 	skit_trie_node *current,
@@ -214,7 +427,8 @@ static skit_trie_coords skit_trie_next_node(
 
 	if ( current == NULL )
 	{
-		skit_trie_dump(trie, skit_stream_stdout);
+		if ( trie != NULL )
+			skit_trie_dump(trie, skit_stream_stdout);
 		sASSERT(0);
 	}
 #endif
@@ -260,49 +474,16 @@ static skit_trie_coords skit_trie_next_node(
 		skit_trie_accumulate_key(trie, start_pos, (const uint8_t*)current->chars, current->chars_len);
 		return skit_trie_continue_lookup(&current->nodes.array[0], pos);
 	}
-	else if ( current->chars_len <= SKIT__TRIE_NODE_PREALLOC )
-	{
-		/*
-		There is more than one choice, but few enough that we can
-		fit them in a small amount of space.
-		We scan the 'chars' array; when an element in that matches the
-		current char in our key, then that index is the index to use
-		in the 'nodes' array.
-		*/
-		FIND_DEBUG("%s, %d: Multi node. node->chars == \"%.*s\"\n", __func__, __LINE__, (int)current->chars_len, (char*)current->chars);
-		sASSERT( current->chars_len == current->nodes_len );
-
-		if ( pos >= key_len )
-			return skit_trie_stop_lookup(current, pos, 0);
-
-		char c = key[pos];
-		if ( case_mode == SKIT_TRIE_CASE_TRY_UPPER )
-			c = skit_char_ascii_to_upper(c);
-		else if ( case_mode == SKIT_TRIE_CASE_TRY_LOWER )
-			c = skit_char_ascii_to_lower(c);
-
-		size_t chars_len = current->chars_len;
-		size_t i = 0;
-		for ( ; i < chars_len; i++ )
-			if ( 0 == skit_char_ascii_cmp(current->chars[i], c) )
-				break;
-
-		if ( i == chars_len )
-			return skit_trie_stop_lookup(current, pos, 0);
-
-		skit_trie_accumulate_key(trie, pos, &current->chars[i], 1);
-		return skit_trie_continue_lookup(&current->nodes.array[i], pos+1);
-	}
 	else
 	{
 		/*
-		In this case, there are so many possible paths to take, that
-		it becomes worth it to allocate a 256 *node table and do a
-		lookup on the given character.  Ideally, the lookup will be
-		faster than any attempts to scan through a smaller array
-		of characters.
+		There is more than one choice.  Depending on how many there are,
+		the node is a multi-node (a short array of characters to scan),
+		a node16 (a longer array of characters to scan), a node48 (a byte
+		index into its children), or a 256 entry table of children.
+		skit_trie_node_find_child handles the differences.
 		*/
-		FIND_DEBUG("%s, %d: Table node. node->nodes_len == %d\n", __func__, __LINE__, current->nodes_len);
+		FIND_DEBUG("%s, %d: Branch node. node->nodes_len == %d\n", __func__, __LINE__, current->nodes_len);
 		if ( pos >= key_len )
 			return skit_trie_stop_lookup(current, pos, 0);
 
@@ -311,17 +492,19 @@ static skit_trie_coords skit_trie_next_node(
 		// values, it could end up being negative for high values of key[pos].
 		// To avoid squirrelly sign-expansion issues, we assign it to the
 		// appropriate integer type to begin with. 
-		size_t c = key[pos];
+		uint8_t c = key[pos];
 		if ( case_mode == SKIT_TRIE_CASE_TRY_UPPER )
 			c = skit_char_ascii_to_upper(c);
 		else if ( case_mode == SKIT_TRIE_CASE_TRY_LOWER )
 			c = skit_char_ascii_to_lower(c);
 
-		skit_trie_node *next_node = current->nodes.table[c];
+		skit_trie_node *next_node = skit_trie_node_find_child(current, c);
 		if ( next_node == NULL )
 			return skit_trie_stop_lookup(current, pos, 0);
 
-		skit_trie_accumulate_key(trie, pos, &key[pos], 1);
+		/* Record the character as it is stored, not as it was given: */
+		/*   case-insensitive lookups need to return the exact key. */
+		skit_trie_accumulate_key(trie, pos, &c, 1);
 		return skit_trie_continue_lookup(next_node, pos+1);
 	}
 
@@ -378,10 +561,36 @@ static skit_trie_coords skit_trie_find_icase(
 )
 {
 	FIND_DEBUG("%s, %d: \n", __func__, __LINE__);
+
+	/*
+	Only branch nodes can lead to different places for the upper and lower
+	case versions of a character (linear nodes compare their characters
+	case-insensitively either way).  Even then, both need to be tried only
+	if the node has a child for each of them.  Otherwise, the one way that
+	can work is the only one that is taken.
+	*/
+	skit_trie_node *node = coords.node;
+	skit_trie_case_find_mode first_mode = SKIT_TRIE_CASE_TRY_UPPER;
+	int try_both = 0;
+	if ( node->nodes_len > 1 && coords.pos < key_len )
+	{
+		uint8_t upper = skit_char_ascii_to_upper(key_ptr[coords.pos]);
+		uint8_t lower = skit_char_ascii_to_lower(key_ptr[coords.pos]);
+		if ( upper != lower )
+		{
+			int have_upper = skit_trie_node_find_child(node, upper) != NULL;
+			int have_lower = skit_trie_node_find_child(node, lower) != NULL;
+			if ( have_upper && have_lower )
+				try_both = 1;
+			else if ( have_lower )
+				first_mode = SKIT_TRIE_CASE_TRY_LOWER;
+		}
+	}
+
 	skit_trie_coords end_coords_a = skit_trie_find_icase_r(
-		trie, key_ptr, key_len, coords, SKIT_TRIE_CASE_TRY_UPPER);
+		trie, key_ptr, key_len, coords, first_mode);
 
-	if ( end_coords_a.lookup_stopped && !skit_exact_match(end_coords_a, key_len) )
+	if ( try_both && end_coords_a.lookup_stopped && !skit_exact_match(end_coords_a, key_len) )
 	{
 		FIND_DEBUG("%s, %d: \n", __func__, __LINE__);
 		skit_trie_coords end_coords_b = skit_trie_find_icase_r(
@@ -404,7 +613,12 @@ static skit_trie_coords skit_trie_find_icase(
 
 /* ------------------------------------------------------------------------- */
 
-static skit_trie_coords skit_trie_find(
+/*
+'key_trie' receives the matched key in its key_return_buf.  It may be NULL,
+in which case the lookup does not write to anything.
+*/
+static skit_trie_coords skit_trie_find_from(
+	skit_trie_node *root,
 	skit_trie *trie,
 	const uint8_t *key_ptr,
 	size_t key_len,
@@ -413,14 +627,14 @@ static skit_trie_coords skit_trie_find(
 	FIND_DEBUG("%s(trie, \"%.*s\")\n", __func__, (int)key_len, key_ptr);
 	sASSERT(key_ptr != NULL);
 
-	FIND_DEBUG("%s, %d: trie->root == %p\n", __func__, __LINE__, trie->root);
-	if ( trie->root == NULL )
+	FIND_DEBUG("%s, %d: root == %p\n", __func__, __LINE__, root);
+	if ( root == NULL )
 		return skit_trie_stop_lookup(NULL, 0, 0);
 
 	skit_trie_coords coords;
 	skit_trie_coords_ctor(&coords);
 	
-	coords.node = trie->root;
+	coords.node = root;
 
 	if ( !case_sensitive )
 		return skit_trie_find_icase(trie, key_ptr, key_len, coords);
@@ -441,1793 +655,5609 @@ static skit_trie_coords skit_trie_find(
 	return coords;
 }
 
-/* ------------------------------------------------------------------------- */
-
-static void skit_trie_node_dtor(skit_trie_node *node)
+/*
+Follows 'key' through a trie whose keys are all lowercase, lowercasing the
+key on the way.  This never writes to anything, and never backtracks.
+*/
+static skit_trie_coords skit_trie_find_folded(
+	skit_trie_node *root,
+	const uint8_t *key_ptr,
+	size_t key_len)
 {
-	size_t i = 0;
-	
-	if ( node->nodes_len <= SKIT__TRIE_NODE_PREALLOC )
-	{
-		for(; i < node->nodes_len; i++ )
-			skit_trie_node_dtor(&node->nodes.array[i]);
-		
-		skit_free(node->nodes.array);
-	}
-	else
+	if ( root == NULL )
+		return skit_trie_stop_lookup(NULL, 0, 0);
+
+	/* Linear nodes compare case-insensitively in every mode, and the */
+	/*   lowercase characters are the only ones there are to find. */
+	skit_trie_coords coords = skit_trie_continue_lookup(root, 0);
+	while ( 1 )
 	{
-		for(; i < 256; i++ )
-		{
-			if ( node->nodes.table[i] != NULL )
-			{
-				skit_trie_node_dtor(node->nodes.table[i]);
-				skit_free(node->nodes.table[i]);
-			}
-		}
-		
-		skit_free(node->nodes.table);
+		coords = skit_trie_next_node(NULL, coords.node, key_ptr, key_len, coords.pos, SKIT_TRIE_CASE_TRY_LOWER);
+		if ( coords.lookup_stopped || skit_exact_match(coords, key_len) )
+			return coords;
 	}
 }
 
-/* ------------------------------------------------------------------------- */
+/*
+Each icase index entry holds the canonical spelling of its key, and a copy
+of the value stored under that spelling, so that a case-insensitive lookup
+only has to walk the index.
+*/
+typedef struct skit_trie_icase_entry skit_trie_icase_entry;
+struct skit_trie_icase_entry
+{
+	skit_loaf   spelling;
+	const void  *value;
+};
 
-skit_trie *skit_trie_new()
+/* Returns the icase index entry for 'key', or NULL if it isn't in the trie in any casing. */
+static skit_trie_icase_entry *skit_trie_icase_entry_find(
+	const skit_trie *trie,
+	const uint8_t *key_ptr,
+	size_t key_len)
 {
-	skit_trie *result = skit_malloc(sizeof(skit_trie));
-	skit_trie_ctor(result);
-	return result;
+	skit_trie_coords coords = skit_trie_find_folded(trie->icase_index->root, key_ptr, key_len);
+	if ( !skit_exact_match(coords, key_len) )
+		return NULL;
+	return (skit_trie_icase_entry*)coords.node->value;
 }
 
-/* ------------------------------------------------------------------------- */
-
-void skit_trie_ctor( skit_trie *trie )
+static skit_trie_coords skit_trie_find(
+	skit_trie *trie,
+	const uint8_t *key_ptr,
+	size_t key_len,
+	int case_sensitive)
 {
-	trie->length = 0;
-	trie->root = NULL;
-	trie->key_return_buf = skit_loaf_new();
-	trie->iterator_count = 0;
+	/* With an icase index, a case-insensitive search is done as a */
+	/*   case-sensitive search for the key's canonical spelling.  If the key */
+	/*   has none, a case-sensitive search for the key itself still finds */
+	/*   where it would be inserted. */
+	if ( !case_sensitive && trie->icase_index != NULL )
+	{
+		skit_trie_icase_entry *entry = skit_trie_icase_entry_find(trie, key_ptr, key_len);
+		if ( entry != NULL )
+			key_ptr = sLPTR(entry->spelling);
+		case_sensitive = 1;
+	}
+
+	return skit_trie_find_from(trie->root, trie, key_ptr, key_len, case_sensitive);
 }
 
 /* ------------------------------------------------------------------------- */
 
-skit_trie *skit_trie_free(skit_trie *trie)
+/* Records 'spelling' as the canonical spelling of its key, unless it already has one. */
+static void skit_trie_icase_index_add(skit_trie *index, skit_slice spelling, const void *value)
 {
-	skit_trie_dtor(trie);
-	skit_free(trie);
-	return NULL;
+	size_t key_len = sSLENGTH(spelling);
+	skit_trie_coords coords = skit_trie_find_folded(index->root, sSPTR(spelling), key_len);
+	if ( skit_exact_match(coords, key_len) )
+		return;
+
+	skit_trie_icase_entry *entry = skit_malloc(sizeof(skit_trie_icase_entry));
+	entry->spelling = skit_loaf_dup(spelling);
+	entry->value = value;
+
+	skit_loaf folded = skit_loaf_dup(spelling);
+	skit_slice_ascii_to_lower(&folded.as_slice);
+	skit_trie_set(index, folded.as_slice, entry, SKIT_FLAG_C);
+	skit_loaf_free(&folded);
 }
 
-/* ------------------------------------------------------------------------- */
+/*
+Keeps the icase index's copy of the value current after the key in
+trie->key_return_buf (of length 'key_len') has been given a new value.
+*/
+static void skit_trie_icase_index_overwrite(skit_trie *trie, size_t key_len, const void *value)
+{
+	const uint8_t *spelling = sLPTR(trie->key_return_buf);
+	skit_trie_icase_entry *entry = skit_trie_icase_entry_find(trie, spelling, key_len);
+	sASSERT(entry != NULL);
+	if ( memcmp(sLPTR(entry->spelling), spelling, key_len) == 0 )
+		entry->value = value;
+}
 
-void skit_trie_dtor( skit_trie *trie )
+/*
+Updates the icase index after the key in trie->key_return_buf (of length
+'key_len') has been removed from the trie.  If that key was the canonical
+spelling, another spelling takes its place, or the index entry goes away if
+there are none left.
+*/
+static void skit_trie_icase_index_remove(skit_trie *trie, size_t key_len)
 {
-	SKIT_USE_FEATURE_EMULATION;
-	if ( trie->iterator_count > 0 )
-		sTHROW(SKIT_TRIE_WRITE_IN_ITERATION,
-			"Call to skit_trie_dtor during iteration. #iters = %d",
-			trie->iterator_count);
+	size_t i;
+	uint8_t *removed = sLPTR(trie->key_return_buf);
+	skit_trie_icase_entry *entry = skit_trie_icase_entry_find(trie, removed, key_len);
+	sASSERT(entry != NULL);
 
-	if ( trie->root != NULL )
+	uint8_t *spelling_ptr = sLPTR(entry->spelling);
+	if ( memcmp(spelling_ptr, removed, key_len) != 0 )
+		return;
+
+	/* Find another spelling the slow way.  The search writes what it */
+	/*   finds into key_return_buf, where the removed key must be kept. */
+	skit_trie_coords coords = skit_trie_find_from(trie->root, trie, spelling_ptr, key_len, 0);
+	if ( skit_exact_match(coords, key_len) )
 	{
-		skit_trie_node_dtor(trie->root);
-		skit_free(trie->root);
-		trie->root = NULL;
+		/* Swap: the index gets the new spelling, the buffer gets the old one back. */
+		for ( i = 0; i < key_len; i++ )
+		{
+			uint8_t tmp = spelling_ptr[i];
+			spelling_ptr[i] = removed[i];
+			removed[i] = tmp;
+		}
+		entry->value = coords.node->value;
+		return;
 	}
 
-	if ( !skit_loaf_is_null(trie->key_return_buf) )
-		trie->key_return_buf = skit_loaf_free(&trie->key_return_buf);
-}
+	/* The failed search may still have written part of a spelling into */
+	/*   key_return_buf: put the removed key back. */
+	memcpy(removed, spelling_ptr, key_len);
 
-/* ------------------------------------------------------------------------- */
+	/* This was the last spelling of the key. */
+	skit_slice_ascii_to_lower(&entry->spelling.as_slice);
+	skit_trie_remove(trie->icase_index, entry->spelling.as_slice, SKIT_FLAGS_NONE);
+	skit_loaf_free(&entry->spelling);
+	skit_free(entry);
+}
 
-skit_slice skit_trie_get( skit_trie *trie, const skit_slice key, void **value, skit_flags flags )
+static void skit_trie_icase_index_free(skit_trie *index)
 {
-	const uint8_t *key_ptr = sSPTR(key);
-	sENFORCE_MSG(value != NULL, "NULL value pointer given in call to skit_trie_set.  "
-		"This must be a pointer to a variable that can accept the returned value.");
-	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_set.");
+	skit_slice key;
+	void *value;
+	skit_trie_iter *iter = skit_trie_iter_new(index, sSLICE(""), SKIT_FLAGS_NONE);
+	while ( skit_trie_iter_next(iter, &key, &value) )
+	{
+		skit_trie_icase_entry *entry = value;
+		skit_loaf_free(&entry->spelling);
+		skit_free(entry);
+	}
+	skit_trie_iter_free(iter);
+	skit_trie_free(index);
+}
 
-	skit_trie_enforce_valid_flags(flags, CREATE | OVERWRITE | ICASE);
-	
-	ENTRY_DEBUG("%s, %d: \n", __func__, __LINE__);
+void skit_trie_enable_icase_index( skit_trie *trie )
+{
+	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_enable_icase_index.");
+	if ( trie->icase_index != NULL )
+		return;
 
-	size_t key_len = sSLENGTH(key);
-	skit_trie_coords coords = skit_trie_find(trie, key_ptr, key_len, (flags & ICASE) ? 0 : 1);
+	skit_trie *index = skit_trie_new();
 
-	if ( skit_exact_match(coords, key_len) )
-	{
-		/* Cast away constness because we are handing this back to the caller. */
-		/* We only guarantee that WE won't alter it. */
-		*value = (void*)coords.node->value;
-		return skit_slice_of(trie->key_return_buf.as_slice, 0, key_len);
-	}
+	skit_slice key;
+	void *value;
+	skit_trie_iter *iter = skit_trie_iter_new(trie, sSLICE(""), SKIT_FLAGS_NONE);
+	while ( skit_trie_iter_next(iter, &key, &value) )
+		skit_trie_icase_index_add(index, key, value);
+	skit_trie_iter_free(iter);
 
-	*value = NULL;
-	return skit_slice_null();
+	trie->icase_index = index;
 }
 
 /* ------------------------------------------------------------------------- */
 
-skit_slice skit_trie_getc( skit_trie *trie, const char *key, void **value, skit_flags flags )
+/* Chunks start on a cache line, so that granules never straddle one. */
+#define SKIT_TRIE_POOL_CHUNK_ALIGN 64
+#define SKIT_TRIE_POOL_FIRST_CHUNK 1024
+#define SKIT_TRIE_POOL_MAX_CHUNK   65536
+
+/*
+Sizes of the node16 and node48 blocks when they hold 'n' children.
+These blocks are resized on every insertion and removal, the same way that
+multi-node arrays are, so that they never hold unused children.
+*/
+#define SKIT_TRIE_NODE16_SIZE(n) (sizeof(skit_trie_node16) + (n) * sizeof(skit_trie_node))
+#define SKIT_TRIE_NODE48_SIZE(n) (sizeof(skit_trie_node48) + (n) * sizeof(skit_trie_node))
+
+/*
+A free block starts with this header and ends with a copy of n_granules, so
+that the block after it can find its start when the two are merged.
+*/
+typedef struct skit_trie_free_block skit_trie_free_block;
+struct skit_trie_free_block
 {
-	return skit_trie_get(trie, skit_slice_of_cstr(key), value, flags);
-}
+	skit_trie_free_block *next;
+	skit_trie_free_block *prev;
+	size_t               n_granules;
+};
 
-/* ------------------------------------------------------------------------- */
+typedef char skit_trie_free_block_fits_in_a_granule
+	[(sizeof(skit_trie_free_block) + sizeof(size_t) <= SKIT__TRIE_POOL_GRANULE) ? 1 : -1];
 
-static void skit_trie_node_ctor( skit_trie_node *node )
+static size_t skit_trie_pool_granules(size_t size)
 {
-	node->nodes.array = NULL;
-	node->value = NULL;
-	node->nodes_len = 0;
-	node->chars_len = 0;
-	node->have_value = 0;
+	size_t n_granules = (size + SKIT__TRIE_POOL_GRANULE - 1) / SKIT__TRIE_POOL_GRANULE;
+	sASSERT_GT(n_granules, 0);
+	sASSERT_LE(n_granules, SKIT__TRIE_POOL_N_LISTS);
+	return n_granules;
 }
 
-static skit_trie_node *skit_trie_node_new()
+static size_t skit_trie_pool_lowest_bit64(uint64_t mask)
 {
-	skit_trie_node *result = skit_malloc(sizeof(skit_trie_node));
-	skit_trie_node_ctor(result);
-	return result;
+	if ( (uint32_t)mask != 0 )
+		return skit_trie_lowest_bit((uint32_t)mask);
+	return 32 + skit_trie_lowest_bit((uint32_t)(mask >> 32));
 }
 
-/* ------------------------------------------------------------------------- */
+static void skit_trie_block_list_push(skit_trie_block_list *list, void *ptr, size_t size)
+{
+	if ( list->len == list->cap )
+	{
+		list->cap = list->cap == 0 ? 16 : list->cap * 2;
+		if ( list->blocks == NULL )
+			list->blocks = skit_malloc(list->cap * sizeof(skit_trie_block));
+		else
+			list->blocks = skit_realloc(list->blocks, list->cap * sizeof(skit_trie_block));
+	}
+	list->blocks[list->len].ptr = ptr;
+	list->blocks[list->len].size = size;
+	list->len++;
+}
 
-/*
-. Converts
-.
-.     node -> "asdf" -> node -> "qwer" -> value
-.
-. into
-.
-.     node -> "asdfqwer" -> value
-.
-If the tail has more complicated constructs in it, then the folding will
-stop at the first non-linear node.
-This is purely a space-optimization.
+/* Searches from the end, because the newest blocks are the ones most likely to be asked about. */
+static skit_trie_block *skit_trie_block_list_find(const skit_trie_block_list *list, const void *ptr)
+{
+	size_t i;
+	for ( i = list->len; i > 0; i-- )
+		if ( list->blocks[i-1].ptr == ptr )
+			return &list->blocks[i-1];
+	return NULL;
+}
 
-(If you look at the output of skit_trie_dump after the tests in the linear_node
-unittest, you might notice that this function might not actually need to be
-implemented.  Some emergent behavior in the node splitting code seems to 
-inherently handle this optimization.  The calls to it are left around as hints
-for where it should be used, should it become useful.)
-*/
-static skit_trie_node *skit_trie_node_fold(skit_trie_node *node)
+/* Removes 'ptr' from the list.  Returns 0 if it wasn't there. */
+static int skit_trie_block_list_drop(skit_trie_block_list *list, const void *ptr)
 {
-	/* printf("%s, %d: Stub!\n", __func__, __LINE__); */
-	return node;
+	skit_trie_block *block = skit_trie_block_list_find(list, ptr);
+	if ( block == NULL )
+		return 0;
+	*block = list->blocks[list->len - 1];
+	list->len--;
+	return 1;
 }
 
-static void skit_trie_node_set_value( skit_trie_node *node, const void *value )
+static void skit_trie_block_list_dtor(skit_trie_block_list *list)
 {
-	node->value = value;
-	node->have_value = 1;
+	skit_free(list->blocks);
+	list->blocks = NULL;
+	list->len = 0;
+	list->cap = 0;
 }
 
-static void skit_trie_node_insert_non0_str(
-	skit_trie_node *node,
-	skit_trie_node *tail,
-	const uint8_t *str_ptr,
-	size_t str_len )
+static void skit_trie_pool_ctor(skit_trie_pool *pool)
 {
-	sASSERT(node != NULL);
-	sASSERT(tail != NULL);
-	sASSERT(node != tail);
+	size_t i;
+	pool->chunks = NULL;
+	pool->n_chunks = 0;
+	pool->next_chunk_size = SKIT_TRIE_POOL_FIRST_CHUNK;
+	pool->live_bytes = 0;
+	pool->nonempty = 0;
+	for ( i = 0; i < SKIT__TRIE_POOL_N_LISTS; i++ )
+		pool->free_lists[i] = NULL;
+	pool->cow = NULL;
+}
 
-	skit_trie_node_ctor(node);
+static void skit_trie_pool_dtor(skit_trie_pool *pool)
+{
+	size_t i;
+	for ( i = 0; i < pool->n_chunks; i++ )
+		skit_free(pool->chunks[i].mem);
+	skit_free(pool->chunks);
+	skit_trie_pool_ctor(pool);
+}
 
-	skit_trie_node *next_node;
-	if ( str_len > SKIT__TRIE_NODE_PREALLOC )
+/* Returns the chunk that 'ptr' points into. */
+static skit_trie_pool_chunk *skit_trie_pool_find_chunk(skit_trie_pool *pool, const void *ptr)
+{
+	size_t lo = 0;
+	size_t hi = pool->n_chunks;
+	while ( hi - lo > 1 )
 	{
-		next_node = skit_trie_node_new();
-		skit_trie_node_insert_non0_str(next_node, tail,
-			str_ptr + SKIT__TRIE_NODE_PREALLOC,
-			str_len - SKIT__TRIE_NODE_PREALLOC);
-
-		node->chars_len = SKIT__TRIE_NODE_PREALLOC;
+		size_t mid = (lo + hi) / 2;
+		if ( (const uint8_t*)ptr < pool->chunks[mid].start )
+			hi = mid;
+		else
+			lo = mid;
 	}
+	skit_trie_pool_chunk *chunk = &pool->chunks[lo];
+	sASSERT((const uint8_t*)ptr >= chunk->start);
+	sASSERT((const uint8_t*)ptr < chunk->start + chunk->n_granules * SKIT__TRIE_POOL_GRANULE);
+	return chunk;
+}
+
+static int skit_trie_pool_is_free_end(const skit_trie_pool_chunk *chunk, size_t granule)
+{
+	return (chunk->free_ends[granule / 64] >> (granule % 64)) & 1;
+}
+
+static void skit_trie_pool_flip_ends(skit_trie_pool_chunk *chunk, size_t first, size_t n_granules)
+{
+	size_t last = first + n_granules - 1;
+	chunk->free_ends[first / 64] ^= (uint64_t)1 << (first % 64);
+	if ( last != first )
+		chunk->free_ends[last / 64] ^= (uint64_t)1 << (last % 64);
+}
+
+static uint8_t *skit_trie_pool_granule_ptr(const skit_trie_pool_chunk *chunk, size_t granule)
+{
+	return chunk->start + granule * SKIT__TRIE_POOL_GRANULE;
+}
+
+static size_t skit_trie_pool_list_index(size_t n_granules)
+{
+	return SKIT_MIN(n_granules, SKIT__TRIE_POOL_N_LISTS) - 1;
+}
+
+/* Makes granules [first, first + n_granules) of the chunk into a free block.  This does not merge. */
+static void skit_trie_pool_insert_free(skit_trie_pool *pool, skit_trie_pool_chunk *chunk, size_t first, size_t n_granules)
+{
+	uint8_t *mem = skit_trie_pool_granule_ptr(chunk, first);
+	skit_trie_free_block *block = (skit_trie_free_block*)mem;
+	size_t list = skit_trie_pool_list_index(n_granules);
+
+	block->n_granules = n_granules;
+	*(size_t*)(mem + n_granules * SKIT__TRIE_POOL_GRANULE - sizeof(size_t)) = n_granules;
+
+	block->prev = NULL;
+	block->next = pool->free_lists[list];
+	if ( block->next != NULL )
+		block->next->prev = block;
+	pool->free_lists[list] = block;
+	pool->nonempty |= (uint64_t)1 << list;
+
+	skit_trie_pool_flip_ends(chunk, first, n_granules);
+}
+
+static void skit_trie_pool_remove_free(skit_trie_pool *pool, skit_trie_pool_chunk *chunk, skit_trie_free_block *block)
+{
+	size_t list = skit_trie_pool_list_index(block->n_granules);
+	if ( block->prev != NULL )
+		block->prev->next = block->next;
 	else
+		pool->free_lists[list] = block->next;
+	if ( block->next != NULL )
+		block->next->prev = block->prev;
+	if ( pool->free_lists[list] == NULL )
+		pool->nonempty &= ~((uint64_t)1 << list);
+
+	size_t first = ((uint8_t*)block - chunk->start) / SKIT__TRIE_POOL_GRANULE;
+	skit_trie_pool_flip_ends(chunk, first, block->n_granules);
+}
+
+/* Returns granules [first, first + n_granules) to the chunk, merging them with free neighbors. */
+static void skit_trie_pool_release(skit_trie_pool *pool, skit_trie_pool_chunk *chunk, size_t first, size_t n_granules)
+{
+	if ( first > 0 && skit_trie_pool_is_free_end(chunk, first - 1) )
 	{
-		next_node = tail;
-		node->chars_len = str_len;
+		uint8_t *mem = skit_trie_pool_granule_ptr(chunk, first);
+		size_t left_len = *(size_t*)(mem - sizeof(size_t));
+		skit_trie_pool_remove_free(pool, chunk, (skit_trie_free_block*)(mem - left_len * SKIT__TRIE_POOL_GRANULE));
+		first -= left_len;
+		n_granules += left_len;
 	}
 
-	memcpy(node->chars, str_ptr, node->chars_len);
-	node->nodes_len = 1;
-	node->nodes.array = next_node;
+	size_t after = first + n_granules;
+	if ( after < chunk->n_granules && skit_trie_pool_is_free_end(chunk, after) )
+	{
+		skit_trie_free_block *right = (skit_trie_free_block*)skit_trie_pool_granule_ptr(chunk, after);
+		n_granules += right->n_granules;
+		skit_trie_pool_remove_free(pool, chunk, right);
+	}
+
+	skit_trie_pool_insert_free(pool, chunk, first, n_granules);
 }
 
-/* ------------------------------------------------------------------------- */
+/* Adds a chunk with room for at least 'n_granules' granules, as one free block. */
+static void skit_trie_pool_add_chunk(skit_trie_pool *pool, size_t n_granules)
+{
+	size_t i;
+	size_t chunk_size = SKIT_MAX(pool->next_chunk_size, n_granules * SKIT__TRIE_POOL_GRANULE);
+	pool->next_chunk_size = SKIT_MIN(pool->next_chunk_size * 2, SKIT_TRIE_POOL_MAX_CHUNK);
+
+	skit_trie_pool_chunk chunk;
+	chunk.n_granules = chunk_size / SKIT__TRIE_POOL_GRANULE;
+	size_t map_size = ((chunk.n_granules + 63) / 64) * sizeof(uint64_t);
+	chunk.mem = skit_malloc(SKIT_TRIE_POOL_CHUNK_ALIGN + chunk.n_granules * SKIT__TRIE_POOL_GRANULE + map_size);
+
+	size_t start = ((size_t)chunk.mem + SKIT_TRIE_POOL_CHUNK_ALIGN - 1) & ~(size_t)(SKIT_TRIE_POOL_CHUNK_ALIGN - 1);
+	chunk.start = (uint8_t*)start;
+	chunk.free_ends = (uint64_t*)(chunk.start + chunk.n_granules * SKIT__TRIE_POOL_GRANULE);
+	memset(chunk.free_ends, 0, map_size);
+
+	/* Keep the chunks sorted, for skit_trie_pool_find_chunk. */
+	pool->chunks = skit_realloc(pool->chunks, (pool->n_chunks + 1) * sizeof(skit_trie_pool_chunk));
+	for ( i = pool->n_chunks; i > 0 && pool->chunks[i-1].start > chunk.start; i-- )
+		pool->chunks[i] = pool->chunks[i-1];
+	pool->chunks[i] = chunk;
+	pool->n_chunks++;
+
+	skit_trie_pool_insert_free(pool, &pool->chunks[i], 0, chunk.n_granules);
+}
 
-static void skit_trie_node_append_str(
-	skit_trie_node *node,
-	skit_trie_node **new_tail,
-	const uint8_t *str_ptr,
-	size_t str_len )
+static void *skit_trie_pool_alloc(skit_trie_pool *pool, size_t size)
 {
-	if ( str_len == 0 ) {
-		*new_tail = node;
-	} else {
-		*new_tail = skit_trie_node_new();
-		skit_trie_node_insert_non0_str(node, *new_tail, str_ptr, str_len);
+	size_t n_granules = skit_trie_pool_granules(size);
+	uint64_t candidates = pool->nonempty & (~(uint64_t)0 << (n_granules - 1));
+	if ( candidates == 0 )
+	{
+		skit_trie_pool_add_chunk(pool, n_granules);
+		candidates = pool->nonempty & (~(uint64_t)0 << (n_granules - 1));
 	}
+
+	/* Take the smallest block that is big enough, and give back the rest. */
+	skit_trie_free_block *block = pool->free_lists[skit_trie_pool_lowest_bit64(candidates)];
+	skit_trie_pool_chunk *chunk = skit_trie_pool_find_chunk(pool, block);
+	size_t first = ((uint8_t*)block - chunk->start) / SKIT__TRIE_POOL_GRANULE;
+	size_t block_len = block->n_granules;
+	skit_trie_pool_remove_free(pool, chunk, block);
+	if ( block_len > n_granules )
+		skit_trie_pool_insert_free(pool, chunk, first + n_granules, block_len - n_granules);
+
+	pool->live_bytes += n_granules * SKIT__TRIE_POOL_GRANULE;
+	if ( pool->cow != NULL )
+		skit_trie_block_list_push(&pool->cow->fresh, block, size);
+	return block;
 }
 
-/* ------------------------------------------------------------------------- */
+/* Frees the block even if readers of a skit_trie_shared might still see it. */
+static void skit_trie_pool_free_now(skit_trie_pool *pool, void *ptr, size_t size)
+{
+	size_t n_granules = skit_trie_pool_granules(size);
+	skit_trie_pool_chunk *chunk = skit_trie_pool_find_chunk(pool, ptr);
+	size_t first = ((uint8_t*)ptr - chunk->start) / SKIT__TRIE_POOL_GRANULE;
+	skit_trie_pool_release(pool, chunk, first, n_granules);
+	pool->live_bytes -= n_granules * SKIT__TRIE_POOL_GRANULE;
+}
 
-static skit_trie_node *skit_trie_finish_tail(
-	skit_trie_node *given_start_node,
-	const skit_trie_coords coords,
-	const uint8_t *key_ptr,
-	size_t key_len,
-	const void *value)
+/* 'size' must be the size that the block was allocated with.  NULL is ignored. */
+static void skit_trie_pool_free(skit_trie_pool *pool, void *ptr, size_t size)
 {
-	skit_trie_node *new_value_node;
+	if ( ptr == NULL )
+		return;
 
-	skit_trie_node_ctor(given_start_node);
+	/* Blocks from before the current copy-on-write write wait for its readers. */
+	if ( pool->cow != NULL && !skit_trie_block_list_drop(&pool->cow->fresh, ptr) )
+	{
+		skit_trie_block_list_push(&pool->cow->retired, ptr, size);
+		return;
+	}
 
-	const uint8_t *new_node_str = key_ptr + (coords.pos + 1);
-	size_t         new_node_len = key_len - (coords.pos + 1);
-	skit_trie_node_append_str(given_start_node, &new_value_node, new_node_str, new_node_len);
-	skit_trie_node_set_value(new_value_node, value);
-	return given_start_node;
+	skit_trie_pool_free_now(pool, ptr, size);
 }
 
-/* ------------------------------------------------------------------------- */
+/* Copies the block into a new one of 'new_size' bytes, and frees the old one. */
+static void *skit_trie_pool_move(skit_trie_pool *pool, void *ptr, size_t old_size, size_t new_size)
+{
+	void *result = skit_trie_pool_alloc(pool, new_size);
+	memcpy(result, ptr, SKIT_MIN(old_size, new_size));
+	skit_trie_pool_free(pool, ptr, old_size);
+	return result;
+}
 
-static void skit_trie_split_node(
-	skit_trie *trie,
-	skit_trie_coords coords,
-	const uint8_t *key_ptr,
-	size_t key_len,
-	const void *value);
+/* Returns nonzero if the block's contents may be changed in place. */
+static int skit_trie_pool_is_writable(const skit_trie_pool *pool, const void *ptr)
+{
+	return pool->cow == NULL || skit_trie_block_list_find(&pool->cow->fresh, ptr) != NULL;
+}
 
-/* ------------------------------------------------------------------------- */
+/*
+Returns 'ptr' if the block may be changed in place, or else a copy of it
+that may be.  The trie must be repointed at whatever this returns.
+*/
+static void *skit_trie_pool_own(skit_trie_pool *pool, void *ptr, size_t size)
+{
+	if ( ptr == NULL || skit_trie_pool_is_writable(pool, ptr) )
+		return ptr;
+	return skit_trie_pool_move(pool, ptr, size, size);
+}
 
-static void skit_trie_split_table_node(
-	skit_trie *trie,
-	skit_trie_coords coords,
-	const uint8_t *key_ptr,
-	size_t key_len,
-	const void *value)
+/*
+Like realloc, but the caller supplies the block's current size.  'ptr' may
+be NULL.  The block is resized in place if that's possible.
+*/
+static void *skit_trie_pool_realloc(skit_trie_pool *pool, void *ptr, size_t old_size, size_t new_size)
 {
-	SPLIT_DEBUG("%s, %d: \n", __func__, __LINE__);
-	/* Easy case: just add a new entry in the table. */
-	skit_trie_node *node = coords.node;
-	sASSERT(node->nodes_len > SKIT__TRIE_NODE_PREALLOC);
-	uint8_t new_char = key_ptr[coords.pos];
+	if ( ptr == NULL )
+		return skit_trie_pool_alloc(pool, new_size);
 
-	/* skit_trie_finish_tail ensures that the rest of the key gets accounted for. */
-	node->nodes.table[new_char] =
-		skit_trie_finish_tail(skit_trie_node_new(), coords, key_ptr, key_len, value);
+	if ( !skit_trie_pool_is_writable(pool, ptr) )
+		return skit_trie_pool_move(pool, ptr, old_size, new_size);
+
+	size_t old_len = skit_trie_pool_granules(old_size);
+	size_t new_len = skit_trie_pool_granules(new_size);
+	if ( old_len == new_len )
+		return ptr;
+
+	skit_trie_pool_chunk *chunk = skit_trie_pool_find_chunk(pool, ptr);
+	size_t first = ((uint8_t*)ptr - chunk->start) / SKIT__TRIE_POOL_GRANULE;
+	size_t after = first + old_len;
+	if ( new_len < old_len )
+	{
+		skit_trie_pool_release(pool, chunk, first + new_len, old_len - new_len);
+		pool->live_bytes -= (old_len - new_len) * SKIT__TRIE_POOL_GRANULE;
+		return ptr;
+	}
+
+	if ( after < chunk->n_granules && skit_trie_pool_is_free_end(chunk, after) )
+	{
+		skit_trie_free_block *right = (skit_trie_free_block*)skit_trie_pool_granule_ptr(chunk, after);
+		size_t right_len = right->n_granules;
+		size_t needed = new_len - old_len;
+		if ( right_len >= needed )
+		{
+			skit_trie_pool_remove_free(pool, chunk, right);
+			if ( right_len > needed )
+				skit_trie_pool_insert_free(pool, chunk, after + needed, right_len - needed);
+			pool->live_bytes += needed * SKIT__TRIE_POOL_GRANULE;
+			return ptr;
+		}
+	}
 
-	(node->nodes_len)++;
+	return skit_trie_pool_move(pool, ptr, old_size, new_size);
 }
 
-/* ------------------------------------------------------------------------- */
+/* Returns the size of the block that holds a node's 'n' children, or 0 if there are none. */
+static size_t skit_trie_children_block_size(size_t n)
+{
+	if ( n <= SKIT__TRIE_NODE_PREALLOC )
+		return n * sizeof(skit_trie_node);
+	else if ( n <= SKIT__TRIE_NODE16_MAX )
+		return SKIT_TRIE_NODE16_SIZE(n);
+	else if ( n <= SKIT__TRIE_NODE48_MAX )
+		return SKIT_TRIE_NODE48_SIZE(n);
+	else
+		return 256 * sizeof(skit_trie_node*);
+}
 
-static void skit_trie_split_multi_to_table(
-	skit_trie *trie,
-	skit_trie_coords coords,
-	const uint8_t *key_ptr,
-	size_t key_len,
-	const void *value)
+static size_t skit_trie_node_block_size(const skit_trie_node *node)
 {
-	SPLIT_DEBUG("%s, %d: \n", __func__, __LINE__);
-	size_t i;
-	skit_trie_node *node = coords.node;
-	sASSERT(node->nodes_len == node->chars_len);
-	sASSERT(node->nodes_len == SKIT__TRIE_NODE_PREALLOC);
-	uint8_t new_char = key_ptr[coords.pos];
+	return skit_trie_children_block_size(node->nodes_len);
+}
 
-	/* Default initialization for a node's lookup table. */
-	skit_trie_node **new_node_array = skit_malloc(sizeof(skit_trie_node*)*256);
-	for ( i = 0; i < 256; i++ )
-		new_node_array[i] = NULL;
+/* ------------------------------------------------------------------------- */
 
-	/* COPY all of the nodes out of the node->nodes array and into their */
-	/*   own blocks of memory, which are then indexed by node->nodes.table. */
-	/* The copying is important.  Since these keys might be removed later, */
-	/*   it needs to be possible to call skit_free on each individual node. */
-	/*   Having some, but not all, of the table's nodes be allocated in the */
-	/*   same chunk of memory, defeats that purpose.  Calling skit_free on */
-	/*   that same chunk repeated and at different offsets is not advised. */
-	/*   That's why we do away with the contiguous chunk at this point.    */
-	/* This does mean that lookups need to do an extra indirection, but    */
-	/*   the extra indirection is a table-lookup that should offset the    */
-	/*   cost of having to find an index into an unsorted node array.      */
-	for ( i = 0; i < node->nodes_len; i++ )
+/* Frees the node's descendants, but not the node itself. */
+static void skit_trie_node_dtor(skit_trie_pool *pool, skit_trie_node *node)
+{
+	size_t i = 0;
+	skit_trie_node *children = skit_trie_node_children(node);
+	
+	if ( node->nodes_len <= SKIT__TRIE_NODE48_MAX )
 	{
-#if SKIT_DO_SPLIT_DEBUG != 0
-		if ( node->chars[i] == new_char )
+		for(; i < node->nodes_len; i++ )
+			skit_trie_node_dtor(pool, &children[i]);
+	}
+	else
+	{
+		for(; i < 256; i++ )
 		{
-			skit_trie_dump(trie, skit_stream_stdout);
-			printf("New key: '%.*s'\n", (int)key_len, (char*)key_ptr);
+			if ( node->nodes.table[i] != NULL )
+			{
+				skit_trie_node_dtor(pool, node->nodes.table[i]);
+				skit_trie_pool_free(pool, node->nodes.table[i], sizeof(skit_trie_node));
+			}
 		}
-#endif
-		sASSERT_NE(node->chars[i], new_char);
-		skit_trie_node *new_node = skit_malloc(sizeof(skit_trie_node));
-		memcpy(new_node, &node->nodes.array[i], sizeof(skit_trie_node));
-		new_node_array[node->chars[i]] = new_node;
 	}
 
-	/* Free the original chunk of nodes. */
-	skit_free(node->nodes.array);
+	/* For node16 and node48, this also frees the header that the */
+	/*   children are stored after: it is all one block. */
+	if ( node->nodes_len > 0 )
+		skit_trie_pool_free(pool, node->nodes.array, skit_trie_node_block_size(node));
+}
 
-	/* Replace it with the new node array/table. */
-	node->nodes.table = new_node_array;
+/* ------------------------------------------------------------------------- */
 
-	/* Do the value insertion. */
-	/* skit_trie_finish_tail ensures that the rest of the key gets accounted for. */
-	node->nodes.table[new_char] =
-		skit_trie_finish_tail(skit_trie_node_new(), coords, key_ptr, key_len, value);
+skit_trie *skit_trie_new()
+{
+	skit_trie *result = skit_malloc(sizeof(skit_trie));
+	skit_trie_ctor(result);
+	return result;
+}
 
-	/* Update length metadata. */
-	node->chars_len = 0xFF;
-	(node->nodes_len)++;
+/* ------------------------------------------------------------------------- */
+
+void skit_trie_ctor( skit_trie *trie )
+{
+	trie->length = 0;
+	trie->root = NULL;
+	skit_trie_pool_ctor(&trie->pool);
+	trie->key_return_buf = skit_loaf_new();
+	trie->iterator_count = 0;
+	trie->icase_index = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
 
+skit_trie *skit_trie_free(skit_trie *trie)
+{
+	skit_trie_dtor(trie);
+	skit_free(trie);
+	return NULL;
 }
 
 /* ------------------------------------------------------------------------- */
 
-static void skit_trie_split_multi_node(
-	skit_trie *trie,
-	skit_trie_coords coords,
-	const uint8_t *key_ptr,
-	size_t key_len,
-	const void *value)
+void skit_trie_dtor( skit_trie *trie )
 {
-	SPLIT_DEBUG("%s, %d: \n", __func__, __LINE__);
-	skit_trie_node *node = coords.node;
-	sASSERT(node->nodes_len == node->chars_len);
-	sASSERT(node->nodes_len < SKIT__TRIE_NODE_PREALLOC); /* This does NOT handle the convert-to-table case. */
+	SKIT_USE_FEATURE_EMULATION;
+	if ( trie->iterator_count > 0 )
+		sTHROW(SKIT_TRIE_WRITE_IN_ITERATION,
+			"Call to skit_trie_dtor during iteration. #iters = %d",
+			trie->iterator_count);
 
-	/*
-	New pair is {"cxyz",value}
-	Before
-	.         ,-> 'a' -> cnode0 -> ...
-	. node - {
-	.         `-> 'b' -> cnode1 -> ...
-	After
-	.
-	.         ,-> 'a' -> cnode0 -> ...
-	.        |
-	. node - + -> 'b' -> cnode1 -> ...
-	.        |
-	.         `-> 'c' -> new_node -> "xyz" ... -> new_cnode -> value
-	*/
-	
-	(node->nodes_len)++;
-	node->nodes.array = skit_realloc( node->nodes.array, sizeof(skit_trie_node) * node->nodes_len);
+	/* The nodes don't own anything outside of the pool, so there's no */
+	/*   need to visit them. */
+	skit_trie_pool_dtor(&trie->pool);
+	trie->root = NULL;
+
+	if ( trie->icase_index != NULL )
+	{
+		skit_trie_icase_index_free(trie->icase_index);
+		trie->icase_index = NULL;
+	}
 
-	(node->chars_len)++;
-	node->chars[node->chars_len - 1] = key_ptr[coords.pos];
-	skit_trie_node *new_node = &node->nodes.array[node->nodes_len - 1];
-	skit_trie_finish_tail(new_node, coords, key_ptr, key_len, value);
+	if ( !skit_loaf_is_null(trie->key_return_buf) )
+		trie->key_return_buf = skit_loaf_free(&trie->key_return_buf);
 }
 
 /* ------------------------------------------------------------------------- */
 
-static void skit_trie_split_linear_node(
-	skit_trie *trie,
-	skit_trie_coords coords,
-	const uint8_t *key_ptr,
-	size_t key_len,
-	const void *value)
+skit_slice skit_trie_get( skit_trie *trie, const skit_slice key, void **value, skit_flags flags )
 {
-	SPLIT_DEBUG("%s, %d: \n", __func__, __LINE__);
-	/* Linear node that has >1 character. */
-	skit_trie_node *node = coords.node;
-	sASSERT(node->nodes_len == 1);
-	sASSERT(node->chars_len > 1);
+	const uint8_t *key_ptr = sSPTR(key);
+	sENFORCE_MSG(value != NULL, "NULL value pointer given in call to skit_trie_set.  "
+		"This must be a pointer to a variable that can accept the returned value.");
+	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_set.");
 
-	if ( coords.n_chars_into_node == 0 )
-	{
-		/* No common prefix: split it into three nodes. */
-		/* Illustration: (new pair is {'xyz',value})
-		Before:
-		.
-		. node -> "abc" -> cnode0 -> ...
-		.
-		After
-		.         ,-> 'a' -> node0 -> "bc" -> cnode0 -> ...
-		. node - {
-		.         `-> 'x' -> node1 -> "yz" ... -> cnode1 -> value
-		.
-		*/
-
-		/* Avoid copying and temporary allocations. */
-		/* We allow cnode0 to remain where it is, and just create a new */
-		/*   block of memory for the new array of nodes. */
-		skit_trie_node *cnode0 = &node->nodes.array[0];
-
-		node->nodes.array = skit_malloc(2 * sizeof(skit_trie_node));
-		skit_trie_node *node0 = &node->nodes.array[0];
-		skit_trie_node *node1 = &node->nodes.array[1];
-
-		/* Populate node0. */
-		const uint8_t *node0_str = (const uint8_t*)node->chars + 1;
-		size_t         node0_len = node->chars_len - 1;
-		skit_trie_node_insert_non0_str(node0, cnode0, node0_str, node0_len);
-
-		/* Populate node1. */
-		skit_trie_finish_tail(node1, coords, key_ptr, key_len, value);
-
-		/* Setup up the new char-to-node mapping table. */
-		/* Do this AFTER chars has been copied into other nodes. */
-		/* node->chars[0] = node->chars[0]; (already handled.) */
-		node->chars[1] = key_ptr[coords.pos];
-
-		/* Meta-data update.  This should also be done later due to the */
-		/* possibility of overwriting values before they get used in the */
-		/* previous calculations. */
-		node->chars_len = 2;
-		node->nodes_len = 2;
+	skit_trie_enforce_valid_flags(flags, CREATE | OVERWRITE | ICASE);
+	
+	ENTRY_DEBUG("%s, %d: \n", __func__, __LINE__);
 
-		/* Optimizations. */
-		skit_trie_node_fold(node0);
-		skit_trie_node_fold(node1);
-	}
-	else
+	size_t key_len = sSLENGTH(key);
+	if ( (flags & ICASE) && trie->icase_index != NULL )
 	{
-		/* Common prefix: split it into four nodes. */
-		/* Illustration: (new pair is {'abyqp',value2})
-		Before:
-		.
-		. node -> "abxdb" -> cnode0 -> ...
-		.
-		After
-		.                          ,-> 'x' -> node1 -> "db" -> cnode0 -> ...
-		. node -> "ab" -> node0 - {
-		.                          `-> 'y' -> node2 -> "qp" ... -> cnode1 -> value
-		.
-		To accomplish this, we first turn it into this:
-		.
-		. node -> "ab" -> node0 -> "xdb" -> cnode0 -> ...
-		.
-		And then recurse on node0 with new coordinates.
-		The new coordinates will be such that the next operation falls
-		into the (coords.n_chars_into_node == 0) case and gets finished
-		that way.
-		*/
-		skit_trie_node *node0 = skit_trie_node_new();
-		void *dst_start = node0->chars;
-		void *src_start = node->chars + coords.n_chars_into_node;
-		size_t copy_len = node->chars_len - coords.n_chars_into_node;
-		memcpy( dst_start, src_start, copy_len );
-		node0->chars_len = copy_len;
-
-		/* Transfer the tail (cnode0 in the drawing) to the new node. */
-		node0->nodes.array = node->nodes.array;
-		node0->nodes_len = 1;
+		skit_trie_icase_entry *entry = skit_trie_icase_entry_find(trie, key_ptr, key_len);
+		if ( entry != NULL )
+		{
+			memcpy(sLPTR(trie->key_return_buf), sLPTR(entry->spelling), key_len);
+			*value = (void*)entry->value;
+			return skit_slice_of(trie->key_return_buf.as_slice, 0, key_len);
+		}
 
-		/* Transfer the new node (node0) to the original node. */
-		node->nodes.array = node0;
-		sASSERT(node->nodes_len == 1);
-		node->chars_len = coords.n_chars_into_node;
+		*value = NULL;
+		return skit_slice_null();
+	}
 
-		/* Calculate the coordinates for the next split. */
-		skit_trie_coords new_coords = coords;
-		new_coords.node = node0;
-		new_coords.pos  = coords.pos;
-		new_coords.n_chars_into_node = 0;
+	skit_trie_coords coords = skit_trie_find(trie, key_ptr, key_len, (flags & ICASE) ? 0 : 1);
 
-		/* Note that (node0->chars_len == 1) is possible. */
-		/* This means that if we called skit_trie_split_linear_node, then */
-		/*   we could easily violate the assertion that (node->chars_len > 1) */
-		/* Because of that danger, we call the more generic */
-		/*   skit_trie_split_node to force a reclassification of node0. */
-		skit_trie_split_node(trie, new_coords, key_ptr, key_len, value);
+	if ( skit_exact_match(coords, key_len) )
+	{
+		/* Cast away constness because we are handing this back to the caller. */
+		/* We only guarantee that WE won't alter it. */
+		*value = (void*)coords.node->value;
+		return skit_slice_of(trie->key_return_buf.as_slice, 0, key_len);
 	}
+
+	*value = NULL;
+	return skit_slice_null();
 }
 
 /* ------------------------------------------------------------------------- */
 
-static void skit_trie_split_node(
-	skit_trie *trie,
-	skit_trie_coords coords,
-	const uint8_t *key_ptr,
-	size_t key_len,
-	const void *value)
+skit_slice skit_trie_getc( skit_trie *trie, const char *key, void **value, skit_flags flags )
 {
-	SPLIT_DEBUG("%s, %d: \n", __func__, __LINE__);
-	skit_trie_node *node = coords.node;
-
-	if ( coords.n_chars_into_node == 0 && coords.pos == key_len )
-		skit_trie_node_set_value(node, value);
-	else if ( node->nodes_len == 1 && node->chars_len > 1 )
-		skit_trie_split_linear_node(trie, coords, key_ptr, key_len, value);
-	else if  ( node->nodes_len < SKIT__TRIE_NODE_PREALLOC )
-		skit_trie_split_multi_node(trie, coords, key_ptr, key_len, value);
-	else if ( node->nodes_len == SKIT__TRIE_NODE_PREALLOC )
-		skit_trie_split_multi_to_table(trie, coords, key_ptr, key_len, value);
-	else
-		skit_trie_split_table_node(trie, coords, key_ptr, key_len, value);
+	return skit_trie_get(trie, skit_slice_of_cstr(key), value, flags);
 }
 
 /* ------------------------------------------------------------------------- */
 
-skit_slice skit_trie_set( skit_trie *trie, const skit_slice key, const void *value, skit_flags flags )
+int skit_trie_lookup( const skit_trie *trie, const skit_slice key, void **value, skit_flags flags )
 {
-	SKIT_USE_FEATURE_EMULATION;
-	size_t key_len = sSLENGTH(key);
-	const uint8_t *key_ptr = (const uint8_t*)sSPTR(key);
-	ENTRY_DEBUG("skit_trie_set(trie, \"%.*s\", %p, %x)\n", (int)key_len, key_ptr, value, flags);
-	
-	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_set.");
-	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_set.");
-	
-	if ( trie->iterator_count > 0 )
-	{
-		char flags_str[SKIT_FLAGS_BUF_SIZE];
-		skit_flags_to_str(flags, flags_str);
-		sTHROW(SKIT_TRIE_WRITE_IN_ITERATION,
-			"Call to skit_trie_set during iteration. #iters = %d, key = \"%.*s\", flags = \"%s\"",
-			trie->iterator_count, key_len, key_ptr, flags_str);
-	}
+	const uint8_t *key_ptr = sSPTR(key);
+	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_lookup.");
+	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_lookup.");
 
 	skit_trie_enforce_valid_flags(flags, CREATE | OVERWRITE | ICASE);
-	
-	if ( !(flags & (CREATE | OVERWRITE)) )
+
+	size_t key_len = sSLENGTH(key);
+	if ( (flags & ICASE) && trie->icase_index != NULL )
 	{
-		char flags_str[SKIT_FLAGS_BUF_SIZE];
-		skit_flags_to_str(flags, flags_str);
-		sTHROW(SKIT_TRIE_BAD_FLAGS,
-			"Call to skit_trie_set without providing 'c' or 'o' flags. key = \"%.*s\", flags = \"%s\"",
-			key_len, key_ptr, flags_str);
+		skit_trie_icase_entry *entry = skit_trie_icase_entry_find(trie, key_ptr, key_len);
+		if ( value != NULL )
+			*value = entry != NULL ? (void*)entry->value : NULL;
+		return entry != NULL;
 	}
 
-	if ( key_len > sLLENGTH(trie->key_return_buf) )
-		trie->key_return_buf = *skit_loaf_resize(&trie->key_return_buf, key_len);
+	skit_trie_coords coords = skit_trie_find_from(trie->root, NULL, key_ptr, key_len, (flags & ICASE) ? 0 : 1);
 
-	/* First insertion. */
-	/* Check this first to avoid calling skit_trie_find in such cases. */
-	if ( trie->root == NULL )
+	if ( skit_exact_match(coords, key_len) )
 	{
-		if ( !(flags & CREATE) )
-			sTHROW(SKIT_EXCEPTION,
-				"Wrote a value to an empty trie. Key is \"%.*s\". 'c' (create) not passed in flags.",
-				key_len, key_ptr);
-
-		ENTRY_DEBUG("%s, %d: new root.\n", __func__, __LINE__);
-		trie->root = skit_trie_node_new();
-		skit_trie_node *end_node;
-		skit_trie_node_append_str(trie->root, &end_node, key_ptr, key_len);
-		skit_trie_node_set_value(end_node, value);
-		
-		memcpy( sLPTR(trie->key_return_buf), key_ptr, key_len );
-		
-		(trie->length)++;
-		
-		return skit_slice_of(trie->key_return_buf.as_slice, 0, key_len);
+		if ( value != NULL )
+			*value = (void*)coords.node->value;
+		return 1;
 	}
 
-	/* Insertions/replacements for already-existing keys. */
-	skit_trie_coords coords = skit_trie_find(trie, key_ptr, key_len, (flags & ICASE) ? 0 : 1);
+	if ( value != NULL )
+		*value = NULL;
+	return 0;
+}
 
-	if ( skit_exact_match(coords, key_len) )
-	{
-		if ( !(flags & OVERWRITE) )
-			sTHROW(SKIT_EXCEPTION,
-				"Wrote a value to an already existing key \"%.*s\". 'o' (overwrite) not passed in flags.",
-				key_len, key_ptr);
+/* ------------------------------------------------------------------------- */
 
-		/* Exact match is the easier case and involves no allocations. */
-		/* Just replace an existing value with the new one. */
-		coords.node->value = value;
-	}
-	else if ( skit_prefix_match(coords, key_len) || skit_no_match(coords, key_len) )
+/*
+Moves one node further along 'input'.  'pos' is how much of the input leads
+to 'node', and is advanced past the characters consumed.
+Returns NULL if the input doesn't continue into any of the node's children.
+*/
+static const skit_trie_node *skit_trie_prefix_step(
+	const skit_trie_node *node,
+	const uint8_t *input,
+	size_t input_len,
+	size_t *pos)
+{
+	if ( node->nodes_len == 0 )
+		return NULL;
+
+	if ( node->nodes_len == 1 )
 	{
-		if ( !(flags & CREATE) )
-			sTHROW(SKIT_EXCEPTION,
-				"Wrote a value to a non-existant key \"%.*s\". 'c' (create) not passed in flags.",
-				key_len, key_ptr);
+		if ( input_len - *pos < node->chars_len || memcmp(node->chars, input + *pos, node->chars_len) != 0 )
+			return NULL;
+		*pos += node->chars_len;
+		return &node->nodes.array[0];
+	}
 
-		/* The first part of key_return_buf will be filled by the call to skit_trie_find. */
-		/* The second part is something we need to fill.  We're inserting the */
-		/*   rest of the key, so we know that it will end up entered exactly */
-		/*   the way the caller supplied it. */
-		void       *dst_start = sLPTR(trie->key_return_buf) + coords.pos;
-		const void *src_start = key_ptr + coords.pos;
-		size_t       copy_len = key_len - coords.pos;
-		memcpy(dst_start, src_start, copy_len);
+	if ( *pos == input_len )
+		return NULL;
 
-		/* Split a node to insert the new value. */
-		skit_trie_split_node(trie, coords, key_ptr, key_len, value);
-		
-		/* Update this. */
-		(trie->length)++;
+	const skit_trie_node *child = skit_trie_node_find_child(node, input[*pos]);
+	if ( child != NULL )
+		(*pos)++;
+	return child;
+}
+
+skit_slice skit_trie_longest_prefix( const skit_trie *trie, const skit_slice input, void **value )
+{
+	const uint8_t *input_ptr = sSPTR(input);
+	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_longest_prefix.");
+	sENFORCE_MSG(input_ptr != NULL, "NULL input given in call to skit_trie_longest_prefix.");
+
+	size_t input_len = sSLENGTH(input);
+	const skit_trie_node *node = trie->root;
+	const skit_trie_node *match = NULL;
+	size_t match_len = 0;
+	size_t pos = 0;
+	while ( node != NULL )
+	{
+		if ( node->have_value )
+		{
+			match = node;
+			match_len = pos;
+		}
+		node = skit_trie_prefix_step(node, input_ptr, input_len, &pos);
 	}
-	else
-		sTHROW(SKIT_FATAL_EXCEPTION, "Impossible result for trie lookup on key \"%.*s\".", key_len, sSPTR(key));
 
-	return skit_slice_of(trie->key_return_buf.as_slice, 0, key_len);
+	if ( value != NULL )
+		*value = match != NULL ? (void*)match->value : NULL;
+	if ( match == NULL )
+		return skit_slice_null();
+	return skit_slice_of(input, 0, match_len);
 }
 
-/* ------------------------------------------------------------------------- */
-
-skit_slice skit_trie_setc( skit_trie *trie, const char *key, const void *value, skit_flags flags )
+void skit_trie_prefixes_ctor( skit_trie_prefixes *prefixes, const skit_trie *trie, const skit_slice input )
 {
-	return skit_trie_set( trie, skit_slice_of_cstr(key), value, flags );
+	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_prefixes_ctor.");
+	sENFORCE_MSG(sSPTR(input) != NULL, "NULL input given in call to skit_trie_prefixes_ctor.");
+	prefixes->node = trie->root;
+	prefixes->pos = 0;
+	prefixes->input = input;
 }
 
-/* ------------------------------------------------------------------------- */
-
-skit_slice skit_trie_remove( skit_trie *trie, const skit_slice key, skit_flags flags )
+int skit_trie_prefixes_next( skit_trie_prefixes *prefixes, skit_slice *key, void **value )
 {
-	SKIT_USE_FEATURE_EMULATION;
-	size_t key_len = sSLENGTH(key);
-	const uint8_t *key_ptr = (const uint8_t*)sSPTR(key);
-	
-	if ( trie->iterator_count > 0 )
+	sENFORCE_MSG(value != NULL, "NULL value pointer given in call to skit_trie_prefixes_next.");
+	sENFORCE_MSG(key != NULL, "NULL key pointer given in call to skit_trie_prefixes_next.");
+
+	const uint8_t *input_ptr = sSPTR(prefixes->input);
+	size_t input_len = sSLENGTH(prefixes->input);
+	while ( prefixes->node != NULL )
 	{
-		char flags_str[SKIT_FLAGS_BUF_SIZE];
-		skit_flags_to_str(flags, flags_str);
-		sTHROW(SKIT_TRIE_WRITE_IN_ITERATION,
-			"Call to skit_trie_remove during iteration. #iters = %d, key = \"%.*s\", flags = \"%s\"",
-			trie->iterator_count, key_len, key_ptr, flags_str);
+		const skit_trie_node *node = prefixes->node;
+		size_t pos = prefixes->pos;
+		prefixes->node = skit_trie_prefix_step(node, input_ptr, input_len, &prefixes->pos);
+		if ( node->have_value )
+		{
+			*key = skit_slice_of(prefixes->input, 0, pos);
+			*value = (void*)node->value;
+			return 1;
+		}
 	}
 
-	printf("%s, %d: Stub!  Not implemented.\n", __func__, __LINE__);
-	return skit_slice_null();
+	*key = skit_slice_null();
+	*value = NULL;
+	return 0;
 }
 
 /* ------------------------------------------------------------------------- */
 
-size_t skit_trie_len( const skit_trie *trie )
-{
-	return trie->length;
-}
+#if defined(__GNUC__)
+#  define SKIT_TRIE_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#  define SKIT_TRIE_PREFETCH(addr) ((void)0)
+#endif
 
-/* ------------------------------------------------------------------------- */
+/* How many lookups skit_trie_lookup_many keeps in flight at once. */
+#define SKIT_TRIE_BATCH_LANES 8
 
-static int32_t skit_trie_count_leaves( const skit_trie_node *node )
+typedef struct skit_trie_batch_lane skit_trie_batch_lane;
+struct skit_trie_batch_lane
 {
-	if ( node == NULL || node->nodes_len == 0 )
-		return 1;
+	const skit_trie_node  *node;      /* NULL if the lane is idle. */
+	const uint8_t         *key;
+	size_t                key_len;
+	size_t                pos;
+	size_t                index;      /* Which of the keys this lane is looking up. */
+	int                   searching;  /* Set once the node's search structure has been prefetched. */
+};
 
-	size_t i = 0;
-	size_t result = 0;
-	if ( node->nodes_len <= SKIT__TRIE_NODE_PREALLOC )
+/*
+Takes one step of a lane's lookup.  Each step touches only memory that the
+step before it prefetched, and prefetches whatever the next one will need,
+so the lookups in the other lanes run while that memory is on its way.
+Stepping into a child takes two steps when the node searches for its
+children outside of itself (node16s, node48s, and tables), and one step
+otherwise.
+Returns 1 if the key was found (lane->node is its node), -1 if it isn't in
+the trie, or 0 if there is more to do.
+*/
+static int skit_trie_batch_step(skit_trie_batch_lane *lane)
+{
+	const skit_trie_node *node = lane->node;
+	if ( !lane->searching )
 	{
-		for(; i < node->nodes_len; i++ )
-			result += skit_trie_count_leaves(&node->nodes.array[i]);
+		if ( lane->pos == lane->key_len )
+			return node->have_value ? 1 : -1;
+
+		size_t n = node->nodes_len;
+		if ( n == 0 )
+			return -1;
+
+		if ( n == 1 )
+		{
+			if ( lane->key_len - lane->pos < node->chars_len ||
+			     memcmp(node->chars, lane->key + lane->pos, node->chars_len) != 0 )
+				return -1;
+			lane->pos += node->chars_len;
+			lane->node = node->nodes.array;
+			SKIT_TRIE_PREFETCH(lane->node);
+			return 0;
+		}
+
+		if ( n > SKIT__TRIE_NODE_PREALLOC )
+		{
+			uint8_t c = lane->key[lane->pos];
+			if ( n <= SKIT__TRIE_NODE16_MAX )
+				SKIT_TRIE_PREFETCH(node->nodes.n16->keys);
+			else if ( n <= SKIT__TRIE_NODE48_MAX )
+				SKIT_TRIE_PREFETCH(&node->nodes.n48->index[c]);
+			else
+				SKIT_TRIE_PREFETCH(&node->nodes.table[c]);
+			lane->searching = 1;
+			return 0;
+		}
 	}
-	else
+
+	lane->searching = 0;
+	const skit_trie_node *child = skit_trie_node_find_child(node, lane->key[lane->pos]);
+	if ( child == NULL )
+		return -1;
+	lane->pos++;
+	lane->node = child;
+	SKIT_TRIE_PREFETCH(child);
+	return 0;
+}
+
+size_t skit_trie_lookup_many( const skit_trie *trie, const skit_slice *keys, size_t n_keys, void **values )
+{
+	size_t i;
+	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_lookup_many.");
+	sENFORCE_MSG(n_keys == 0 || (keys != NULL && values != NULL),
+		"NULL keys or values given in call to skit_trie_lookup_many.");
+
+	if ( trie->root == NULL )
 	{
-		for(; i < 256; i++ )
-			if ( node->nodes.table[i] != NULL )
-				result += skit_trie_count_leaves(node->nodes.table[i]);
+		for ( i = 0; i < n_keys; i++ )
+			values[i] = NULL;
+		return 0;
 	}
 
-	return result;
+	skit_trie_batch_lane lanes[SKIT_TRIE_BATCH_LANES];
+	size_t n_busy = 0;
+	size_t n_found = 0;
+	size_t next_key = 0;
+	for ( i = 0; i < SKIT_TRIE_BATCH_LANES; i++ )
+		lanes[i].node = NULL;
+
+	do
+	{
+		for ( i = 0; i < SKIT_TRIE_BATCH_LANES; i++ )
+		{
+			skit_trie_batch_lane *lane = &lanes[i];
+			int result = 0;
+			if ( lane->node != NULL )
+			{
+				result = skit_trie_batch_step(lane);
+				if ( result == 0 )
+					continue;
+
+				values[lane->index] = result > 0 ? (void*)lane->node->value : NULL;
+				n_found += result > 0;
+				lane->node = NULL;
+				n_busy--;
+			}
+
+			if ( next_key < n_keys )
+			{
+				lane->key = (const uint8_t*)sSPTR(keys[next_key]);
+				lane->key_len = sSLENGTH(keys[next_key]);
+				sENFORCE_MSG(lane->key != NULL, "NULL key given in call to skit_trie_lookup_many.");
+				lane->pos = 0;
+				lane->index = next_key++;
+				lane->searching = 0;
+				lane->node = trie->root;
+				n_busy++;
+			}
+		}
+	}
+	while ( n_busy > 0 );
+
+	return n_found;
 }
 
-typedef struct skit_trie_drawing skit_trie_drawing;
-struct skit_trie_drawing
+static void skit_trie_lookup_test()
 {
-	int32_t width;
-	int32_t height;
-	char *buffer;
-};
+	skit_trie *trie = skit_trie_new();
+	skit_trie_setc(trie, "abc", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "XYz", (void*)2, SKIT_FLAG_C);
 
-typedef struct skit_trie_draw_cursor skit_trie_draw_cursor;
-struct skit_trie_draw_cursor
-{
-	int32_t x;
-	int32_t y;
-};
+	void *val;
+	sASSERT(skit_trie_lookup(trie, sSLICE("abc"), &val, SKIT_FLAGS_NONE));
+	sASSERT_EQ((size_t)val, 1);
+	sASSERT(!skit_trie_lookup(trie, sSLICE("ABC"), &val, SKIT_FLAGS_NONE));
+	sASSERT(val == NULL);
+	sASSERT(skit_trie_lookup(trie, sSLICE("xyZ"), &val, SKIT_FLAG_I));
+	sASSERT_EQ((size_t)val, 2);
+	sASSERT(!skit_trie_lookup(trie, sSLICE("ab"), NULL, SKIT_FLAGS_NONE));
+	sASSERT(!skit_trie_lookup(trie, sSLICE("abcd"), NULL, SKIT_FLAGS_NONE));
 
-static char *skit_trie_cell_addr( skit_trie_drawing *dst, int32_t x, int32_t y )
-{
-	return &dst->buffer[x + (y * dst->width)];
+	/* The key return buffer is left alone. */
+	sASSERT_EQS(skit_trie_getc(trie, "abc", &val, SKIT_FLAGS_NONE), sSLICE("abc"));
+	sASSERT(skit_trie_lookup(trie, sSLICE("XYz"), &val, SKIT_FLAGS_NONE));
+	sASSERT_EQS(skit_slice_of(trie->key_return_buf.as_slice, 0, 3), sSLICE("abc"));
+	skit_trie_free(trie);
+
+	/* A key that ends partway through the characters after another key's */
+	/*   value isn't in the trie. */
+	trie = skit_trie_new();
+	skit_trie_setc(trie, "abcd", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "abcdefghi", (void*)2, SKIT_FLAG_C);
+	sASSERT(!skit_trie_lookup(trie, sSLICE("abcdef"), &val, SKIT_FLAGS_NONE));
+	sASSERT(!skit_trie_lookup(trie, sSLICE("ABCDEF"), &val, SKIT_FLAG_I));
+	sASSERT_EQS(skit_trie_getc(trie, "abcdef", &val, SKIT_FLAGS_NONE), skit_slice_null());
+	sASSERT_EQS(skit_trie_remove(trie, sSLICE("abcdef"), SKIT_FLAG_C), skit_slice_null());
+	sASSERT_EQ(skit_trie_len(trie), 2);
+	sASSERT_EQS(skit_trie_setc(trie, "abcdef", (void*)3, SKIT_FLAG_C), sSLICE("abcdef"));
+	sASSERT(skit_trie_lookup(trie, sSLICE("abcd"), &val, SKIT_FLAGS_NONE));
+	sASSERT_EQ((size_t)val, 1);
+	sASSERT(skit_trie_lookup(trie, sSLICE("abcdef"), &val, SKIT_FLAGS_NONE));
+	sASSERT_EQ((size_t)val, 3);
+	sASSERT(skit_trie_lookup(trie, sSLICE("abcdefghi"), &val, SKIT_FLAGS_NONE));
+	sASSERT_EQ((size_t)val, 2);
+	skit_trie_free(trie);
+
+	printf("  skit_trie_lookup_test passed.\n");
 }
 
-static void skit_trie_ndraw( skit_trie_drawing *dst, skit_trie_draw_cursor *cursor, const char *str_ptr, int32_t str_len )
+static void skit_trie_icase_test()
 {
-	int32_t rclip = cursor->x + str_len;
-	if ( rclip > dst->width )
-		str_len -= (dst->width - rclip);
-	
-	sASSERT_GE(cursor->x, 0);
-	
-	memcpy(skit_trie_cell_addr(dst, cursor->x, cursor->y), str_ptr, str_len);
-	(cursor->x) += str_len;
-}
+	void *val;
+	skit_trie *trie = skit_trie_new();
 
-#define skit_trie_draw( dst, cursor, str ) \
-	(skit_trie_ndraw( (dst), (cursor), (str), sizeof(str)-1 ))
+	/* Only the lower-case branch leads to a match, so the lookup must back up. */
+	skit_trie_setc(trie, "Ax", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "aY", (void*)2, SKIT_FLAG_C);
+	sASSERT_EQS(skit_trie_getc(trie, "ay", &val, SKIT_FLAG_I), sSLICE("aY"));
+	sASSERT_EQ((skit_uintptr_t)val, 2);
+	sASSERT_EQS(skit_trie_getc(trie, "aX", &val, SKIT_FLAG_I), sSLICE("Ax"));
+	sASSERT_EQ((skit_uintptr_t)val, 1);
+	sASSERT_EQS(skit_trie_getc(trie, "az", &val, SKIT_FLAG_I), skit_slice_null());
 
-static void skit_trie_draw_value( skit_trie_drawing *dst, skit_trie_draw_cursor *cursor, const void *value )
-{
-	char spbuf[22];
-	
-	/* Use spbuf to avoid writing a '\0' to the drawing. */
-	int n_chars = snprintf( spbuf, sizeof(spbuf), "(%p)", value );
-	skit_trie_ndraw( dst, cursor, spbuf, n_chars );
+	/* Characters without case, and nodes with only one of the cases. */
+	skit_trie_setc(trie, "1b", (void*)3, SKIT_FLAG_C);
+	skit_trie_setc(trie, "Qq", (void*)4, SKIT_FLAG_C);
+	sASSERT_EQS(skit_trie_getc(trie, "1B", &val, SKIT_FLAG_I), sSLICE("1b"));
+	sASSERT_EQ((skit_uintptr_t)val, 3);
+	sASSERT_EQS(skit_trie_getc(trie, "qQ", &val, SKIT_FLAG_I), sSLICE("Qq"));
+	sASSERT_EQ((skit_uintptr_t)val, 4);
+	sASSERT(skit_trie_lookup(trie, sSLICE("AY"), NULL, SKIT_FLAG_I));
+	sASSERT(!skit_trie_lookup(trie, sSLICE("1"), NULL, SKIT_FLAG_I));
+
+	skit_trie_free(trie);
+	printf("  skit_trie_icase_test passed.\n");
 }
 
-static void skit_trie_draw_char( skit_trie_drawing *dst, skit_trie_draw_cursor *cursor, uint8_t c )
+/* Keys for the icase index test: up to 4 characters from "aAbB". */
+#define SKIT_TRIE_ITEST_MAX_LEN 4
+#define SKIT_TRIE_ITEST_N_KEYS  (1 + 4 + 16 + 64 + 256)
+#define SKIT_TRIE_ITEST_N_FOLDS (1 + 2 + 4 + 8 + 16)
+
+/* Writes the key numbered 'id' into 'buf' and returns its length. */
+static size_t skit_trie_itest_key(size_t id, char *buf, size_t *fold_id)
 {
-	if ( c == '\\' )
-		skit_trie_draw( dst, cursor, "\\\\" );
-	else if ( 0x20 <= c && c < 0x7F ) /* Printable chars between space (inclusive) and delete (exclusive) */
-		skit_trie_ndraw( dst, cursor, (const char*)&c, 1 );
-	else
+	static const char alphabet[] = "aAbB";
+	size_t len = 0;
+	size_t n_of_len = 1;
+	size_t fold_base = 0;
+	while ( id >= n_of_len )
 	{
-		/* Non-printables, ex: the null byte becomes \x00 */
-		char spbuf[5];
-		
-		/* Use spbuf to avoid writing a '\0' to the drawing. */
-		int n_chars = snprintf( spbuf, sizeof(spbuf), "\\x%.2X", c );
-		skit_trie_ndraw( dst, cursor, spbuf, n_chars );
+		id -= n_of_len;
+		fold_base += (size_t)1 << len; /* Each length has 2^len lowercased keys. */
+		n_of_len *= 4;
+		len++;
+	}
+
+	size_t i;
+	size_t fold = 0;
+	for ( i = 0; i < len; i++ )
+	{
+		size_t digit = (id >> (2*i)) & 3;
+		buf[i] = alphabet[digit];
+		fold |= (digit >> 1) << i;
 	}
+	*fold_id = fold_base + fold;
+	return len;
 }
 
-static void skit_trie_draw_vert_branch(
-	skit_trie_drawing *dst,
-	int32_t x,
-	int32_t y1,
-	int32_t y2,
-	const char *distinction,
-	int32_t vert_branch_top,
-	int32_t vert_branch_bottom)
+static void skit_trie_icase_index_test()
 {
-	skit_trie_draw_cursor cursor;
+	void *val;
 	size_t i;
-	
-	cursor.x = x;
-	cursor.y = (y1 + y2) / 2;
-	skit_trie_draw( dst, &cursor, "-" );
-	
-	int32_t distinction_len = strlen(distinction);
-	if ( distinction_len > 0 )
-		skit_trie_ndraw( dst, &cursor, distinction, distinction_len );
-	
-	int32_t vert_branch_x = cursor.x;
-	cursor.x = vert_branch_x;
-	cursor.y = vert_branch_top;
-	skit_trie_draw( dst, &cursor, "," );
-	
-	for ( i = vert_branch_top+1; i < vert_branch_bottom; i++ )
+	char buf[SKIT_TRIE_ITEST_MAX_LEN];
+
+	/* The example from trie.h. */
+	skit_trie *trie = skit_trie_new();
+	skit_trie_enable_icase_index(trie);
+	skit_trie_setc(trie, "Content-Type", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "content-type", (void*)2, SKIT_FLAG_C);
+	sASSERT_EQS(skit_trie_getc(trie, "CONTENT-TYPE", &val, SKIT_FLAG_I), sSLICE("Content-Type"));
+	sASSERT_EQ((skit_uintptr_t)val, 1);
+	skit_trie_remove(trie, sSLICE("Content-Type"), SKIT_FLAGS_NONE);
+	sASSERT_EQS(skit_trie_getc(trie, "CONTENT-TYPE", &val, SKIT_FLAG_I), sSLICE("content-type"));
+	sASSERT_EQ((skit_uintptr_t)val, 2);
+	skit_trie_free(trie);
+
+	/* Keys that are already there get indexed, preferring upper case. */
+	trie = skit_trie_new();
+	skit_trie_setc(trie, "xy", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "xY", (void*)2, SKIT_FLAG_C);
+	skit_trie_enable_icase_index(trie);
+	skit_trie_enable_icase_index(trie);
+	sASSERT_EQS(skit_trie_getc(trie, "XY", &val, SKIT_FLAG_I), sSLICE("xY"));
+	sASSERT(skit_trie_lookup(trie, sSLICE("Xy"), &val, SKIT_FLAG_I));
+	sASSERT_EQ((skit_uintptr_t)val, 2);
+	sASSERT_EQS(skit_trie_setc(trie, "XY", (void*)3, SKIT_FLAG_O | SKIT_FLAG_I), sSLICE("xY"));
+	sASSERT(skit_trie_lookup(trie, sSLICE("xy"), &val, SKIT_FLAG_I));
+	sASSERT_EQ((skit_uintptr_t)val, 3);
+	skit_trie_setc(trie, "xy", (void*)5, SKIT_FLAG_O);
+	sASSERT(skit_trie_lookup(trie, sSLICE("XY"), &val, SKIT_FLAG_I));
+	sASSERT_EQ((skit_uintptr_t)val, 3);
+	skit_trie_setc(trie, "xY", (void*)6, SKIT_FLAG_O);
+	sASSERT(skit_trie_lookup(trie, sSLICE("XY"), &val, SKIT_FLAG_I));
+	sASSERT_EQ((skit_uintptr_t)val, 6);
+	sASSERT(!skit_trie_lookup(trie, sSLICE("xz"), &val, SKIT_FLAG_I));
+	sASSERT(val == NULL);
+	sASSERT_EQS(skit_trie_setc(trie, "XYZ", (void*)4, SKIT_FLAG_C | SKIT_FLAG_I), sSLICE("XYZ"));
+	sASSERT_EQ(skit_trie_len(trie), 3);
+	sASSERT_EQS(skit_trie_remove(trie, sSLICE("xyz"), SKIT_FLAG_I), sSLICE("XYZ"));
+	skit_trie_free(trie);
+
+	/*
+	Random insertions and removals.  canonical[] tracks which spelling each
+	lowercased key should resolve to: the first one inserted, until it is
+	removed.  Then any remaining spelling may take over, but it has to stay
+	the same until it is removed in turn.
+	*/
+	uint8_t present[SKIT_TRIE_ITEST_N_KEYS];
+	ssize_t canonical[SKIT_TRIE_ITEST_N_FOLDS];
+	memset(present, 0, sizeof(present));
+	for ( i = 0; i < SKIT_TRIE_ITEST_N_FOLDS; i++ )
+		canonical[i] = -1;
+
+	trie = skit_trie_new();
+	skit_trie_enable_icase_index(trie);
+	unsigned int seed = 2468;
+	int step;
+	for ( step = 0; step < 4000; step++ )
 	{
-		cursor.x = vert_branch_x;
-		cursor.y = i;
-		skit_trie_draw( dst, &cursor, "|" );
+		size_t fold;
+		size_t id = ((seed = seed * 1103515245 + 12345) >> 16) % SKIT_TRIE_ITEST_N_KEYS;
+		skit_slice key = skit_slice_of_cstrn(buf, skit_trie_itest_key(id, buf, &fold));
+		sASSERT_LT(fold, SKIT_TRIE_ITEST_N_FOLDS);
+
+		if ( !present[id] )
+		{
+			skit_trie_set(trie, key, (void*)(id+1), SKIT_FLAG_C);
+			present[id] = 1;
+			if ( canonical[fold] < 0 )
+				canonical[fold] = id;
+		}
+		else if ( step % 3 != 0 )
+		{
+			skit_trie_remove(trie, key, SKIT_FLAGS_NONE);
+			present[id] = 0;
+			if ( canonical[fold] == id )
+			{
+				canonical[fold] = -1;
+				if ( skit_trie_lookup(trie, key, &val, SKIT_FLAG_I) )
+				{
+					canonical[fold] = (skit_uintptr_t)val - 1;
+					sASSERT(present[canonical[fold]]);
+				}
+			}
+		}
+
+		/* Every case-insensitive lookup resolves to the canonical spelling. */
+		for ( i = 0; i < SKIT_TRIE_ITEST_N_KEYS; i += 7 )
+		{
+			size_t ifold;
+			char ibuf[SKIT_TRIE_ITEST_MAX_LEN];
+			skit_slice ikey = skit_slice_of_cstrn(ibuf, skit_trie_itest_key(i, ibuf, &ifold));
+			skit_slice found = skit_trie_get(trie, ikey, &val, SKIT_FLAG_I);
+			if ( canonical[ifold] < 0 )
+				sASSERT(skit_slice_is_null(found));
+			else
+			{
+				sASSERT_EQ((skit_uintptr_t)val, canonical[ifold] + 1);
+				sASSERT_IEQS(found, ikey);
+			}
+		}
 	}
-	
-	cursor.x = vert_branch_x;
-	cursor.y = vert_branch_bottom;
-	skit_trie_draw( dst, &cursor, "`" );
+	skit_trie_free(trie);
+
+	printf("  skit_trie_icase_index_test passed.\n");
 }
-	
 
-static void skit_trie_draw_node( skit_trie_drawing *dst, const skit_trie_node *node, int32_t x, int32_t y1, int32_t y2 );
+/* ------------------------------------------------------------------------- */
 
-static void skit_trie_draw_horiz_branch(
-	skit_trie_drawing *dst,
-	const skit_trie_node *node, 
-	const uint8_t c,
-	int32_t x,
-	int32_t *cy1,
-	int32_t *cy2,
-	int32_t *vert_branch_top,
-	int32_t *vert_branch_bottom)
+static void skit_trie_node_ctor( skit_trie_node *node )
 {
-	skit_trie_draw_cursor cursor;
-	
-	/* This child's lower bound is the previous child's upper bound. */
-	*cy1 = *cy2;
-	int32_t n_leaves = skit_trie_count_leaves(node) * 2 - 1;
-	*cy2 += n_leaves;
-	
-	cursor.x = x;
-	cursor.y = (*cy1 + *cy2) / 2;
-	
-	/* Draw the branch, followed by the next node. */
-	skit_trie_draw( dst, &cursor, "-> '" );
-	skit_trie_draw_char( dst, &cursor, c );
-	skit_trie_draw( dst, &cursor, "' " );
-	
-	skit_trie_draw_node( dst, node, cursor.x, *cy1, *cy2 );
+	node->nodes.array = NULL;
+	node->value = NULL;
+	node->nodes_len = 0;
+	node->chars_len = 0;
+	node->have_value = 0;
+}
 
-	/* Record the sizing info for the vertical branch. */
-	*vert_branch_top    = SKIT_MIN( *vert_branch_top, cursor.y );
-	*vert_branch_bottom = SKIT_MAX( *vert_branch_bottom, cursor.y );
-	
-	/* This inserts a space between the branches. */
-	(*cy2)++;
+static skit_trie_node *skit_trie_node_new(skit_trie_pool *pool)
+{
+	skit_trie_node *result = skit_trie_pool_alloc(pool, sizeof(skit_trie_node));
+	skit_trie_node_ctor(result);
+	return result;
 }
 
-static void skit_trie_draw_node( skit_trie_drawing *dst, const skit_trie_node *node, int32_t x, int32_t y1, int32_t y2 )
+/* ------------------------------------------------------------------------- */
+
+/*
+. Converts
+.
+.     node -> "asdf" -> node -> "qwer" -> value
+.
+. into
+.
+.     node -> "asdfqwer" -> value
+.
+If the tail has more complicated constructs in it, then the folding will
+stop at the first non-linear node.  Nodes that can't hold all of the
+characters are filled up, and the remainder is left in the next node.
+This is purely a space-optimization.
+
+Insertion rarely creates such chains: the node splitting code tends to avoid
+them on its own.  Removal does create them, though.  Removing "abc" from
+{"abc","abcdef"} leaves the "abc" node as a valueless link in a linear
+chain, and folding is what gives the memory back.
+*/
+static skit_trie_node *skit_trie_node_fold(skit_trie_pool *pool, skit_trie_node *node)
 {
-	skit_trie_draw_cursor cursor;
-	
-	if ( node == NULL )
+	while ( node->nodes_len == 1 && node->chars_len < SKIT__TRIE_NODE_PREALLOC )
 	{
-		/* Completely empty tree. */
-		cursor.x = x;
-		cursor.y = (y2 + y1) / 2;
-		
-		skit_trie_draw( dst, &cursor, "-> {null node}\n" );
+		/* A linear node always owns its child's memory block by itself. */
+		skit_trie_node *child = node->nodes.array;
+		if ( child->have_value || child->nodes_len != 1 )
+			break;
+
+		size_t n_chars = SKIT_MIN(
+			SKIT__TRIE_NODE_PREALLOC - node->chars_len, child->chars_len);
+		memcpy(node->chars + node->chars_len, child->chars, n_chars);
+		node->chars_len += n_chars;
+
+		if ( n_chars < child->chars_len )
+		{
+			/* The child may be below the part of a shared trie that the */
+			/*   current write copied. */
+			child = node->nodes.array = skit_trie_pool_own(pool, child, sizeof(skit_trie_node));
+			memmove(child->chars, child->chars + n_chars, child->chars_len - n_chars);
+			child->chars_len -= n_chars;
+			break;
+		}
+
+		/* The child is empty now: splice it out. */
+		node->nodes.array = child->nodes.array;
+		skit_trie_pool_free(pool, child, sizeof(skit_trie_node));
 	}
-	else if ( node->nodes_len == 0 )
-	{
-		/* Leaf nodes. */
-		cursor.x = x;
-		cursor.y = (y2 + y1) / 2;
-		
-		/*skit_trie_draw( dst, &cursor, "-> " );*/
-		
-		if ( node->have_value )
-			skit_trie_draw_value( dst, &cursor, node->value );
-		else
-			skit_trie_draw( dst, &cursor, "{empty leaf}");
-		
-		/*skit_trie_draw( dst, &cursor, "\n" );*/
+
+	return node;
+}
+
+static void skit_trie_node_set_value( skit_trie_node *node, const void *value )
+{
+	node->value = value;
+	node->have_value = 1;
+}
+
+static void skit_trie_node_insert_non0_str(
+	skit_trie_pool *pool,
+	skit_trie_node *node,
+	skit_trie_node *tail,
+	const uint8_t *str_ptr,
+	size_t str_len )
+{
+	sASSERT(node != NULL);
+	sASSERT(tail != NULL);
+	sASSERT(node != tail);
+
+	skit_trie_node_ctor(node);
+
+	skit_trie_node *next_node;
+	if ( str_len > SKIT__TRIE_NODE_PREALLOC )
+	{
+		next_node = skit_trie_node_new(pool);
+		skit_trie_node_insert_non0_str(pool, next_node, tail,
+			str_ptr + SKIT__TRIE_NODE_PREALLOC,
+			str_len - SKIT__TRIE_NODE_PREALLOC);
+
+		node->chars_len = SKIT__TRIE_NODE_PREALLOC;
 	}
-	else if ( node->nodes_len == 1 )
+	else
 	{
-		/* Linear nodes. (and multi-nodes with 1 child) */
-		cursor.x = x;
-		cursor.y = (y2 + y1) / 2;
-		
-		if ( node->have_value )
-		{
-			skit_trie_draw_value( dst, &cursor, node->value );
-			skit_trie_draw( dst, &cursor, " " );
-		}
-		
-		skit_trie_draw( dst, &cursor, "-> " );
-		
-		const char *delimiter;
-		if ( node->chars_len > 1 )
-			delimiter = "\"";
-		else
-			delimiter = "'";
-		
-		size_t i;
-		skit_trie_ndraw( dst, &cursor, delimiter, 1 );
-		for ( i = 0; i < node->chars_len; i++ )
-			skit_trie_draw_char( dst, &cursor, node->chars[i] );
-		skit_trie_ndraw( dst, &cursor, delimiter, 1 );
-		skit_trie_draw( dst, &cursor, " " );
-		
-		skit_trie_draw_node( dst, &node->nodes.array[0], cursor.x, y1, y2 );
+		next_node = tail;
+		node->chars_len = str_len;
 	}
-	else if ( node->nodes_len <= SKIT__TRIE_NODE_PREALLOC )
+
+	memcpy(node->chars, str_ptr, node->chars_len);
+	node->nodes_len = 1;
+	node->nodes.array = next_node;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_trie_node_append_str(
+	skit_trie_pool *pool,
+	skit_trie_node *node,
+	skit_trie_node **new_tail,
+	const uint8_t *str_ptr,
+	size_t str_len )
+{
+	if ( str_len == 0 ) {
+		*new_tail = node;
+	} else {
+		*new_tail = skit_trie_node_new(pool);
+		skit_trie_node_insert_non0_str(pool, node, *new_tail, str_ptr, str_len);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static skit_trie_node *skit_trie_finish_tail(
+	skit_trie_pool *pool,
+	skit_trie_node *given_start_node,
+	const skit_trie_coords coords,
+	const uint8_t *key_ptr,
+	size_t key_len,
+	const void *value)
+{
+	skit_trie_node *new_value_node;
+
+	skit_trie_node_ctor(given_start_node);
+
+	const uint8_t *new_node_str = key_ptr + (coords.pos + 1);
+	size_t         new_node_len = key_len - (coords.pos + 1);
+	skit_trie_node_append_str(pool, given_start_node, &new_value_node, new_node_str, new_node_len);
+	skit_trie_node_set_value(new_value_node, value);
+	return given_start_node;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_trie_split_node(
+	skit_trie *trie,
+	skit_trie_coords coords,
+	const uint8_t *key_ptr,
+	size_t key_len,
+	const void *value);
+
+/* ------------------------------------------------------------------------- */
+
+/* Converts a full multi-node into a node16 with room for one more child. */
+static void skit_trie_grow_multi_to_n16(skit_trie_pool *pool, skit_trie_node *node)
+{
+	sASSERT_EQ(node->nodes_len, SKIT__TRIE_NODE_PREALLOC);
+	sASSERT_EQ(node->chars_len, SKIT__TRIE_NODE_PREALLOC);
+
+	skit_trie_node16 *n16 = skit_trie_pool_alloc(pool, SKIT_TRIE_NODE16_SIZE(node->nodes_len + 1));
+	memcpy(n16->keys, node->chars, node->nodes_len);
+	memcpy(n16->children, node->nodes.array, sizeof(skit_trie_node) * node->nodes_len);
+
+	skit_trie_pool_free(pool, node->nodes.array, sizeof(skit_trie_node) * node->nodes_len);
+	node->nodes.n16 = n16;
+	node->chars_len = 0xFF;
+}
+
+/* Converts a full node16 into a node48 with room for one more child. */
+static void skit_trie_grow_n16_to_n48(skit_trie_pool *pool, skit_trie_node *node)
+{
+	size_t i;
+	sASSERT_EQ(node->nodes_len, SKIT__TRIE_NODE16_MAX);
+
+	skit_trie_node16 *n16 = node->nodes.n16;
+	skit_trie_node48 *n48 = skit_trie_pool_alloc(pool, SKIT_TRIE_NODE48_SIZE(node->nodes_len + 1));
+	memset(n48->index, 0, sizeof(n48->index));
+	for ( i = 0; i < node->nodes_len; i++ )
+		n48->index[n16->keys[i]] = i + 1;
+	memcpy(n48->children, n16->children, sizeof(skit_trie_node) * node->nodes_len);
+
+	skit_trie_pool_free(pool, n16, SKIT_TRIE_NODE16_SIZE(node->nodes_len));
+	node->nodes.n48 = n48;
+}
+
+/* Converts a full node48 into a table node. */
+static void skit_trie_grow_n48_to_table(skit_trie_pool *pool, skit_trie_node *node)
+{
+	size_t i;
+	sASSERT_EQ(node->nodes_len, SKIT__TRIE_NODE48_MAX);
+
+	skit_trie_node48 *n48 = node->nodes.n48;
+
+	/* Default initialization for a node's lookup table. */
+	skit_trie_node **new_node_array = skit_trie_pool_alloc(pool, sizeof(skit_trie_node*)*256);
+	for ( i = 0; i < 256; i++ )
+		new_node_array[i] = NULL;
+
+	/* COPY all of the nodes out of the node48 and into their own blocks */
+	/*   of memory, which are then indexed by node->nodes.table. */
+	/* The copying is important.  Since these keys might be removed later, */
+	/*   it needs to be possible to free each individual node.  Having */
+	/*   some, but not all, of the table's nodes be allocated in the same */
+	/*   block of memory, defeats that purpose.  Freeing that same block */
+	/*   repeatedly and at different offsets is not advised.  That's why */
+	/*   we do away with the contiguous block at this point.               */
+	/* This does mean that lookups need to do an extra indirection, but    */
+	/*   by now the node is wide enough that the 256 entry table costs     */
+	/*   little more than a node48 would.                                  */
+	for ( i = 0; i < 256; i++ )
 	{
-		/* Multi-nodes. */
-		size_t i;
-		int32_t cy1 = y1;
-		int32_t cy2 = y1;
-		int32_t vert_branch_top = dst->height;
-		int32_t vert_branch_bottom = 0;
-		
-		cursor.x = x;
-		cursor.y = (y2 + y1) / 2;
-		if ( node->have_value )
+		if ( n48->index[i] == 0 )
+			continue;
+		skit_trie_node *new_node = skit_trie_pool_alloc(pool, sizeof(skit_trie_node));
+		memcpy(new_node, &n48->children[n48->index[i] - 1], sizeof(skit_trie_node));
+		new_node_array[i] = new_node;
+	}
+
+	skit_trie_pool_free(pool, n48, SKIT_TRIE_NODE48_SIZE(node->nodes_len));
+	node->nodes.table = new_node_array;
+}
+
+/*
+Adds a child for the character 'c' to a node that doesn't have one yet,
+changing the node's shape first if it is full.  Linear nodes may only be
+given to this if they have exactly one character.
+Returns the (uninitialized) new child.
+Any pointers to the node's other children are invalidated, because they
+may have moved.
+*/
+static skit_trie_node *skit_trie_node_add_child(skit_trie_pool *pool, skit_trie_node *node, uint8_t c)
+{
+	skit_trie_node *result;
+	size_t n = node->nodes_len;
+	sASSERT_LT(n, 256);
+	sASSERT(n < 2 || skit_trie_node_find_child(node, c) == NULL);
+
+	if ( n < SKIT__TRIE_NODE_PREALLOC )
+	{
+		sASSERT_EQ(n, node->chars_len);
+		node->nodes.array = skit_trie_pool_realloc(pool, node->nodes.array,
+			sizeof(skit_trie_node) * n, sizeof(skit_trie_node) * (n+1));
+		node->chars[n] = c;
+		node->chars_len = n+1;
+		result = &node->nodes.array[n];
+	}
+	else if ( n < SKIT__TRIE_NODE48_MAX )
+	{
+		if ( n == SKIT__TRIE_NODE_PREALLOC )
+			skit_trie_grow_multi_to_n16(pool, node);
+		else if ( n == SKIT__TRIE_NODE16_MAX )
+			skit_trie_grow_n16_to_n48(pool, node);
+		else if ( n < SKIT__TRIE_NODE16_MAX )
+			node->nodes.n16 = skit_trie_pool_realloc(pool, node->nodes.n16,
+				SKIT_TRIE_NODE16_SIZE(n), SKIT_TRIE_NODE16_SIZE(n+1));
+		else
+			node->nodes.n48 = skit_trie_pool_realloc(pool, node->nodes.n48,
+				SKIT_TRIE_NODE48_SIZE(n), SKIT_TRIE_NODE48_SIZE(n+1));
+
+		if ( n < SKIT__TRIE_NODE16_MAX )
 		{
-			skit_trie_draw_value( dst, &cursor, node->value );
-			skit_trie_draw( dst, &cursor, " " );
+			node->nodes.n16->keys[n] = c;
+			result = &node->nodes.n16->children[n];
 		}
-		
-		for( i = 0; i < node->nodes_len; i++ )
+		else
 		{
-			/* x+2 makes room for the vertical branch
-			.                      ,  
-			.                     -|
-			.                      `
-			. construct that will be filled in later. */
-			skit_trie_draw_horiz_branch(
-				dst, &node->nodes.array[i], node->chars[i], cursor.x+2, 
-				&cy1, &cy2, &vert_branch_top, &vert_branch_bottom);
+			node->nodes.n48->index[c] = n+1;
+			result = &node->nodes.n48->children[n];
 		}
-		
-		skit_trie_draw_vert_branch(
-			dst, cursor.x, y1, y2, "", vert_branch_top, vert_branch_bottom);
 	}
 	else
 	{
-		/* Table nodes. */
-		size_t i;
-		int32_t cy1 = y1;
-		int32_t cy2 = y1;
-		int32_t vert_branch_top = dst->height;
-		int32_t vert_branch_bottom = 0;
-		
-		cursor.x = x;
-		cursor.y = (y2 + y1) / 2;
-		if ( node->have_value )
-		{
-			skit_trie_draw_value( dst, &cursor, node->value );
-			skit_trie_draw( dst, &cursor, " " );
-		}
-		
-		for( i = 0; i < 256; i++ )
-		{
-			if ( node->nodes.table[i] == NULL )
-				continue;
-			
-			/* x+4 makes room for the vertical branch
-			.                      ,  
-			.                   -[]|
-			.                      `
-			. construct that will be filled in later. */
-			skit_trie_draw_horiz_branch(
-				dst, node->nodes.table[i], i, cursor.x+4,
-				&cy1, &cy2, &vert_branch_top, &vert_branch_bottom);
-		}
-		
-		skit_trie_draw_vert_branch(
-			dst, cursor.x, y1, y2, "[]", vert_branch_top, vert_branch_bottom);
+		if ( n == SKIT__TRIE_NODE48_MAX )
+			skit_trie_grow_n48_to_table(pool, node);
+		result = skit_trie_pool_alloc(pool, sizeof(skit_trie_node));
+		node->nodes.table[c] = result;
 	}
+
+	node->nodes_len = n+1;
+	return result;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_trie_split_branch_node(
+	skit_trie *trie,
+	skit_trie_coords coords,
+	const uint8_t *key_ptr,
+	size_t key_len,
+	const void *value)
+{
+	SPLIT_DEBUG("%s, %d: \n", __func__, __LINE__);
+	skit_trie_node *node = coords.node;
+	sASSERT(node->nodes_len != 1 || node->chars_len == 1);
+
+	/*
+	New pair is {"cxyz",value}
+	Before
+	.         ,-> 'a' -> cnode0 -> ...
+	. node - {
+	.         `-> 'b' -> cnode1 -> ...
+	After
+	.
+	.         ,-> 'a' -> cnode0 -> ...
+	.        |
+	. node - + -> 'b' -> cnode1 -> ...
+	.        |
+	.         `-> 'c' -> new_node -> "xyz" ... -> new_cnode -> value
+	*/
+	skit_trie_node *new_node = skit_trie_node_add_child(&trie->pool, node, key_ptr[coords.pos]);
+
+	/* skit_trie_finish_tail ensures that the rest of the key gets accounted for. */
+	skit_trie_finish_tail(&trie->pool, new_node, coords, key_ptr, key_len, value);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_trie_split_linear_node(
+	skit_trie *trie,
+	skit_trie_coords coords,
+	const uint8_t *key_ptr,
+	size_t key_len,
+	const void *value)
+{
+	SPLIT_DEBUG("%s, %d: \n", __func__, __LINE__);
+	/* Linear node that has >1 character. */
+	skit_trie_node *node = coords.node;
+	sASSERT(node->nodes_len == 1);
+	sASSERT(node->chars_len > 1);
+
+	if ( coords.n_chars_into_node == 0 )
+	{
+		/* No common prefix: split it into three nodes. */
+		/* Illustration: (new pair is {'xyz',value})
+		Before:
+		.
+		. node -> "abc" -> cnode0 -> ...
+		.
+		After
+		.         ,-> 'a' -> node0 -> "bc" -> cnode0 -> ...
+		. node - {
+		.         `-> 'x' -> node1 -> "yz" ... -> cnode1 -> value
+		.
+		*/
+
+		/* Avoid copying and temporary allocations. */
+		/* We allow cnode0 to remain where it is, and just create a new */
+		/*   block of memory for the new array of nodes. */
+		skit_trie_node *cnode0 = &node->nodes.array[0];
+
+		node->nodes.array = skit_trie_pool_alloc(&trie->pool, 2 * sizeof(skit_trie_node));
+		skit_trie_node *node0 = &node->nodes.array[0];
+		skit_trie_node *node1 = &node->nodes.array[1];
+
+		/* Populate node0. */
+		const uint8_t *node0_str = (const uint8_t*)node->chars + 1;
+		size_t         node0_len = node->chars_len - 1;
+		skit_trie_node_insert_non0_str(&trie->pool, node0, cnode0, node0_str, node0_len);
+
+		/* Populate node1. */
+		skit_trie_finish_tail(&trie->pool, node1, coords, key_ptr, key_len, value);
+
+		/* Setup up the new char-to-node mapping table. */
+		/* Do this AFTER chars has been copied into other nodes. */
+		/* node->chars[0] = node->chars[0]; (already handled.) */
+		node->chars[1] = key_ptr[coords.pos];
+
+		/* Meta-data update.  This should also be done later due to the */
+		/* possibility of overwriting values before they get used in the */
+		/* previous calculations. */
+		node->chars_len = 2;
+		node->nodes_len = 2;
+
+		/* Optimizations. */
+		skit_trie_node_fold(&trie->pool, node0);
+		skit_trie_node_fold(&trie->pool, node1);
+	}
+	else
+	{
+		/* Common prefix: split it into four nodes. */
+		/* Illustration: (new pair is {'abyqp',value2})
+		Before:
+		.
+		. node -> "abxdb" -> cnode0 -> ...
+		.
+		After
+		.                          ,-> 'x' -> node1 -> "db" -> cnode0 -> ...
+		. node -> "ab" -> node0 - {
+		.                          `-> 'y' -> node2 -> "qp" ... -> cnode1 -> value
+		.
+		To accomplish this, we first turn it into this:
+		.
+		. node -> "ab" -> node0 -> "xdb" -> cnode0 -> ...
+		.
+		And then recurse on node0 with new coordinates.
+		The new coordinates will be such that the next operation falls
+		into the (coords.n_chars_into_node == 0) case and gets finished
+		that way.
+		*/
+		skit_trie_node *node0 = skit_trie_node_new(&trie->pool);
+		void *dst_start = node0->chars;
+		void *src_start = node->chars + coords.n_chars_into_node;
+		size_t copy_len = node->chars_len - coords.n_chars_into_node;
+		memcpy( dst_start, src_start, copy_len );
+		node0->chars_len = copy_len;
+
+		/* Transfer the tail (cnode0 in the drawing) to the new node. */
+		node0->nodes.array = node->nodes.array;
+		node0->nodes_len = 1;
+
+		/* Transfer the new node (node0) to the original node. */
+		node->nodes.array = node0;
+		sASSERT(node->nodes_len == 1);
+		node->chars_len = coords.n_chars_into_node;
+
+		/* Calculate the coordinates for the next split. */
+		skit_trie_coords new_coords = coords;
+		new_coords.node = node0;
+		new_coords.pos  = coords.pos;
+		new_coords.n_chars_into_node = 0;
+
+		/* Note that (node0->chars_len == 1) is possible. */
+		/* This means that if we called skit_trie_split_linear_node, then */
+		/*   we could easily violate the assertion that (node->chars_len > 1) */
+		/* Because of that danger, we call the more generic */
+		/*   skit_trie_split_node to force a reclassification of node0. */
+		skit_trie_split_node(trie, new_coords, key_ptr, key_len, value);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_trie_split_node(
+	skit_trie *trie,
+	skit_trie_coords coords,
+	const uint8_t *key_ptr,
+	size_t key_len,
+	const void *value)
+{
+	SPLIT_DEBUG("%s, %d: \n", __func__, __LINE__);
+	skit_trie_node *node = coords.node;
+
+	if ( coords.n_chars_into_node == 0 && coords.pos == key_len )
+		skit_trie_node_set_value(node, value);
+	else if ( node->nodes_len == 1 && node->chars_len > 1 )
+		skit_trie_split_linear_node(trie, coords, key_ptr, key_len, value);
+	else
+		skit_trie_split_branch_node(trie, coords, key_ptr, key_len, value);
+}
+
+/* ------------------------------------------------------------------------- */
+
+skit_slice skit_trie_set( skit_trie *trie, const skit_slice key, const void *value, skit_flags flags )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t key_len = sSLENGTH(key);
+	const uint8_t *key_ptr = (const uint8_t*)sSPTR(key);
+	ENTRY_DEBUG("skit_trie_set(trie, \"%.*s\", %p, %x)\n", (int)key_len, key_ptr, value, flags);
+	
+	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_set.");
+	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_set.");
+	
+	if ( trie->iterator_count > 0 )
+	{
+		char flags_str[SKIT_FLAGS_BUF_SIZE];
+		skit_flags_to_str(flags, flags_str);
+		sTHROW(SKIT_TRIE_WRITE_IN_ITERATION,
+			"Call to skit_trie_set during iteration. #iters = %d, key = \"%.*s\", flags = \"%s\"",
+			trie->iterator_count, key_len, key_ptr, flags_str);
+	}
+
+	skit_trie_enforce_valid_flags(flags, CREATE | OVERWRITE | ICASE);
+	
+	if ( !(flags & (CREATE | OVERWRITE)) )
+	{
+		char flags_str[SKIT_FLAGS_BUF_SIZE];
+		skit_flags_to_str(flags, flags_str);
+		sTHROW(SKIT_TRIE_BAD_FLAGS,
+			"Call to skit_trie_set without providing 'c' or 'o' flags. key = \"%.*s\", flags = \"%s\"",
+			key_len, key_ptr, flags_str);
+	}
+
+	if ( key_len > sLLENGTH(trie->key_return_buf) )
+		trie->key_return_buf = *skit_loaf_resize(&trie->key_return_buf, key_len);
+
+	/* First insertion. */
+	/* Check this first to avoid calling skit_trie_find in such cases. */
+	if ( trie->root == NULL )
+	{
+		if ( !(flags & CREATE) )
+			sTHROW(SKIT_EXCEPTION,
+				"Wrote a value to an empty trie. Key is \"%.*s\". 'c' (create) not passed in flags.",
+				key_len, key_ptr);
+
+		ENTRY_DEBUG("%s, %d: new root.\n", __func__, __LINE__);
+		trie->root = skit_trie_node_new(&trie->pool);
+		skit_trie_node *end_node;
+		skit_trie_node_append_str(&trie->pool, trie->root, &end_node, key_ptr, key_len);
+		skit_trie_node_set_value(end_node, value);
+		
+		memcpy( sLPTR(trie->key_return_buf), key_ptr, key_len );
+		
+		(trie->length)++;
+		
+		if ( trie->icase_index != NULL )
+			skit_trie_icase_index_add(trie->icase_index, skit_slice_of(trie->key_return_buf.as_slice, 0, key_len), value);
+		
+		return skit_slice_of(trie->key_return_buf.as_slice, 0, key_len);
+	}
+
+	/* Insertions/replacements for already-existing keys. */
+	skit_trie_coords coords = skit_trie_find(trie, key_ptr, key_len, (flags & ICASE) ? 0 : 1);
+
+	if ( skit_exact_match(coords, key_len) )
+	{
+		if ( !(flags & OVERWRITE) )
+			sTHROW(SKIT_EXCEPTION,
+				"Wrote a value to an already existing key \"%.*s\". 'o' (overwrite) not passed in flags.",
+				key_len, key_ptr);
+
+		/* Exact match is the easier case and involves no allocations. */
+		/* Just replace an existing value with the new one. */
+		coords.node->value = value;
+		
+		if ( trie->icase_index != NULL )
+			skit_trie_icase_index_overwrite(trie, key_len, value);
+	}
+	else if ( skit_prefix_match(coords, key_len) || skit_no_match(coords, key_len) )
+	{
+		if ( !(flags & CREATE) )
+			sTHROW(SKIT_EXCEPTION,
+				"Wrote a value to a non-existant key \"%.*s\". 'c' (create) not passed in flags.",
+				key_len, key_ptr);
+
+		/* The first part of key_return_buf will be filled by the call to skit_trie_find. */
+		/* The second part is something we need to fill.  We're inserting the */
+		/*   rest of the key, so we know that it will end up entered exactly */
+		/*   the way the caller supplied it. */
+		void       *dst_start = sLPTR(trie->key_return_buf) + coords.pos;
+		const void *src_start = key_ptr + coords.pos;
+		size_t       copy_len = key_len - coords.pos;
+		memcpy(dst_start, src_start, copy_len);
+
+		/* Split a node to insert the new value. */
+		skit_trie_split_node(trie, coords, key_ptr, key_len, value);
+		
+		/* Update this. */
+		(trie->length)++;
+		
+		if ( trie->icase_index != NULL )
+			skit_trie_icase_index_add(trie->icase_index, skit_slice_of(trie->key_return_buf.as_slice, 0, key_len), value);
+	}
+	else
+		sTHROW(SKIT_FATAL_EXCEPTION, "Impossible result for trie lookup on key \"%.*s\".", key_len, sSPTR(key));
+
+	return skit_slice_of(trie->key_return_buf.as_slice, 0, key_len);
+}
+
+/* ------------------------------------------------------------------------- */
+
+skit_slice skit_trie_setc( skit_trie *trie, const char *key, const void *value, skit_flags flags )
+{
+	return skit_trie_set( trie, skit_slice_of_cstr(key), value, flags );
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Removes the (empty) child at 'index' from a linear or multi-node. */
+static void skit_trie_remove_array_child(skit_trie_pool *pool, skit_trie_node *node, size_t index)
+{
+	sASSERT_LT(index, node->nodes_len);
+	skit_trie_node_dtor(pool, &node->nodes.array[index]);
+
+	size_t n_after = node->nodes_len - index - 1;
+	memmove(&node->nodes.array[index], &node->nodes.array[index+1], n_after * sizeof(skit_trie_node));
+	memmove(&node->chars[index], &node->chars[index+1], n_after);
+	node->nodes_len--;
+
+	if ( node->nodes_len == 0 )
+	{
+		skit_trie_pool_free(pool, node->nodes.array, sizeof(skit_trie_node));
+		node->nodes.array = NULL;
+		node->chars_len = 0;
+	}
+	else
+	{
+		node->nodes.array = skit_trie_pool_realloc(pool, node->nodes.array,
+			sizeof(skit_trie_node) * (node->nodes_len + 1), sizeof(skit_trie_node) * node->nodes_len);
+		node->chars_len = node->nodes_len;
+	}
+}
+
+/*
+The skit_trie_shrink_* functions turn a node that has thinned out back into
+the next smaller shape.  This must happen as soon as the node has few enough
+children for the smaller shape, because everything else uses nodes_len to
+tell the shapes apart.
+*/
+static void skit_trie_shrink_n16_to_multi(skit_trie_pool *pool, skit_trie_node *node)
+{
+	skit_trie_node16 *n16 = node->nodes.n16;
+	sASSERT_EQ(node->nodes_len, SKIT__TRIE_NODE_PREALLOC);
+
+	node->nodes.array = skit_trie_pool_alloc(pool, sizeof(skit_trie_node) * node->nodes_len);
+	memcpy(node->nodes.array, n16->children, sizeof(skit_trie_node) * node->nodes_len);
+	memcpy(node->chars, n16->keys, node->nodes_len);
+	node->chars_len = node->nodes_len;
+
+	skit_trie_pool_free(pool, n16, SKIT_TRIE_NODE16_SIZE(node->nodes_len + 1));
+}
+
+static void skit_trie_shrink_n48_to_n16(skit_trie_pool *pool, skit_trie_node *node)
+{
+	size_t i;
+	size_t n = 0;
+	skit_trie_node48 *n48 = node->nodes.n48;
+	sASSERT_EQ(node->nodes_len, SKIT__TRIE_NODE16_MAX);
+
+	skit_trie_node16 *n16 = skit_trie_pool_alloc(pool, SKIT_TRIE_NODE16_SIZE(node->nodes_len));
+	for ( i = 0; i < 256; i++ )
+	{
+		if ( n48->index[i] == 0 )
+			continue;
+		n16->keys[n] = i;
+		memcpy(&n16->children[n], &n48->children[n48->index[i] - 1], sizeof(skit_trie_node));
+		n++;
+	}
+	sASSERT_EQ(n, node->nodes_len);
+
+	skit_trie_pool_free(pool, n48, SKIT_TRIE_NODE48_SIZE(node->nodes_len + 1));
+	node->nodes.n16 = n16;
+}
+
+static void skit_trie_shrink_table_to_n48(skit_trie_pool *pool, skit_trie_node *node)
+{
+	size_t i;
+	size_t n = 0;
+	skit_trie_node **table = node->nodes.table;
+	sASSERT_EQ(node->nodes_len, SKIT__TRIE_NODE48_MAX);
+
+	skit_trie_node48 *n48 = skit_trie_pool_alloc(pool, SKIT_TRIE_NODE48_SIZE(node->nodes_len));
+	for ( i = 0; i < 256; i++ )
+	{
+		if ( table[i] == NULL )
+		{
+			n48->index[i] = 0;
+			continue;
+		}
+		memcpy(&n48->children[n], table[i], sizeof(skit_trie_node));
+		n48->index[i] = n + 1;
+		skit_trie_pool_free(pool, table[i], sizeof(skit_trie_node));
+		n++;
+	}
+	sASSERT_EQ(n, node->nodes_len);
+
+	skit_trie_pool_free(pool, table, 256 * sizeof(skit_trie_node*));
+	node->nodes.n48 = n48;
+}
+
+/*
+Removes the (empty) child for the character 'c' from a multi-node, node16,
+node48, or table node, changing the node's shape if it gets small enough.
+Any pointers to the node's other children are invalidated.
+*/
+static void skit_trie_node_remove_child(skit_trie_pool *pool, skit_trie_node *node, uint8_t c)
+{
+	size_t i;
+	size_t n = node->nodes_len;
+	sASSERT_GT(n, 1);
+
+	if ( n <= SKIT__TRIE_NODE_PREALLOC )
+	{
+		for ( i = 0; i < n; i++ )
+			if ( node->chars[i] == c )
+				break;
+		sASSERT_LT(i, n);
+		skit_trie_remove_array_child(pool, node, i);
+	}
+	else if ( n <= SKIT__TRIE_NODE16_MAX )
+	{
+		/* The keys aren't sorted, so the last child can fill the hole. */
+		skit_trie_node16 *n16 = node->nodes.n16;
+		for ( i = 0; i < n; i++ )
+			if ( n16->keys[i] == c )
+				break;
+		sASSERT_LT(i, n);
+
+		skit_trie_node_dtor(pool, &n16->children[i]);
+		n16->keys[i] = n16->keys[n-1];
+		n16->children[i] = n16->children[n-1];
+		node->nodes_len = n-1;
+
+		if ( n-1 == SKIT__TRIE_NODE_PREALLOC )
+			skit_trie_shrink_n16_to_multi(pool, node);
+		else
+			node->nodes.n16 = skit_trie_pool_realloc(pool, n16,
+				SKIT_TRIE_NODE16_SIZE(n), SKIT_TRIE_NODE16_SIZE(n-1));
+	}
+	else if ( n <= SKIT__TRIE_NODE48_MAX )
+	{
+		/* Move the last child into the hole, then repoint its index entry. */
+		skit_trie_node48 *n48 = node->nodes.n48;
+		size_t hole = n48->index[c] - 1;
+		sASSERT_LT(hole, n);
+
+		skit_trie_node_dtor(pool, &n48->children[hole]);
+		n48->index[c] = 0;
+		if ( hole != n-1 )
+		{
+			for ( i = 0; i < 256; i++ )
+				if ( n48->index[i] == n )
+					break;
+			sASSERT_LT(i, 256);
+			n48->children[hole] = n48->children[n-1];
+			n48->index[i] = hole + 1;
+		}
+		node->nodes_len = n-1;
+
+		if ( n-1 == SKIT__TRIE_NODE16_MAX )
+			skit_trie_shrink_n48_to_n16(pool, node);
+		else
+			node->nodes.n48 = skit_trie_pool_realloc(pool, n48,
+				SKIT_TRIE_NODE48_SIZE(n), SKIT_TRIE_NODE48_SIZE(n-1));
+	}
+	else
+	{
+		skit_trie_node *child = node->nodes.table[c];
+		sASSERT(child != NULL);
+		skit_trie_node_dtor(pool, child);
+		skit_trie_pool_free(pool, child, sizeof(skit_trie_node));
+		node->nodes.table[c] = NULL;
+		node->nodes_len = n-1;
+
+		if ( n-1 == SKIT__TRIE_NODE48_MAX )
+			skit_trie_shrink_table_to_n48(pool, node);
+	}
+}
+
+/*
+Clears the value at the end of 'key' and then tidies up every node on the
+way back up: empty children are unlinked and freed, thinned-out nodes are
+turned back into smaller shapes, and linear chains are folded together.
+The key must be present and is matched case-sensitively.
+Returns nonzero if 'node' itself ended up with no value and no children,
+in which case the caller must unlink it.
+*/
+static int skit_trie_node_remove_r(
+	skit_trie_pool *pool,
+	skit_trie_node *node,
+	const uint8_t *key,
+	size_t key_len,
+	size_t pos)
+{
+	if ( pos == key_len )
+	{
+		sASSERT(node->have_value);
+		node->have_value = 0;
+		node->value = NULL;
+	}
+	else if ( node->nodes_len == 1 )
+	{
+		sASSERT(pos + node->chars_len <= key_len);
+		if ( skit_trie_node_remove_r(pool, &node->nodes.array[0], key, key_len, pos + node->chars_len) )
+			skit_trie_remove_array_child(pool, node, 0);
+	}
+	else
+	{
+		skit_trie_node *child = skit_trie_node_find_child(node, key[pos]);
+		sASSERT(child != NULL);
+
+		if ( skit_trie_node_remove_r(pool, child, key, key_len, pos+1) )
+			skit_trie_node_remove_child(pool, node, key[pos]);
+	}
+
+	skit_trie_node_fold(pool, node);
+	return !node->have_value && node->nodes_len == 0;
+}
+
+skit_slice skit_trie_remove( skit_trie *trie, const skit_slice key, skit_flags flags )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t key_len = sSLENGTH(key);
+	const uint8_t *key_ptr = (const uint8_t*)sSPTR(key);
+	ENTRY_DEBUG("skit_trie_remove(trie, \"%.*s\", %x)\n", (int)key_len, key_ptr, flags);
+
+	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_remove.");
+	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_remove.");
+	
+	if ( trie->iterator_count > 0 )
+	{
+		char flags_str[SKIT_FLAGS_BUF_SIZE];
+		skit_flags_to_str(flags, flags_str);
+		sTHROW(SKIT_TRIE_WRITE_IN_ITERATION,
+			"Call to skit_trie_remove during iteration. #iters = %d, key = \"%.*s\", flags = \"%s\"",
+			trie->iterator_count, key_len, key_ptr, flags_str);
+	}
+
+	skit_trie_enforce_valid_flags(flags, CREATE | OVERWRITE | ICASE);
+
+	/* Keys longer than any in the trie can't be in it. */
+	/* This also guarantees that skit_trie_find has room to record the key. */
+	skit_trie_coords coords;
+	if ( key_len <= sLLENGTH(trie->key_return_buf) )
+		coords = skit_trie_find(trie, key_ptr, key_len, (flags & ICASE) ? 0 : 1);
+	else
+		coords = skit_trie_stop_lookup(NULL, 0, 0);
+
+	if ( !skit_exact_match(coords, key_len) )
+	{
+		if ( !(flags & CREATE) )
+			sTHROW(SKIT_TRIE_KEY_NOT_FOUND,
+				"Attempt to remove a non-existant key \"%.*s\". 'c' not passed in flags.",
+				key_len, key_ptr);
+		return skit_slice_null();
+	}
+
+	/* skit_trie_find recorded the exact spelling of the key, which lets */
+	/*   the removal walk the trie case-sensitively. */
+	const uint8_t *exact_key = sLPTR(trie->key_return_buf);
+	if ( skit_trie_node_remove_r(&trie->pool, trie->root, exact_key, key_len, 0) )
+	{
+		skit_trie_node_dtor(&trie->pool, trie->root);
+		skit_trie_pool_free(&trie->pool, trie->root, sizeof(skit_trie_node));
+		trie->root = NULL;
+	}
+
+	(trie->length)--;
+
+	if ( trie->icase_index != NULL )
+		skit_trie_icase_index_remove(trie, key_len);
+
+	return skit_slice_of(trie->key_return_buf.as_slice, 0, key_len);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/*
+Copies the node's children, and then their descendants, out of wherever
+they are now and into 'pool'.  All of a node's children are copied before
+any of its grandchildren, so siblings stay next to each other.
+*/
+static void skit_trie_node_relocate(skit_trie_pool *pool, skit_trie_node *node)
+{
+	size_t i;
+	size_t n = node->nodes_len;
+	if ( n == 0 )
+		return;
+
+	size_t block_size = skit_trie_node_block_size(node);
+	void *block = skit_trie_pool_alloc(pool, block_size);
+	memcpy(block, node->nodes.array, block_size);
+
+	if ( n <= SKIT__TRIE_NODE_PREALLOC )
+		node->nodes.array = block;
+	else if ( n <= SKIT__TRIE_NODE16_MAX )
+		node->nodes.n16 = block;
+	else if ( n <= SKIT__TRIE_NODE48_MAX )
+		node->nodes.n48 = block;
+	else
+	{
+		node->nodes.table = block;
+		for ( i = 0; i < 256; i++ )
+		{
+			skit_trie_node *child = node->nodes.table[i];
+			if ( child == NULL )
+				continue;
+			node->nodes.table[i] = skit_trie_pool_alloc(pool, sizeof(skit_trie_node));
+			memcpy(node->nodes.table[i], child, sizeof(skit_trie_node));
+		}
+
+		for ( i = 0; i < 256; i++ )
+			if ( node->nodes.table[i] != NULL )
+				skit_trie_node_relocate(pool, node->nodes.table[i]);
+		return;
+	}
+
+	skit_trie_node *children = skit_trie_node_children(node);
+	for ( i = 0; i < n; i++ )
+		skit_trie_node_relocate(pool, &children[i]);
+}
+
+void skit_trie_compact( skit_trie *trie )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_compact.");
+
+	if ( trie->iterator_count > 0 )
+		sTHROW(SKIT_TRIE_WRITE_IN_ITERATION,
+			"Call to skit_trie_compact during iteration. #iters = %d",
+			trie->iterator_count);
+
+	skit_trie_pool new_pool;
+	skit_trie_pool_ctor(&new_pool);
+	if ( trie->root != NULL )
+	{
+		/* Size the first chunk to hold everything, with nothing left over. */
+		new_pool.next_chunk_size = trie->pool.live_bytes;
+
+		skit_trie_node *root = skit_trie_pool_alloc(&new_pool, sizeof(skit_trie_node));
+		memcpy(root, trie->root, sizeof(skit_trie_node));
+		skit_trie_node_relocate(&new_pool, root);
+		trie->root = root;
+
+		sASSERT_EQ(new_pool.live_bytes, trie->pool.live_bytes);
+		new_pool.next_chunk_size = trie->pool.next_chunk_size;
+	}
+
+	skit_trie_pool_dtor(&trie->pool);
+	trie->pool = new_pool;
+
+	if ( trie->icase_index != NULL )
+		skit_trie_compact(trie->icase_index);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/*
+skit_trie_build_sorted reads each key many times, so it copies the keys'
+pointers and lengths out of their slices first.
+*/
+typedef struct skit_trie_build_key skit_trie_build_key;
+struct skit_trie_build_key
+{
+	const uint8_t *ptr;
+	size_t        len;
+};
+
+/*
+Returns how many bytes past 'depth' all of keys[lo..hi) have in common.
+The keys are sorted, so this is just what the first and last keys share.
+*/
+static size_t skit_trie_build_common_len(const skit_trie_build_key *keys, size_t lo, size_t hi, size_t depth)
+{
+	const uint8_t *first = keys[lo].ptr;
+	const uint8_t *last = keys[hi-1].ptr;
+	size_t max_len = SKIT_MIN(keys[lo].len, keys[hi-1].len) - depth;
+	size_t i;
+	for ( i = 0; i < max_len; i++ )
+		if ( first[depth + i] != last[depth + i] )
+			break;
+	return i;
+}
+
+/*
+Returns the index of the first key after 'lo' whose byte at 'depth' differs
+from keys[lo]'s.  Those bytes only ever go up from one key to the next, so
+this gallops forwards and then bisects, instead of looking at every key.
+*/
+static size_t skit_trie_build_group_end(const skit_trie_build_key *keys, size_t lo, size_t hi, size_t depth)
+{
+	uint8_t c = keys[lo].ptr[depth];
+	size_t step = 1;
+	while ( lo + step < hi && keys[lo + step].ptr[depth] == c )
+	{
+		lo += step;
+		step *= 2;
+	}
+
+	/* keys[lo] has 'c', and the answer is in (lo, end]. */
+	size_t end = SKIT_MIN(lo + step, hi);
+	while ( end - lo > 1 )
+	{
+		size_t mid = lo + (end - lo) / 2;
+		if ( keys[mid].ptr[depth] == c )
+			lo = mid;
+		else
+			end = mid;
+	}
+	return end;
+}
+
+/*
+Constructs the nodes for keys[lo..hi) in 'node' and below, allocating their
+blocks in the same depth-first order that skit_trie_compact uses.
+Returns the number of pool bytes that those blocks take up.
+If 'pool' is NULL, nothing is constructed and only the size is returned:
+'node' is ignored and 'values' isn't read.
+Every key in keys[lo..hi) must have the same first 'depth' bytes.
+*/
+static size_t skit_trie_build_node(
+	skit_trie_pool *pool,
+	skit_trie_node *node,
+	const skit_trie_build_key *keys,
+	void *const *values,
+	size_t lo,
+	size_t hi,
+	size_t depth)
+{
+	size_t i, j, k;
+	size_t n_bytes = 0;
+	size_t common_len = 0;
+
+	/* Linear nodes, until the keys branch apart. */
+	while ( 1 )
+	{
+		if ( pool != NULL )
+			skit_trie_node_ctor(node);
+
+		/* While common_len is nonzero, no key ends here. */
+		if ( common_len == 0 )
+		{
+			/* Only the first key in the range can end at this depth. */
+			if ( keys[lo].len == depth )
+			{
+				if ( pool != NULL )
+					skit_trie_node_set_value(node, values != NULL ? values[lo] : NULL);
+				lo++;
+			}
+
+			if ( lo == hi )
+				return n_bytes;
+
+			common_len = skit_trie_build_common_len(keys, lo, hi, depth);
+			if ( common_len == 0 )
+				break;
+		}
+
+		size_t n_chars = SKIT_MIN(common_len, SKIT__TRIE_NODE_PREALLOC);
+		n_bytes += skit_trie_pool_granules(sizeof(skit_trie_node)) * SKIT__TRIE_POOL_GRANULE;
+		if ( pool != NULL )
+		{
+			memcpy(node->chars, keys[lo].ptr + depth, n_chars);
+			node->chars_len = n_chars;
+			node->nodes_len = 1;
+			node->nodes.array = skit_trie_pool_alloc(pool, sizeof(skit_trie_node));
+			node = node->nodes.array;
+		}
+		common_len -= n_chars;
+		depth += n_chars;
+	}
+
+	/* A branch: there is one child for each distinct byte at 'depth'. */
+	size_t n_children = 0;
+	for ( i = lo; i < hi; i = skit_trie_build_group_end(keys, i, hi, depth) )
+		n_children++;
+
+	size_t block_size = skit_trie_children_block_size(n_children);
+	n_bytes += skit_trie_pool_granules(block_size) * SKIT__TRIE_POOL_GRANULE;
+	if ( n_children > SKIT__TRIE_NODE48_MAX )
+		n_bytes += n_children * skit_trie_pool_granules(sizeof(skit_trie_node)) * SKIT__TRIE_POOL_GRANULE;
+
+	if ( pool != NULL )
+	{
+		void *block = skit_trie_pool_alloc(pool, block_size);
+		node->nodes_len = n_children;
+		node->chars_len = 0xFF;
+		if ( n_children <= SKIT__TRIE_NODE_PREALLOC )
+		{
+			node->nodes.array = block;
+			node->chars_len = n_children;
+		}
+		else if ( n_children <= SKIT__TRIE_NODE16_MAX )
+			node->nodes.n16 = block;
+		else if ( n_children <= SKIT__TRIE_NODE48_MAX )
+		{
+			node->nodes.n48 = block;
+			memset(node->nodes.n48->index, 0, sizeof(node->nodes.n48->index));
+		}
+		else
+		{
+			node->nodes.table = block;
+			for ( k = 0; k < 256; k++ )
+				node->nodes.table[k] = NULL;
+		}
+
+		/* Place every child before building any of them, so that */
+		/*   the table's children end up next to each other too. */
+		for ( i = lo, k = 0; i < hi; i = j, k++ )
+		{
+			uint8_t c = keys[i].ptr[depth];
+			j = skit_trie_build_group_end(keys, i, hi, depth);
+			if ( n_children <= SKIT__TRIE_NODE_PREALLOC )
+				node->chars[k] = c;
+			else if ( n_children <= SKIT__TRIE_NODE16_MAX )
+				node->nodes.n16->keys[k] = c;
+			else if ( n_children <= SKIT__TRIE_NODE48_MAX )
+				node->nodes.n48->index[c] = k + 1;
+			else
+				node->nodes.table[c] = skit_trie_pool_alloc(pool, sizeof(skit_trie_node));
+		}
+	}
+
+	skit_trie_node *children = pool != NULL ? skit_trie_node_children(node) : NULL;
+	for ( i = lo, k = 0; i < hi; i = j, k++ )
+	{
+		j = skit_trie_build_group_end(keys, i, hi, depth);
+		skit_trie_node *child = NULL;
+		if ( children != NULL )
+			child = &children[k];
+		else if ( pool != NULL )
+			child = node->nodes.table[keys[i].ptr[depth]];
+		n_bytes += skit_trie_build_node(pool, child, keys, values, i, j, depth + 1);
+	}
+
+	return n_bytes;
+}
+
+skit_trie *skit_trie_build_sorted( const skit_slice *keys, void *const *values, size_t n_keys )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t i;
+	size_t longest_key_len = 0;
+	sENFORCE_MSG(keys != NULL || n_keys == 0, "NULL keys given in call to skit_trie_build_sorted.");
+
+	/* Check everything before allocating anything, so that nothing leaks if this throws. */
+	for ( i = 0; i < n_keys; i++ )
+	{
+		size_t key_len = sSLENGTH(keys[i]);
+		sENFORCE_MSG(sSPTR(keys[i]) != NULL, "NULL key given in call to skit_trie_build_sorted.");
+		longest_key_len = SKIT_MAX(longest_key_len, key_len);
+		if ( i == 0 )
+			continue;
+
+		size_t prev_len = sSLENGTH(keys[i-1]);
+		int cmp = memcmp(sSPTR(keys[i-1]), sSPTR(keys[i]), SKIT_MIN(prev_len, key_len));
+		if ( cmp == 0 && prev_len == key_len )
+			sTHROW(SKIT_TRIE_KEY_ALREADY_EXISTS,
+				"Duplicate key \"%.*s\" given to skit_trie_build_sorted at positions %ld and %ld.",
+				(int)key_len, sSPTR(keys[i]), (long)i-1, (long)i);
+		if ( cmp > 0 || (cmp == 0 && prev_len > key_len) )
+			sTHROW(SKIT_TRIE_EXCEPTION,
+				"Unsorted keys given to skit_trie_build_sorted: \"%.*s\" at position %ld comes after \"%.*s\".",
+				(int)key_len, sSPTR(keys[i]), (long)i, (int)prev_len, sSPTR(keys[i-1]));
+	}
+
+	skit_trie *trie = skit_trie_new();
+	if ( n_keys == 0 )
+		return trie;
+
+	skit_trie_build_key *build_keys = skit_malloc(n_keys * sizeof(skit_trie_build_key));
+	for ( i = 0; i < n_keys; i++ )
+	{
+		build_keys[i].ptr = (const uint8_t*)sSPTR(keys[i]);
+		build_keys[i].len = sSLENGTH(keys[i]);
+	}
+
+	/* Size the first chunk to hold everything, with nothing left over. */
+	size_t n_bytes = skit_trie_pool_granules(sizeof(skit_trie_node)) * SKIT__TRIE_POOL_GRANULE;
+	n_bytes += skit_trie_build_node(NULL, NULL, build_keys, values, 0, n_keys, 0);
+	trie->pool.next_chunk_size = n_bytes;
+
+	trie->root = skit_trie_pool_alloc(&trie->pool, sizeof(skit_trie_node));
+	skit_trie_build_node(&trie->pool, trie->root, build_keys, values, 0, n_keys, 0);
+	sASSERT_EQ(trie->pool.live_bytes, n_bytes);
+	trie->pool.next_chunk_size = SKIT_TRIE_POOL_FIRST_CHUNK;
+	skit_free(build_keys);
+
+	trie->length = n_keys;
+	trie->key_return_buf = *skit_loaf_resize(&trie->key_return_buf, longest_key_len);
+	return trie;
+}
+
+/* ------------------------------------------------------------------------- */
+
+size_t skit_trie_len( const skit_trie *trie )
+{
+	return trie->length;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int32_t skit_trie_count_leaves( const skit_trie_node *node )
+{
+	if ( node == NULL || node->nodes_len == 0 )
+		return 1;
+
+	size_t i = 0;
+	size_t result = 0;
+	skit_trie_node *children = skit_trie_node_children(node);
+	if ( children != NULL )
+	{
+		for(; i < node->nodes_len; i++ )
+			result += skit_trie_count_leaves(&children[i]);
+	}
+	else
+	{
+		for(; i < 256; i++ )
+			if ( node->nodes.table[i] != NULL )
+				result += skit_trie_count_leaves(node->nodes.table[i]);
+	}
+
+	return result;
+}
+
+typedef struct skit_trie_drawing skit_trie_drawing;
+struct skit_trie_drawing
+{
+	int32_t width;
+	int32_t height;
+	char *buffer;
+};
+
+typedef struct skit_trie_draw_cursor skit_trie_draw_cursor;
+struct skit_trie_draw_cursor
+{
+	int32_t x;
+	int32_t y;
+};
+
+static char *skit_trie_cell_addr( skit_trie_drawing *dst, int32_t x, int32_t y )
+{
+	return &dst->buffer[x + (y * dst->width)];
+}
+
+static void skit_trie_ndraw( skit_trie_drawing *dst, skit_trie_draw_cursor *cursor, const char *str_ptr, int32_t str_len )
+{
+	int32_t rclip = cursor->x + str_len;
+	if ( rclip > dst->width )
+		str_len -= (dst->width - rclip);
+	
+	sASSERT_GE(cursor->x, 0);
+	
+	memcpy(skit_trie_cell_addr(dst, cursor->x, cursor->y), str_ptr, str_len);
+	(cursor->x) += str_len;
+}
+
+#define skit_trie_draw( dst, cursor, str ) \
+	(skit_trie_ndraw( (dst), (cursor), (str), sizeof(str)-1 ))
+
+static void skit_trie_draw_value( skit_trie_drawing *dst, skit_trie_draw_cursor *cursor, const void *value )
+{
+	char spbuf[22];
+	
+	/* Use spbuf to avoid writing a '\0' to the drawing. */
+	int n_chars = snprintf( spbuf, sizeof(spbuf), "(%p)", value );
+	skit_trie_ndraw( dst, cursor, spbuf, n_chars );
+}
+
+static void skit_trie_draw_char( skit_trie_drawing *dst, skit_trie_draw_cursor *cursor, uint8_t c )
+{
+	if ( c == '\\' )
+		skit_trie_draw( dst, cursor, "\\\\" );
+	else if ( 0x20 <= c && c < 0x7F ) /* Printable chars between space (inclusive) and delete (exclusive) */
+		skit_trie_ndraw( dst, cursor, (const char*)&c, 1 );
+	else
+	{
+		/* Non-printables, ex: the null byte becomes \x00 */
+		char spbuf[5];
+		
+		/* Use spbuf to avoid writing a '\0' to the drawing. */
+		int n_chars = snprintf( spbuf, sizeof(spbuf), "\\x%.2X", c );
+		skit_trie_ndraw( dst, cursor, spbuf, n_chars );
+	}
+}
+
+static void skit_trie_draw_vert_branch(
+	skit_trie_drawing *dst,
+	int32_t x,
+	int32_t y1,
+	int32_t y2,
+	const char *distinction,
+	int32_t vert_branch_top,
+	int32_t vert_branch_bottom)
+{
+	skit_trie_draw_cursor cursor;
+	size_t i;
+	
+	cursor.x = x;
+	cursor.y = (y1 + y2) / 2;
+	skit_trie_draw( dst, &cursor, "-" );
+	
+	int32_t distinction_len = strlen(distinction);
+	if ( distinction_len > 0 )
+		skit_trie_ndraw( dst, &cursor, distinction, distinction_len );
+	
+	int32_t vert_branch_x = cursor.x;
+	cursor.x = vert_branch_x;
+	cursor.y = vert_branch_top;
+	skit_trie_draw( dst, &cursor, "," );
+	
+	for ( i = vert_branch_top+1; i < vert_branch_bottom; i++ )
+	{
+		cursor.x = vert_branch_x;
+		cursor.y = i;
+		skit_trie_draw( dst, &cursor, "|" );
+	}
+	
+	cursor.x = vert_branch_x;
+	cursor.y = vert_branch_bottom;
+	skit_trie_draw( dst, &cursor, "`" );
+}
+	
+
+static void skit_trie_draw_node( skit_trie_drawing *dst, const skit_trie_node *node, int32_t x, int32_t y1, int32_t y2 );
+
+static void skit_trie_draw_horiz_branch(
+	skit_trie_drawing *dst,
+	const skit_trie_node *node, 
+	const uint8_t c,
+	int32_t x,
+	int32_t *cy1,
+	int32_t *cy2,
+	int32_t *vert_branch_top,
+	int32_t *vert_branch_bottom)
+{
+	skit_trie_draw_cursor cursor;
+	
+	/* This child's lower bound is the previous child's upper bound. */
+	*cy1 = *cy2;
+	int32_t n_leaves = skit_trie_count_leaves(node) * 2 - 1;
+	*cy2 += n_leaves;
+	
+	cursor.x = x;
+	cursor.y = (*cy1 + *cy2) / 2;
+	
+	/* Draw the branch, followed by the next node. */
+	skit_trie_draw( dst, &cursor, "-> '" );
+	skit_trie_draw_char( dst, &cursor, c );
+	skit_trie_draw( dst, &cursor, "' " );
+	
+	skit_trie_draw_node( dst, node, cursor.x, *cy1, *cy2 );
+
+	/* Record the sizing info for the vertical branch. */
+	*vert_branch_top    = SKIT_MIN( *vert_branch_top, cursor.y );
+	*vert_branch_bottom = SKIT_MAX( *vert_branch_bottom, cursor.y );
+	
+	/* This inserts a space between the branches. */
+	(*cy2)++;
+}
+
+static void skit_trie_draw_node( skit_trie_drawing *dst, const skit_trie_node *node, int32_t x, int32_t y1, int32_t y2 )
+{
+	skit_trie_draw_cursor cursor;
+	
+	if ( node == NULL )
+	{
+		/* Completely empty tree. */
+		cursor.x = x;
+		cursor.y = (y2 + y1) / 2;
+		
+		skit_trie_draw( dst, &cursor, "-> {null node}\n" );
+	}
+	else if ( node->nodes_len == 0 )
+	{
+		/* Leaf nodes. */
+		cursor.x = x;
+		cursor.y = (y2 + y1) / 2;
+		
+		/*skit_trie_draw( dst, &cursor, "-> " );*/
+		
+		if ( node->have_value )
+			skit_trie_draw_value( dst, &cursor, node->value );
+		else
+			skit_trie_draw( dst, &cursor, "{empty leaf}");
+		
+		/*skit_trie_draw( dst, &cursor, "\n" );*/
+	}
+	else if ( node->nodes_len == 1 )
+	{
+		/* Linear nodes. (and multi-nodes with 1 child) */
+		cursor.x = x;
+		cursor.y = (y2 + y1) / 2;
+		
+		if ( node->have_value )
+		{
+			skit_trie_draw_value( dst, &cursor, node->value );
+			skit_trie_draw( dst, &cursor, " " );
+		}
+		
+		skit_trie_draw( dst, &cursor, "-> " );
+		
+		const char *delimiter;
+		if ( node->chars_len > 1 )
+			delimiter = "\"";
+		else
+			delimiter = "'";
+		
+		size_t i;
+		skit_trie_ndraw( dst, &cursor, delimiter, 1 );
+		for ( i = 0; i < node->chars_len; i++ )
+			skit_trie_draw_char( dst, &cursor, node->chars[i] );
+		skit_trie_ndraw( dst, &cursor, delimiter, 1 );
+		skit_trie_draw( dst, &cursor, " " );
+		
+		skit_trie_draw_node( dst, &node->nodes.array[0], cursor.x, y1, y2 );
+	}
+	else if ( node->nodes_len <= SKIT__TRIE_NODE_PREALLOC )
+	{
+		/* Multi-nodes. */
+		size_t i;
+		int32_t cy1 = y1;
+		int32_t cy2 = y1;
+		int32_t vert_branch_top = dst->height;
+		int32_t vert_branch_bottom = 0;
+		
+		cursor.x = x;
+		cursor.y = (y2 + y1) / 2;
+		if ( node->have_value )
+		{
+			skit_trie_draw_value( dst, &cursor, node->value );
+			skit_trie_draw( dst, &cursor, " " );
+		}
+		
+		for( i = 0; i < node->nodes_len; i++ )
+		{
+			/* x+2 makes room for the vertical branch
+			.                      ,  
+			.                     -|
+			.                      `
+			. construct that will be filled in later. */
+			skit_trie_draw_horiz_branch(
+				dst, &node->nodes.array[i], node->chars[i], cursor.x+2, 
+				&cy1, &cy2, &vert_branch_top, &vert_branch_bottom);
+		}
+		
+		skit_trie_draw_vert_branch(
+			dst, cursor.x, y1, y2, "", vert_branch_top, vert_branch_bottom);
+	}
+	else
+	{
+		/* node16, node48, and table nodes. */
+		const char *distinction;
+		if ( node->nodes_len <= SKIT__TRIE_NODE16_MAX )
+			distinction = "[16]";
+		else if ( node->nodes_len <= SKIT__TRIE_NODE48_MAX )
+			distinction = "[48]";
+		else
+			distinction = "[]";
+		
+		uint16_t c = 0;
+		uint8_t found_c;
+		skit_trie_node *child;
+		int32_t cy1 = y1;
+		int32_t cy2 = y1;
+		int32_t vert_branch_top = dst->height;
+		int32_t vert_branch_bottom = 0;
+		
+		cursor.x = x;
+		cursor.y = (y2 + y1) / 2;
+		if ( node->have_value )
+		{
+			skit_trie_draw_value( dst, &cursor, node->value );
+			skit_trie_draw( dst, &cursor, " " );
+		}
+		
+		while ( (child = skit_trie_node_child_from(node, c, &found_c)) != NULL )
+		{
+			/* This makes room for the vertical branch
+			.                      ,  
+			.                   -[]|
+			.                      `
+			. construct that will be filled in later. */
+			skit_trie_draw_horiz_branch(
+				dst, child, found_c, cursor.x + 2 + strlen(distinction),
+				&cy1, &cy2, &vert_branch_top, &vert_branch_bottom);
+			c = found_c + 1;
+		}
+		
+		skit_trie_draw_vert_branch(
+			dst, cursor.x, y1, y2, distinction, vert_branch_top, vert_branch_bottom);
+	}
+	
+}
+
+static void skit_trie_draw_tree( const skit_trie *trie, skit_stream *output )
+{
+	/*
+	A (slightly incorrect) example trie drawing:
+	.
+	.           ,-> 'x' -> (0xF00Df00dF00Df00d)
+	.           |
+	. -> 'a' -[]|-> '\x00' -> "h@x" -> (0xF00Df00dF00Df00d)
+	.           |
+	.           `-> 'z' -> (0xF00Df00dF00Df00d) "qasdf" -> (0xF00Df00dF00Df00d)
+	.
+	This example is used to give an intuitive grasp of sizing concerns on a
+	per-node basis.  There are some elements to consider:
+	- Single letter branches take up to 6 characters just to draw the character. (ex: '\x00')
+	- Multi-letter branches will be more space efficient than single letter branches.
+	- Filler between nodes: " -[]|-> " which is about 8 characters max.
+	    (The [] is used to indicate that the node is a table lookup.  The
+		above drawing is incorrect because a table lookup would never be used
+		for a mere 3-node wide split.  A normal multi-node would draw " -|-> ")
+	- Up to 16+2+2+1 = 21 characters for hex dumps of void* values.
+		- 16 for the hex digits.
+		- 2 for the ()
+		- 2 for the 0x
+		- 1 for the extra space needed.
+	
+	Armed with these numbers, we can calculate a theoretical maximum number of
+	screen width used for each node:
+		6+8+21 = 35 characters.
+	
+	For total width, add 1 to the sum to make room for newlines.
+	
+	If the total width by that calculation is low, then it may be because
+	of an empty trie.  In that case, we want at least enough characters to
+	draw the "-> {null node}\n" used to represent empty tries.  We'll give
+	ourselves some extra room and say that we must always have 64 bytes.
+	
+	The height will be the number of leaves, multiplied by 2 to leave spacing
+	inbetween them for readability.  Minus 1 because the last line doesn't
+	need spacing after it (we will print a newline later to separate it from
+	adjacent characters in the stream).
+	*/
+	
+	skit_trie_drawing drawing;
+	int32_t x, y;
+	size_t longest_key_len = sLLENGTH(trie->key_return_buf);
+	int32_t n_leaves = skit_trie_count_leaves(trie->root);
+	drawing.width  = SKIT_MAX(longest_key_len*35 + 1, 64);
+	drawing.height = n_leaves*2 - 1;
+	drawing.buffer = skit_malloc(drawing.width * drawing.height);
+	memset(drawing.buffer, ' ', drawing.width*drawing.height); /* Fill it with spaces. */
+	
+	/* Do drawing with a recursive traversal. */
+	skit_trie_draw_node(&drawing, trie->root, 0, 0, drawing.height);
+	
+	/* Send the finished rendering to the stream. */
+	/* This pass will strip out all of the extra spaces that follow the */
+	/*   ends of lines (and the \n character itself: let the stream worry */
+	/*   about converting that). */
+	for ( y = 0; y < drawing.height; y++ )
+	{
+		for ( x = drawing.width - 1; x >= 0; x-- )
+		{
+			if ( drawing.buffer[x + (y*drawing.width)] != ' ' )
+			{
+				skit_stream_appendln(output, skit_slice_of_cstrn(&drawing.buffer[y*drawing.width], x+1));
+				break;
+			}
+		}
+	}
+	
+	/* Cleanup. */
+	skit_free(drawing.buffer);
+}
+
+void skit_trie_dump( const skit_trie *trie, skit_stream *output )
+{
+	skit_stream_appendln(output, sSLICE("skit_trie with the following tree:"));
+	skit_stream_appendln(output, sSLICE(""));
+	skit_trie_draw_tree( trie, output );
+	skit_stream_appendln(output, sSLICE(""));
+}
+
+/* ------------------------------------------------------------------------- */
+/* ------------------------- Iteration Logic ------------------------------- */
+/* ------------------------------------------------------------------------- */
+
+typedef struct skit_trie_frame skit_trie_frame;
+struct skit_trie_frame
+{
+	skit_trie_coords coords;
+	uint16_t current_char;
+};
+
+struct skit_trie_iter
+{
+	skit_trie *trie;
+	skit_trie_frame *frames;
+	ssize_t current_frame;
+	ssize_t prev_frame;
+	uint8_t *key_buffer;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_iter_accumulate_key(skit_trie_iter *iter, size_t pos, const uint8_t *key_frag, size_t frag_len)
+{
+	/* printf("skit_trie_accumulate_key(iter, %d, \"%.*s\")\n", pos, (int)frag_len, key_frag); */
+	uint8_t *key_return_buf = iter->key_buffer;
+	
+	/* printf("  -> '%.*s' ~ '%.*s'\n", pos, key_return_buf, (int)frag_len, key_frag); */
+	
+	void       *dst_start = key_return_buf + pos;
+	const void *src_start = key_frag;
+	memcpy(dst_start, src_start, frag_len);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_trie_iter_push( skit_trie_iter *iter, skit_trie_node *node, size_t pos )
+{
+	skit_trie_frame *frame = &iter->frames[iter->current_frame + 1];
+	
+	/* initialize and populate the new frame */
+	skit_trie_coords_ctor(&frame->coords);
+	frame->coords.node = node;
+	frame->coords.pos = pos;
+	frame->current_char = 0;
+	
+	/* commit the results */
+	iter->prev_frame = iter->current_frame;
+	(iter->current_frame)++;
+}
+
+static void skit_trie_iter_pop( skit_trie_iter *iter )
+{
+	iter->prev_frame = iter->current_frame;
+	(iter->current_frame)--;
+}
+
+/* ------------------------------------------------------------------------- */
+
+skit_trie_iter *skit_trie_iter_new( skit_trie *trie, const skit_slice prefix, skit_flags flags )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	
+	/*
+	Case-insensitive iteration is potentially tricky because skit_trie_find
+	would need to be able to return multiple nodes that the iterator could
+	walk over to cover all possible prefixes that case-insensitively match.
+	Ex:
+	trie = trie of { "ABCD", "abcd", "aBcX", "AbCx" }
+	iter = skit_trie_iter_new( trie, "abc", sFLAGS("i") );
+	This iterator should return all keys in the above trie.  Using the
+	current implementation of skit_trie_find, it would probably only return
+	"ABCD" because "ABC" is the first node that skit_trie_find would find.
+	*/
+	sENFORCE_MSG( !(flags & ICASE), "Case insensitive operations are currently unimplemented for skit_trie_iter.");
+	
+	ITER_DEBUG("%s, %d: \n", __func__, __LINE__);
+	skit_trie_enforce_valid_flags(flags, CREATE | OVERWRITE | ICASE);
+	size_t key_len = sSLENGTH(prefix);
+	const uint8_t *key_ptr = (const uint8_t*)sSPTR(prefix);
+
+	if ( flags & (CREATE | OVERWRITE) )
+	{
+		char flags_str[SKIT_FLAGS_BUF_SIZE];
+		skit_flags_to_str(flags, flags_str);
+		sTHROW(SKIT_TRIE_BAD_FLAGS,
+			"Call to skit_trie_iter_new with 'c' or 'o' flags. These are invalid for iteration. prefix = \"%.\", flags = \"%s\"",
+			key_len, key_ptr, flags_str);
+	}
+	
+	size_t longest_key_len = sLLENGTH(trie->key_return_buf);
+	
+	skit_trie_iter *result = skit_malloc(sizeof(skit_trie_iter));
+	result->trie = trie;
+	result->frames = NULL;
+	result->current_frame = -1;
+	result->prev_frame = -1;
+	result->key_buffer = skit_malloc(longest_key_len);
+	
+	(trie->iterator_count)++;
+	
+	skit_trie_coords coords = skit_trie_find(trie, key_ptr, key_len, 1);
+	if ( skit_no_match(coords, key_len) )
+	{
+		/* Leave result->current_frame as -1 so that skit_trie_iter_next returns 0 immediately. */
+		return result;
+	}
+	
+	/* skit_trie_find accumulates the found key into trie->key_return_buf. */
+	/* We actually need it in iter->key_buffer. */
+	/* This call should fix that. */
+	skit_iter_accumulate_key(result, 0, sLPTR(trie->key_return_buf), coords.pos);
+	
+	/* */
+	result->frames = skit_malloc(sizeof(skit_trie_frame) * ((longest_key_len - coords.pos) + 1));
+
+	/* skit_trie_find should only return coords.n_chars_into_node > 0  */
+	/*   for linear nodes that the prefix doesn't completely encompass. */
+	/* The iterator can't handle that, so we'll skip ahead to the next */
+	/*   complete node in those cases. */
+	if ( coords.n_chars_into_node > 0 )
+	{
+		skit_trie_node *node = coords.node;
+		sASSERT_EQ(node->nodes_len, 1);
+		sASSERT_GT(node->chars_len, 1); /* chars_len > 1 */
+
+		/* Copy the rest of the node into the key_buffer. */
+		void *dst_start = result->key_buffer + coords.pos;
+		void *src_start = node->chars + coords.n_chars_into_node;
+		size_t copy_len = node->chars_len - coords.n_chars_into_node;
+		memcpy(dst_start, src_start, copy_len);
+		
+		/* Update coords to point to the next node. */
+		coords.pos += copy_len;
+		coords.n_chars_into_node = 0;
+		coords.node = &node->nodes.array[0];
+	}
+	
+	skit_trie_iter_push( result, coords.node, coords.pos );
+	
+	return result;
+}
+
+/* ------------------------------------------------------------------------- */
+
+skit_trie_iter *skit_trie_iter_free( skit_trie_iter *iter )
+{
+	SKIT_USE_FEATURE_EMULATION;
+
+	/* frames can't be used for this check because it may be NULL for empty sets. */
+	if ( iter->key_buffer == NULL )
+		sTHROW(SKIT_TRIE_EXCEPTION, "Attempt to free an already-freed skit_trie_iter.");
+	
+	if ( iter->frames != NULL )
+	{
+		skit_free(iter->frames);
+		iter->frames = NULL;
+	}
+
+	skit_free(iter->key_buffer);
+	iter->key_buffer = NULL;
+	
+	(iter->trie->iterator_count)--;
+	
+	skit_free(iter);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int skit_trie_iter_next( skit_trie_iter *iter, skit_slice *key, void **value )
+{
+	ITER_DEBUG("skit_trie_iter_next(...): %d\n", __LINE__);
+	ITER_DEBUG("%s, %d: iter->current_frame == %d\n", __func__, __LINE__, iter->current_frame);
+	sENFORCE_MSG(value != NULL, "NULL value pointer given in call to skit_trie_iter_next.  "
+		"This must be a pointer to a variable that can accept the returned value.");
+	sENFORCE_MSG(key != NULL, "NULL key pointer given in call to skit_trie_iter_next.  "
+		"This must be a pointer to a skit_slice that can accept the returned key.");
+	
+	/* Global termination case: we just popped the last frame. */
+	/*   That means we left the first node we ever visited, and there are no */
+	/*   more children to descend into: iteration is over. */
+	if ( iter->current_frame < 0 )
+	{
+		*key = skit_slice_null();
+		*value = NULL;
+		return 0;
+	}
+
+	skit_trie_frame *frame = &iter->frames[iter->current_frame];
+	skit_trie_coords *coords = &frame->coords;
+	skit_trie_node *node = coords->node;
+
+	ITER_DEBUG("%s, %d: current key: %.*s\n", __func__, __LINE__, coords->pos, iter->key_buffer);
+	
+	/* It seems our iterator is alive.  Let's iterate! */
+	
+	/* Entry case: Catch the case where we just pushed. */
+	/* This means we just enetered the node for the first time. */
+	if ( iter->prev_frame < iter->current_frame )
+	{
+		ITER_DEBUG("%s, %d: Entry case.\n", __func__, __LINE__);
+		/* Check for a value, yield it if one is found. */
+		if ( node->have_value )
+		{
+			ITER_DEBUG("%s, %d: Have value.\n", __func__, __LINE__);
+			/* Update this so that we don't loop forever. */
+			iter->prev_frame = iter->current_frame;
+			
+			/* Yield the value. */
+			*key = skit_slice_of_cstrn((char*)iter->key_buffer, coords->pos);
+			*value = (void*)node->value;
+			return 1;
+		}
+	}
+	
+	/* Exit case: We just exhausted the node and must do a pop. */
+	if ( frame->current_char > 255 )
+	{
+		ITER_DEBUG("%s, %d: Exiting.\n", __func__, __LINE__);
+		skit_trie_iter_pop(iter);
+		
+		/* Refresh function-scope variables by recursing. */
+		return skit_trie_iter_next(iter, key, value);
+	}
+	
+	/* Iteration case: visit the next child node. */
+	if ( node->nodes_len == 1 && node->chars_len > 1 )
+	{
+		ITER_DEBUG("%s, %d: Linear node.\n", __func__, __LINE__);
+		/* Linear nodes. */
+		
+		/* Mark this node as exhausted and then push the child into focus. */
+		frame->current_char = 256;
+		skit_trie_iter_push(iter, &node->nodes.array[0], coords->pos + node->chars_len);
+		skit_iter_accumulate_key(iter, coords->pos, node->chars, node->chars_len);
+		
+		/* Continue searching for a value. */
+		return skit_trie_iter_next(iter, key, value);
+	}
+	else
+	{
+		ITER_DEBUG("%s, %d: Branch node.\n", __func__, __LINE__);
+		/* Multi-nodes, node16, node48, and table nodes. */
+		/* current_char is the lowest character that hasn't been visited yet. */
+		uint8_t c;
+		skit_trie_node *child = skit_trie_node_child_from(node, frame->current_char, &c);
+		
+		/* No children left: mark the node as exhausted so that the next */
+		/*   call pops it. */
+		if ( child == NULL )
+		{
+			frame->current_char = 256;
+			return skit_trie_iter_next(iter, key, value);
+		}
+		
+		/* Advance the iteration and descend into the child. */
+		frame->current_char = (uint16_t)c + 1;
+		skit_trie_iter_push(iter, child, coords->pos + 1);
+		skit_iter_accumulate_key(iter, coords->pos, &c, 1);
+		
+		return skit_trie_iter_next(iter, key, value);
+	}
+	
+	sASSERT(0);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* ---------------------------- trie images -------------------------------- */
+
+/*
+An image starts with a header, which is followed by the records for the
+trie's nodes in depth-first order.  Offsets count from the start of the
+image.  Multi-byte fields are in the writer's byte order and are not
+aligned, so they are always read with memcpy.
+
+Header:
+	char      magic[8]         "skittrie"
+	uint32_t  version          SKIT_TRIE_IMAGE_VERSION
+	uint32_t  byte_order       SKIT_TRIE_IMAGE_BYTE_ORDER, as the writer saw it
+	uint64_t  length           number of keys
+	uint64_t  longest_key_len
+	uint64_t  n_bytes          size of the whole image
+	uint64_t  root             offset of the root record, or 0 if there are no keys
+
+Record:
+	uint8_t   flags            SKIT_TRIE_IMAGE_* bits
+	uint8_t   count            run: number of chars; branch: number of children - 1
+	uint64_t  value            only if flags has SKIT_TRIE_IMAGE_HAS_VALUE
+	Run records:
+	uint8_t   chars[count]     the record for the rest of the key comes right after these
+	Branch records (neither SKIT_TRIE_IMAGE_RUN nor SKIT_TRIE_IMAGE_LEAF):
+	uint8_t   keys[count+1]    sorted
+	uint32_t  children[count+1]
+
+A run record's value belongs to the position before its chars.  Runs hold a
+whole chain of linear nodes at once, up to 255 chars.
+*/
+#define SKIT_TRIE_IMAGE_VERSION     1
+#define SKIT_TRIE_IMAGE_BYTE_ORDER  0x01020304
+#define SKIT_TRIE_IMAGE_HEADER_SIZE 48
+#define SKIT_TRIE_IMAGE_MAX_SIZE    ((size_t)0xFFFFFFFF)
+
+#define SKIT_TRIE_IMAGE_HAS_VALUE 0x01
+#define SKIT_TRIE_IMAGE_RUN       0x02
+#define SKIT_TRIE_IMAGE_LEAF      0x04
+
+static const char skit_trie_image_magic[8] = { 's','k','i','t','t','r','i','e' };
+
+/* A record, decoded. */
+typedef struct skit_trie_image_record skit_trie_image_record;
+struct skit_trie_image_record
+{
+	uint8_t        flags;
+	size_t         count;     /* Chars in a run, or children in a branch. */
+	const void     *value;
+	const uint8_t  *chars;    /* A run's chars, or a branch's keys. */
+	const uint8_t  *children; /* A branch's child offsets. */
+	size_t         next;      /* Offset of the record after a run. */
+};
+
+static uint32_t skit_trie_image_u32(const uint8_t *ptr)
+{
+	uint32_t result;
+	memcpy(&result, ptr, sizeof(result));
+	return result;
+}
+
+static uint64_t skit_trie_image_u64(const uint8_t *ptr)
+{
+	uint64_t result;
+	memcpy(&result, ptr, sizeof(result));
+	return result;
+}
+
+static void skit_trie_image_corrupt(const skit_trie_image *image, size_t offset)
+{
+	SKIT_USE_FEATURE_EMULATION;
+	sTHROW(SKIT_TRIE_BAD_IMAGE, "Damaged trie image: bad record at offset %ld of %ld.",
+		(long)offset, (long)image->n_bytes);
+}
+
+/* Decodes the record at 'offset', making sure that all of it is inside the image. */
+static void skit_trie_image_read(const skit_trie_image *image, size_t offset, skit_trie_image_record *rec)
+{
+	const uint8_t *bytes = image->bytes;
+	size_t pos = offset + 2;
+	if ( offset < SKIT_TRIE_IMAGE_HEADER_SIZE || pos > image->n_bytes )
+		skit_trie_image_corrupt(image, offset);
+
+	rec->flags = bytes[offset];
+	rec->count = bytes[offset + 1];
+	rec->value = NULL;
+	rec->children = NULL;
+	if ( rec->flags & SKIT_TRIE_IMAGE_HAS_VALUE )
+	{
+		if ( pos + 8 > image->n_bytes )
+			skit_trie_image_corrupt(image, offset);
+		rec->value = (const void*)(skit_uintptr_t)skit_trie_image_u64(bytes + pos);
+		pos += 8;
+	}
+
+	rec->chars = bytes + pos;
+	if ( rec->flags & SKIT_TRIE_IMAGE_RUN )
+	{
+		if ( rec->count == 0 )
+			skit_trie_image_corrupt(image, offset);
+		pos += rec->count;
+		rec->next = pos;
+	}
+	else if ( rec->flags & SKIT_TRIE_IMAGE_LEAF )
+		rec->count = 0;
+	else
+	{
+		rec->count++;
+		rec->children = rec->chars + rec->count;
+		pos += rec->count * 5;
+	}
+
+	if ( pos > image->n_bytes )
+		skit_trie_image_corrupt(image, offset);
+}
+
+/* Returns the offset of the branch's child for 'c', or 0 if there is none. */
+static size_t skit_trie_image_child(const skit_trie_image_record *rec, uint8_t c)
+{
+	size_t lo = 0;
+	size_t hi = rec->count;
+	if ( hi <= 16 )
+	{
+		const uint8_t *found = memchr(rec->chars, c, hi);
+		if ( found == NULL )
+			return 0;
+		return skit_trie_image_u32(rec->children + (found - rec->chars) * 4);
+	}
+
+	while ( lo < hi )
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if ( rec->chars[mid] < c )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if ( lo == rec->count || rec->chars[lo] != c )
+		return 0;
+	return skit_trie_image_u32(rec->children + lo * 4);
+}
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct skit_trie_image_writer skit_trie_image_writer;
+struct skit_trie_image_writer
+{
+	uint8_t  *buf;
+	size_t   len;
+	size_t   capacity;
+	int      too_big;
+};
+
+/* Adds 'n' bytes to the end of the image and returns their offset. */
+static size_t skit_trie_image_extend(skit_trie_image_writer *writer, size_t n)
+{
+	size_t result = writer->len;
+	if ( writer->len + n > writer->capacity )
+	{
+		writer->capacity = SKIT_MAX(writer->capacity * 2, writer->len + n);
+		writer->buf = skit_realloc(writer->buf, writer->capacity);
+	}
+	writer->len += n;
+	return result;
+}
+
+static void skit_trie_image_put_u32(skit_trie_image_writer *writer, size_t offset, size_t val)
+{
+	uint32_t val32 = (uint32_t)val;
+	if ( val > SKIT_TRIE_IMAGE_MAX_SIZE )
+		writer->too_big = 1;
+	memcpy(writer->buf + offset, &val32, sizeof(val32));
+}
+
+static void skit_trie_image_put_u64(skit_trie_image_writer *writer, size_t offset, uint64_t val)
+{
+	memcpy(writer->buf + offset, &val, sizeof(val));
+}
+
+/* Returns the size of a record's flags, count, and value. */
+static size_t skit_trie_image_record_head(uint8_t flags)
+{
+	return (flags & SKIT_TRIE_IMAGE_HAS_VALUE) ? 2 + 8 : 2;
+}
+
+/* Adds a record with room for 'body_size' bytes after its value, and returns its offset. */
+static size_t skit_trie_image_put_record(
+	skit_trie_image_writer *writer, uint8_t flags, uint8_t count, const void *value, size_t body_size)
+{
+	size_t offset = skit_trie_image_extend(writer, skit_trie_image_record_head(flags) + body_size);
+	writer->buf[offset] = flags;
+	writer->buf[offset + 1] = count;
+	if ( flags & SKIT_TRIE_IMAGE_HAS_VALUE )
+		skit_trie_image_put_u64(writer, offset + 2, (uint64_t)(skit_uintptr_t)value);
+	return offset;
+}
+
+static void skit_trie_image_write_node(skit_trie_image_writer *writer, const skit_trie_node *node)
+{
+	size_t i, k;
+	size_t skip = 0; /* How many of a linear node's chars have already been written. */
+
+	/* Chains of linear nodes become runs, without any recursion. */
+	while ( node->nodes_len == 1 )
+	{
+		uint8_t flags = SKIT_TRIE_IMAGE_RUN;
+		if ( skip == 0 && node->have_value )
+			flags |= SKIT_TRIE_IMAGE_HAS_VALUE;
+		size_t offset = skit_trie_image_put_record(writer, flags, 0, node->value, 0);
+		size_t chars_offset = offset + skit_trie_image_record_head(flags);
+
+		/* The chars go right after the record, so they can be appended as they come. */
+		size_t run_len = 0;
+		while ( 1 )
+		{
+			size_t n_chars = SKIT_MIN(node->chars_len - skip, 255 - run_len);
+			skit_trie_image_extend(writer, n_chars);
+			memcpy(writer->buf + chars_offset + run_len, node->chars + skip, n_chars);
+			run_len += n_chars;
+			skip += n_chars;
+			if ( skip < node->chars_len )
+				break;
+
+			node = node->nodes.array;
+			skip = 0;
+			if ( node->have_value || node->nodes_len != 1 || run_len == 255 )
+				break;
+		}
+		writer->buf[offset + 1] = run_len;
+	}
+
+	size_t n = node->nodes_len;
+	uint8_t flags = (n == 0) ? SKIT_TRIE_IMAGE_LEAF : 0;
+	if ( node->have_value )
+		flags |= SKIT_TRIE_IMAGE_HAS_VALUE;
+	size_t offset = skit_trie_image_put_record(writer, flags, n == 0 ? 0 : n - 1, node->value, n * 5);
+	size_t keys_offset = offset + skit_trie_image_record_head(flags);
+
+	uint8_t c;
+	skit_trie_node *child;
+	for ( i = 0, k = 0; (child = skit_trie_node_child_from(node, i, &c)) != NULL; i = c + 1, k++ )
+		writer->buf[keys_offset + k] = c;
+	sASSERT_EQ(k, n);
+
+	for ( i = 0, k = 0; (child = skit_trie_node_child_from(node, i, &c)) != NULL; i = c + 1, k++ )
+	{
+		skit_trie_image_put_u32(writer, keys_offset + n + k * 4, writer->len);
+		skit_trie_image_write_node(writer, child);
+	}
+}
+
+void skit_trie_save( const skit_trie *trie, skit_stream *output )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	sENFORCE_MSG(trie != NULL, "NULL trie given in call to skit_trie_save.");
+	sENFORCE_MSG(output != NULL, "NULL output stream given in call to skit_trie_save.");
+
+	skit_trie_image_writer writer;
+	writer.buf = NULL;
+	writer.len = 0;
+	writer.capacity = 0;
+	writer.too_big = 0;
+
+	skit_trie_image_extend(&writer, SKIT_TRIE_IMAGE_HEADER_SIZE);
+	if ( trie->root != NULL )
+		skit_trie_image_write_node(&writer, trie->root);
+
+	uint32_t version = SKIT_TRIE_IMAGE_VERSION;
+	uint32_t byte_order = SKIT_TRIE_IMAGE_BYTE_ORDER;
+	memcpy(writer.buf, skit_trie_image_magic, 8);
+	memcpy(writer.buf + 8, &version, 4);
+	memcpy(writer.buf + 12, &byte_order, 4);
+	skit_trie_image_put_u64(&writer, 16, trie->length);
+	skit_trie_image_put_u64(&writer, 24, sLLENGTH(trie->key_return_buf));
+	skit_trie_image_put_u64(&writer, 32, writer.len);
+	skit_trie_image_put_u64(&writer, 40, trie->root != NULL ? SKIT_TRIE_IMAGE_HEADER_SIZE : 0);
+
+	if ( writer.too_big || writer.len > SKIT_TRIE_IMAGE_MAX_SIZE )
+	{
+		skit_free(writer.buf);
+		sTHROW(SKIT_TRIE_EXCEPTION, "Trie is too big to save: image would be longer than 4 GiB.");
+	}
+
+	skit_stream_append(output, skit_slice_of_cstrn((char*)writer.buf, writer.len));
+	skit_free(writer.buf);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Fills in the image from its header.  Returns NULL on success, or what is wrong. */
+static const char *skit_trie_image_parse(skit_trie_image *image, const uint8_t *bytes, size_t n_bytes)
+{
+	uint32_t version;
+	uint32_t byte_order;
+	if ( n_bytes < SKIT_TRIE_IMAGE_HEADER_SIZE || memcmp(bytes, skit_trie_image_magic, 8) != 0 )
+		return "Not a trie image.";
+
+	memcpy(&version, bytes + 8, 4);
+	memcpy(&byte_order, bytes + 12, 4);
+	if ( byte_order != SKIT_TRIE_IMAGE_BYTE_ORDER )
+		return "Trie image was written on a machine with a different byte order.";
+	if ( version != SKIT_TRIE_IMAGE_VERSION )
+		return "Unsupported trie image version.";
+	if ( skit_trie_image_u64(bytes + 32) != n_bytes )
+		return "Trie image is truncated or has extra bytes after it.";
+
+	image->bytes = bytes;
+	image->n_bytes = n_bytes;
+	image->length = skit_trie_image_u64(bytes + 16);
+	image->longest_key_len = skit_trie_image_u64(bytes + 24);
+	image->root = skit_trie_image_u64(bytes + 40);
+	image->mapping = NULL;
+	if ( (image->root == 0) != (image->length == 0) || image->root >= n_bytes )
+		return "Trie image has a bad root offset.";
+
+	/* Every char of the longest key is stored in at least one byte after the header. */
+	if ( image->longest_key_len > n_bytes - SKIT_TRIE_IMAGE_HEADER_SIZE )
+		return "Trie image has a bad longest key length.";
+	return NULL;
+}
+
+void skit_trie_image_ctor( skit_trie_image *image, skit_slice bytes )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	sENFORCE_MSG(image != NULL, "NULL image given in call to skit_trie_image_ctor.");
+	const char *problem = skit_trie_image_parse(image, (const uint8_t*)sSPTR(bytes), sSLENGTH(bytes));
+	if ( problem != NULL )
+		sTHROW(SKIT_TRIE_BAD_IMAGE, "%s", problem);
+}
+
+skit_trie_image *skit_trie_image_map( skit_slice file_path )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	char errbuf[1024];
+	skit_loaf path = skit_loaf_dup(file_path);
+	int fd = open(skit_loaf_as_cstr(path), O_RDONLY);
+	skit_loaf_free(&path);
+	if ( fd < 0 )
+	{
+		skit_err_code etype = (errno == ENOENT) ? SKIT_FILE_NOT_FOUND : SKIT_FILE_IO_EXCEPTION;
+		sTHROW(etype, "Could not open trie image \"%.*s\": %s",
+			(int)sSLENGTH(file_path), sSPTR(file_path), skit_errno_to_cstr(errbuf, sizeof(errbuf)));
+	}
+
+	struct stat file_info;
+	if ( fstat(fd, &file_info) != 0 )
+	{
+		skit_errno_to_cstr(errbuf, sizeof(errbuf));
+		close(fd);
+		sTHROW(SKIT_FILE_IO_EXCEPTION, "Could not stat trie image \"%.*s\": %s",
+			(int)sSLENGTH(file_path), sSPTR(file_path), errbuf);
+	}
+
+	size_t n_bytes = file_info.st_size;
+	if ( n_bytes < SKIT_TRIE_IMAGE_HEADER_SIZE )
+	{
+		close(fd);
+		sTHROW(SKIT_TRIE_BAD_IMAGE, "\"%.*s\" is too short to be a trie image.",
+			(int)sSLENGTH(file_path), sSPTR(file_path));
+	}
+
+	/* The descriptor isn't needed once the mapping exists. */
+	void *mapping = mmap(NULL, n_bytes, PROT_READ, MAP_SHARED, fd, 0);
+	if ( mapping == MAP_FAILED )
+		skit_errno_to_cstr(errbuf, sizeof(errbuf));
+	close(fd);
+	if ( mapping == MAP_FAILED )
+		sTHROW(SKIT_FILE_IO_EXCEPTION, "Could not map trie image \"%.*s\": %s",
+			(int)sSLENGTH(file_path), sSPTR(file_path), errbuf);
+
+	skit_trie_image *image = skit_malloc(sizeof(skit_trie_image));
+	const char *problem = skit_trie_image_parse(image, mapping, n_bytes);
+	if ( problem != NULL )
+	{
+		munmap(mapping, n_bytes);
+		skit_free(image);
+		sTHROW(SKIT_TRIE_BAD_IMAGE, "\"%.*s\": %s", (int)sSLENGTH(file_path), sSPTR(file_path), problem);
+	}
+
+	image->mapping = mapping;
+	return image;
+}
+
+void skit_trie_image_dtor( skit_trie_image *image )
+{
+	if ( image->mapping != NULL )
+		munmap(image->mapping, image->n_bytes);
+	image->mapping = NULL;
+	image->bytes = NULL;
+	image->n_bytes = 0;
+}
+
+skit_trie_image *skit_trie_image_free( skit_trie_image *image )
+{
+	skit_trie_image_dtor(image);
+	skit_free(image);
+	return NULL;
+}
+
+size_t skit_trie_image_len( const skit_trie_image *image )
+{
+	return image->length;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Case-insensitive lookup, from the record at 'offset' with 'pos' bytes of the key matched. */
+static int skit_trie_image_lookup_icase(
+	const skit_trie_image *image,
+	size_t offset,
+	const uint8_t *key_ptr,
+	size_t key_len,
+	size_t pos,
+	void **value)
+{
+	size_t i;
+	skit_trie_image_record rec;
+	while ( 1 )
+	{
+		skit_trie_image_read(image, offset, &rec);
+		if ( pos == key_len )
+		{
+			*value = (void*)rec.value;
+			return rec.flags & SKIT_TRIE_IMAGE_HAS_VALUE;
+		}
+
+		if ( rec.flags & SKIT_TRIE_IMAGE_RUN )
+		{
+			if ( key_len - pos < rec.count )
+				return 0;
+			for ( i = 0; i < rec.count; i++ )
+				if ( skit_char_ascii_to_lower(rec.chars[i]) != skit_char_ascii_to_lower(key_ptr[pos + i]) )
+					return 0;
+			pos += rec.count;
+			offset = rec.next;
+			continue;
+		}
+
+		/* Branches: try the upper case spelling first, like sorted order would. */
+		uint8_t lower = skit_char_ascii_to_lower(key_ptr[pos]);
+		uint8_t upper = (lower >= 'a' && lower <= 'z') ? lower - 'a' + 'A' : lower;
+		size_t child = skit_trie_image_child(&rec, upper);
+		if ( child != 0 && skit_trie_image_lookup_icase(image, child, key_ptr, key_len, pos + 1, value) )
+			return 1;
+		if ( upper == lower )
+			return 0;
+		offset = skit_trie_image_child(&rec, lower);
+		if ( offset == 0 )
+			return 0;
+		pos++;
+	}
+}
+
+int skit_trie_image_lookup( const skit_trie_image *image, const skit_slice key, void **value, skit_flags flags )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	void *dummy;
+	size_t key_len = sSLENGTH(key);
+	const uint8_t *key_ptr = (const uint8_t*)sSPTR(key);
+	sENFORCE_MSG(image != NULL, "NULL image given in call to skit_trie_image_lookup.");
+	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_image_lookup.");
+	skit_trie_enforce_valid_flags(flags, ICASE);
+
+	if ( value == NULL )
+		value = &dummy;
+	*value = NULL;
+	if ( image->root == 0 )
+		return 0;
+	if ( flags & ICASE )
+		return skit_trie_image_lookup_icase(image, image->root, key_ptr, key_len, 0, value);
+
+	size_t offset = image->root;
+	size_t pos = 0;
+	skit_trie_image_record rec;
+	while ( 1 )
+	{
+		skit_trie_image_read(image, offset, &rec);
+		if ( pos == key_len )
+		{
+			if ( !(rec.flags & SKIT_TRIE_IMAGE_HAS_VALUE) )
+				return 0;
+			*value = (void*)rec.value;
+			return 1;
+		}
+
+		if ( rec.flags & SKIT_TRIE_IMAGE_RUN )
+		{
+			if ( key_len - pos < rec.count || memcmp(rec.chars, key_ptr + pos, rec.count) != 0 )
+				return 0;
+			pos += rec.count;
+			offset = rec.next;
+		}
+		else
+		{
+			offset = skit_trie_image_child(&rec, key_ptr[pos]);
+			if ( offset == 0 )
+				return 0;
+			pos++;
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct skit_trie_image_frame skit_trie_image_frame;
+struct skit_trie_image_frame
+{
+	size_t  offset;      /* A branch record. */
+	size_t  next_child;
+	size_t  pos;         /* Length of the key up to the branch. */
+};
+
+struct skit_trie_image_iter
+{
+	const skit_trie_image  *image;
+	skit_trie_image_frame  *frames;
+	size_t                 n_frames;
+	size_t                 current;      /* Offset of the next record to enter, or 0. */
+	size_t                 current_pos;
+	int                    value_done;   /* The current record's value was already returned. */
+	uint8_t                *key_buffer;
+};
+
+skit_trie_image_iter *skit_trie_image_iter_new( const skit_trie_image *image, const skit_slice prefix, skit_flags flags )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t prefix_len = sSLENGTH(prefix);
+	const uint8_t *prefix_ptr = (const uint8_t*)sSPTR(prefix);
+	sENFORCE_MSG(image != NULL, "NULL image given in call to skit_trie_image_iter_new.");
+	sENFORCE_MSG( !(flags & ICASE), "Case insensitive operations are currently unimplemented for skit_trie_image_iter.");
+	skit_trie_enforce_valid_flags(flags, SKIT_FLAGS_NONE);
+
+	skit_trie_image_iter *iter = skit_malloc(sizeof(skit_trie_image_iter));
+	iter->image = image;
+	iter->frames = NULL;
+	iter->n_frames = 0;
+	iter->current = 0;
+	iter->current_pos = 0;
+	iter->value_done = 0;
+	iter->key_buffer = NULL;
+	if ( image->root == 0 || prefix_len > image->longest_key_len )
+		return iter;
+
+	/* Follow the prefix down to the first record under it. */
+	iter->key_buffer = skit_malloc(image->longest_key_len + 1);
+	memcpy(iter->key_buffer, prefix_ptr, prefix_len);
+	size_t offset = image->root;
+	size_t pos = 0;
+	skit_trie_image_record rec;
+	while ( pos < prefix_len )
+	{
+		skit_trie_image_read(image, offset, &rec);
+		if ( rec.flags & SKIT_TRIE_IMAGE_RUN )
+		{
+			size_t n_chars = SKIT_MIN(rec.count, prefix_len - pos);
+			if ( memcmp(rec.chars, prefix_ptr + pos, n_chars) != 0 )
+				return iter;
+			if ( pos + rec.count > image->longest_key_len )
+				skit_trie_image_corrupt(image, offset);
+
+			/* The prefix may end partway into the run. */
+			memcpy(iter->key_buffer + pos, rec.chars, rec.count);
+			pos += rec.count;
+			offset = rec.next;
+		}
+		else
+		{
+			offset = skit_trie_image_child(&rec, prefix_ptr[pos]);
+			if ( offset == 0 )
+				return iter;
+			pos++;
+		}
+	}
+
+	iter->frames = skit_malloc(sizeof(skit_trie_image_frame) * (image->longest_key_len + 1));
+	iter->current = offset;
+	iter->current_pos = pos;
+	return iter;
+}
+
+skit_trie_image_iter *skit_trie_image_iter_free( skit_trie_image_iter *iter )
+{
+	skit_free(iter->frames);
+	skit_free(iter->key_buffer);
+	skit_free(iter);
+	return NULL;
+}
+
+int skit_trie_image_iter_next( skit_trie_image_iter *iter, skit_slice *key, void **value )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	sENFORCE_MSG(value != NULL, "NULL value pointer given in call to skit_trie_image_iter_next.");
+	sENFORCE_MSG(key != NULL, "NULL key pointer given in call to skit_trie_image_iter_next.");
+
+	const skit_trie_image *image = iter->image;
+	skit_trie_image_record rec;
+	while ( 1 )
+	{
+		/* Enter a record: return its value, then move past it. */
+		if ( iter->current != 0 )
+		{
+			size_t pos = iter->current_pos;
+			skit_trie_image_read(image, iter->current, &rec);
+			if ( (rec.flags & SKIT_TRIE_IMAGE_HAS_VALUE) && !iter->value_done )
+			{
+				iter->value_done = 1;
+				*key = skit_slice_of_cstrn((char*)iter->key_buffer, pos);
+				*value = (void*)rec.value;
+				return 1;
+			}
+			iter->value_done = 0;
+
+			if ( rec.flags & SKIT_TRIE_IMAGE_RUN )
+			{
+				if ( pos + rec.count > image->longest_key_len )
+					skit_trie_image_corrupt(image, iter->current);
+				memcpy(iter->key_buffer + pos, rec.chars, rec.count);
+				iter->current_pos = pos + rec.count;
+				iter->current = rec.next;
+				continue;
+			}
+
+			if ( !(rec.flags & SKIT_TRIE_IMAGE_LEAF) )
+			{
+				/* Every branch adds a byte to the key, which bounds the stack. */
+				if ( pos >= image->longest_key_len )
+					skit_trie_image_corrupt(image, iter->current);
+				skit_trie_image_frame *frame = &iter->frames[iter->n_frames++];
+				frame->offset = iter->current;
+				frame->next_child = 0;
+				frame->pos = pos;
+			}
+			iter->current = 0;
+		}
+
+		/* Descend into the next child of the innermost branch. */
+		if ( iter->n_frames == 0 )
+		{
+			*key = skit_slice_null();
+			*value = NULL;
+			return 0;
+		}
+
+		skit_trie_image_frame *frame = &iter->frames[iter->n_frames - 1];
+		skit_trie_image_read(image, frame->offset, &rec);
+		if ( frame->next_child == rec.count )
+		{
+			iter->n_frames--;
+			continue;
+		}
+
+		iter->key_buffer[frame->pos] = rec.chars[frame->next_child];
+		iter->current = skit_trie_image_u32(rec.children + frame->next_child * 4);
+		iter->current_pos = frame->pos + 1;
+		frame->next_child++;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* ---------------------------- shared tries ------------------------------- */
+
+/*
+Makes the nodes on the path to 'key' writable: each node from the root down
+to the last one that the key reaches, and the block holding that node's
+children.  Those are all the nodes that skit_trie_set and skit_trie_remove
+change in place.  Anything further down that they touch goes through the
+pool, which copies it as needed.
+*/
+static void skit_trie_own_path(skit_trie *trie, const uint8_t *key, size_t key_len)
+{
+	skit_trie_pool *pool = &trie->pool;
+	size_t pos = 0;
+	if ( trie->root == NULL )
+		return;
+
+	trie->root = skit_trie_pool_own(pool, trie->root, sizeof(skit_trie_node));
+	skit_trie_node *node = trie->root;
+	while ( node->nodes_len > 0 )
+	{
+		size_t n = node->nodes_len;
+
+		/* Every shape's pointer points at the start of its block. */
+		if ( n <= SKIT__TRIE_NODE48_MAX )
+			node->nodes.array = skit_trie_pool_own(pool, node->nodes.array, skit_trie_node_block_size(node));
+		else
+			node->nodes.table = skit_trie_pool_own(pool, node->nodes.table, skit_trie_node_block_size(node));
+
+		if ( n == 1 )
+		{
+			if ( key_len - pos < node->chars_len || memcmp(node->chars, key + pos, node->chars_len) != 0 )
+				return;
+			pos += node->chars_len;
+			node = &node->nodes.array[0];
+			continue;
+		}
+
+		if ( pos == key_len )
+			return;
+
+		uint8_t c = key[pos++];
+		if ( n > SKIT__TRIE_NODE48_MAX && node->nodes.table[c] != NULL )
+			node->nodes.table[c] = skit_trie_pool_own(pool, node->nodes.table[c], sizeof(skit_trie_node));
+
+		node = skit_trie_node_find_child(node, c);
+		if ( node == NULL )
+			return;
+	}
+}
+
+/*
+The shared trie's reader counters, phase, and version pointer are accessed
+with GCC-style atomics.  Compilers without them (DEC C) get functions that
+do the same operations under one process-wide mutex instead.  That makes
+readers briefly contend with each other, but keeps every access sequentially
+consistent, which is all that the reclamation scheme below relies on.
+*/
+#if defined(__GNUC__)
+#  define SKIT__TRIE_LOAD_SIZE(ptr)        __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#  define SKIT__TRIE_STORE_SIZE(ptr, val)  __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+#  define SKIT__TRIE_INC_SIZE(ptr)         __atomic_add_fetch((ptr), 1, __ATOMIC_SEQ_CST)
+#  define SKIT__TRIE_DEC_SIZE(ptr)         __atomic_sub_fetch((ptr), 1, __ATOMIC_RELEASE)
+#  define SKIT__TRIE_LOAD_PTR(ptr)         __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#  define SKIT__TRIE_STORE_PTR(ptr, val)   __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+#else
+static pthread_mutex_t skit__trie_atomic_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t skit__trie_load_size(size_t *ptr)
+{
+	size_t result;
+	pthread_mutex_lock(&skit__trie_atomic_mutex);
+	result = *ptr;
+	pthread_mutex_unlock(&skit__trie_atomic_mutex);
+	return result;
+}
+
+static void skit__trie_store_size(size_t *ptr, size_t val)
+{
+	pthread_mutex_lock(&skit__trie_atomic_mutex);
+	*ptr = val;
+	pthread_mutex_unlock(&skit__trie_atomic_mutex);
+}
+
+static void skit__trie_add_size(size_t *ptr, size_t delta)
+{
+	pthread_mutex_lock(&skit__trie_atomic_mutex);
+	*ptr += delta;
+	pthread_mutex_unlock(&skit__trie_atomic_mutex);
+}
+
+static void *skit__trie_load_ptr(void **ptr)
+{
+	void *result;
+	pthread_mutex_lock(&skit__trie_atomic_mutex);
+	result = *ptr;
+	pthread_mutex_unlock(&skit__trie_atomic_mutex);
+	return result;
+}
+
+static void skit__trie_store_ptr(void **ptr, void *val)
+{
+	pthread_mutex_lock(&skit__trie_atomic_mutex);
+	*ptr = val;
+	pthread_mutex_unlock(&skit__trie_atomic_mutex);
+}
+
+#  define SKIT__TRIE_LOAD_SIZE(ptr)        skit__trie_load_size((ptr))
+#  define SKIT__TRIE_STORE_SIZE(ptr, val)  skit__trie_store_size((ptr), (val))
+#  define SKIT__TRIE_INC_SIZE(ptr)         skit__trie_add_size((ptr), 1)
+#  define SKIT__TRIE_DEC_SIZE(ptr)         skit__trie_add_size((ptr), (size_t)-1)
+#  define SKIT__TRIE_LOAD_PTR(ptr)         skit__trie_load_ptr((void**)(ptr))
+#  define SKIT__TRIE_STORE_PTR(ptr, val)   skit__trie_store_ptr((void**)(ptr), (val))
+#endif
+
+/*
+Readers count themselves on the stripe picked by where their stack is, which
+spreads threads over the stripes without any per-thread setup.
+*/
+static size_t skit_trie_shared_pick_stripe()
+{
+	char local;
+	uint64_t addr = (uintptr_t)&local >> 12;
+	return (size_t)((addr * UINT64_C(0x9E3779B97F4A7C15)) >> 60) % SKIT__TRIE_SHARED_STRIPES;
+}
+
+/* Returns a token to give to skit_trie_shared_leave. */
+static size_t skit_trie_shared_enter(skit_trie_shared *shared)
+{
+	size_t stripe = skit_trie_shared_pick_stripe();
+	size_t phase = SKIT__TRIE_LOAD_SIZE(&shared->phase);
+	SKIT__TRIE_INC_SIZE(&shared->stripes[stripe].readers[phase]);
+	return stripe * 2 + phase;
+}
+
+static void skit_trie_shared_leave(skit_trie_shared *shared, size_t token)
+{
+	SKIT__TRIE_DEC_SIZE(&shared->stripes[token / 2].readers[token % 2]);
+}
+
+static skit_trie_shared_version *skit_trie_shared_current(skit_trie_shared *shared)
+{
+	return SKIT__TRIE_LOAD_PTR(&shared->current);
+}
+
+/* Returns nonzero if no reader that started in 'phase' was running throughout the call. */
+static int skit_trie_shared_drained(skit_trie_shared *shared, size_t phase)
+{
+	size_t i;
+	for ( i = 0; i < SKIT__TRIE_SHARED_STRIPES; i++ )
+		if ( SKIT__TRIE_LOAD_SIZE(&shared->stripes[i].readers[phase]) != 0 )
+			return 0;
+	return 1;
+}
+
+static void skit_trie_shared_free_garbage(skit_trie_shared *shared, size_t phase)
+{
+	size_t i;
+	skit_trie_block_list *garbage = &shared->garbage[phase];
+	for ( i = 0; i < garbage->len; i++ )
+		skit_trie_pool_free_now(&shared->writer.pool, garbage->blocks[i].ptr, garbage->blocks[i].size);
+	garbage->len = 0;
+}
+
+/*
+A retired block is freed once the readers of each phase have been seen to
+be drained at some point after it was retired.  A reader that could have
+found the block had to start before it was retired, and it stays counted in
+one phase until it finishes, so it can't have been running through both of
+those checks.  Readers count themselves in the current phase, and flipping
+the phase is what lets the other one drain while new readers keep arriving.
+*/
+static void skit_trie_shared_reclaim(skit_trie_shared *shared)
+{
+	size_t p = shared->phase;
+
+	/* garbage[1-p] saw phase p drain when the phase was flipped to p. */
+	if ( shared->garbage[1-p].len > 0 )
+	{
+		if ( !skit_trie_shared_drained(shared, 1-p) )
+			return;
+		skit_trie_shared_free_garbage(shared, 1-p);
+	}
+
+	if ( shared->garbage[p].len > 0 && skit_trie_shared_drained(shared, 1-p) )
+	{
+		SKIT__TRIE_STORE_SIZE(&shared->phase, 1-p);
+		if ( skit_trie_shared_drained(shared, p) )
+			skit_trie_shared_free_garbage(shared, p);
+	}
+}
+
+/* Makes the writer's trie the newest version, and retires what it replaced. */
+static void skit_trie_shared_publish(skit_trie_shared *shared)
+{
+	size_t i;
+	skit_trie *trie = &shared->writer;
+	skit_trie_shared_version *version = skit_trie_pool_alloc(&trie->pool, sizeof(skit_trie_shared_version));
+	version->root = trie->root;
+	version->length = trie->length;
+	version->longest_key_len = sLLENGTH(trie->key_return_buf);
+	skit_trie_pool_free(&trie->pool, shared->current, sizeof(skit_trie_shared_version));
+	SKIT__TRIE_STORE_PTR(&shared->current, version);
+
+	/* Readers that start from here on can't reach anything that was retired. */
+	skit_trie_block_list *retired = &shared->cow.retired;
+	for ( i = 0; i < retired->len; i++ )
+		skit_trie_block_list_push(&shared->garbage[shared->phase], retired->blocks[i].ptr, retired->blocks[i].size);
+	retired->len = 0;
+	shared->cow.fresh.len = 0;
+
+	skit_trie_shared_reclaim(shared);
+}
+
+/* ------------------------------------------------------------------------- */
+
+skit_trie_shared *skit_trie_shared_new()
+{
+	skit_trie_shared *result = skit_malloc(sizeof(skit_trie_shared));
+	skit_trie_shared_ctor(result);
+	return result;
+}
+
+void skit_trie_shared_ctor( skit_trie_shared *shared )
+{
+	memset(shared, 0, sizeof(skit_trie_shared));
+	pthread_mutex_init(&shared->write_lock, NULL);
+	skit_trie_ctor(&shared->writer);
+	shared->writer.pool.cow = &shared->cow;
+	skit_trie_shared_publish(shared);
+}
+
+skit_trie_shared *skit_trie_shared_free( skit_trie_shared *shared )
+{
+	skit_trie_shared_dtor(shared);
+	skit_free(shared);
+	return NULL;
+}
+
+void skit_trie_shared_dtor( skit_trie_shared *shared )
+{
+	/* The pool holds the garbage too, so destroying it frees everything. */
+	skit_trie_dtor(&shared->writer);
+	skit_trie_block_list_dtor(&shared->garbage[0]);
+	skit_trie_block_list_dtor(&shared->garbage[1]);
+	skit_trie_block_list_dtor(&shared->cow.fresh);
+	skit_trie_block_list_dtor(&shared->cow.retired);
+	shared->current = NULL;
+	pthread_mutex_destroy(&shared->write_lock);
+}
+
+/* ------------------------------------------------------------------------- */
+
+void skit_trie_shared_set( skit_trie_shared *shared, const skit_slice key, const void *value, skit_flags flags )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t key_len = sSLENGTH(key);
+	const uint8_t *key_ptr = (const uint8_t*)sSPTR(key);
+	sENFORCE_MSG(shared != NULL, "NULL trie given in call to skit_trie_shared_set.");
+	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_shared_set.");
+
+	if ( (flags & ~(CREATE | OVERWRITE)) || !(flags & (CREATE | OVERWRITE)) )
+	{
+		char flags_str[SKIT_FLAGS_BUF_SIZE];
+		skit_flags_to_str(flags, flags_str);
+		sTHROW(SKIT_TRIE_BAD_FLAGS,
+			"skit_trie_shared_set needs 'c' and/or 'o' flags, and takes no others. key = \"%.*s\", flags = \"%s\"",
+			key_len, key_ptr, flags_str);
+	}
+
+	/* Everything that could throw is checked before the trie is touched. */
+	pthread_mutex_lock(&shared->write_lock);
+	int exists = skit_trie_lookup(&shared->writer, key, NULL, SKIT_FLAGS_NONE);
+	if ( exists && !(flags & OVERWRITE) )
+	{
+		pthread_mutex_unlock(&shared->write_lock);
+		sTHROW(SKIT_EXCEPTION,
+			"Wrote a value to an already existing key \"%.*s\". 'o' (overwrite) not passed in flags.",
+			key_len, key_ptr);
+	}
+	if ( !exists && !(flags & CREATE) )
+	{
+		pthread_mutex_unlock(&shared->write_lock);
+		sTHROW(SKIT_EXCEPTION,
+			"Wrote a value to a non-existant key \"%.*s\". 'c' (create) not passed in flags.",
+			key_len, key_ptr);
+	}
+
+	skit_trie_own_path(&shared->writer, key_ptr, key_len);
+	skit_trie_set(&shared->writer, key, value, flags);
+	skit_trie_shared_publish(shared);
+	pthread_mutex_unlock(&shared->write_lock);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int skit_trie_shared_remove( skit_trie_shared *shared, const skit_slice key, skit_flags flags )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t key_len = sSLENGTH(key);
+	const uint8_t *key_ptr = (const uint8_t*)sSPTR(key);
+	sENFORCE_MSG(shared != NULL, "NULL trie given in call to skit_trie_shared_remove.");
+	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_shared_remove.");
+
+	if ( flags & ~CREATE )
+	{
+		char flags_str[SKIT_FLAGS_BUF_SIZE];
+		skit_flags_to_str(flags, flags_str);
+		sTHROW(SKIT_TRIE_BAD_FLAGS,
+			"skit_trie_shared_remove only takes the 'c' flag. key = \"%.*s\", flags = \"%s\"",
+			key_len, key_ptr, flags_str);
+	}
+
+	pthread_mutex_lock(&shared->write_lock);
+	if ( !skit_trie_lookup(&shared->writer, key, NULL, SKIT_FLAGS_NONE) )
+	{
+		pthread_mutex_unlock(&shared->write_lock);
+		if ( !(flags & CREATE) )
+			sTHROW(SKIT_TRIE_KEY_NOT_FOUND,
+				"Attempt to remove a non-existant key \"%.*s\". 'c' not passed in flags.",
+				key_len, key_ptr);
+		return 0;
+	}
+
+	skit_trie_own_path(&shared->writer, key_ptr, key_len);
+	skit_trie_remove(&shared->writer, key, SKIT_FLAGS_NONE);
+	skit_trie_shared_publish(shared);
+	pthread_mutex_unlock(&shared->write_lock);
+	return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int skit_trie_shared_lookup( skit_trie_shared *shared, const skit_slice key, void **value, skit_flags flags )
+{
+	const uint8_t *key_ptr = sSPTR(key);
+	sENFORCE_MSG(shared != NULL, "NULL trie given in call to skit_trie_shared_lookup.");
+	sENFORCE_MSG(key_ptr != NULL, "NULL key given in call to skit_trie_shared_lookup.");
+
+	size_t key_len = sSLENGTH(key);
+	size_t token = skit_trie_shared_enter(shared);
+	skit_trie_shared_version *version = skit_trie_shared_current(shared);
+	skit_trie_coords coords = skit_trie_find_from(version->root, NULL, key_ptr, key_len, (flags & ICASE) ? 0 : 1);
+	int found = skit_exact_match(coords, key_len);
+	if ( value != NULL )
+		*value = found ? (void*)coords.node->value : NULL;
+	skit_trie_shared_leave(shared, token);
+	return found;
+}
+
+size_t skit_trie_shared_len( skit_trie_shared *shared )
+{
+	sENFORCE_MSG(shared != NULL, "NULL trie given in call to skit_trie_shared_len.");
+	size_t token = skit_trie_shared_enter(shared);
+	size_t result = skit_trie_shared_current(shared)->length;
+	skit_trie_shared_leave(shared, token);
+	return result;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct skit_trie_shared_iter
+{
+	skit_trie_shared  *shared;
+	size_t            token;
+	skit_trie         snapshot;  /* Borrows a version's nodes.  Owns only its key buffer. */
+	skit_trie_iter    *iter;
+};
+
+skit_trie_shared_iter *skit_trie_shared_iter_new( skit_trie_shared *shared, const skit_slice prefix, skit_flags flags )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	sENFORCE_MSG(shared != NULL, "NULL trie given in call to skit_trie_shared_iter_new.");
+	sENFORCE_MSG(sSPTR(prefix) != NULL, "NULL prefix given in call to skit_trie_shared_iter_new.");
+	if ( flags != SKIT_FLAGS_NONE )
+	{
+		char flags_str[SKIT_FLAGS_BUF_SIZE];
+		skit_flags_to_str(flags, flags_str);
+		sTHROW(SKIT_TRIE_BAD_FLAGS, "skit_trie_shared_iter_new takes no flags. flags = \"%s\"", flags_str);
+	}
+
+	skit_trie_shared_iter *result = skit_malloc(sizeof(skit_trie_shared_iter));
+	result->shared = shared;
+	skit_trie_ctor(&result->snapshot);
+
+	result->token = skit_trie_shared_enter(shared);
+	skit_trie_shared_version *version = skit_trie_shared_current(shared);
+	result->snapshot.root = version->root;
+	result->snapshot.length = version->length;
+	if ( version->longest_key_len > 0 )
+		result->snapshot.key_return_buf = *skit_loaf_resize(&result->snapshot.key_return_buf, version->longest_key_len);
+
+	result->iter = skit_trie_iter_new(&result->snapshot, prefix, SKIT_FLAGS_NONE);
+	return result;
+}
+
+skit_trie_shared_iter *skit_trie_shared_iter_free( skit_trie_shared_iter *iter )
+{
+	skit_trie_iter_free(iter->iter);
+	iter->snapshot.root = NULL;
+	skit_trie_dtor(&iter->snapshot);
+	skit_trie_shared_leave(iter->shared, iter->token);
+	skit_free(iter);
+	return NULL;
+}
+
+int skit_trie_shared_iter_next( skit_trie_shared_iter *iter, skit_slice *key, void **value )
+{
+	return skit_trie_iter_next(iter->iter, key, value);
+}
+
+/* ------------------------------------------------------------------------- */
+/* ------------------------------ testing! --------------------------------- */
+
+
+typedef struct skit_trie_test skit_trie_test;
+struct skit_trie_test
+{
+	skit_slice      slice;
+	skit_slice      islice;
+	skit_uintptr_t  val;
+};
+
+static void skit_trie_test_ctor(
+	skit_trie_test  *test,
+	skit_slice      slice,
+	skit_slice      islice,
+	skit_uintptr_t  val)
+{
+	test->slice = slice;
+	test->islice = islice;
+	test->val = val;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skit_trie_exhaustive_get_test(
+	skit_trie *trie,
+	const skit_trie_test* tests,
+	size_t trie_size,
+	size_t n_slices,
+	int test_vals )
+{
+	void *val;
+	size_t i;
+	
+	sASSERT_EQ(skit_trie_len(trie), trie_size);
+	
+	/* Test for false negatives. */
+	for ( i = 0; i < trie_size; i++ )
+	{
+		sASSERT_EQS(skit_trie_get(trie, tests[i].slice, &val, SKIT_FLAGS_NONE), tests[i].slice);
+		if ( test_vals )
+			sASSERT_EQ((skit_uintptr_t)val, tests[i].val);
+		
+		sASSERT_IEQS(skit_trie_get(trie, tests[i].islice, &val, SKIT_FLAG_I), tests[i].slice );
+		/* sASSERT_EQ((skit_uintptr_t)val, tests[i].val, "%d"); */
+	}
+	
+	/* Test against false positives. */
+	for ( i = trie_size; i < n_slices; i++ )
+	{
+		sASSERT_EQS(skit_trie_get(trie, tests[i].slice, &val, SKIT_FLAGS_NONE), skit_slice_null());
+		sASSERT(val == NULL);
+	}
+}
+
+static int skit_trie_cmp_test( const void *a, const void *b )
+{
+	skit_trie_test *t1 = (skit_trie_test*)a;
+	skit_trie_test *t2 = (skit_trie_test*)b;
+	return skit_slice_ascii_cmp( t1->slice, t2->slice );
+}
+
+static void skit_trie_iter_test(
+	skit_trie *trie,
+	skit_trie_test *tests, /* Must be sorted. */
+	size_t n_tests,
+	size_t pos,
+	int recurse )
+{
+	skit_slice prefix = skit_slice_of(tests[0].slice, 0, pos);
+	
+	ITER_DEBUG("\n\n");
+	ITER_DEBUG("skit_trie_iter_test(trie, tests[%ld], %ld, %d), prefix == '%.*s'\n",
+		n_tests, pos, recurse, sSLENGTH(prefix), sSPTR(prefix));
+	
+	skit_trie_iter *iter = skit_trie_iter_new(trie, prefix, SKIT_FLAGS_NONE);
+	
+	skit_slice key;
+	void *val;
+	size_t i = 0;
+	while ( skit_trie_iter_next( iter, &key, &val ) )
+	{
+		ITER_DEBUG("%s, %d: calling skit_trie_iter_next(iter, \"%.*s\", %ld); i == %d; expect %ld\n",
+			__func__, __LINE__,
+			sSLENGTH(key), sSPTR(key),
+			(skit_uintptr_t)val, i, tests[i].val);
+		
+		sASSERT_EQS( tests[i].slice, key );
+		sASSERT_EQ ( tests[i].val, (size_t)val );
+		i++;
+	}
+	
+	sASSERT_EQ( i, n_tests );
+	
+	skit_trie_iter_free(iter);
+	
+	if ( recurse && n_tests > 1 )
+	{
+		uint8_t *key_ptr = sSPTR(tests[0].slice);
+		size_t   key_len = sSLENGTH(tests[0].slice);
+		uint16_t prev_char = 0x800;
+		uint16_t this_char = (pos == key_len ? 0x800 : key_ptr[pos]);
+		size_t prev_index = 0;
+		for ( i = 1; i < n_tests; i++ )
+		{
+			key_ptr = sSPTR(tests[i].slice);
+			key_len = sSLENGTH(tests[i].slice);
+			
+			prev_char = this_char;
+			
+			sASSERT( pos <= key_len ); /* We should reach n_tests before falling off any cliffs. */
+			if ( pos == key_len )
+				this_char = 0x800; /* Cases where we iterate on exact matches. */
+			else
+				this_char = key_ptr[pos]; /* Prefix stuff. */
+			
+			if ( this_char != prev_char && i > prev_index )
+			{
+				if ( prev_char < 0x800 )
+					skit_trie_iter_test( trie, &tests[prev_index], i - prev_index, pos+1, 1 );
+				prev_index = i;
+			}
+		}
+
+		/* Pick up anything left-over. */
+		skit_trie_iter_test( trie, &tests[prev_index], n_tests - prev_index, pos+1, 1 );
+	}
+}
+
+static void skit_trie_exhaustive_test( skit_trie_test* tests, size_t n_tests, int harder )
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t i;
+	skit_trie *trie = skit_trie_new();
+	
+	/* ----- Get/set ----- */
+	for ( i = 0; i < n_tests; i++ )
+	{
+		/*printf("Going to set with %p, %ld\n", sSPTR(tests[i]), sSLENGTH(tests[i]));*/
+		sASSERT_EQS(skit_trie_set(trie, tests[i].slice, (void*)tests[i].val, sFLAGS("c")), tests[i].slice);
+		
+		/*
+		if ( harder )
+			skit_trie_dump(trie, skit_stream_stdout);
+		*/
+
+		if ( harder )
+			sTRACE4(skit_trie_exhaustive_get_test(trie, tests, i+1, n_tests, 1));
+	}
+	
+	#if 0
+	if ( !harder )
+	{
+		skit_trie_dump(trie, skit_stream_stdout);
+		/*sASSERT_MSG(0, "Here is your tree, sir.");*/
+	}
+	#endif
+	
+	if ( !harder )
+		sTRACE0(skit_trie_exhaustive_get_test(trie, tests, n_tests, n_tests, 1));
+	
+	/* ----- Iteration test ----- */
+	qsort( tests, n_tests, sizeof(skit_trie_test), &skit_trie_cmp_test );
+	
+	int recurse = 0;
+	if ( harder )
+		recurse = 1;
+
+	ITER_DEBUG("\n\n-------- Iteration test begins. ---------\n\n\n");
+	sTRACE0(skit_trie_iter_test( trie, tests, n_tests, 0, recurse ));
+	
+	/* ----- Case sensitivity ----- */
+	/* It should be possible to do overwriting assignments into all of the
+	keys in a case-insensitive manner without altering the trie.
+	We test this by inserting all of the test islice's and then checking
+	the length and running the get test again.  
+	If these insertions grow the trie, then the length assertion will 
+	catch it. 
+	If these insertions alter the keys then the get_test will catch it.
+	This test should be done last, because it may alter the values
+	corresponding to various keys in unpredictable ways. */
+	size_t length_before = skit_trie_len(trie);
+	for ( i = 0; i < n_tests; i++ )
+	{
+		sASSERT_IEQS(skit_trie_set(trie, tests[i].islice, (void*)tests[i].val, sFLAGS("io")), tests[i].slice);
+		
+		/*
+		if ( harder )
+			skit_trie_dump(trie, skit_stream_stdout);
+		*/
+	}
+	
+	sASSERT_EQ( length_before, skit_trie_len(trie) );
+	sTRACE0(skit_trie_exhaustive_get_test(trie, tests, n_tests, n_tests, 0));
+	
+	/* ----- Removal ----- */
+	/* Remove the keys from last to first, so that the get test can keep */
+	/*   checking that the remaining keys are intact and the removed ones */
+	/*   are gone.  Removal is case-sensitive here because some of the test */
+	/*   keys are case-insensitively equal to each other. */
+	for ( i = n_tests; i > 0; i-- )
+	{
+		sASSERT_EQS(skit_trie_remove(trie, tests[i-1].slice, SKIT_FLAGS_NONE), tests[i-1].slice);
+		sASSERT_EQS(skit_trie_remove(trie, tests[i-1].slice, SKIT_FLAG_C), skit_slice_null());
+		
+		if ( harder || i-1 == n_tests/2 )
+			sTRACE4(skit_trie_exhaustive_get_test(trie, tests, i-1, n_tests, 0));
+	}
+	
+	sASSERT(trie->root == NULL);
+	
+	sTRACE0(skit_trie_free(trie));
+}
+
+static void skit_trie_unittest_basics()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t n_tests = 10;
+	skit_trie_test *tests = skit_malloc(sizeof(skit_trie_test) * n_tests);
+	
+	/* Successively shorter keys.  Also special characters. */
+	skit_trie_test_ctor(&tests[0], sSLICE("abcde"        ), sSLICE("Abcde"        ), 1  );
+	skit_trie_test_ctor(&tests[1], sSLICE("abxyz"        ), sSLICE("abXYZ"        ), 2  );
+	skit_trie_test_ctor(&tests[2], sSLICE("a1234"        ), sSLICE("A1234"        ), 3  );
+	skit_trie_test_ctor(&tests[3], sSLICE("abcd!"        ), sSLICE("aBcD!"        ), 4  );
+	skit_trie_test_ctor(&tests[4], sSLICE("abcxy"        ), sSLICE("abCxy"        ), 5  );
+	skit_trie_test_ctor(&tests[5], sSLICE("abc"          ), sSLICE("ABC"          ), 6  );
+	skit_trie_test_ctor(&tests[6], sSLICE("\0\xFF\0\xFF" ), sSLICE("\0\xFF\0\xFF" ), 7  );
+	skit_trie_test_ctor(&tests[7], sSLICE("\0\xFF\x7F"   ), sSLICE("\0\xFF\x7F"   ), 8  );
+	skit_trie_test_ctor(&tests[8], sSLICE("\0\x7F\x7F"   ), sSLICE("\0\x7F\x7F"   ), 9 );
+	skit_trie_test_ctor(&tests[9], sSLICE(""             ), sSLICE(""             ), 10 );
+
+	sTRACE0(skit_trie_exhaustive_test(tests, n_tests, 1));
+	
+	char buf[256];
+	void *val;
+	skit_trie *trie;
+
+	/* Test inserting successively longer keys. */
+	/* (The previous mix tests successively shorter keys.) */
+	trie = skit_trie_new();
+	sASSERT_EQS(skit_trie_setc(trie, "abc", (void*)1, sFLAGS("c")), sSLICE("abc"));
+	sASSERT_EQS(skit_trie_getc(trie, "abcde", &val, SKIT_FLAGS_NONE), skit_slice_null());
+	sASSERT(val == NULL);
+	sASSERT_EQS(skit_trie_setc(trie, "abcde", (void*)1, sFLAGS("c")), sSLICE("abcde"));
+	sASSERT_EQS(skit_trie_getc(trie, "abcde", &val, SKIT_FLAGS_NONE), sSLICE("abcde"));
+	sASSERT_EQ((skit_uintptr_t)val, 1);
+	sTRACE0(skit_trie_free(trie));
+	
+	trie = skit_trie_new();
+	sASSERT_EQS(skit_trie_setc(trie, "", (void*)1, sFLAGS("c")), sSLICE(""));
+	sASSERT_EQS(skit_trie_getc(trie, "", &val, SKIT_FLAGS_NONE), sSLICE(""));
+	sTRACE0(skit_trie_free(trie));
+	
+	// Bug found in the wild: retrieving from a zero-length string caused a
+	//   segfault.  It should return a null-slice instead.
+	trie = skit_trie_new();
+	sASSERT_EQS(skit_trie_getc(trie, "", &val, SKIT_FLAGS_NONE), skit_slice_null());
+	sTRACE0(skit_trie_free(trie));
+
+	// Bug found in the wild: insensitive lookups can fail under certain conditions.
+	// This was caused by the fact that the finding logic wouldn't backtrack
+	// when failing, thus making it possible to use "decoy" paths that differed
+	// in case earlier in the string but differed in content later in the
+	// string.  If a 'doomed' path is chosen first, then the engine would never
+	// back up to the case-insensitive branching point and try the non-doomed
+	// path.
+	trie = skit_trie_new();
+	ssize_t i;
+	buf[1] = '\0';
+	for ( i = 'A'; i <= 'Z'; i++ )
+	{
+		// force a tabled-lookup in the first node of the trie.
+		buf[0] = i;
+		sTRACE(skit_trie_setc(trie, buf, (void*)1, sFLAGS("c")));
+	}
+	// provide multiple options for the first 'd': uppercase and lowercase.
+	sASSERT_EQS(skit_trie_setc(trie, "DA", (void*)2, sFLAGS("c")), sSLICE("DA"));
+	sASSERT_EQS(skit_trie_setc(trie, "dummy", (void*)3, sFLAGS("c")), sSLICE("dummy"));
+	sASSERT_EQS(skit_trie_getc(trie, "dummy", &val, sFLAGS("i")), sSLICE("dummy"));
+	sASSERT_EQ((skit_uintptr_t)val, 3);
+	sTRACE0(skit_trie_free(trie));
+
+	// Bug found in the wild: this is a regression caused while creating the
+	// fix for the previous test case.  Note the case-insensitive flag during
+	// key insertion.
+	trie = skit_trie_new();
+	sASSERT_EQS(skit_trie_setc(trie, "ANY", NULL, sFLAGS("ci")), sSLICE("ANY"));
+	sASSERT_EQS(skit_trie_setc(trie, "ALL", NULL, sFLAGS("ci")), sSLICE("ALL"));
+	for ( i = 'a'; i <= 'z'; i++ )
+	{
+		buf[0] = 'C';
+		buf[1] = i;
+		buf[2] = '\0';
+		sASSERT_EQS(skit_trie_setc(trie, buf, NULL, sFLAGS("ci")), skit_slice_of_cstr(buf));
+	}
+	sTRACE0(skit_trie_free(trie));
+
+	skit_free(tests);
+	
+	printf("  skit_trie_unittest_basics passed.\n");
+}
+
+static void skit_trie_unittest_linear_nodes()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	skit_trie_test *tests = skit_malloc(sizeof(skit_trie_test) * 3);
+	size_t i;
+	
+	#define teststr_len  (SKIT__TRIE_NODE_PREALLOC*3 + 2)
+	#define teststr_mid1 (SKIT__TRIE_NODE_PREALLOC*2 - 4)
+	#define teststr_mid2 (SKIT__TRIE_NODE_PREALLOC*2 - 2)
 	
-}
-
-static void skit_trie_draw_tree( const skit_trie *trie, skit_stream *output )
-{
-	/*
-	A (slightly incorrect) example trie drawing:
-	.
-	.           ,-> 'x' -> (0xF00Df00dF00Df00d)
-	.           |
-	. -> 'a' -[]|-> '\x00' -> "h@x" -> (0xF00Df00dF00Df00d)
-	.           |
-	.           `-> 'z' -> (0xF00Df00dF00Df00d) "qasdf" -> (0xF00Df00dF00Df00d)
-	.
-	This example is used to give an intuitive grasp of sizing concerns on a
-	per-node basis.  There are some elements to consider:
-	- Single letter branches take up to 6 characters just to draw the character. (ex: '\x00')
-	- Multi-letter branches will be more space efficient than single letter branches.
-	- Filler between nodes: " -[]|-> " which is about 8 characters max.
-	    (The [] is used to indicate that the node is a table lookup.  The
-		above drawing is incorrect because a table lookup would never be used
-		for a mere 3-node wide split.  A normal multi-node would draw " -|-> ")
-	- Up to 16+2+2+1 = 21 characters for hex dumps of void* values.
-		- 16 for the hex digits.
-		- 2 for the ()
-		- 2 for the 0x
-		- 1 for the extra space needed.
+	/* This is not a requirement of the trie, but it IS an assumption of the unittest. */
+	/* It mostly affects the choice of teststr_mid1 and teststr_mid2, */
+	/*   which were chosen to leave at least 2 characters between the */
+	/*   splitting that they cause. */
+	sASSERT_GE(SKIT__TRIE_NODE_PREALLOC, 6);
 	
-	Armed with these numbers, we can calculate a theoretical maximum number of
-	screen width used for each node:
-		6+8+21 = 35 characters.
+	/* "abcdefghijklmnopqrstuvwxyzabcdefg..." */
+	char teststr0[teststr_len+1];
+	tests[0].slice = skit_slice_of_cstrn(teststr0, teststr_len);
+	for ( i = 0; i < teststr_len; i++ )
+		teststr0[i] = 'a' + (i % 26);
+	teststr0[teststr_len] = '\0';
 	
-	For total width, add 1 to the sum to make room for newlines.
+	/* "abcdefghijklmnopqRSTUVWXYZABCDEFG..." */
+	char teststr1[teststr_len+1];
+	tests[1].slice = skit_slice_of_cstrn(teststr1, teststr_len);
+	memcpy(teststr1, teststr0, teststr_len);
+	for ( i = teststr_mid1; i < teststr_len; i++ )
+		teststr1[i] = skit_char_ascii_to_upper(teststr1[i]);
+	teststr1[teststr_len] = '\0';
 	
-	If the total width by that calculation is low, then it may be because
-	of an empty trie.  In that case, we want at least enough characters to
-	draw the "-> {null node}\n" used to represent empty tries.  We'll give
-	ourselves some extra room and say that we must always have 64 bytes.
+	/* "abcdefghijklmnopqrs" */
+	char teststr2[teststr_mid2+1];
+	tests[2].slice = skit_slice_of_cstrn(teststr2, teststr_mid2);
+	memcpy(teststr2, teststr0, teststr_mid2);
+	teststr2[teststr_mid2] = '\0';
 	
-	The height will be the number of leaves, multiplied by 2 to leave spacing
-	inbetween them for readability.  Minus 1 because the last line doesn't
-	need spacing after it (we will print a newline later to separate it from
-	adjacent characters in the stream).
-	*/
+	tests[0].islice = tests[1].slice;
+	tests[1].islice = tests[0].slice;
+	tests[2].islice = tests[2].slice; /* TODO: this test could be better. */
 	
-	skit_trie_drawing drawing;
-	int32_t x, y;
-	size_t longest_key_len = sLLENGTH(trie->key_return_buf);
-	int32_t n_leaves = skit_trie_count_leaves(trie->root);
-	drawing.width  = SKIT_MAX(longest_key_len*35 + 1, 64);
-	drawing.height = n_leaves*2 - 1;
-	drawing.buffer = skit_malloc(drawing.width * drawing.height);
-	memset(drawing.buffer, ' ', drawing.width*drawing.height); /* Fill it with spaces. */
+	tests[0].val = 1;
+	tests[1].val = 2;
+	tests[2].val = 3;
 	
-	/* Do drawing with a recursive traversal. */
-	skit_trie_draw_node(&drawing, trie->root, 0, 0, drawing.height);
+	sTRACE0(skit_trie_exhaustive_test(tests, 3, 1));
 	
-	/* Send the finished rendering to the stream. */
-	/* This pass will strip out all of the extra spaces that follow the */
-	/*   ends of lines (and the \n character itself: let the stream worry */
-	/*   about converting that). */
-	for ( y = 0; y < drawing.height; y++ )
-	{
-		for ( x = drawing.width - 1; x >= 0; x-- )
-		{
-			if ( drawing.buffer[x + (y*drawing.width)] != ' ' )
-			{
-				skit_stream_appendln(output, skit_slice_of_cstrn(&drawing.buffer[y*drawing.width], x+1));
-				break;
-			}
-		}
-	}
+	sTRACE0(skit_free(tests));
 	
-	/* Cleanup. */
-	skit_free(drawing.buffer);
-}
-
-void skit_trie_dump( const skit_trie *trie, skit_stream *output )
-{
-	skit_stream_appendln(output, sSLICE("skit_trie with the following tree:"));
-	skit_stream_appendln(output, sSLICE(""));
-	skit_trie_draw_tree( trie, output );
-	skit_stream_appendln(output, sSLICE(""));
+	printf("  skit_trie_unittest_linear_nodes passed.\n");
 }
 
-/* ------------------------------------------------------------------------- */
-/* ------------------------- Iteration Logic ------------------------------- */
-/* ------------------------------------------------------------------------- */
-
-typedef struct skit_trie_frame skit_trie_frame;
-struct skit_trie_frame
-{
-	skit_trie_coords coords;
-	uint16_t current_char;
-};
-
-struct skit_trie_iter
-{
-	skit_trie *trie;
-	skit_trie_frame *frames;
-	ssize_t current_frame;
-	ssize_t prev_frame;
-	uint8_t *key_buffer;
-};
-
-/* ------------------------------------------------------------------------- */
+/* If don't already know what a trigram is and you want to know, then I suggest
+lookup up ngram or n-gram rather than trigram.  As a search term, "trigram" is
+likely to bring up the Chinese bagua, which is quite a different entity. 
 
-static void skit_iter_accumulate_key(skit_trie_iter *iter, size_t pos, const uint8_t *key_frag, size_t frag_len)
+Long and short: trigrams are sequences of 3-characters, usually the first three
+of words in a corpus of text, and usually used to index that text for fast 
+lookup of contained words and such.
+*/
+static void skit_trie_test_make_trigram(
+	skit_loaf *loaf,
+	size_t *loaf_index,
+	size_t max_index,
+	const skit_slice parent,
+	int breadth,
+	int depth)
 {
-	/* printf("skit_trie_accumulate_key(iter, %d, \"%.*s\")\n", pos, (int)frag_len, key_frag); */
-	uint8_t *key_return_buf = iter->key_buffer;
+	size_t i;
 	
-	/* printf("  -> '%.*s' ~ '%.*s'\n", pos, key_return_buf, (int)frag_len, key_frag); */
+	/*
+	printf("%s, %d: skit_trigram(%p, %ld, %ld, \"%.*s\", %d, %d)\n", __func__, __LINE__,
+		loaf, *loaf_index, max_index, (int)sSLENGTH(parent), sSPTR(parent), breadth, depth);
+	*/
+	sASSERT_LE( *loaf_index, max_index );
 	
-	void       *dst_start = key_return_buf + pos;
-	const void *src_start = key_frag;
-	memcpy(dst_start, src_start, frag_len);
-}
-
-/* ------------------------------------------------------------------------- */
-
-static void skit_trie_iter_push( skit_trie_iter *iter, skit_trie_node *node, size_t pos )
-{
-	skit_trie_frame *frame = &iter->frames[iter->current_frame + 1];
+	if ( depth > 3 )
+		return;
 	
-	/* initialize and populate the new frame */
-	skit_trie_coords_ctor(&frame->coords);
-	frame->coords.node = node;
-	frame->coords.pos = pos;
-	frame->current_char = 0;
+	if ( depth == 0 )
+	{
+		skit_loaf current = skit_loaf_new();
+		loaf[*loaf_index] = current;
+		(*loaf_index)++;
+		skit_trie_test_make_trigram(loaf, loaf_index, max_index, current.as_slice, breadth, depth+1);
+		return;
+	}
 	
-	/* commit the results */
-	iter->prev_frame = iter->current_frame;
-	(iter->current_frame)++;
-}
-
-static void skit_trie_iter_pop( skit_trie_iter *iter )
-{
-	iter->prev_frame = iter->current_frame;
-	(iter->current_frame)--;
+	int frequency = 256 / SKIT__TRIE_NODE_PREALLOC;
+	
+	for ( i = 0; i < breadth; i++ )
+	{
+		skit_loaf current = skit_loaf_alloc(depth);
+		loaf[*loaf_index] = current;
+		skit_loaf_store_slice(&current, parent);
+		uint8_t *ptr = sLPTR(current);
+		
+		if ( i == 0 )
+			ptr[depth-1] = 0x00;
+		else if ( i == breadth-1 ) /* Always ensure that the highest possible branch value gets tested. */
+			ptr[depth-1] = 0xFF;
+		else 
+			ptr[depth-1] = (i*frequency) + depth;
+		/*ptr[depth-1] = i + 'a';*/
+		
+		(*loaf_index)++;
+		skit_trie_test_make_trigram(loaf, loaf_index, max_index, current.as_slice, breadth, depth+1);
+	}
 }
 
-/* ------------------------------------------------------------------------- */
-
-skit_trie_iter *skit_trie_iter_new( skit_trie *trie, const skit_slice prefix, skit_flags flags )
+static void skit_trie_unittest_table_nodes()
 {
 	SKIT_USE_FEATURE_EMULATION;
+	size_t i, j;
+	size_t breadth = SKIT__TRIE_NODE_PREALLOC+1;
 	
-	/*
-	Case-insensitive iteration is potentially tricky because skit_trie_find
-	would need to be able to return multiple nodes that the iterator could
-	walk over to cover all possible prefixes that case-insensitively match.
-	Ex:
-	trie = trie of { "ABCD", "abcd", "aBcX", "AbCx" }
-	iter = skit_trie_iter_new( trie, "abc", sFLAGS("i") );
-	This iterator should return all keys in the above trie.  Using the
-	current implementation of skit_trie_find, it would probably only return
-	"ABCD" because "ABC" is the first node that skit_trie_find would find.
-	*/
-	sENFORCE_MSG( !(flags & ICASE), "Case insensitive operations are currently unimplemented for skit_trie_iter.");
+	/* Create a trie of trigrams (and their subsets). */
+	/* Make each level slightly fatter than the prealloc number. */
+	size_t n_strings = 
+		skit_ipow(breadth, 3)+
+		skit_ipow(breadth, 2)+
+		skit_ipow(breadth, 1)+1;
 	
-	ITER_DEBUG("%s, %d: \n", __func__, __LINE__);
-	skit_trie_enforce_valid_flags(flags, CREATE | OVERWRITE | ICASE);
-	size_t key_len = sSLENGTH(prefix);
-	const uint8_t *key_ptr = (const uint8_t*)sSPTR(prefix);
-
-	if ( flags & (CREATE | OVERWRITE) )
+	skit_loaf      *loaves  = skit_malloc(sizeof(skit_loaf) * n_strings);
+	skit_loaf      *iloaves = skit_malloc(sizeof(skit_loaf) * n_strings);
+	skit_trie_test *tests   = skit_malloc(sizeof(skit_trie_test) * n_strings);
+	size_t loaf_index = 0;
+	skit_trie_test_make_trigram( loaves, &loaf_index, n_strings, sSLICE(""), breadth, 0 );
+	
+	for ( i = 0; i < n_strings; i++ )
 	{
-		char flags_str[SKIT_FLAGS_BUF_SIZE];
-		skit_flags_to_str(flags, flags_str);
-		sTHROW(SKIT_TRIE_BAD_FLAGS,
-			"Call to skit_trie_iter_new with 'c' or 'o' flags. These are invalid for iteration. prefix = \"%.\", flags = \"%s\"",
-			key_len, key_ptr, flags_str);
+		uint8_t *lptr = sLPTR(loaves[i]);
+		ssize_t len = sLLENGTH(loaves[i]);
+		
+		iloaves[i] = skit_loaf_alloc(len);
+		uint8_t *ilptr = sLPTR(iloaves[i]);
+		
+		/* Reverse casing where it matters. */
+		for ( j = 0; j < len; j++ )
+		{
+			uint8_t c = lptr[j];
+			if ( c == skit_char_ascii_to_lower(c) )
+				ilptr[j] = skit_char_ascii_to_upper(c);
+			else
+				ilptr[j] = skit_char_ascii_to_lower(c);
+		}
 	}
 	
-	size_t longest_key_len = sLLENGTH(trie->key_return_buf);
-	
-	skit_trie_iter *result = skit_malloc(sizeof(skit_trie_iter));
-	result->trie = trie;
-	result->frames = NULL;
-	result->current_frame = -1;
-	result->prev_frame = -1;
-	result->key_buffer = skit_malloc(longest_key_len);
-	
-	(trie->iterator_count)++;
-	
-	skit_trie_coords coords = skit_trie_find(trie, key_ptr, key_len, 1);
-	if ( skit_no_match(coords, key_len) )
+	for ( i = 0; i < n_strings; i++ )
 	{
-		/* Leave result->current_frame as -1 so that skit_trie_iter_next returns 0 immediately. */
-		return result;
+		tests[i].slice = loaves[i].as_slice;
+		tests[i].islice = iloaves[i].as_slice;
+		tests[i].val = i+1;
 	}
 	
-	/* skit_trie_find accumulates the found key into trie->key_return_buf. */
-	/* We actually need it in iter->key_buffer. */
-	/* This call should fix that. */
-	skit_iter_accumulate_key(result, 0, sLPTR(trie->key_return_buf), coords.pos);
+	sTRACE0(skit_trie_exhaustive_test(tests, n_strings, 0));
 	
-	/* */
-	result->frames = skit_malloc(sizeof(skit_trie_frame) * ((longest_key_len - coords.pos) + 1));
-
-	/* skit_trie_find should only return coords.n_chars_into_node > 0  */
-	/*   for linear nodes that the prefix doesn't completely encompass. */
-	/* The iterator can't handle that, so we'll skip ahead to the next */
-	/*   complete node in those cases. */
-	if ( coords.n_chars_into_node > 0 )
+	for ( i = 0; i < n_strings; i++ )
 	{
-		skit_trie_node *node = coords.node;
-		sASSERT_EQ(node->nodes_len, 1);
-		sASSERT_GT(node->chars_len, 1); /* chars_len > 1 */
-
-		/* Copy the rest of the node into the key_buffer. */
-		void *dst_start = result->key_buffer + coords.pos;
-		void *src_start = node->chars + coords.n_chars_into_node;
-		size_t copy_len = node->chars_len - coords.n_chars_into_node;
-		memcpy(dst_start, src_start, copy_len);
-		
-		/* Update coords to point to the next node. */
-		coords.pos += copy_len;
-		coords.n_chars_into_node = 0;
-		coords.node = &node->nodes.array[0];
+		skit_loaf_free(&loaves[i]);
+		skit_loaf_free(&iloaves[i]);
 	}
 	
-	skit_trie_iter_push( result, coords.node, coords.pos );
-	
-	return result;
+	sTRACE0(skit_free(loaves));
+	sTRACE0(skit_free(iloaves));
+	sTRACE0(skit_free(tests));
 }
 
-/* ------------------------------------------------------------------------- */
-
-skit_trie_iter *skit_trie_iter_free( skit_trie_iter *iter )
+static void skit_trie_remove_test()
 {
 	SKIT_USE_FEATURE_EMULATION;
-
-	/* frames can't be used for this check because it may be NULL for empty sets. */
-	if ( iter->key_buffer == NULL )
-		sTHROW(SKIT_TRIE_EXCEPTION, "Attempt to free an already-freed skit_trie_iter.");
+	void *val;
+	char buf[2];
+	size_t i;
+	skit_trie *trie = skit_trie_new();
 	
-	if ( iter->frames != NULL )
+	/* Removing the middle of a chain folds it back into one linear node. */
+	skit_trie_setc(trie, "abc", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "abcdef", (void*)2, SKIT_FLAG_C);
+	sASSERT_EQS(skit_trie_remove(trie, sSLICE("ABC"), SKIT_FLAG_I), sSLICE("abc"));
+	sASSERT_EQ(skit_trie_len(trie), 1);
+	sASSERT_EQ(trie->root->nodes_len, 1);
+	sASSERT_EQ(trie->root->chars_len, 6);
+	sASSERT_EQ(trie->root->nodes.array[0].nodes_len, 0);
+	sASSERT_EQS(skit_trie_getc(trie, "abcdef", &val, SKIT_FLAGS_NONE), sSLICE("abcdef"));
+	sASSERT_EQ((skit_uintptr_t)val, 2);
+	sASSERT_EQS(skit_trie_getc(trie, "abc", &val, SKIT_FLAGS_NONE), skit_slice_null());
+	
+	/* Missing keys throw unless 'c' is given. */
+	int caught = 0;
+	sTRY
+		skit_trie_remove(trie, sSLICE("abc"), SKIT_FLAGS_NONE);
+	sCATCH(SKIT_TRIE_KEY_NOT_FOUND, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+	sASSERT_EQS(skit_trie_remove(trie, sSLICE("abcdefg"), SKIT_FLAG_C), skit_slice_null());
+	sASSERT_EQ(skit_trie_len(trie), 1);
+	
+	/* Removing a branch turns the multi-node back into a linear chain. */
+	skit_trie_setc(trie, "abcxyz", (void*)3, SKIT_FLAG_C);
+	sASSERT_EQ(skit_trie_len(trie), 2);
+	sASSERT_EQS(skit_trie_remove(trie, sSLICE("abcxyz"), SKIT_FLAGS_NONE), sSLICE("abcxyz"));
+	sASSERT_EQ(trie->root->nodes_len, 1);
+	sASSERT_EQ(trie->root->chars_len, 6);
+	
+	sASSERT_EQS(skit_trie_remove(trie, sSLICE("abcdef"), SKIT_FLAGS_NONE), sSLICE("abcdef"));
+	sASSERT_EQ(skit_trie_len(trie), 0);
+	sASSERT(trie->root == NULL);
+	
+	/* Wide nodes turn back into multi-nodes when they thin out. */
+	buf[1] = '\0';
+	for ( i = 0; i <= SKIT__TRIE_NODE_PREALLOC; i++ )
 	{
-		skit_free(iter->frames);
-		iter->frames = NULL;
+		buf[0] = 'a' + i;
+		skit_trie_setc(trie, buf, (void*)(i+1), SKIT_FLAG_C);
+	}
+	sASSERT_EQ(trie->root->nodes_len, SKIT__TRIE_NODE_PREALLOC + 1);
+	sASSERT_GT(trie->root->chars_len, SKIT__TRIE_NODE_PREALLOC);
+	sASSERT_EQS(skit_trie_remove(trie, sSLICE("c"), SKIT_FLAGS_NONE), sSLICE("c"));
+	sASSERT_EQ(trie->root->nodes_len, SKIT__TRIE_NODE_PREALLOC);
+	sASSERT_EQ(trie->root->chars_len, SKIT__TRIE_NODE_PREALLOC);
+	for ( i = 0; i <= SKIT__TRIE_NODE_PREALLOC; i++ )
+	{
+		buf[0] = 'a' + i;
+		if ( buf[0] == 'c' )
+			sASSERT(!skit_trie_lookup(trie, skit_slice_of_cstr(buf), NULL, SKIT_FLAGS_NONE));
+		else
+		{
+			sASSERT(skit_trie_lookup(trie, skit_slice_of_cstr(buf), &val, SKIT_FLAGS_NONE));
+			sASSERT_EQ((skit_uintptr_t)val, i+1);
+		}
 	}
-
-	skit_free(iter->key_buffer);
-	iter->key_buffer = NULL;
-	
-	(iter->trie->iterator_count)--;
 	
-	skit_free(iter);
-	return NULL;
+	skit_trie_free(trie);
+	printf("  skit_trie_remove_test passed.\n");
 }
 
-/* ------------------------------------------------------------------------- */
-
-int skit_trie_iter_next( skit_trie_iter *iter, skit_slice *key, void **value )
+/* Checks that the root has the given number of children, and the shape that goes with it. */
+static void skit_trie_check_root_shape(skit_trie *trie, size_t n_children)
 {
-	ITER_DEBUG("skit_trie_iter_next(...): %d\n", __LINE__);
-	ITER_DEBUG("%s, %d: iter->current_frame == %d\n", __func__, __LINE__, iter->current_frame);
-	sENFORCE_MSG(value != NULL, "NULL value pointer given in call to skit_trie_iter_next.  "
-		"This must be a pointer to a variable that can accept the returned value.");
-	sENFORCE_MSG(key != NULL, "NULL key pointer given in call to skit_trie_iter_next.  "
-		"This must be a pointer to a skit_slice that can accept the returned key.");
-	
-	/* Global termination case: we just popped the last frame. */
-	/*   That means we left the first node we ever visited, and there are no */
-	/*   more children to descend into: iteration is over. */
-	if ( iter->current_frame < 0 )
-	{
-		*key = skit_slice_null();
-		*value = NULL;
-		return 0;
-	}
+	sASSERT_EQ(trie->root->nodes_len, n_children);
+	if ( n_children <= SKIT__TRIE_NODE_PREALLOC )
+		sASSERT_EQ(trie->root->chars_len, n_children);
+	else
+		sASSERT_EQ(trie->root->chars_len, 0xFF);
+}
 
-	skit_trie_frame *frame = &iter->frames[iter->current_frame];
-	skit_trie_coords *coords = &frame->coords;
-	skit_trie_node *node = coords->node;
+/* The i'th key of the fanout test: the order is scrambled, but 0x00 and 0xFF both appear. */
+static uint8_t skit_trie_fanout_char(size_t i)
+{
+	return (uint8_t)(i * 97 + 13);
+}
 
-	ITER_DEBUG("%s, %d: current key: %.*s\n", __func__, __LINE__, coords->pos, iter->key_buffer);
-	
-	/* It seems our iterator is alive.  Let's iterate! */
-	
-	/* Entry case: Catch the case where we just pushed. */
-	/* This means we just enetered the node for the first time. */
-	if ( iter->prev_frame < iter->current_frame )
+/* Looks up every possible fanout key and makes sure that exactly 'n_present' are there. */
+static void skit_trie_check_fanout(skit_trie *trie, const uint8_t *present, size_t n_present)
+{
+	size_t i;
+	void *val;
+	uint8_t key[2];
+	size_t n_found = 0;
+	for ( i = 0; i < 256; i++ )
 	{
-		ITER_DEBUG("%s, %d: Entry case.\n", __func__, __LINE__);
-		/* Check for a value, yield it if one is found. */
-		if ( node->have_value )
+		key[0] = i;
+		key[1] = '-';
+		int found = skit_trie_lookup(trie, skit_slice_of_cstrn((char*)key, 2), &val, SKIT_FLAGS_NONE);
+		sASSERT_EQ(found, present[i]);
+		if ( found )
 		{
-			ITER_DEBUG("%s, %d: Have value.\n", __func__, __LINE__);
-			/* Update this so that we don't loop forever. */
-			iter->prev_frame = iter->current_frame;
-			
-			/* Yield the value. */
-			*key = skit_slice_of_cstrn((char*)iter->key_buffer, coords->pos);
-			*value = (void*)node->value;
-			return 1;
+			sASSERT_EQ((skit_uintptr_t)val, i + 1);
+			n_found++;
 		}
+		sASSERT(!skit_trie_lookup(trie, skit_slice_of_cstrn((char*)key, 1), NULL, SKIT_FLAGS_NONE));
 	}
-	
-	/* Exit case: We just exhausted the node and must do a pop. */
-	if ( frame->current_char > 255 )
+	sASSERT_EQ(n_found, n_present);
+
+	/* Iteration must visit the keys in order, whatever the node's shape. */
+	skit_slice key_found;
+	int last = -1;
+	n_found = 0;
+	skit_trie_iter *iter = skit_trie_iter_new(trie, sSLICE(""), SKIT_FLAGS_NONE);
+	while ( skit_trie_iter_next(iter, &key_found, &val) )
 	{
-		ITER_DEBUG("%s, %d: Exiting.\n", __func__, __LINE__);
-		skit_trie_iter_pop(iter);
-		
-		/* Refresh function-scope variables by recursing. */
-		return skit_trie_iter_next(iter, key, value);
+		int c = sSPTR(key_found)[0];
+		sASSERT_EQ(sSLENGTH(key_found), 2);
+		sASSERT_GT(c, last);
+		sASSERT_EQ((skit_uintptr_t)val, c + 1);
+		last = c;
+		n_found++;
 	}
-	
-	/* Iteration case: visit the next child node. */
-	if ( node->nodes_len == 1 && node->chars_len > 1 )
+	skit_trie_iter_free(iter);
+	sASSERT_EQ(n_found, n_present);
+}
+
+static void skit_trie_fanout_test()
+{
+	size_t i;
+	uint8_t key[2];
+	uint8_t present[256];
+	skit_trie *trie = skit_trie_new();
+	memset(present, 0, sizeof(present));
+	key[1] = '-';
+
+	/* Grow the root through every shape: multi, node16, node48, table. */
+	for ( i = 0; i < 256; i++ )
 	{
-		ITER_DEBUG("%s, %d: Linear node.\n", __func__, __LINE__);
-		/* Linear nodes. */
-		
-		/* Mark this node as exhausted and then push the child into focus. */
-		frame->current_char = 256;
-		skit_trie_iter_push(iter, &node->nodes.array[0], coords->pos + node->chars_len);
-		skit_iter_accumulate_key(iter, coords->pos, node->chars, node->chars_len);
-		
-		/* Continue searching for a value. */
-		return skit_trie_iter_next(iter, key, value);
+		uint8_t c = skit_trie_fanout_char(i);
+		key[0] = c;
+		skit_trie_set(trie, skit_slice_of_cstrn((char*)key, 2), (void*)((skit_uintptr_t)c + 1), SKIT_FLAG_C);
+		present[c] = 1;
+		if ( i > 0 )
+			skit_trie_check_root_shape(trie, i+1);
+
+		switch ( i+1 )
+		{
+			case SKIT__TRIE_NODE_PREALLOC:
+			case SKIT__TRIE_NODE_PREALLOC+1:
+			case SKIT__TRIE_NODE16_MAX:
+			case SKIT__TRIE_NODE16_MAX+1:
+			case SKIT__TRIE_NODE48_MAX:
+			case SKIT__TRIE_NODE48_MAX+1:
+			case 256:
+				skit_trie_check_fanout(trie, present, i+1);
+		}
 	}
-	else if ( node->nodes_len <= SKIT__TRIE_NODE_PREALLOC )
+
+	/* Shrink it back down, removing keys in a different order. */
+	for ( i = 0; i < 256; i++ )
 	{
-		ITER_DEBUG("%s, %d: Multi-node.\n", __func__, __LINE__);
-		/* Multi-nodes. */
-		size_t i;
-		ssize_t node_index = -1;
-		uint16_t next_char = 256;
-		sASSERT_EQ(node->nodes_len, node->chars_len);
+		uint8_t c = (uint8_t)(i * 31 + 7);
+		key[0] = c;
+		sASSERT_EQS(skit_trie_remove(trie, skit_slice_of_cstrn((char*)key, 2), SKIT_FLAGS_NONE),
+			skit_slice_of_cstrn((char*)key, 2));
+		present[c] = 0;
 
-		/* Find the index of the node that corresponds to current_char */
-		/*   and also find the character that comes after it, alphabetically. */
-		for ( i = 0; i < node->chars_len; i++ )
+		size_t n_left = 255 - i;
+		if ( n_left > 1 )
+			skit_trie_check_root_shape(trie, n_left);
+
+		switch ( n_left )
 		{
-			uint16_t c = node->chars[i];
-		
-			if ( c == frame->current_char )
-				node_index = i;
-			
-			if ( frame->current_char < c && c < next_char )
-				next_char = c;
+			case 1:
+			case SKIT__TRIE_NODE_PREALLOC:
+			case SKIT__TRIE_NODE_PREALLOC+1:
+			case SKIT__TRIE_NODE16_MAX:
+			case SKIT__TRIE_NODE16_MAX+1:
+			case SKIT__TRIE_NODE48_MAX:
+			case SKIT__TRIE_NODE48_MAX+1:
+				skit_trie_check_fanout(trie, present, n_left);
 		}
-		
-		/* Advance the iteration. */
-		frame->current_char = next_char;
-		
-		/* When entering a node for the first time, current_char will be 0. */
-		/* There will seldom be a '\0' character in a trie node, and so we */
-		/*   definitely can't count on finding one.  In the likely case that */
-		/*   we don't, we'll have to skip ahead to the lowest character that */
-		/*   has a corresponding node and descend into that one instead. */
-		/*   We do this by calling ourselves and thus recalculating with */
-		/*   the new current_char set.  Iteration should proceed normally */
-		/*   after that. */
-		if ( node_index < 0 )
-			return skit_trie_iter_next(iter, key, value);
-		
-		/* Normal case: there is a node_index for us to descend into. */
-		skit_trie_iter_push(iter, &node->nodes.array[node_index], coords->pos + 1);
-		skit_iter_accumulate_key(iter, coords->pos, &node->chars[node_index], 1);
-		
-		return skit_trie_iter_next(iter, key, value);
 	}
-	else
+	sASSERT(trie->root == NULL);
+
+	/* Case-insensitive lookups return the stored spelling in every shape. */
+	/* The uppercase letters are padded with high bytes to reach each shape. */
+	size_t widths[3] = { SKIT__TRIE_NODE_PREALLOC+2, 26, SKIT__TRIE_NODE48_MAX+8 };
+	size_t w;
+	for ( w = 0; w < 3; w++ )
 	{
-		ITER_DEBUG("%s, %d: Table node.\n", __func__, __LINE__);
-		/* Table nodes. */
-		size_t i;
-		ssize_t node_index = frame->current_char;
-		uint16_t next_char = 256;
-		
-		/* Scan for the next node that we can descend into. */
-		for ( i = node_index + 1; i < 256; i++ )
+		void *val;
+		for ( i = 0; i < widths[w]; i++ )
 		{
-			if ( node->nodes.table[i] != NULL )
-			{
-				next_char = i;
-				break;
-			}
+			key[0] = i < 26 ? 'A' + i : 0x80 + i;
+			skit_trie_set(trie, skit_slice_of_cstrn((char*)key, 2), (void*)((skit_uintptr_t)key[0] + 1), SKIT_FLAG_C);
 		}
-		
-		/* Advance the iteration. */
-		frame->current_char = next_char;
-		
-		/* When entering a node for the first time, current_char will be 0. */
-		/* There will seldom be a '\0' character in a trie node, and so we */
-		/*   definitely can't count on finding one.  In the likely case that */
-		/*   we don't, we'll have to skip ahead to the lowest character that */
-		/*   has a corresponding node and descend into that one instead. */
-		/*   We do this by calling ourselves and thus recalculating with */
-		/*   the new current_char set.  Iteration should proceed normally */
-		/*   after that. */
-		if ( node->nodes.table[node_index] == NULL )
-			return skit_trie_iter_next(iter, key, value);
-		
-		/* Normal case: there is a node_index for us to descend into. */
-		skit_trie_iter_push(iter, node->nodes.table[node_index], coords->pos + 1);
-		
-		uint8_t c = node_index;
-		skit_iter_accumulate_key(iter, coords->pos, &c, 1);
-		
-		return skit_trie_iter_next(iter, key, value);
+		skit_trie_check_root_shape(trie, widths[w]);
+
+		for ( i = 0; i < widths[w] && i < 26; i++ )
+		{
+			key[0] = 'a' + i;
+			skit_slice found = skit_trie_get(trie, skit_slice_of_cstrn((char*)key, 2), &val, SKIT_FLAG_I);
+			sASSERT_EQ(sSLENGTH(found), 2);
+			sASSERT_EQ(sSPTR(found)[0], 'A' + i);
+			sASSERT_EQ((skit_uintptr_t)val, 'A' + i + 1);
+		}
+
+		for ( i = 0; i < widths[w]; i++ )
+		{
+			key[0] = i < 26 ? 'A' + i : 0x80 + i;
+			skit_trie_remove(trie, skit_slice_of_cstrn((char*)key, 2), SKIT_FLAG_I);
+		}
+		sASSERT(trie->root == NULL);
+		sASSERT_EQ(trie->pool.live_bytes, 0);
 	}
-	
-	sASSERT(0);
-	return 0;
+
+	skit_trie_free(trie);
+	printf("  skit_trie_fanout_test passed.\n");
 }
 
-/* ------------------------------------------------------------------------- */
-/* ------------------------------ testing! --------------------------------- */
+/* Checks that every block under 'node' is granule-aligned and lies in the pool's only chunk. */
+static void skit_trie_check_layout(const skit_trie *trie, const skit_trie_node *node)
+{
+	size_t i;
+	const uint8_t *chunk_start = trie->pool.chunks[0].start;
+	const uint8_t *chunk_end = chunk_start + trie->pool.chunks[0].n_granules * SKIT__TRIE_POOL_GRANULE;
+	const uint8_t *block = (const uint8_t*)node->nodes.array;
+	if ( node->nodes_len == 0 )
+		return;
 
+	sASSERT_EQ((skit_uintptr_t)block % SKIT__TRIE_POOL_GRANULE, 0);
+	sASSERT(chunk_start <= block && block < chunk_end);
 
-typedef struct skit_trie_test skit_trie_test;
-struct skit_trie_test
-{
-	skit_slice      slice;
-	skit_slice      islice;
-	skit_uintptr_t  val;
-};
+	skit_trie_node *children = skit_trie_node_children(node);
+	for ( i = 0; i < 256; i++ )
+	{
+		if ( children != NULL && i < node->nodes_len )
+			skit_trie_check_layout(trie, &children[i]);
+		else if ( children == NULL && node->nodes.table[i] != NULL )
+		{
+			sASSERT_EQ((skit_uintptr_t)node->nodes.table[i] % SKIT__TRIE_POOL_GRANULE, 0);
+			skit_trie_check_layout(trie, node->nodes.table[i]);
+		}
+	}
+}
 
-static void skit_trie_test_ctor(
-	skit_trie_test  *test,
-	skit_slice      slice,
-	skit_slice      islice,
-	skit_uintptr_t  val)
+/* The i'th key of the compaction test.  Its nodes come in every shape. */
+static size_t skit_trie_compact_key(size_t i, char *buf)
 {
-	test->slice = slice;
-	test->islice = islice;
-	test->val = val;
+	size_t len = 0;
+	size_t j;
+	buf[len++] = 'A' + i % 60;
+	buf[len++] = 'A' + (i / 60) % (i % 60 + 1);
+	for ( j = 0; j < (i * 7) % 23; j++ )
+		buf[len++] = 'a' + (i + j) % 3;
+	return len;
 }
 
-/* ------------------------------------------------------------------------- */
+static void skit_trie_compact_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t i;
+	void *val;
+	char buf[32];
+	uint8_t present[3000];
+	skit_trie *trie = skit_trie_new();
+
+	skit_trie_compact(trie);
+	sASSERT(trie->root == NULL);
+
+	memset(present, 0, sizeof(present));
+	for ( i = 0; i < 3000; i++ )
+	{
+		skit_slice key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		if ( skit_trie_lookup(trie, key, NULL, SKIT_FLAGS_NONE) )
+			continue;
+		skit_trie_set(trie, key, (void*)(i+1), SKIT_FLAG_C);
+		present[i] = 1;
+	}
+	for ( i = 0; i < 3000; i += 3 )
+	{
+		if ( !present[i] )
+			continue;
+		skit_trie_remove(trie, skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf)), SKIT_FLAGS_NONE);
+		present[i] = 0;
+	}
+	skit_trie_enable_icase_index(trie);
+
+	size_t live_bytes = trie->pool.live_bytes;
+	size_t n_keys = skit_trie_len(trie);
+	skit_trie_compact(trie);
+	sASSERT_EQ(trie->pool.live_bytes, live_bytes);
+	sASSERT_EQ(skit_trie_len(trie), n_keys);
+	sASSERT_EQ(trie->pool.n_chunks, 1);
+	sASSERT_EQ(trie->pool.nonempty, 0);
+	skit_trie_check_layout(trie, trie->root);
+
+	for ( i = 0; i < 3000; i++ )
+	{
+		skit_slice key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		if ( !present[i] )
+			continue;
+		sASSERT(skit_trie_lookup(trie, key, &val, SKIT_FLAGS_NONE));
+		sASSERT_EQ((skit_uintptr_t)val, i+1);
+		skit_slice_ascii_to_lower(&key);
+		sASSERT(skit_trie_lookup(trie, key, &val, SKIT_FLAG_I));
+	}
+
+	/* Iteration still goes in order. */
+	skit_loaf last = skit_loaf_new();
+	skit_slice key;
+	size_t n_found = 0;
+	skit_trie_iter *iter = skit_trie_iter_new(trie, sSLICE(""), SKIT_FLAGS_NONE);
+	while ( skit_trie_iter_next(iter, &key, &val) )
+	{
+		sASSERT_LT(skit_slice_ascii_cmp(last.as_slice, key), 0);
+		skit_loaf_assign_slice(&last, key);
+		n_found++;
+	}
+
+	int caught = 0;
+	sTRY
+		skit_trie_compact(trie);
+	sCATCH(SKIT_TRIE_WRITE_IN_ITERATION, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+	skit_trie_iter_free(iter);
+	skit_loaf_free(&last);
+	sASSERT_EQ(n_found, n_keys);
 
-static void skit_trie_exhaustive_get_test(
-	skit_trie *trie,
-	const skit_trie_test* tests,
-	size_t trie_size,
-	size_t n_slices,
-	int test_vals )
-{
-	void *val;
-	size_t i;
-	
-	sASSERT_EQ(skit_trie_len(trie), trie_size);
-	
-	/* Test for false negatives. */
-	for ( i = 0; i < trie_size; i++ )
+	/* The trie can still change afterwards, and gives all of its memory back. */
+	for ( i = 0; i < 3000; i++ )
 	{
-		sASSERT_EQS(skit_trie_get(trie, tests[i].slice, &val, SKIT_FLAGS_NONE), tests[i].slice);
-		if ( test_vals )
-			sASSERT_EQ((skit_uintptr_t)val, tests[i].val);
-		
-		sASSERT_IEQS(skit_trie_get(trie, tests[i].islice, &val, SKIT_FLAG_I), tests[i].slice );
-		/* sASSERT_EQ((skit_uintptr_t)val, tests[i].val, "%d"); */
+		skit_slice key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		if ( present[i] )
+			skit_trie_remove(trie, key, SKIT_FLAGS_NONE);
+		else if ( !skit_trie_lookup(trie, key, NULL, SKIT_FLAGS_NONE) )
+			skit_trie_set(trie, key, (void*)(i+1), SKIT_FLAG_C);
 	}
-	
-	/* Test against false positives. */
-	for ( i = trie_size; i < n_slices; i++ )
+	for ( i = 0; i < 3000; i++ )
+		skit_trie_remove(trie, skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf)), SKIT_FLAG_C);
+	sASSERT_EQ(skit_trie_len(trie), 0);
+	sASSERT_EQ(trie->pool.live_bytes, 0);
+
+	/* Every chunk has been merged back into a single free block. */
+	for ( i = 0; i < trie->pool.n_chunks; i++ )
 	{
-		sASSERT_EQS(skit_trie_get(trie, tests[i].slice, &val, SKIT_FLAGS_NONE), skit_slice_null());
-		sASSERT(val == NULL);
+		skit_trie_pool_chunk *chunk = &trie->pool.chunks[i];
+		skit_trie_free_block *block = (skit_trie_free_block*)chunk->start;
+		sASSERT(skit_trie_pool_is_free_end(chunk, 0));
+		sASSERT_EQ(block->n_granules, chunk->n_granules);
 	}
+
+	skit_trie_free(trie);
+	printf("  skit_trie_compact_test passed.\n");
 }
 
-static int skit_trie_cmp_test( const void *a, const void *b )
+/* Checks that 'a' and 'b' hold the same keys, with the same values, in the same order. */
+static void skit_trie_check_same(skit_trie *a, skit_trie *b)
 {
-	skit_trie_test *t1 = (skit_trie_test*)a;
-	skit_trie_test *t2 = (skit_trie_test*)b;
-	return skit_slice_ascii_cmp( t1->slice, t2->slice );
+	skit_slice key_a, key_b;
+	void *val_a, *val_b;
+	sASSERT_EQ(skit_trie_len(a), skit_trie_len(b));
+	skit_trie_iter *iter_a = skit_trie_iter_new(a, sSLICE(""), SKIT_FLAGS_NONE);
+	skit_trie_iter *iter_b = skit_trie_iter_new(b, sSLICE(""), SKIT_FLAGS_NONE);
+	while ( skit_trie_iter_next(iter_a, &key_a, &val_a) )
+	{
+		sASSERT(skit_trie_iter_next(iter_b, &key_b, &val_b));
+		sASSERT_EQS(key_a, key_b);
+		sASSERT(val_a == val_b);
+	}
+	sASSERT(!skit_trie_iter_next(iter_b, &key_b, &val_b));
+	skit_trie_iter_free(iter_a);
+	skit_trie_iter_free(iter_b);
 }
 
-static void skit_trie_iter_test(
-	skit_trie *trie,
-	skit_trie_test *tests, /* Must be sorted. */
-	size_t n_tests,
-	size_t pos,
-	int recurse )
+static void skit_trie_build_sorted_test()
 {
-	skit_slice prefix = skit_slice_of(tests[0].slice, 0, pos);
-	
-	ITER_DEBUG("\n\n");
-	ITER_DEBUG("skit_trie_iter_test(trie, tests[%ld], %ld, %d), prefix == '%.*s'\n",
-		n_tests, pos, recurse, sSLENGTH(prefix), sSPTR(prefix));
-	
-	skit_trie_iter *iter = skit_trie_iter_new(trie, prefix, SKIT_FLAGS_NONE);
-	
+	SKIT_USE_FEATURE_EMULATION;
+	size_t i, j;
+	void *val, *expected;
+	char buf[32];
 	skit_slice key;
-	void *val;
-	size_t i = 0;
-	while ( skit_trie_iter_next( iter, &key, &val ) )
+
+	/* Build the same keys one at a time, and use that trie's order as the input. */
+	skit_trie *incremental = skit_trie_new();
+	skit_trie_setc(incremental, "", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(incremental, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaa", (void*)2, SKIT_FLAG_C);
+	for ( i = 0; i < 3000; i++ )
 	{
-		ITER_DEBUG("%s, %d: calling skit_trie_iter_next(iter, \"%.*s\", %ld); i == %d; expect %ld\n",
-			__func__, __LINE__,
-			sSLENGTH(key), sSPTR(key),
-			(skit_uintptr_t)val, i, tests[i].val);
-		
-		sASSERT_EQS( tests[i].slice, key );
-		sASSERT_EQ ( tests[i].val, (size_t)val );
-		i++;
+		key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		if ( !skit_trie_lookup(incremental, key, NULL, SKIT_FLAGS_NONE) )
+			skit_trie_set(incremental, key, (void*)(i+3), SKIT_FLAG_C);
+	}
+
+	size_t n_keys = skit_trie_len(incremental);
+	skit_loaf  *loaves = skit_malloc(n_keys * sizeof(skit_loaf));
+	skit_slice *keys = skit_malloc(n_keys * sizeof(skit_slice));
+	void       **values = skit_malloc(n_keys * sizeof(void*));
+	skit_trie_iter *iter = skit_trie_iter_new(incremental, sSLICE(""), SKIT_FLAGS_NONE);
+	for ( i = 0; skit_trie_iter_next(iter, &key, &val); i++ )
+	{
+		values[i] = val;
+		loaves[i] = skit_loaf_dup(key);
+		keys[i] = loaves[i].as_slice;
 	}
-	
-	sASSERT_EQ( i, n_tests );
-	
 	skit_trie_iter_free(iter);
-	
-	if ( recurse && n_tests > 1 )
+	sASSERT_EQ(i, n_keys);
+
+	skit_trie *trie = skit_trie_build_sorted(keys, values, n_keys);
+	skit_trie_check_same(trie, incremental);
+	sASSERT_EQ(trie->pool.n_chunks, 1);
+	sASSERT_EQ(trie->pool.nonempty, 0);
+	sASSERT_LE(trie->pool.live_bytes, incremental->pool.live_bytes);
+	skit_trie_check_layout(trie, trie->root);
+	sASSERT_EQ(sLLENGTH(trie->key_return_buf), sLLENGTH(incremental->key_return_buf));
+
+	/* Lookups agree on every key, and every prefix of every key. */
+	for ( i = 0; i < n_keys; i++ )
 	{
-		uint8_t *key_ptr = sSPTR(tests[0].slice);
-		size_t   key_len = sSLENGTH(tests[0].slice);
-		uint16_t prev_char = 0x800;
-		uint16_t this_char = (pos == key_len ? 0x800 : key_ptr[pos]);
-		size_t prev_index = 0;
-		for ( i = 1; i < n_tests; i++ )
+		for ( j = 0; j <= sSLENGTH(keys[i]); j++ )
 		{
-			key_ptr = sSPTR(tests[i].slice);
-			key_len = sSLENGTH(tests[i].slice);
-			
-			prev_char = this_char;
-			
-			sASSERT( pos <= key_len ); /* We should reach n_tests before falling off any cliffs. */
-			if ( pos == key_len )
-				this_char = 0x800; /* Cases where we iterate on exact matches. */
-			else
-				this_char = key_ptr[pos]; /* Prefix stuff. */
-			
-			if ( this_char != prev_char && i > prev_index )
-			{
-				if ( prev_char < 0x800 )
-					skit_trie_iter_test( trie, &tests[prev_index], i - prev_index, pos+1, 1 );
-				prev_index = i;
-			}
+			key = skit_slice_of(keys[i], 0, j);
+			int found = skit_trie_lookup(incremental, key, &expected, SKIT_FLAGS_NONE);
+			sASSERT_EQ(skit_trie_lookup(trie, key, &val, SKIT_FLAGS_NONE), found);
+			sASSERT(val == expected);
 		}
-
-		/* Pick up anything left-over. */
-		skit_trie_iter_test( trie, &tests[prev_index], n_tests - prev_index, pos+1, 1 );
+		sASSERT(skit_trie_lookup(trie, keys[i], NULL, SKIT_FLAG_I));
 	}
-}
 
-static void skit_trie_exhaustive_test( skit_trie_test* tests, size_t n_tests, int harder )
-{
-	SKIT_USE_FEATURE_EMULATION;
-	size_t i;
-	skit_trie *trie = skit_trie_new();
-	
-	/* ----- Get/set ----- */
-	for ( i = 0; i < n_tests; i++ )
+	/* The built trie can be changed like any other. */
+	for ( i = 0; i < 3000; i++ )
 	{
-		/*printf("Going to set with %p, %ld\n", sSPTR(tests[i]), sSLENGTH(tests[i]));*/
-		sASSERT_EQS(skit_trie_set(trie, tests[i].slice, (void*)tests[i].val, sFLAGS("c")), tests[i].slice);
-		
-		/*
-		if ( harder )
-			skit_trie_dump(trie, skit_stream_stdout);
-		*/
-
-		if ( harder )
-			sTRACE4(skit_trie_exhaustive_get_test(trie, tests, i+1, n_tests, 1));
+		key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		if ( i % 3 == 0 )
+			key = skit_slice_of(key, 0, sSLENGTH(key) / 2);
+		if ( skit_trie_lookup(trie, key, NULL, SKIT_FLAGS_NONE) )
+		{
+			skit_trie_remove(trie, key, SKIT_FLAGS_NONE);
+			skit_trie_remove(incremental, key, SKIT_FLAGS_NONE);
+		}
+		else
+		{
+			skit_trie_set(trie, key, (void*)i, SKIT_FLAG_C);
+			skit_trie_set(incremental, key, (void*)i, SKIT_FLAG_C);
+		}
 	}
-	
-	#if 0
-	if ( !harder )
+	skit_trie_check_same(trie, incremental);
+	skit_trie_free(trie);
+
+	/* Without values, every key maps to NULL. */
+	trie = skit_trie_build_sorted(keys, NULL, n_keys);
+	sASSERT_EQ(skit_trie_len(trie), n_keys);
+	for ( i = 0; i < n_keys; i++ )
 	{
-		skit_trie_dump(trie, skit_stream_stdout);
-		/*sASSERT_MSG(0, "Here is your tree, sir.");*/
+		sASSERT(skit_trie_lookup(trie, keys[i], &val, SKIT_FLAGS_NONE));
+		sASSERT(val == NULL);
 	}
-	#endif
-	
-	if ( !harder )
-		sTRACE0(skit_trie_exhaustive_get_test(trie, tests, n_tests, n_tests, 1));
-	
-	/* ----- Iteration test ----- */
-	qsort( tests, n_tests, sizeof(skit_trie_test), &skit_trie_cmp_test );
-	
-	int recurse = 0;
-	if ( harder )
-		recurse = 1;
+	skit_trie_free(trie);
 
-	ITER_DEBUG("\n\n-------- Iteration test begins. ---------\n\n\n");
-	sTRACE0(skit_trie_iter_test( trie, tests, n_tests, 0, recurse ));
-	
-	/* ----- Case sensitivity ----- */
-	/* It should be possible to do overwriting assignments into all of the
-	keys in a case-insensitive manner without altering the trie.
-	We test this by inserting all of the test islice's and then checking
-	the length and running the get test again.  
-	If these insertions grow the trie, then the length assertion will 
-	catch it. 
-	If these insertions alter the keys then the get_test will catch it.
-	This test should be done last, because it may alter the values
-	corresponding to various keys in unpredictable ways. */
-	size_t length_before = skit_trie_len(trie);
-	for ( i = 0; i < n_tests; i++ )
+	/* Small cases: nothing, only the empty key, and one long key. */
+	trie = skit_trie_build_sorted(NULL, NULL, 0);
+	sASSERT(trie->root == NULL);
+	sASSERT_EQ(skit_trie_len(trie), 0);
+	skit_trie_setc(trie, "abc", (void*)1, SKIT_FLAG_C);
+	sASSERT(skit_trie_lookup(trie, sSLICE("abc"), NULL, SKIT_FLAGS_NONE));
+	skit_trie_free(trie);
+
+	trie = skit_trie_build_sorted(keys, values, 1);
+	sASSERT_EQ(sSLENGTH(keys[0]), 0);
+	sASSERT(skit_trie_lookup(trie, sSLICE(""), &val, SKIT_FLAGS_NONE));
+	sASSERT_EQ((skit_uintptr_t)val, 1);
+	sASSERT(!skit_trie_lookup(trie, sSLICE("a"), NULL, SKIT_FLAGS_NONE));
+	skit_trie_free(trie);
+
+	key = sSLICE("abcdefghijklmnopqrstuvwxyz");
+	trie = skit_trie_build_sorted(&key, values, 1);
+	sASSERT(skit_trie_lookup(trie, key, &val, SKIT_FLAGS_NONE));
+	sASSERT(!skit_trie_lookup(trie, skit_slice_of(key, 0, 12), NULL, SKIT_FLAGS_NONE));
+	sASSERT_EQ(trie->root->chars_len, SKIT__TRIE_NODE_PREALLOC);
+	skit_trie_free(trie);
+
+	/* Bad input is rejected. */
+	skit_slice bad_keys[3][2] = {
+		{ sSLICE("abc"), sSLICE("abc") },
+		{ sSLICE("abd"), sSLICE("abc") },
+		{ sSLICE("abcd"), sSLICE("abc") } };
+	for ( i = 0; i < 3; i++ )
 	{
-		sASSERT_IEQS(skit_trie_set(trie, tests[i].islice, (void*)tests[i].val, sFLAGS("io")), tests[i].slice);
-		
-		/*
-		if ( harder )
-			skit_trie_dump(trie, skit_stream_stdout);
-		*/
+		int caught = 0;
+		sTRY
+			skit_trie_build_sorted(bad_keys[i], NULL, 2);
+		sCATCH(SKIT_TRIE_KEY_ALREADY_EXISTS, e)
+			sASSERT_EQ(i, 0);
+			caught = 1;
+		sCATCH(SKIT_TRIE_EXCEPTION, e)
+			sASSERT_NE(i, 0);
+			caught = 1;
+		sEND_TRY
+		sASSERT(caught);
 	}
-	
-	sASSERT_EQ( length_before, skit_trie_len(trie) );
-	sTRACE0(skit_trie_exhaustive_get_test(trie, tests, n_tests, n_tests, 0));
-	
-	sTRACE0(skit_trie_free(trie));
+
+	for ( i = 0; i < n_keys; i++ )
+		skit_loaf_free(&loaves[i]);
+	skit_free(loaves);
+	skit_free(keys);
+	skit_free(values);
+	skit_trie_free(incremental);
+	printf("  skit_trie_build_sorted_test passed.\n");
 }
 
-static void skit_trie_unittest_basics()
+/* Checks that iterating over 'prefix' gives the same keys and values in the trie and the image. */
+static void skit_trie_check_image_iter(skit_trie *trie, const skit_trie_image *image, skit_slice prefix)
 {
-	SKIT_USE_FEATURE_EMULATION;
-	size_t n_tests = 10;
-	skit_trie_test *tests = skit_malloc(sizeof(skit_trie_test) * n_tests);
-	
-	/* Successively shorter keys.  Also special characters. */
-	skit_trie_test_ctor(&tests[0], sSLICE("abcde"        ), sSLICE("Abcde"        ), 1  );
-	skit_trie_test_ctor(&tests[1], sSLICE("abxyz"        ), sSLICE("abXYZ"        ), 2  );
-	skit_trie_test_ctor(&tests[2], sSLICE("a1234"        ), sSLICE("A1234"        ), 3  );
-	skit_trie_test_ctor(&tests[3], sSLICE("abcd!"        ), sSLICE("aBcD!"        ), 4  );
-	skit_trie_test_ctor(&tests[4], sSLICE("abcxy"        ), sSLICE("abCxy"        ), 5  );
-	skit_trie_test_ctor(&tests[5], sSLICE("abc"          ), sSLICE("ABC"          ), 6  );
-	skit_trie_test_ctor(&tests[6], sSLICE("\0\xFF\0\xFF" ), sSLICE("\0\xFF\0\xFF" ), 7  );
-	skit_trie_test_ctor(&tests[7], sSLICE("\0\xFF\x7F"   ), sSLICE("\0\xFF\x7F"   ), 8  );
-	skit_trie_test_ctor(&tests[8], sSLICE("\0\x7F\x7F"   ), sSLICE("\0\x7F\x7F"   ), 9 );
-	skit_trie_test_ctor(&tests[9], sSLICE(""             ), sSLICE(""             ), 10 );
+	skit_slice key, image_key;
+	void *val, *image_val;
+	size_t n_found = 0;
+	skit_trie_iter *iter = skit_trie_iter_new(trie, prefix, SKIT_FLAGS_NONE);
+	skit_trie_image_iter *image_iter = skit_trie_image_iter_new(image, prefix, SKIT_FLAGS_NONE);
+	while ( skit_trie_iter_next(iter, &key, &val) )
+	{
+		sASSERT(skit_trie_image_iter_next(image_iter, &image_key, &image_val));
+		sASSERT_EQS(key, image_key);
+		sASSERT(val == image_val);
+		n_found++;
+	}
+	sASSERT(!skit_trie_image_iter_next(image_iter, &image_key, &image_val));
+	sASSERT(!skit_trie_image_iter_next(image_iter, &image_key, &image_val));
+	skit_trie_image_iter_free(image_iter);
+	skit_trie_iter_free(iter);
+}
 
-	sTRACE0(skit_trie_exhaustive_test(tests, n_tests, 1));
-	
-	char buf[256];
-	void *val;
-	skit_trie *trie;
+#define SKIT_TRIE_IMAGE_UTEST_FILE "skit_trie_image_unittest.trie"
 
-	/* Test inserting successively longer keys. */
-	/* (The previous mix tests successively shorter keys.) */
-	trie = skit_trie_new();
-	sASSERT_EQS(skit_trie_setc(trie, "abc", (void*)1, sFLAGS("c")), sSLICE("abc"));
-	sASSERT_EQS(skit_trie_getc(trie, "abcde", &val, SKIT_FLAGS_NONE), skit_slice_null());
-	sASSERT(val == NULL);
-	sASSERT_EQS(skit_trie_setc(trie, "abcde", (void*)1, sFLAGS("c")), sSLICE("abcde"));
-	sASSERT_EQS(skit_trie_getc(trie, "abcde", &val, SKIT_FLAGS_NONE), sSLICE("abcde"));
-	sASSERT_EQ((skit_uintptr_t)val, 1);
-	sTRACE0(skit_trie_free(trie));
-	
-	trie = skit_trie_new();
-	sASSERT_EQS(skit_trie_setc(trie, "", (void*)1, sFLAGS("c")), sSLICE(""));
-	sASSERT_EQS(skit_trie_getc(trie, "", &val, SKIT_FLAGS_NONE), sSLICE(""));
-	sTRACE0(skit_trie_free(trie));
-	
-	// Bug found in the wild: retrieving from a zero-length string caused a
-	//   segfault.  It should return a null-slice instead.
-	trie = skit_trie_new();
-	sASSERT_EQS(skit_trie_getc(trie, "", &val, SKIT_FLAGS_NONE), skit_slice_null());
-	sTRACE0(skit_trie_free(trie));
+static void skit_trie_image_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t i, j;
+	void *val, *expected;
+	char buf[32];
+	char long_key[600];
+	skit_slice key;
+	skit_trie *trie = skit_trie_new();
 
-	// Bug found in the wild: insensitive lookups can fail under certain conditions.
-	// This was caused by the fact that the finding logic wouldn't backtrack
-	// when failing, thus making it possible to use "decoy" paths that differed
-	// in case earlier in the string but differed in content later in the
-	// string.  If a 'doomed' path is chosen first, then the engine would never
-	// back up to the case-insensitive branching point and try the non-doomed
-	// path.
-	trie = skit_trie_new();
-	ssize_t i;
-	buf[1] = '\0';
-	for ( i = 'A'; i <= 'Z'; i++ )
+	/* Runs longer than 255 chars, values partway through runs, and every node shape. */
+	for ( i = 0; i < sizeof(long_key); i++ )
+		long_key[i] = 'a' + (i / 7) % 26;
+	skit_trie_set(trie, skit_slice_of_cstrn(long_key, 600), (void*)1, SKIT_FLAG_C);
+	skit_trie_set(trie, skit_slice_of_cstrn(long_key, 300), (void*)2, SKIT_FLAG_C);
+	skit_trie_set(trie, skit_slice_of_cstrn(long_key, 299), (void*)3, SKIT_FLAG_C);
+	skit_trie_set(trie, sSLICE(""), (void*)4, SKIT_FLAG_C);
+	for ( i = 0; i < 3000; i++ )
 	{
-		// force a tabled-lookup in the first node of the trie.
-		buf[0] = i;
-		sTRACE(skit_trie_setc(trie, buf, (void*)1, sFLAGS("c")));
+		key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		if ( !skit_trie_lookup(trie, key, NULL, SKIT_FLAGS_NONE) )
+			skit_trie_set(trie, key, (void*)(i+5), SKIT_FLAG_C);
 	}
-	// provide multiple options for the first 'd': uppercase and lowercase.
-	sASSERT_EQS(skit_trie_setc(trie, "DA", (void*)2, sFLAGS("c")), sSLICE("DA"));
-	sASSERT_EQS(skit_trie_setc(trie, "dummy", (void*)3, sFLAGS("c")), sSLICE("dummy"));
-	sASSERT_EQS(skit_trie_getc(trie, "dummy", &val, sFLAGS("i")), sSLICE("dummy"));
-	sASSERT_EQ((skit_uintptr_t)val, 3);
-	sTRACE0(skit_trie_free(trie));
+	for ( i = 0; i < 256; i++ )
+	{
+		buf[0] = (char)0xFE;
+		buf[1] = i;
+		skit_trie_set(trie, skit_slice_of_cstrn(buf, 2), (void*)(i+5000), SKIT_FLAG_C);
+	}
+	skit_trie_remove(trie, skit_slice_of_cstrn(long_key, 299), SKIT_FLAGS_NONE);
 
-	// Bug found in the wild: this is a regression caused while creating the
-	// fix for the previous test case.  Note the case-insensitive flag during
-	// key insertion.
+	skit_text_stream tstream;
+	skit_text_stream_ctor(&tstream);
+	skit_trie_save(trie, &tstream.as_stream);
+	skit_slice bytes = skit_text_stream_slurp(&tstream, NULL);
+
+	skit_trie_image image;
+	skit_trie_image_ctor(&image, bytes);
+	sASSERT_EQ(skit_trie_image_len(&image), skit_trie_len(trie));
+
+	/* Lookups agree on every key, and on every prefix of every key. */
+	for ( i = 0; i < 3000 + 256 + 1; i++ )
+	{
+		if ( i < 3000 )
+			key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		else if ( i < 3000 + 256 )
+		{
+			buf[0] = (char)0xFE;
+			buf[1] = i - 3000;
+			key = skit_slice_of_cstrn(buf, 2);
+		}
+		else
+			key = skit_slice_of_cstrn(long_key, 600);
+
+		for ( j = 0; j <= sSLENGTH(key); j++ )
+		{
+			skit_slice sub = skit_slice_of(key, 0, j);
+			int found = skit_trie_lookup(trie, sub, &expected, SKIT_FLAGS_NONE);
+			sASSERT_EQ(skit_trie_image_lookup(&image, sub, &val, SKIT_FLAGS_NONE), found);
+			sASSERT(val == expected);
+			found = skit_trie_lookup(trie, sub, NULL, SKIT_FLAG_I);
+			sASSERT_EQ(skit_trie_image_lookup(&image, sub, NULL, SKIT_FLAG_I), found);
+		}
+	}
+	sASSERT(skit_trie_image_lookup(&image, sSLICE("babcabcab"), &val, SKIT_FLAG_I));
+	sASSERT_EQ((skit_uintptr_t)val, 1+5); /* "BAbcabcab" */
+	sASSERT(!skit_trie_image_lookup(&image, sSLICE("babcabcab"), &val, SKIT_FLAGS_NONE));
+
+	skit_trie_check_image_iter(trie, &image, sSLICE(""));
+	skit_trie_check_image_iter(trie, &image, sSLICE("A"));
+	skit_trie_check_image_iter(trie, &image, sSLICE("Aa"));
+	skit_trie_check_image_iter(trie, &image, sSLICE("\xFE"));
+	skit_trie_check_image_iter(trie, &image, sSLICE("zzz"));
+	skit_trie_check_image_iter(trie, &image, skit_slice_of_cstrn(long_key, 5));
+	skit_trie_check_image_iter(trie, &image, skit_slice_of_cstrn(long_key, 299));
+	skit_trie_check_image_iter(trie, &image, skit_slice_of_cstrn(long_key, 600));
+	skit_trie_check_image_iter(trie, &image, skit_slice_of_cstrn(long_key, 601));
+	skit_trie_image_dtor(&image);
+
+	/* Damaged images are caught, even after they have been opened. */
+	skit_loaf damaged = skit_loaf_dup(bytes);
+	int caught = 0;
+	sTRY
+		skit_trie_image_ctor(&image, skit_slice_of(damaged.as_slice, 0, sLLENGTH(damaged) - 1));
+	sCATCH(SKIT_TRIE_BAD_IMAGE, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+
+	uint64_t good_longest_key_len;
+	uint64_t bad_longest_key_len = UINT64_MAX;
+	memcpy(&good_longest_key_len, sLPTR(damaged) + 24, 8);
+	memcpy(sLPTR(damaged) + 24, &bad_longest_key_len, 8);
+	caught = 0;
+	sTRY
+		skit_trie_image_ctor(&image, damaged.as_slice);
+	sCATCH(SKIT_TRIE_BAD_IMAGE, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+	memcpy(sLPTR(damaged) + 24, &good_longest_key_len, 8);
+
+	sLPTR(damaged)[SKIT_TRIE_IMAGE_HEADER_SIZE] = SKIT_TRIE_IMAGE_RUN;
+	sLPTR(damaged)[SKIT_TRIE_IMAGE_HEADER_SIZE + 1] = 0;
+	skit_trie_image_ctor(&image, damaged.as_slice);
+	caught = 0;
+	sTRY
+		skit_trie_image_lookup(&image, sSLICE("A"), NULL, SKIT_FLAGS_NONE);
+	sCATCH(SKIT_TRIE_BAD_IMAGE, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+	skit_trie_image_dtor(&image);
+	skit_loaf_free(&damaged);
+
+	/* Round trip through a file. */
+	skit_pfile_stream file;
+	skit_pfile_stream_ctor(&file);
+	skit_pfile_stream_open(&file, sSLICE(SKIT_TRIE_IMAGE_UTEST_FILE), "w");
+	skit_trie_save(trie, &file.as_stream);
+	skit_pfile_stream_dtor(&file);
+
+	skit_trie_image *mapped = skit_trie_image_map(sSLICE(SKIT_TRIE_IMAGE_UTEST_FILE));
+	sASSERT_EQ(mapped->n_bytes, sSLENGTH(bytes));
+	sASSERT(memcmp(mapped->bytes, sSPTR(bytes), mapped->n_bytes) == 0);
+	sASSERT(skit_trie_image_lookup(mapped, skit_slice_of_cstrn(long_key, 300), &val, SKIT_FLAGS_NONE));
+	sASSERT_EQ((skit_uintptr_t)val, 2);
+	skit_trie_check_image_iter(trie, mapped, sSLICE(""));
+	skit_trie_image_free(mapped);
+
+	skit_pfile_stream_ctor(&file);
+	skit_pfile_stream_open(&file, sSLICE(SKIT_TRIE_IMAGE_UTEST_FILE), "w");
+	skit_pfile_stream_appendln(&file, sSLICE("This is not a trie image, even though it is long enough to be one."));
+	skit_pfile_stream_dtor(&file);
+	caught = 0;
+	sTRY
+		skit_trie_image_map(sSLICE(SKIT_TRIE_IMAGE_UTEST_FILE));
+	sCATCH(SKIT_TRIE_BAD_IMAGE, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+
+	sASSERT_EQ(remove(SKIT_TRIE_IMAGE_UTEST_FILE), 0);
+	caught = 0;
+	sTRY
+		skit_trie_image_map(sSLICE(SKIT_TRIE_IMAGE_UTEST_FILE));
+	sCATCH(SKIT_FILE_NOT_FOUND, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+
+	/* Empty tries make empty images. */
+	skit_trie_free(trie);
 	trie = skit_trie_new();
-	sASSERT_EQS(skit_trie_setc(trie, "ANY", NULL, sFLAGS("ci")), sSLICE("ANY"));
-	sASSERT_EQS(skit_trie_setc(trie, "ALL", NULL, sFLAGS("ci")), sSLICE("ALL"));
-	for ( i = 'a'; i <= 'z'; i++ )
+	skit_text_stream_clear(&tstream);
+	skit_trie_save(trie, &tstream.as_stream);
+	skit_trie_image_ctor(&image, skit_text_stream_slurp(&tstream, NULL));
+	sASSERT_EQ(skit_trie_image_len(&image), 0);
+	sASSERT(!skit_trie_image_lookup(&image, sSLICE(""), NULL, SKIT_FLAGS_NONE));
+	skit_trie_check_image_iter(trie, &image, sSLICE(""));
+	skit_trie_image_dtor(&image);
+
+	skit_text_stream_dtor(&tstream);
+	skit_trie_free(trie);
+	printf("  skit_trie_image_test passed.\n");
+}
+
+/* Checks that the iterator gives exactly what iterating over all of 'trie' gives, then frees it. */
+static void skit_trie_check_shared_iter(skit_trie_shared_iter *iter, skit_trie *trie)
+{
+	skit_slice key_a, key_b;
+	void *val_a, *val_b;
+	skit_trie_iter *iter_b = skit_trie_iter_new(trie, sSLICE(""), SKIT_FLAGS_NONE);
+	while ( skit_trie_shared_iter_next(iter, &key_a, &val_a) )
 	{
-		buf[0] = 'C';
-		buf[1] = i;
-		buf[2] = '\0';
-		sASSERT_EQS(skit_trie_setc(trie, buf, NULL, sFLAGS("ci")), skit_slice_of_cstr(buf));
+		sASSERT(skit_trie_iter_next(iter_b, &key_b, &val_b));
+		sASSERT_EQS(key_a, key_b);
+		sASSERT(val_a == val_b);
 	}
-	sTRACE0(skit_trie_free(trie));
+	sASSERT(!skit_trie_iter_next(iter_b, &key_b, &val_b));
+	skit_trie_iter_free(iter_b);
+	skit_trie_shared_iter_free(iter);
+}
 
-	skit_free(tests);
-	
-	printf("  skit_trie_unittest_basics passed.\n");
+static void skit_trie_check_shared(skit_trie_shared *shared, skit_trie *trie)
+{
+	sASSERT_EQ(skit_trie_shared_len(shared), skit_trie_len(trie));
+	skit_trie_check_shared_iter(skit_trie_shared_iter_new(shared, sSLICE(""), SKIT_FLAGS_NONE), trie);
 }
 
-static void skit_trie_unittest_linear_nodes()
+static size_t skit_trie_shared_garbage(const skit_trie_shared *shared)
+{
+	return shared->garbage[0].len + shared->garbage[1].len;
+}
+
+static void skit_trie_shared_test()
 {
 	SKIT_USE_FEATURE_EMULATION;
-	skit_trie_test *tests = skit_malloc(sizeof(skit_trie_test) * 3);
 	size_t i;
-	
-	#define teststr_len  (SKIT__TRIE_NODE_PREALLOC*3 + 2)
-	#define teststr_mid1 (SKIT__TRIE_NODE_PREALLOC*2 - 4)
-	#define teststr_mid2 (SKIT__TRIE_NODE_PREALLOC*2 - 2)
-	
-	/* This is not a requirement of the trie, but it IS an assumption of the unittest. */
-	/* It mostly affects the choice of teststr_mid1 and teststr_mid2, */
-	/*   which were chosen to leave at least 2 characters between the */
-	/*   splitting that they cause. */
-	sASSERT_GE(SKIT__TRIE_NODE_PREALLOC, 6);
-	
-	/* "abcdefghijklmnopqrstuvwxyzabcdefg..." */
-	char teststr0[teststr_len+1];
-	tests[0].slice = skit_slice_of_cstrn(teststr0, teststr_len);
-	for ( i = 0; i < teststr_len; i++ )
-		teststr0[i] = 'a' + (i % 26);
-	teststr0[teststr_len] = '\0';
-	
-	/* "abcdefghijklmnopqRSTUVWXYZABCDEFG..." */
-	char teststr1[teststr_len+1];
-	tests[1].slice = skit_slice_of_cstrn(teststr1, teststr_len);
-	memcpy(teststr1, teststr0, teststr_len);
-	for ( i = teststr_mid1; i < teststr_len; i++ )
-		teststr1[i] = skit_char_ascii_to_upper(teststr1[i]);
-	teststr1[teststr_len] = '\0';
-	
-	/* "abcdefghijklmnopqrs" */
-	char teststr2[teststr_mid2+1];
-	tests[2].slice = skit_slice_of_cstrn(teststr2, teststr_mid2);
-	memcpy(teststr2, teststr0, teststr_mid2);
-	teststr2[teststr_mid2] = '\0';
-	
-	tests[0].islice = tests[1].slice;
-	tests[1].islice = tests[0].slice;
-	tests[2].islice = tests[2].slice; /* TODO: this test could be better. */
-	
-	tests[0].val = 1;
-	tests[1].val = 2;
-	tests[2].val = 3;
-	
-	sTRACE0(skit_trie_exhaustive_test(tests, 3, 1));
-	
-	sTRACE0(skit_free(tests));
-	
-	printf("  skit_trie_unittest_linear_nodes passed.\n");
-}
+	void *val_a, *val_b;
+	char buf[32];
+	skit_trie_shared *shared = skit_trie_shared_new();
+	skit_trie *trie = skit_trie_new();    /* Gets every write that 'shared' gets. */
+	skit_trie *before = skit_trie_new();  /* Stops getting them when the snapshot is taken. */
 
-/* If don't already know what a trigram is and you want to know, then I suggest
-lookup up ngram or n-gram rather than trigram.  As a search term, "trigram" is
-likely to bring up the Chinese bagua, which is quite a different entity. 
+	sASSERT(!skit_trie_shared_lookup(shared, sSLICE(""), &val_a, SKIT_FLAGS_NONE));
+	skit_trie_check_shared(shared, trie);
 
-Long and short: trigrams are sequences of 3-characters, usually the first three
-of words in a corpus of text, and usually used to index that text for fast 
-lookup of contained words and such.
+	/* Many of these keys are repeats, which get overwritten. */
+	for ( i = 0; i < 3000; i++ )
+	{
+		skit_slice key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		skit_trie_shared_set(shared, key, (void*)(i+1), SKIT_FLAG_C | SKIT_FLAG_O);
+		skit_trie_set(trie, key, (void*)(i+1), SKIT_FLAG_C | SKIT_FLAG_O);
+		skit_trie_set(before, key, (void*)(i+1), SKIT_FLAG_C | SKIT_FLAG_O);
+		if ( i % 500 == 0 )
+			skit_trie_check_shared(shared, trie);
+	}
+	skit_trie_check_shared(shared, trie);
+
+	/* Nothing was reading, so each write freed what the previous one replaced. */
+	sASSERT_EQ(skit_trie_shared_garbage(shared), 0);
+	sASSERT_EQ(shared->writer.pool.live_bytes, trie->pool.live_bytes + SKIT__TRIE_POOL_GRANULE);
+
+	/* A snapshot isn't disturbed by later writes, and keeps what they replace alive. */
+	skit_trie_shared_iter *snapshot = skit_trie_shared_iter_new(shared, sSLICE(""), SKIT_FLAGS_NONE);
+	for ( i = 0; i < 3000; i += 3 )
+	{
+		skit_slice key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		sASSERT_EQ(skit_trie_shared_remove(shared, key, SKIT_FLAG_C), skit_trie_lookup(trie, key, NULL, SKIT_FLAGS_NONE));
+		skit_trie_remove(trie, key, SKIT_FLAG_C);
+	}
+	skit_trie_shared_set(shared, sSLICE("snapshot"), (void*)1, SKIT_FLAG_C);
+	skit_trie_set(trie, sSLICE("snapshot"), (void*)1, SKIT_FLAG_C);
+	sASSERT_GT(skit_trie_shared_garbage(shared), 0);
+	skit_trie_check_shared_iter(snapshot, before);
+	skit_trie_check_shared(shared, trie);
+
+	skit_trie_shared_remove(shared, sSLICE("snapshot"), SKIT_FLAGS_NONE);
+	skit_trie_remove(trie, sSLICE("snapshot"), SKIT_FLAGS_NONE);
+	sASSERT_EQ(skit_trie_shared_garbage(shared), 0);
+	sASSERT_EQ(shared->writer.pool.live_bytes, trie->pool.live_bytes + SKIT__TRIE_POOL_GRANULE);
+
+	for ( i = 0; i < 3000; i++ )
+	{
+		skit_slice key = skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf));
+		sASSERT_EQ(skit_trie_shared_lookup(shared, key, &val_a, SKIT_FLAGS_NONE), skit_trie_lookup(trie, key, &val_b, SKIT_FLAGS_NONE));
+		sASSERT(val_a == val_b);
+		skit_slice_ascii_to_lower(&key);
+		sASSERT_EQ(skit_trie_shared_lookup(shared, key, &val_a, SKIT_FLAG_I), skit_trie_lookup(trie, key, &val_b, SKIT_FLAG_I));
+		sASSERT(val_a == val_b);
+	}
+
+	int caught = 0;
+	sTRY
+		skit_trie_shared_set(shared, sSLICE("BAbcabcab"), (void*)1, SKIT_FLAG_C);
+	sCATCH(SKIT_EXCEPTION, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+
+	caught = 0;
+	sTRY
+		skit_trie_shared_remove(shared, sSLICE("missing"), SKIT_FLAGS_NONE);
+	sCATCH(SKIT_TRIE_KEY_NOT_FOUND, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+
+	caught = 0;
+	sTRY
+		skit_trie_shared_set(shared, sSLICE("missing"), (void*)1, SKIT_FLAG_C | SKIT_FLAG_I);
+	sCATCH(SKIT_TRIE_BAD_FLAGS, e)
+		caught = 1;
+	sEND_TRY
+	sASSERT(caught);
+	sASSERT(!skit_trie_shared_lookup(shared, sSLICE("missing"), NULL, SKIT_FLAGS_NONE));
+
+	/* Emptying the trie leaves only the newest version's header behind. */
+	for ( i = 0; i < 3000; i++ )
+		skit_trie_shared_remove(shared, skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf)), SKIT_FLAG_C);
+	sASSERT_EQ(skit_trie_shared_len(shared), 0);
+	sASSERT(shared->writer.root == NULL);
+	sASSERT_EQ(shared->writer.pool.live_bytes, SKIT__TRIE_POOL_GRANULE);
+
+	skit_trie_free(before);
+	skit_trie_free(trie);
+	skit_trie_shared_free(shared);
+	printf("  skit_trie_shared_test passed.\n");
+}
+
+/*
+The threaded test's writer keeps a sliding window of keys in the trie, so
+every version of it holds a run of consecutive key numbers.
 */
-static void skit_trie_test_make_trigram(
-	skit_loaf *loaf,
-	size_t *loaf_index,
-	size_t max_index,
-	const skit_slice parent,
-	int breadth,
-	int depth)
+#define SKIT_TRIE_SHARED_UTEST_WRITES  20000
+#define SKIT_TRIE_SHARED_UTEST_WINDOW  40
+#define SKIT_TRIE_SHARED_UTEST_READERS 4
+
+typedef struct skit_trie_shared_utest skit_trie_shared_utest;
+struct skit_trie_shared_utest
 {
+	skit_trie_shared  *shared;
+	size_t            done;
+};
+
+static skit_slice skit_trie_shared_utest_key(size_t n, char *buf)
+{
+	return skit_slice_of_cstrn(buf, sprintf(buf, "%02x.%u", (unsigned)(n % 251), (unsigned)n));
+}
+
+static void *skit_trie_shared_utest_reader(void *arg)
+{
+	SKIT_USE_FEATURE_EMULATION;
+	skit_trie_shared_utest *utest = arg;
+	uint32_t seed = 12345;
+	char buf[32];
+	skit_slice key;
+	void *val;
 	size_t i;
-	
-	/*
-	printf("%s, %d: skit_trigram(%p, %ld, %ld, \"%.*s\", %d, %d)\n", __func__, __LINE__,
-		loaf, *loaf_index, max_index, (int)sSLENGTH(parent), sSPTR(parent), breadth, depth);
-	*/
-	sASSERT_LE( *loaf_index, max_index );
-	
-	if ( depth > 3 )
-		return;
-	
-	if ( depth == 0 )
+
+	while ( !SKIT__TRIE_LOAD_SIZE(&utest->done) )
 	{
-		skit_loaf current = skit_loaf_new();
-		loaf[*loaf_index] = current;
-		(*loaf_index)++;
-		skit_trie_test_make_trigram(loaf, loaf_index, max_index, current.as_slice, breadth, depth+1);
-		return;
+		for ( i = 0; i < 100; i++ )
+		{
+			seed = seed * 1103515245 + 12345;
+			size_t n = (seed >> 8) % SKIT_TRIE_SHARED_UTEST_WRITES;
+			if ( skit_trie_shared_lookup(utest->shared, skit_trie_shared_utest_key(n, buf), &val, SKIT_FLAGS_NONE) )
+				sASSERT_EQ((size_t)val, n + 1);
+		}
+
+		size_t n_keys = 0;
+		size_t lo = SIZE_MAX;
+		size_t hi = 0;
+		skit_trie_shared_iter *iter = skit_trie_shared_iter_new(utest->shared, sSLICE(""), SKIT_FLAGS_NONE);
+		while ( skit_trie_shared_iter_next(iter, &key, &val) )
+		{
+			size_t n = (size_t)val - 1;
+			sASSERT_EQS(key, skit_trie_shared_utest_key(n, buf));
+			lo = SKIT_MIN(lo, n);
+			hi = SKIT_MAX(hi, n);
+			n_keys++;
+		}
+		skit_trie_shared_iter_free(iter);
+
+		if ( n_keys > 0 )
+			sASSERT_EQ(hi - lo + 1, n_keys);
+		sASSERT_LE(n_keys, SKIT_TRIE_SHARED_UTEST_WINDOW + 1);
 	}
-	
-	int frequency = 256 / SKIT__TRIE_NODE_PREALLOC;
-	
-	for ( i = 0; i < breadth; i++ )
+	return NULL;
+}
+
+static void skit_trie_shared_threads_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t i;
+	char buf[32];
+	pthread_t readers[SKIT_TRIE_SHARED_UTEST_READERS];
+	skit_trie_shared_utest utest;
+	utest.shared = skit_trie_shared_new();
+	utest.done = 0;
+
+	for ( i = 0; i < SKIT_TRIE_SHARED_UTEST_READERS; i++ )
+		sASSERT_EQ(pthread_create(&readers[i], NULL, &skit_trie_shared_utest_reader, &utest), 0);
+
+	for ( i = 0; i < SKIT_TRIE_SHARED_UTEST_WRITES; i++ )
 	{
-		skit_loaf current = skit_loaf_alloc(depth);
-		loaf[*loaf_index] = current;
-		skit_loaf_store_slice(&current, parent);
-		uint8_t *ptr = sLPTR(current);
-		
-		if ( i == 0 )
-			ptr[depth-1] = 0x00;
-		else if ( i == breadth-1 ) /* Always ensure that the highest possible branch value gets tested. */
-			ptr[depth-1] = 0xFF;
-		else 
-			ptr[depth-1] = (i*frequency) + depth;
-		/*ptr[depth-1] = i + 'a';*/
-		
-		(*loaf_index)++;
-		skit_trie_test_make_trigram(loaf, loaf_index, max_index, current.as_slice, breadth, depth+1);
+		skit_trie_shared_set(utest.shared, skit_trie_shared_utest_key(i, buf), (void*)(i + 1), SKIT_FLAG_C);
+		if ( i >= SKIT_TRIE_SHARED_UTEST_WINDOW )
+			skit_trie_shared_remove(utest.shared, skit_trie_shared_utest_key(i - SKIT_TRIE_SHARED_UTEST_WINDOW, buf), SKIT_FLAGS_NONE);
 	}
+
+	SKIT__TRIE_STORE_SIZE(&utest.done, 1);
+	for ( i = 0; i < SKIT_TRIE_SHARED_UTEST_READERS; i++ )
+		pthread_join(readers[i], NULL);
+
+	/* With the readers gone, the next write frees everything left over. */
+	for ( i = SKIT_TRIE_SHARED_UTEST_WRITES - SKIT_TRIE_SHARED_UTEST_WINDOW; i < SKIT_TRIE_SHARED_UTEST_WRITES; i++ )
+		skit_trie_shared_remove(utest.shared, skit_trie_shared_utest_key(i, buf), SKIT_FLAGS_NONE);
+	sASSERT_EQ(skit_trie_shared_garbage(utest.shared), 0);
+	sASSERT_EQ(utest.shared->writer.pool.live_bytes, SKIT__TRIE_POOL_GRANULE);
+
+	skit_trie_shared_free(utest.shared);
+	printf("  skit_trie_shared_threads_test passed.\n");
 }
 
-static void skit_trie_unittest_table_nodes()
+static void skit_trie_longest_prefix_test()
 {
 	SKIT_USE_FEATURE_EMULATION;
-	size_t i, j;
-	size_t breadth = SKIT__TRIE_NODE_PREALLOC+1;
-	
-	/* Create a trie of trigrams (and their subsets). */
-	/* Make each level slightly fatter than the prealloc number. */
-	size_t n_strings = 
-		skit_ipow(breadth, 3)+
-		skit_ipow(breadth, 2)+
-		skit_ipow(breadth, 1)+1;
-	
-	skit_loaf      *loaves  = skit_malloc(sizeof(skit_loaf) * n_strings);
-	skit_loaf      *iloaves = skit_malloc(sizeof(skit_loaf) * n_strings);
-	skit_trie_test *tests   = skit_malloc(sizeof(skit_trie_test) * n_strings);
-	size_t loaf_index = 0;
-	skit_trie_test_make_trigram( loaves, &loaf_index, n_strings, sSLICE(""), breadth, 0 );
-	
-	for ( i = 0; i < n_strings; i++ )
+	size_t i, len;
+	void *val;
+	char buf[64];
+	skit_slice key;
+	skit_trie_prefixes prefixes;
+	skit_trie *trie = skit_trie_new();
+
+	sASSERT(skit_slice_is_null(skit_trie_longest_prefix(trie, sSLICE("/api"), &val)));
+	sASSERT(val == NULL);
+	skit_trie_prefixes_ctor(&prefixes, trie, sSLICE("/api"));
+	sASSERT(!skit_trie_prefixes_next(&prefixes, &key, &val));
+
+	skit_trie_setc(trie, "/", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "/api", (void*)2, SKIT_FLAG_C);
+	skit_trie_setc(trie, "/api/v1", (void*)3, SKIT_FLAG_C);
+	skit_trie_setc(trie, "/api/v1/users", (void*)4, SKIT_FLAG_C);
+	skit_trie_setc(trie, "/apix", (void*)5, SKIT_FLAG_C);
+	skit_trie_setc(trie, "/about", (void*)6, SKIT_FLAG_C);
+
+	sASSERT_EQS(skit_trie_longest_prefix(trie, sSLICE("/api/v1/users/42"), &val), sSLICE("/api/v1/users"));
+	sASSERT_EQ((size_t)val, 4);
+	sASSERT_EQS(skit_trie_longest_prefix(trie, sSLICE("/api/v2"), &val), sSLICE("/api"));
+	sASSERT_EQ((size_t)val, 2);
+	sASSERT_EQS(skit_trie_longest_prefix(trie, sSLICE("/ap"), &val), sSLICE("/"));
+	sASSERT_EQS(skit_trie_longest_prefix(trie, sSLICE("/apix"), NULL), sSLICE("/apix"));
+	sASSERT(skit_slice_is_null(skit_trie_longest_prefix(trie, sSLICE("api"), &val)));
+	sASSERT(val == NULL);
+
+	/* The empty key is a prefix of everything. */
+	skit_trie_setc(trie, "", (void*)7, SKIT_FLAG_C);
+	key = skit_trie_longest_prefix(trie, sSLICE("api"), &val);
+	sASSERT(!skit_slice_is_null(key));
+	sASSERT_EQ(sSLENGTH(key), 0);
+	sASSERT_EQ((size_t)val, 7);
+
+	const char *expected[] = { "", "/", "/api", "/api/v1", "/api/v1/users" };
+	skit_trie_prefixes_ctor(&prefixes, trie, sSLICE("/api/v1/users/42"));
+	for ( i = 0; i < sizeof(expected) / sizeof(expected[0]); i++ )
 	{
-		uint8_t *lptr = sLPTR(loaves[i]);
-		ssize_t len = sLLENGTH(loaves[i]);
-		
-		iloaves[i] = skit_loaf_alloc(len);
-		uint8_t *ilptr = sLPTR(iloaves[i]);
-		
-		/* Reverse casing where it matters. */
-		for ( j = 0; j < len; j++ )
+		sASSERT(skit_trie_prefixes_next(&prefixes, &key, &val));
+		sASSERT_EQS(key, skit_slice_of_cstr(expected[i]));
+	}
+	sASSERT(!skit_trie_prefixes_next(&prefixes, &key, &val));
+	sASSERT(!skit_trie_prefixes_next(&prefixes, &key, &val));
+	skit_trie_free(trie);
+
+	/* Compare against a lookup of every prefix, over all of the node shapes. */
+	trie = skit_trie_new();
+	for ( i = 0; i < 3000; i += 2 )
+		skit_trie_set(trie, skit_slice_of_cstrn(buf, skit_trie_compact_key(i, buf)), (void*)(i+1), SKIT_FLAG_C | SKIT_FLAG_O);
+	for ( i = 0; i < 3000; i++ )
+	{
+		len = skit_trie_compact_key(i, buf);
+		memcpy(buf + len, "abc", 3);
+		skit_slice input = skit_slice_of_cstrn(buf, len + 3);
+
+		ssize_t longest = -1;
+		void *longest_val = NULL;
+		skit_trie_prefixes_ctor(&prefixes, trie, input);
+		for ( len = 0; len <= sSLENGTH(input); len++ )
 		{
-			uint8_t c = lptr[j];
-			if ( c == skit_char_ascii_to_lower(c) )
-				ilptr[j] = skit_char_ascii_to_upper(c);
-			else
-				ilptr[j] = skit_char_ascii_to_lower(c);
+			void *expected_val;
+			if ( !skit_trie_lookup(trie, skit_slice_of(input, 0, len), &expected_val, SKIT_FLAGS_NONE) )
+				continue;
+			sASSERT(skit_trie_prefixes_next(&prefixes, &key, &val));
+			sASSERT_EQ(sSLENGTH(key), len);
+			sASSERT(val == expected_val);
+			longest = len;
+			longest_val = val;
 		}
+		sASSERT(!skit_trie_prefixes_next(&prefixes, &key, &val));
+
+		key = skit_trie_longest_prefix(trie, input, &val);
+		if ( longest < 0 )
+			sASSERT(skit_slice_is_null(key));
+		else
+			sASSERT_EQS(key, skit_slice_of(input, 0, longest));
+		sASSERT(val == longest_val);
 	}
-	
-	for ( i = 0; i < n_strings; i++ )
+	skit_trie_free(trie);
+
+	printf("  skit_trie_longest_prefix_test passed.\n");
+}
+
+static void skit_trie_lookup_many_test()
+{
+	SKIT_USE_FEATURE_EMULATION;
+	size_t i;
+	const size_t n_keys = 3000;
+	char       *bufs = skit_malloc(n_keys * 64);
+	skit_slice *keys = skit_malloc(n_keys * sizeof(skit_slice));
+	void       **values = skit_malloc(n_keys * sizeof(void*));
+	skit_trie  *trie = skit_trie_new();
+
+	/* Every other key is left out, and some keys are cut short so that they */
+	/*   end in the middle of a linear node. */
+	for ( i = 0; i < n_keys; i++ )
 	{
-		tests[i].slice = loaves[i].as_slice;
-		tests[i].islice = iloaves[i].as_slice;
-		tests[i].val = i+1;
+		size_t len = skit_trie_compact_key(i, bufs + i*64);
+		if ( i % 2 == 0 )
+			skit_trie_set(trie, skit_slice_of_cstrn(bufs + i*64, len), (void*)(i+1), SKIT_FLAG_C | SKIT_FLAG_O);
+		if ( i % 7 == 3 )
+			len--;
+		keys[i] = skit_slice_of_cstrn(bufs + i*64, len);
 	}
-	
-	sTRACE0(skit_trie_exhaustive_test(tests, n_strings, 0));
-	
-	for ( i = 0; i < n_strings; i++ )
+
+	sASSERT_EQ(skit_trie_lookup_many(trie, keys, 0, NULL), 0);
+
+	int compacted;
+	for ( compacted = 0; compacted < 2; compacted++ )
 	{
-		skit_loaf_free(&loaves[i]);
-		skit_loaf_free(&iloaves[i]);
+		size_t expected_found = 0;
+		for ( i = 0; i < n_keys; i++ )
+			values[i] = (void*)1;
+		size_t n_found = skit_trie_lookup_many(trie, keys, n_keys, values);
+		for ( i = 0; i < n_keys; i++ )
+		{
+			void *expected;
+			if ( skit_trie_lookup(trie, keys[i], &expected, SKIT_FLAGS_NONE) )
+				expected_found++;
+			else
+				expected = NULL;
+			sASSERT(values[i] == expected);
+		}
+		sASSERT_EQ(n_found, expected_found);
+		sASSERT(n_found > 0 && n_found < n_keys);
+
+		/* Batches smaller than the number of lanes. */
+		void *expected;
+		sASSERT(skit_trie_lookup(trie, keys[2], &expected, SKIT_FLAGS_NONE));
+		sASSERT_EQ(skit_trie_lookup_many(trie, keys + 1, 2, values), 1);
+		sASSERT(values[0] == NULL);
+		sASSERT(values[1] == expected);
+
+		skit_trie_compact(trie);
 	}
-	
-	sTRACE0(skit_free(loaves));
-	sTRACE0(skit_free(iloaves));
-	sTRACE0(skit_free(tests));
+
+	/* The empty key. */
+	keys[0] = sSLICE("");
+	sASSERT_EQ(skit_trie_lookup_many(trie, keys, 1, values), 0);
+	sASSERT(values[0] == NULL);
+	skit_trie_setc(trie, "", (void*)42, SKIT_FLAG_C);
+	sASSERT_EQ(skit_trie_lookup_many(trie, keys, 1, values), 1);
+	sASSERT_EQ((size_t)values[0], 42);
+	skit_trie_free(trie);
+
+	/* An empty trie. */
+	trie = skit_trie_new();
+	values[0] = values[1] = (void*)1;
+	sASSERT_EQ(skit_trie_lookup_many(trie, keys, 2, values), 0);
+	sASSERT(values[0] == NULL && values[1] == NULL);
+	skit_trie_free(trie);
+
+	skit_free(values);
+	skit_free(keys);
+	skit_free(bufs);
+	printf("  skit_trie_lookup_many_test passed.\n");
 }
 
 static void skit_trie_unittest_examples()
@@ -2283,6 +6313,18 @@ void skit_trie_unittest()
 	skit_trie_unittest_basics();
 	skit_trie_unittest_linear_nodes();
 	skit_trie_unittest_table_nodes();
+	skit_trie_lookup_test();
+	skit_trie_icase_test();
+	skit_trie_icase_index_test();
+	skit_trie_remove_test();
+	skit_trie_fanout_test();
+	skit_trie_compact_test();
+	skit_trie_build_sorted_test();
+	skit_trie_image_test();
+	skit_trie_shared_test();
+	skit_trie_shared_threads_test();
+	skit_trie_longest_prefix_test();
+	skit_trie_lookup_many_test();
 	printf("  skit_trie_unittest passed!\n");
 	printf("\n");
 	
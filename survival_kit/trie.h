@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <unistd.h> /* For ssize_t */
+#include <pthread.h>
 
 #include "survival_kit/string.h"
 #include "survival_kit/flags.h"
@@ -18,16 +19,36 @@ extern skit_err_code SKIT_TRIE_KEY_ALREADY_EXISTS;
 extern skit_err_code SKIT_TRIE_KEY_NOT_FOUND;
 extern skit_err_code SKIT_TRIE_BAD_FLAGS;
 extern skit_err_code SKIT_TRIE_WRITE_IN_ITERATION;
-
+extern skit_err_code SKIT_TRIE_BAD_IMAGE;
+
+/*
+The shape of a node is determined by nodes_len:
+  0                                      : leaf.
+  1                                      : linear node; 'chars' is the path to its only child.
+  2 .. SKIT__TRIE_NODE_PREALLOC          : multi-node; 'chars' holds one character per child.
+  .. SKIT__TRIE_NODE16_MAX               : node16; unsorted key bytes next to the children.
+  .. SKIT__TRIE_NODE48_MAX               : node48; a 256-entry byte index into the children.
+  more than that                         : table; 256 pointers to individually allocated children.
+In the last three cases chars_len is 0xFF and 'chars' is unused.
+The children of every shape except the table are stored contiguously and are
+allocated for exactly nodes_len entries.
+*/
 #define SKIT__TRIE_NODE_PREALLOC 12
+#define SKIT__TRIE_NODE16_MAX    16
+#define SKIT__TRIE_NODE48_MAX    48
+#define SKIT__TRIE_POOL_GRANULE  32 /* See skit_trie_pool. */
 
-typedef struct skit_trie_node skit_trie_node;
+typedef struct skit_trie_node   skit_trie_node;
+typedef struct skit_trie_node16 skit_trie_node16;
+typedef struct skit_trie_node48 skit_trie_node48;
 struct skit_trie_node
 {
 	union
 	{
-		skit_trie_node *array;
-		skit_trie_node **table;
+		skit_trie_node   *array;
+		skit_trie_node16 *n16;
+		skit_trie_node48 *n48;
+		skit_trie_node   **table;
 	} nodes;
 	const void *value;
 	uint16_t nodes_len;
@@ -36,14 +57,95 @@ struct skit_trie_node
 	uint8_t chars[SKIT__TRIE_NODE_PREALLOC];
 };
 
+struct skit_trie_node16
+{
+	uint8_t        keys[SKIT__TRIE_NODE16_MAX]; /* keys[i] is the character leading to children[i]. */
+	uint8_t        padding[SKIT__TRIE_POOL_GRANULE - SKIT__TRIE_NODE16_MAX]; /* Keeps children[] granule-aligned. */
+	skit_trie_node children[];
+};
+
+struct skit_trie_node48
+{
+	uint8_t        index[256]; /* index[c] is 1 + the position of c's child, or 0 if there is none. */
+	skit_trie_node children[];
+};
+
+/*
+Every node and child block in a trie is carved out of the trie's own pool.
+The pool gets memory from skit_malloc in large chunks that are aligned to
+cache lines, and only gives it back when the trie is destroyed.  Blocks are
+a whole number of granules long, so that no node in them straddles a cache
+line, and they carry no per-block header.  Free blocks are merged with free
+neighbors, and resized blocks grow or shrink in place when they can, so
+that the child arrays that change size on every insertion don't leave
+unusable holes behind.
+*/
+#define SKIT__TRIE_POOL_N_LISTS 64 /* The last list holds every free block of 64 or more granules. */
+
+/*
+skit_trie_shared (see below) writes to its trie copy-on-write.  While a pool
+has a skit_trie_cow attached, any block that was handed out before the
+current write began may still be in use by readers: such blocks are copied
+before they change, and are retired instead of freed.  'fresh' lists the
+blocks handed out by the current write, and 'retired' the older blocks that
+it has let go of.
+*/
+typedef struct skit_trie_block skit_trie_block;
+struct skit_trie_block
+{
+	void    *ptr;
+	size_t  size;
+};
+
+typedef struct skit_trie_block_list skit_trie_block_list;
+struct skit_trie_block_list
+{
+	skit_trie_block  *blocks;
+	size_t           len;
+	size_t           cap;
+};
+
+typedef struct skit_trie_cow skit_trie_cow;
+struct skit_trie_cow
+{
+	skit_trie_block_list  fresh;
+	skit_trie_block_list  retired;
+};
+
+typedef struct skit_trie_pool_chunk skit_trie_pool_chunk;
+struct skit_trie_pool_chunk
+{
+	uint8_t   *start;         /* Cache-line aligned. */
+	size_t    n_granules;
+	uint64_t  *free_ends;     /* Bits are set for the first and last granule of each free block. */
+	void      *mem;           /* What skit_malloc returned. */
+};
+
+typedef struct skit_trie_pool skit_trie_pool;
+struct skit_trie_pool
+{
+	skit_trie_pool_chunk  *chunks;      /* Sorted by address. */
+	size_t                n_chunks;
+	size_t                next_chunk_size;
+	size_t                live_bytes;   /* Bytes in blocks that are handed out. */
+	uint64_t              nonempty;     /* Bit i is set if free_lists[i] isn't empty. */
+	void                  *free_lists[SKIT__TRIE_POOL_N_LISTS]; /* free_lists[i] holds free blocks of i+1 granules. */
+	skit_trie_cow         *cow;         /* NULL unless the trie belongs to a skit_trie_shared. */
+};
+
 typedef struct skit_trie skit_trie;
 struct skit_trie
 {
 	size_t length;
 	skit_loaf key_return_buf; /* sLLENGTH(key_return_buf) should always be equal to the longest key. */
 	skit_trie_node *root;
+	skit_trie_pool pool;
 	
 	int32_t iterator_count;
+	
+	/* NULL unless skit_trie_enable_icase_index has been called. */
+	/* Maps each lowercased key to its canonical spelling and that spelling's value. */
+	skit_trie *icase_index;
 };
 
 typedef struct skit_trie_iter skit_trie_iter;
@@ -78,6 +180,36 @@ directly pointed to by *trie.
 */
 void skit_trie_dtor( skit_trie *trie );
 
+/**
+Creates a new trie holding keys[i] -> values[i] for every i below 'n_keys'.
+If 'values' is NULL, every key is given a NULL value.
+The keys must be sorted bytewise, with shorter keys before any longer keys
+that they are a prefix of (the same order skit_trie_iter_next returns them in).
+The keys are copied into the trie, so they don't need to outlive it.
+
+This is much faster than calling skit_trie_set for each key: each node is
+created once in its final shape, and no node is ever split, grown, or moved.
+All of the nodes are placed in one chunk of memory, laid out the same way
+skit_trie_compact would lay them out.  The resulting trie is an ordinary
+trie and can be changed afterwards.
+
+Throws SKIT_TRIE_KEY_ALREADY_EXISTS if a key appears more than once, or
+SKIT_TRIE_EXCEPTION if the keys are out of order.  Nothing is allocated in
+either case.
+
+Example:
+	skit_slice keys[3] = { sSLICE("bar"), sSLICE("baz"), sSLICE("foo") };
+	void *values[3] = { (void*)1, (void*)2, (void*)3 };
+	skit_trie *trie = skit_trie_build_sorted(keys, values, 3);
+
+	void *val;
+	sASSERT(skit_trie_lookup(trie, sSLICE("baz"), &val, SKIT_FLAGS_NONE));
+	sASSERT_EQ((size_t)val, 2);
+
+	skit_trie_free(trie);
+*/
+skit_trie *skit_trie_build_sorted( const skit_slice *keys, void *const *values, size_t n_keys );
+
 /**
 Retrieves the value associated with the given key.
 
@@ -120,6 +252,82 @@ Example:
 skit_slice skit_trie_get( skit_trie *trie, const skit_slice key, void **value, skit_flags flags );
 skit_slice skit_trie_getc( skit_trie *trie, const char *key, void **value, skit_flags flags );
 
+/**
+Like skit_trie_get, except that the matched key is not returned, and so the
+trie is not written to at all.  skit_trie_get records the matched key in a
+buffer owned by the trie, which makes it unsafe to call from several threads
+at once.  skit_trie_lookup may be called from any number of threads at the
+same time, as long as no thread is modifying the trie.
+
+Returns 1 if the key was found and 0 otherwise.
+'value' may be NULL if only the presence of the key is of interest.
+*/
+int skit_trie_lookup( const skit_trie *trie, const skit_slice key, void **value, skit_flags flags );
+
+/**
+Looks up each of the 'n_keys' keys in 'keys' case-sensitively, like
+skit_trie_lookup, and stores the value found for keys[i] in values[i].
+values[i] is set to NULL if keys[i] isn't in the trie.
+Returns the number of keys that were found.
+
+The lookups are interleaved: several of them walk down the trie at once,
+and each one prefetches the next node it will visit before the others take
+their turns.  With tries much bigger than the CPU's caches, this hides most
+of the time that a loop of skit_trie_lookup calls spends waiting on memory.
+Like skit_trie_lookup, this doesn't write to the trie.
+*/
+size_t skit_trie_lookup_many( const skit_trie *trie, const skit_slice *keys, size_t n_keys, void **values );
+
+/**
+Finds the longest key in the trie that 'input' starts with, and returns the
+part of 'input' that it matched.  If no key is a prefix of 'input' then
+skit_slice_null() is returned.  (An empty key in the trie matches every
+input, and is returned as an empty slice.)
+The matched key's value is placed in *value, or NULL if there was no match.
+'value' may be NULL.
+
+This walks down the trie once, no matter how many keys 'input' starts with,
+and, like skit_trie_lookup, it doesn't write to the trie or allocate memory.
+Keys are matched case-sensitively.
+
+Example:
+	skit_trie_setc(trie, "/api", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "/api/users", (void*)2, SKIT_FLAG_C);
+	sASSERT_EQS(skit_trie_longest_prefix(trie, sSLICE("/api/users/42"), &val), sSLICE("/api/users"));
+	sASSERT_EQS(skit_trie_longest_prefix(trie, sSLICE("/api/posts"), &val), sSLICE("/api"));
+	sASSERT(skit_slice_is_null(skit_trie_longest_prefix(trie, sSLICE("/about"), &val)));
+*/
+skit_slice skit_trie_longest_prefix( const skit_trie *trie, const skit_slice input, void **value );
+
+/**
+Iterates over every key in the trie that 'input' starts with, shortest
+first.  The iterator lives wherever the caller puts it and needs no
+cleanup, so no memory is allocated.  It resumes the same walk down the trie
+on each call, so visiting every match costs no more than one lookup of
+'input'.
+Each key is returned as a slice of 'input', which must outlive the
+iteration.  The trie must not be modified during the iteration.
+Keys are matched case-sensitively.
+
+Example:
+	skit_trie_prefixes prefixes;
+	skit_slice key;
+	void *value;
+	skit_trie_prefixes_ctor(&prefixes, trie, sSLICE("/api/users/42"));
+	while ( skit_trie_prefixes_next(&prefixes, &key, &value) )
+		printf("%.*s\n", (int)sSLENGTH(key), sSPTR(key));
+*/
+typedef struct skit_trie_prefixes skit_trie_prefixes;
+struct skit_trie_prefixes
+{
+	const skit_trie_node  *node;  /* The next node to look at, or NULL once the input runs out. */
+	size_t                pos;    /* How much of the input leads to 'node'. */
+	skit_slice            input;
+};
+
+void skit_trie_prefixes_ctor( skit_trie_prefixes *prefixes, const skit_trie *trie, const skit_slice input );
+int skit_trie_prefixes_next( skit_trie_prefixes *prefixes, skit_slice *key, void **value ); /** ditto */
+
 /**
 Associate the given key with the given value.
 If the key already exists in the trie, then the previous value will be
@@ -187,13 +395,90 @@ differences:
 When providing no flags, it is allowable to pass either the empty string "" or
 NULL into the flags parameter.
 
-Returns the /exact/ key acted on.  This returned slice may be modified by 
-any subsequent calls on the trie: copy it if you intend to use the value.
+Returns the /exact/ key acted on, or skit_slice_null() if the key was not
+found and 'c' was given.  This returned slice may be modified by any
+subsequent calls on the trie: copy it if you intend to use the value.
+
+Nodes that are no longer needed are freed, and the nodes around them are
+merged back into the most compact shape that holds the remaining keys, so
+the trie's memory use follows the number of keys actually stored in it.
 
-BUG: This is currently not implemented.
+Example:
+	skit_trie *trie = skit_trie_new();
+	skit_trie_setc(trie, "abc", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "abcdef", (void*)2, SKIT_FLAG_C);
+	sASSERT_EQS(skit_trie_remove(trie, sSLICE("ABC"), SKIT_FLAG_I), sSLICE("abc"));
+	sASSERT_EQ(skit_trie_len(trie), 1);
+	sASSERT_EQS(skit_trie_remove(trie, sSLICE("abc"), SKIT_FLAG_C), skit_slice_null());
+	skit_trie_free(trie);
 */
 skit_slice skit_trie_remove( skit_trie *trie, const skit_slice key, skit_flags flags );
 
+/**
+Makes case-insensitive operations on the trie take time proportional to the
+length of the key, no matter what keys are in the trie.
+
+Without the index, a case-insensitive lookup has to try both the upper and
+lower case versions of a character wherever the trie has both.  On key sets
+with many keys that differ only by case, that can mean exploring a number of
+paths that grows exponentially with the key length.
+
+The index is a second trie that holds every key lowercased, and maps it to
+one canonical spelling of that key in the original trie, along with that
+spelling's value.  Case-insensitive lookups only walk the index.
+Case-insensitive writes look the key up in the index, and then do a
+case-sensitive operation on the canonical spelling.  A key's canonical
+spelling stays the same for as long as that spelling is in the trie.  A key
+that is added while no other spelling of it is present becomes canonical
+itself.  Keys that were already in the trie when the index was enabled are
+taken in sorted order, so upper case spellings are preferred among those.
+When the canonical spelling is removed, any of the remaining spellings may
+take over; which one is not specified.
+
+The index costs about as much memory as the trie itself, and makes
+insertion and removal slightly slower.  Removing a key that is the canonical
+spelling for other keys still needs one case-insensitive search without the
+index, and whichever spelling that search finds becomes canonical.  The index
+stays enabled until the trie is destroyed.  Calling this on a trie that
+already has the index does nothing.
+
+With the index, case-insensitive insertion of a key that has no match in
+any case stores the key exactly as it was given.  (Without it, the part of
+the key that matches an existing key's prefix takes on that key's casing.)
+
+Example:
+	skit_trie *trie = skit_trie_new();
+	skit_trie_enable_icase_index(trie);
+	skit_trie_setc(trie, "Content-Type", (void*)1, SKIT_FLAG_C);
+	skit_trie_setc(trie, "content-type", (void*)2, SKIT_FLAG_C);
+
+	void *val;
+	sASSERT_EQS(skit_trie_getc(trie, "CONTENT-TYPE", &val, SKIT_FLAG_I), sSLICE("Content-Type"));
+	sASSERT_EQ((size_t)val, 1);
+	skit_trie_remove(trie, sSLICE("Content-Type"), SKIT_FLAGS_NONE);
+	sASSERT_EQS(skit_trie_getc(trie, "CONTENT-TYPE", &val, SKIT_FLAG_I), sSLICE("content-type"));
+	sASSERT_EQ((size_t)val, 2);
+
+	skit_trie_free(trie);
+*/
+void skit_trie_enable_icase_index( skit_trie *trie );
+
+/**
+Moves every node of the trie into one freshly allocated chunk, laid out in
+depth-first order: each node's children come right before the descendants of
+its first child.  Lookups on a trie that has been built and then compacted
+touch fewer cache lines and pages, and any memory left on the pool's free
+lists by earlier removals is given back.
+
+This is for tries that are built once and then mostly read.  It takes time
+and temporary memory proportional to the size of the trie.  Inserting into
+the trie afterwards works as usual, but the new nodes go elsewhere.
+The icase index, if there is one, is compacted too.
+
+Throws SKIT_TRIE_WRITE_IN_ITERATION if there are any iterators on the trie.
+*/
+void skit_trie_compact( skit_trie *trie );
+
 /**
 Returns the number of key-value pairs in the trie.
 */
@@ -234,6 +519,217 @@ skit_trie_iter *skit_trie_iter_new( skit_trie *trie, const skit_slice prefix, sk
 skit_trie_iter *skit_trie_iter_free( skit_trie_iter *iter );
 int skit_trie_iter_next( skit_trie_iter *iter, skit_slice *key, void **value );
 
+/* ------------------------------------------------------------------------- */
+
+/*
+A trie image is a read-only copy of a trie that lives in one flat run of
+bytes with no pointers in it.  skit_trie_save writes one out, and
+skit_trie_image_map maps it back in from a file.  Queries read the mapped
+bytes directly, so opening an image costs the same no matter how many keys
+it holds.  The pages are only read in as lookups touch them, and processes
+that map the same file share one copy of it.
+
+Values are saved as their bit patterns, widened to 64 bits.  Integers or
+indices stored as values come back unchanged, but pointers only mean
+something in the process that saved them.
+
+Images use the byte order of the machine that wrote them, and an image
+made on a machine with a different byte order is rejected.  An image can
+be at most 4 GiB long.
+*/
+typedef struct skit_trie_image skit_trie_image;
+struct skit_trie_image
+{
+	const uint8_t  *bytes;
+	size_t         n_bytes;
+	size_t         length;
+	size_t         longest_key_len;
+	size_t         root;      /* Offset of the root record, or 0 if the image holds no keys. */
+	void           *mapping;  /* Non-NULL if skit_trie_image_map created this image. */
+};
+
+typedef struct skit_trie_image_iter skit_trie_image_iter;
+
+/**
+Writes an image of the trie to 'output'.
+The image is built in memory first and then appended in one piece, so this
+temporarily needs as much memory as the image takes up.
+Throws SKIT_TRIE_EXCEPTION if the image would be longer than 4 GiB.
+
+Example:
+	skit_trie *trie = skit_trie_new();
+	skit_trie_setc(trie, "foo", (void*)1, SKIT_FLAG_C);
+
+	skit_pfile_stream file;
+	skit_pfile_stream_ctor(&file);
+	skit_pfile_stream_open(&file, sSLICE("keys.trie"), "w");
+	skit_trie_save(trie, &file.as_stream);
+	skit_pfile_stream_dtor(&file);
+	skit_trie_free(trie);
+
+	skit_trie_image *image = skit_trie_image_map(sSLICE("keys.trie"));
+	void *val;
+	sASSERT(skit_trie_image_lookup(image, sSLICE("FOO"), &val, SKIT_FLAG_I));
+	sASSERT_EQ((size_t)val, 1);
+	skit_trie_image_free(image);
+*/
+void skit_trie_save( const skit_trie *trie, skit_stream *output );
+
+/**
+Maps the image in the file at 'file_path' into memory, read-only.
+The file must not be changed or truncated while it is mapped.
+Throws SKIT_FILE_NOT_FOUND if there is no such file, SKIT_FILE_IO_EXCEPTION
+if it can't be opened or mapped, and SKIT_TRIE_BAD_IMAGE if it doesn't hold
+an image written by skit_trie_save.
+Free the result with skit_trie_image_free.
+*/
+skit_trie_image *skit_trie_image_map( skit_slice file_path );
+
+/**
+Initializes an image that reads from 'bytes', which must hold exactly what
+skit_trie_save wrote.  The bytes are not copied, and must outlive the image.
+Throws SKIT_TRIE_BAD_IMAGE if they don't hold an image.
+*/
+void skit_trie_image_ctor( skit_trie_image *image, skit_slice bytes );
+
+/**
+Releases the image's resources, including its mapping if it has one.
+skit_trie_image_free also frees the memory pointed to by *image.
+*/
+void skit_trie_image_dtor( skit_trie_image *image );
+skit_trie_image *skit_trie_image_free( skit_trie_image *image ); /** ditto */
+
+/**
+Returns the number of keys in the image.
+*/
+size_t skit_trie_image_len( const skit_trie_image *image );
+
+/**
+Works like skit_trie_lookup on the trie that the image was saved from.
+'flags' may be SKIT_FLAG_I for a case-insensitive lookup, or
+SKIT_FLAGS_NONE.
+Throws SKIT_TRIE_BAD_IMAGE if the lookup runs into damaged bytes.
+*/
+int skit_trie_image_lookup( const skit_trie_image *image, const skit_slice key, void **value, skit_flags flags );
+
+/**
+Works like skit_trie_iter_new, skit_trie_iter_free, and skit_trie_iter_next,
+but over the keys of an image.  The image must outlive the iterator.
+Like skit_trie_iter_new, this does not accept SKIT_FLAG_I.
+*/
+skit_trie_image_iter *skit_trie_image_iter_new( const skit_trie_image *image, const skit_slice prefix, skit_flags flags );
+skit_trie_image_iter *skit_trie_image_iter_free( skit_trie_image_iter *iter ); /** ditto */
+int skit_trie_image_iter_next( skit_trie_image_iter *iter, skit_slice *key, void **value ); /** ditto */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+A skit_trie_shared is a trie that any number of threads may read while
+other threads write to it.  Readers never wait: lookups and iterators work
+on whichever version of the trie was newest when they started, and are
+unaffected by writes that happen after that.  Writers take turns on a mutex.
+
+Each write copies the nodes on the path to its key and then publishes a new
+version of the trie with one atomic pointer swap.  The rest of the trie is
+shared with the previous version.  Nodes that a write replaced are freed by
+later writes, once no reader can still be looking at them.  Readers
+announce themselves on a few counters: one for each of two phases, repeated
+on separate cache lines so that readers on different cores seldom touch
+the same line.  An open iterator keeps everything replaced since it started
+from being freed, so iterators should not be held longer than they are
+needed.
+
+Values are handed to readers exactly as they were stored.  The trie does
+nothing to keep a value alive after it has been overwritten or removed.
+*/
+#define SKIT__TRIE_SHARED_STRIPES 16
+
+typedef struct skit_trie_shared_stripe skit_trie_shared_stripe;
+struct skit_trie_shared_stripe
+{
+	size_t   readers[2];  /* Readers that started in each phase. */
+	uint8_t  padding[64 - 2 * sizeof(size_t)];
+};
+
+typedef struct skit_trie_shared_version skit_trie_shared_version;
+struct skit_trie_shared_version
+{
+	skit_trie_node  *root;
+	size_t          length;
+	size_t          longest_key_len;
+};
+
+typedef struct skit_trie_shared skit_trie_shared;
+struct skit_trie_shared
+{
+	skit_trie_shared_version  *current;     /* Swapped atomically by writers. */
+	pthread_mutex_t           write_lock;
+
+	/* Everything below is only touched while holding write_lock. */
+	skit_trie                 writer;       /* The newest version's nodes, plus the pool. */
+	skit_trie_cow             cow;
+	size_t                    phase;        /* Also read (atomically) by readers. */
+	skit_trie_block_list      garbage[2];   /* garbage[p] was retired while phase == p. */
+
+	skit_trie_shared_stripe   stripes[SKIT__TRIE_SHARED_STRIPES];
+};
+
+typedef struct skit_trie_shared_iter skit_trie_shared_iter;
+
+/**
+Allocates/initializes and destroys/frees a shared trie.
+Destroying the trie requires that no thread is using it any more, including
+through an iterator.
+*/
+skit_trie_shared *skit_trie_shared_new();
+void skit_trie_shared_ctor( skit_trie_shared *shared ); /** ditto */
+skit_trie_shared *skit_trie_shared_free( skit_trie_shared *shared ); /** ditto */
+void skit_trie_shared_dtor( skit_trie_shared *shared ); /** ditto */
+
+/**
+Works like skit_trie_set, but the change becomes visible to readers all at
+once.  The key isn't returned, because the trie's copy of it belongs to the
+writers.  Only the 'c' and 'o' flags are accepted.
+*/
+void skit_trie_shared_set( skit_trie_shared *shared, const skit_slice key, const void *value, skit_flags flags );
+
+/**
+Works like skit_trie_remove, except that it returns 1 if the key was removed
+and 0 if the 'c' flag was given and there was no such key.
+The key is matched case-sensitively; only the 'c' flag is accepted.
+*/
+int skit_trie_shared_remove( skit_trie_shared *shared, const skit_slice key, skit_flags flags );
+
+/**
+Works like skit_trie_lookup, on the newest version of the trie.
+Never blocks.
+*/
+int skit_trie_shared_lookup( skit_trie_shared *shared, const skit_slice key, void **value, skit_flags flags );
+
+/**
+Returns the number of keys in the newest version of the trie.
+*/
+size_t skit_trie_shared_len( skit_trie_shared *shared );
+
+/**
+Works like skit_trie_iter_new, skit_trie_iter_free, and skit_trie_iter_next.
+The iterator walks the version of the trie that was newest when it was
+created, no matter what is written to the trie in the meantime, and writers
+don't have to wait for it.
+'flags' must be SKIT_FLAGS_NONE.
+
+Example:
+	skit_trie_shared_iter *iter = skit_trie_shared_iter_new(shared, sSLICE("foo"), SKIT_FLAGS_NONE);
+	skit_slice key;
+	void *value;
+	while ( skit_trie_shared_iter_next(iter, &key, &value) )
+		printf("%.*s\n", (int)sSLENGTH(key), sSPTR(key));
+	skit_trie_shared_iter_free(iter);
+*/
+skit_trie_shared_iter *skit_trie_shared_iter_new( skit_trie_shared *shared, const skit_slice prefix, skit_flags flags );
+skit_trie_shared_iter *skit_trie_shared_iter_free( skit_trie_shared_iter *iter ); /** ditto */
+int skit_trie_shared_iter_next( skit_trie_shared_iter *iter, skit_slice *key, void **value ); /** ditto */
+
 void skit_trie_unittest();
 
 /* Define skit_trie_loaf */
@@ -0,0 +1,209 @@
+/*
+Measures skit_trie memory use and lookup speed for key sets with different
+amounts of branching.
+
+Each key set is every string of a fixed length over an alphabet of 'fanout'
+characters, so every inner node of the trie has exactly 'fanout' children.
+For each set, this prints the bytes allocated by the trie per key, the
+average time taken to insert a key with skit_trie_set (in a shuffled order)
+and with skit_trie_build_sorted, and the average time taken by
+skit_trie_lookup over all of the keys in a shuffled order: case-sensitively,
+case-sensitively with skit_trie_lookup_many in batches of
+TRIE_BENCH_BATCH keys, case-sensitively after skit_trie_compact,
+case-insensitively, and case-insensitively with the icase index enabled
+(see skit_trie_enable_icase_index).
+The larger key sets make tries of tens of megabytes, which is more than
+most CPUs' last level cache holds.
+
+Usage: trie_bench [passes]
+	passes - The number of times each key set is looked up in full.
+	         Defaults to 10.
+*/
+
+#include "survival_kit/init.h"
+#include "survival_kit/memory.h"
+#include "survival_kit/string.h"
+#include "survival_kit/trie.h"
+#include "survival_kit/feature_emulation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Key sets are kept under this many keys. */
+#define TRIE_BENCH_MAX_KEYS 400000
+
+/* Keys given to each skit_trie_lookup_many call. */
+#define TRIE_BENCH_BATCH 64
+
+static double trie_bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static ssize_t trie_bench_live_bytes()
+{
+	return skit_memory_stats_get()->live_bytes;
+}
+
+/* Returns the time taken to look up every key 'passes' times. */
+static double trie_bench_lookups(
+	skit_trie *trie, const uint8_t *keys, const size_t *order,
+	size_t n_keys, size_t depth, int passes, skit_flags flags)
+{
+	size_t i;
+	size_t n_found = 0;
+	int pass;
+	double start = trie_bench_now();
+	for ( pass = 0; pass < passes; pass++ )
+	{
+		for ( i = 0; i < n_keys; i++ )
+		{
+			skit_slice key = skit_slice_of_cstrn((char*)&keys[order[i]*depth], depth);
+			n_found += skit_trie_lookup(trie, key, NULL, flags);
+		}
+	}
+	double result = trie_bench_now() - start;
+	sASSERT_EQ(n_found, n_keys * passes);
+	return result;
+}
+
+/* Like trie_bench_lookups, but with skit_trie_lookup_many. */
+static double trie_bench_batch_lookups(
+	skit_trie *trie, const uint8_t *keys, const size_t *order,
+	size_t n_keys, size_t depth, int passes)
+{
+	size_t i, j;
+	size_t n_found = 0;
+	skit_slice batch[TRIE_BENCH_BATCH];
+	void *values[TRIE_BENCH_BATCH];
+	int pass;
+	double start = trie_bench_now();
+	for ( pass = 0; pass < passes; pass++ )
+	{
+		for ( i = 0; i < n_keys; i += TRIE_BENCH_BATCH )
+		{
+			size_t batch_len = n_keys - i < TRIE_BENCH_BATCH ? n_keys - i : TRIE_BENCH_BATCH;
+			for ( j = 0; j < batch_len; j++ )
+				batch[j] = skit_slice_of_cstrn((char*)&keys[order[i + j]*depth], depth);
+			n_found += skit_trie_lookup_many(trie, batch, batch_len, values);
+		}
+	}
+	double result = trie_bench_now() - start;
+	sASSERT_EQ(n_found, n_keys * passes);
+	return result;
+}
+
+static int trie_bench_cmp_keys(const void *a, const void *b)
+{
+	const skit_slice *key_a = a;
+	const skit_slice *key_b = b;
+	return memcmp(sSPTR(*key_a), sSPTR(*key_b), sSLENGTH(*key_a));
+}
+
+static void trie_bench_run(size_t fanout, int passes)
+{
+	size_t i, j;
+	size_t depth = 1;
+	size_t n_keys = fanout;
+	while ( n_keys * fanout <= TRIE_BENCH_MAX_KEYS )
+	{
+		n_keys *= fanout;
+		depth++;
+	}
+
+	/* The keys are kept out of the trie's allocation statistics. */
+	uint8_t *keys = malloc(n_keys * depth);
+	size_t  *order = malloc(n_keys * sizeof(size_t));
+	for ( i = 0; i < n_keys; i++ )
+	{
+		/* Spread the alphabet over the whole byte range. */
+		size_t digits = i;
+		for ( j = 0; j < depth; j++ )
+		{
+			keys[i*depth + j] = (uint8_t)((digits % fanout) * 256 / fanout);
+			digits /= fanout;
+		}
+		order[i] = i;
+	}
+
+	/* Lookups go in a random order so that consecutive keys don't share paths. */
+	srand(12345);
+	for ( i = n_keys - 1; i > 0; i-- )
+	{
+		size_t k = ((size_t)rand() * RAND_MAX + rand()) % (i + 1);
+		size_t tmp = order[i];
+		order[i] = order[k];
+		order[k] = tmp;
+	}
+
+	ssize_t bytes_before = trie_bench_live_bytes();
+	double insert_start = trie_bench_now();
+	skit_trie *trie = skit_trie_new();
+	for ( i = 0; i < n_keys; i++ )
+	{
+		skit_slice key = skit_slice_of_cstrn((char*)&keys[order[i]*depth], depth);
+		skit_trie_set(trie, key, (void*)(i + 1), SKIT_FLAG_C);
+	}
+	double insert_time = trie_bench_now() - insert_start;
+	ssize_t trie_bytes = trie_bench_live_bytes() - bytes_before;
+
+	/* All keys have the same length, so sorting them is just a memcmp. */
+	skit_slice *sorted = malloc(n_keys * sizeof(skit_slice));
+	for ( i = 0; i < n_keys; i++ )
+		sorted[i] = skit_slice_of_cstrn((char*)&keys[i*depth], depth);
+	qsort(sorted, n_keys, sizeof(skit_slice), &trie_bench_cmp_keys);
+	double build_start = trie_bench_now();
+	skit_trie *built = skit_trie_build_sorted(sorted, NULL, n_keys);
+	double build_time = trie_bench_now() - build_start;
+	sASSERT_EQ(skit_trie_len(built), n_keys);
+	skit_trie_free(built);
+	free(sorted);
+
+	double lookup_time = trie_bench_lookups(trie, keys, order, n_keys, depth, passes, SKIT_FLAGS_NONE);
+	double batch_time = trie_bench_batch_lookups(trie, keys, order, n_keys, depth, passes);
+	skit_trie_compact(trie);
+	double compact_time = trie_bench_lookups(trie, keys, order, n_keys, depth, passes, SKIT_FLAGS_NONE);
+	double ilookup_time = trie_bench_lookups(trie, keys, order, n_keys, depth, passes, SKIT_FLAG_I);
+	skit_trie_enable_icase_index(trie);
+	double indexed_time = trie_bench_lookups(trie, keys, order, n_keys, depth, passes, SKIT_FLAG_I);
+
+	printf("%6zu %6zu %8zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		fanout, depth, n_keys,
+		(double)trie_bytes / n_keys,
+		insert_time * 1e9 / n_keys,
+		build_time * 1e9 / n_keys,
+		lookup_time * 1e9 / (n_keys * passes),
+		batch_time * 1e9 / (n_keys * passes),
+		compact_time * 1e9 / (n_keys * passes),
+		ilookup_time * 1e9 / (n_keys * passes),
+		indexed_time * 1e9 / (n_keys * passes));
+
+	skit_trie_free(trie);
+	free(order);
+	free(keys);
+}
+
+int main(int argc, char *argv[])
+{
+	int passes = 10;
+	if ( argc > 1 )
+		passes = atoi(argv[1]);
+
+	skit_memory_stats_enable();
+	skit_init();
+	SKIT_USE_FEATURE_EMULATION;
+
+	static const size_t fanouts[] = { 4, 8, 12, 13, 16, 24, 32, 40, 48, 64, 128, 256 };
+
+	printf("%6s %6s %8s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+		"fanout", "depth", "keys", "bytes/key", "insert ns", "build ns", "lookup ns", "batch ns", "compact ns", "ilookup ns", "indexed ns");
+	size_t i;
+	for ( i = 0; i < sizeof(fanouts) / sizeof(fanouts[0]); i++ )
+		sTRACE(trie_bench_run(fanouts[i], passes));
+
+	return 0;
+}
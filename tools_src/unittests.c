@@ -1,8 +1,12 @@
 
 #include "survival_kit/init.h"
+#include "survival_kit/arena.h"
+#include "survival_kit/atom.h"
 #include "survival_kit/bag.h"
 #include "survival_kit/datetime.h"
 #include "survival_kit/math.h"
+#include "survival_kit/memory.h"
+#include "survival_kit/multi_matcher.h"
 #include "survival_kit/inheritance_table.h"
 #include "survival_kit/path.h"
 #include "survival_kit/stack_builtins.h"
@@ -13,6 +17,7 @@
 #include "survival_kit/trie.h"
 #include "survival_kit/regex.h"
 #include "survival_kit/array_builtins.h"
+#include "survival_kit/hashmap_builtins.h"
 #include "survival_kit/parsing/peg.h"
 #include "survival_kit/streams/text_stream.h"
 #include "survival_kit/streams/pfile_stream.h"
@@ -27,14 +32,19 @@ void skit_unittest_modules()
 	skit_macro_unittest();
 	skit_flags_unittest();
 	skit_math_unittest();
+	skit_memory_unittest();
+	skit_arena_unittest();
 	skit_bag_unittest();
 	skit_stack_unittest();
 	skit_fstack_unittest();
 	skit_string_unittest();
 	skit_path_unittest();
 	skit_trie_unittest();
+	skit_multi_matcher_unittest();
+	skit_atom_unittest();
 	skit_regex_unittest();
 	skit_array_unittest();
+	skit_hashmap_unittest();
 	skit_peg_unittests();
 	skit_text_stream_unittests();
 	skit_pfile_stream_unittests();